@@ -0,0 +1,280 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Support for writing asynchronous code as C++20 coroutines. Coroutines can
+// co_await promises, iops completing in a group, and being moved onto a
+// workpool, and a task_t is a coroutine whose result is delivered through a
+// promise.
+//
+// The rest of tclib is C++98 so everything here is only defined when the
+// compiler supports coroutines, in which case HAS_COROUTINES is defined.
+
+#ifndef _TCLIB_COROUTINE_HH
+#define _TCLIB_COROUTINE_HH
+
+#include "c/stdc.h"
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L)
+#  define HAS_COROUTINES 1
+#endif
+
+#ifdef HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "async/promise-inl.hh"
+#include "async/workpool.hh"
+#include "c/stdvector.hh"
+#include "io/iop.hh"
+
+BEGIN_C_INCLUDES
+#include "utils/alloc.h"
+#include "utils/log.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+// Resumes the coroutine whose frame is at the given address. This is what
+// gets bound into the callbacks that continue a suspended coroutine.
+static inline void coroutine_resume(void *address) {
+  std::coroutine_handle<>::from_address(address).resume();
+}
+
+// --- P r o m i s e s ---
+
+template <typename T, typename E>
+class promise_awaiter_t {
+public:
+  explicit promise_awaiter_t(promise_t<T, E> promise) : promise_(promise) { }
+
+  bool await_ready() { return promise_.is_settled(); }
+
+  // The coroutine is resumed by whichever thread settles the promise, as part
+  // of running its continuations. Use reschedule_on to move somewhere else.
+  // If the promise gets settled concurrently the coroutine may resume, and
+  // destroy this awaiter, before on_settle returns so it must be called on a
+  // local copy rather than on the member.
+  void await_suspend(std::coroutine_handle<> handle) {
+    promise_t<T, E> promise = promise_;
+    promise.on_settle(new_callback(resume_on_value, handle.address()),
+        new_callback(resume_on_error, handle.address()));
+  }
+
+  // The result of awaiting a promise is the promise itself, now settled, so
+  // the value or error can be read with the peek_ methods.
+  promise_t<T, E> await_resume() { return promise_; }
+
+private:
+  static void resume_on_value(void *address, T value) {
+    coroutine_resume(address);
+  }
+
+  static void resume_on_error(void *address, E error) {
+    coroutine_resume(address);
+  }
+
+  promise_t<T, E> promise_;
+};
+
+// Makes promises, and hence sync promises, awaitable.
+template <typename T, typename E>
+promise_awaiter_t<T, E> operator co_await(promise_t<T, E> promise) {
+  return promise_awaiter_t<T, E>(promise);
+}
+
+// --- W o r k p o o l s ---
+
+class workpool_awaiter_t {
+public:
+  explicit workpool_awaiter_t(Workpool *pool) : pool_(pool) { }
+
+  // Already being on the pool's worker doesn't count as ready; awaiting a
+  // reschedule always yields to the tasks already queued.
+  bool await_ready() { return false; }
+
+  // If the task can't be added the coroutine just keeps running where it is.
+  bool await_suspend(std::coroutine_handle<> handle) {
+    if (pool_->add_task(new_callback(resume_task, handle.address()),
+        tfRequired))
+      return true;
+    WARN("Failed to reschedule coroutine; continuing on the current thread");
+    return false;
+  }
+
+  void await_resume() { }
+
+private:
+  static opaque_t resume_task(void *address) {
+    coroutine_resume(address);
+    return o0();
+  }
+
+  Workpool *pool_;
+};
+
+// Returns an awaitable that suspends the current coroutine and resumes it as a
+// task on the given workpool.
+static inline workpool_awaiter_t reschedule_on(Workpool *pool) {
+  return workpool_awaiter_t(pool);
+}
+
+// --- I o p s ---
+
+// Drives coroutines that wait for iops in an iop group. Iop groups don't
+// notify anyone when an op completes, someone has to call wait_for_next, so
+// this keeps track of which coroutine is waiting for which iop and whoever
+// drives the group calls resume_next to wait for the next op and resume the
+// coroutine that was waiting for it.
+class IopAwaitGroup {
+public:
+  explicit IopAwaitGroup(IopGroup *group) : group_(group) { }
+
+  class iop_awaiter_t {
+  public:
+    iop_awaiter_t(IopAwaitGroup *owner, Iop *iop) : owner_(owner), iop_(iop) { }
+    bool await_ready() { return iop_->is_complete(); }
+    void await_suspend(std::coroutine_handle<> handle) {
+      owner_->waiting_.push_back(std::make_pair(iop_, handle.address()));
+    }
+    // Returns the iop, now complete.
+    Iop *await_resume() { return iop_; }
+  private:
+    IopAwaitGroup *owner_;
+    Iop *iop_;
+  };
+
+  // Returns an awaitable that resumes the awaiting coroutine once the given iop
+  // has completed. The iop must already be in the group, either because it
+  // was scheduled or because it was recycled after completing in the group.
+  iop_awaiter_t complete(Iop *iop) { return iop_awaiter_t(this, iop); }
+
+  // Waits for the next iop in the group to complete and, if a coroutine is
+  // waiting for it, resumes it. The completed iop is stored in the out
+  // parameter if it is non-NULL. Returns false if waiting failed.
+  bool resume_next(Duration timeout = Duration::unlimited(),
+      Iop **iop_out = NULL);
+
+  // Returns true iff the group has pending operations left.
+  bool has_pending() { return group_->has_pending(); }
+
+  // Returns the underlying group.
+  IopGroup *group() { return group_; }
+
+private:
+  IopGroup *group_;
+  std::vector< std::pair<Iop*, void*> > waiting_;
+};
+
+inline bool IopAwaitGroup::resume_next(Duration timeout, Iop **iop_out) {
+  Iop *iop = NULL;
+  if (!group_->wait_for_next(timeout, &iop))
+    return false;
+  if (iop_out != NULL)
+    *iop_out = iop;
+  for (size_t i = 0; i < waiting_.size(); i++) {
+    if (waiting_[i].first != iop)
+      continue;
+    void *address = waiting_[i].second;
+    waiting_.erase(waiting_.begin() + i);
+    // Resuming may await more iops so the list must be consistent before.
+    coroutine_resume(address);
+    break;
+  }
+  return true;
+}
+
+// --- T a s k s ---
+
+// The result of calling a coroutine whose return type is task_t. The coroutine
+// starts running right away, like a normal function, and its co_return value
+// fulfills the task's promise. Co-returning a promise instead settles the task
+// the same way as that promise once it settles.
+//
+// The coroutine frame is allocated through the default allocator and freed as
+// soon as the coroutine finishes, independent of whether the task is still
+// around, so a task is really just a handle on the result.
+template <typename T, typename E = void*>
+class task_t {
+public:
+  struct promise_type;
+
+  // Returns the promise that will be settled with the coroutine's result.
+  promise_t<T, E> &promise() { return promise_; }
+
+private:
+  explicit task_t(promise_t<T, E> promise) : promise_(promise) { }
+
+  promise_t<T, E> promise_;
+};
+
+template <typename T, typename E>
+struct task_t<T, E>::promise_type {
+  promise_type() : result(new_result()) { }
+
+  task_t<T, E> get_return_object() { return task_t<T, E>(result); }
+
+  // If the frame can't be allocated the coroutine doesn't run at all and the
+  // task's promise never settles.
+  static task_t<T, E> get_return_object_on_allocation_failure() {
+    WARN("Failed to allocate coroutine frame");
+    return task_t<T, E>(new_result());
+  }
+
+  std::suspend_never initial_suspend() noexcept { return {}; }
+  std::suspend_never final_suspend() noexcept { return {}; }
+
+  void return_value(const T &value) { result.fulfill(value); }
+
+  void return_value(promise_t<T, E> outcome) {
+    outcome.on_settle(new_callback(fulfill_result, result),
+        new_callback(reject_result, result));
+  }
+
+  // tclib doesn't use exceptions so there's nothing sensible to do with one.
+  void unhandled_exception() { std::terminate(); }
+
+  static void *operator new(size_t size) noexcept {
+    return allocator_default_malloc(size).start;
+  }
+
+  static void operator delete(void *frame, size_t size) {
+    allocator_default_free(blob_new(frame, size));
+  }
+
+  promise_t<T, E> result;
+
+private:
+  // Returns a fresh promise for the coroutine's result. A task is nothing but
+  // its promise so if that can't be allocated there's nothing to hand back,
+  // and no way to report it, so it's fatal.
+  static promise_t<T, E> new_result() {
+    promise_t<T, E> result = promise_t<T, E>::pending();
+    if (result.is_empty()) {
+      FATAL("Failed to allocate coroutine promise");
+      std::terminate();
+    }
+    return result;
+  }
+
+  static void fulfill_result(promise_t<T, E> dest, T value) {
+    dest.fulfill(value);
+  }
+
+  static void reject_result(promise_t<T, E> dest, E error) {
+    dest.reject(error);
+  }
+};
+
+// Awaiting a task awaits its promise.
+template <typename T, typename E>
+promise_awaiter_t<T, E> operator co_await(task_t<T, E> task) {
+  return promise_awaiter_t<T, E>(task.promise());
+}
+
+} // namespace tclib
+
+#endif // HAS_COROUTINES
+
+#endif // _TCLIB_COROUTINE_HH
@@ -5,34 +5,48 @@
 #define _TCLIB_PROMISE_INL_HH
 
 #include "async/promise.hh"
+#include "async/workpool.hh"
 #include "sync/semaphore.hh"
 #include "utils/fatbool.hh"
 
+#ifdef IS_CPP11
+#  include <type_traits>
+#endif
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "utils/log.h"
+#include "utils/misc-inl.h"
+END_C_INCLUDES
+
 namespace tclib {
 
 template <typename T, typename E>
 const T &promise_state_t<T, E>::unsafe_get_value() {
-  return *pointers_.as_value;
+  return *reinterpret_cast<const T*>(memory_.as_value);
 }
 
 template <typename T, typename E>
 const E &promise_state_t<T, E>::unsafe_get_error() {
-  return *pointers_.as_error;
+  return *reinterpret_cast<const E*>(memory_.as_error);
 }
 
+// The state is stored with release after the value or error has been set so
+// loading it with acquire makes the value or error safe to read.
+
 template <typename T, typename E>
 bool promise_state_t<T, E>::is_settled() {
-  return atomic_int32_get(&state_) > psSettling;
+  return atomic_int32_load(&state_, moAcquire) > psSettling;
 }
 
 template <typename T, typename E>
 bool promise_state_t<T, E>::is_fulfilled() {
-  return atomic_int32_get(&state_) == psFulfilled;
+  return atomic_int32_load(&state_, moAcquire) == psFulfilled;
 }
 
 template <typename T, typename E>
 bool promise_state_t<T, E>::is_rejected() {
-  return atomic_int32_get(&state_) == psRejected;
+  return atomic_int32_load(&state_, moAcquire) == psRejected;
 }
 
 template <typename T, typename E>
@@ -47,26 +61,54 @@ void promise_state_t<T, E>::unsafe_set_value(const T &value) {
   // thing being assigned has not been initialized (because it's just blank
   // memory at this point). So instead we call the copy constructor on the
   // memory, using placement new. That requires no assumptions about the
-  // contents of the memory, and it conveniently gives us back a pointer of the
-  // right type which we keep for later use; strict aliasing makes it really
-  // tricky to get this otherwise.
-  pointers_.as_value = new (memory_.as_value) T(value);
+  // contents of the memory. The object created here is what unsafe_get_value
+  // later reads through the cast pointer.
+  new (memory_.as_value) T(value);
 }
 
 template <typename T, typename E>
 void promise_state_t<T, E>::unsafe_set_error(const E &error) {
   // See the massive comment in set_value.
-  pointers_.as_error = new (memory_.as_error) E(error);
+  new (memory_.as_error) E(error);
+}
+
+#ifdef IS_CPP11
+template <typename T, typename E>
+void promise_state_t<T, E>::unsafe_set_value(T &&value) {
+  new (memory_.as_value) T(MOVE(value));
 }
 
+template <typename T, typename E>
+void promise_state_t<T, E>::unsafe_set_error(E &&error) {
+  new (memory_.as_error) E(MOVE(error));
+}
+#endif
+
+// Passes a settled promise's value or error on to a continuation. Callbacks
+// take their arguments by value so this has to copy, which types that can only
+// be moved don't allow. promise_t refuses to compile registrations of such
+// actions so for those types the only callbacks that get here are empty.
+template <typename T, bool kIsCopyable = IF_CPP11(
+    std::is_copy_constructible<T>::value, true)>
+struct promise_outcome_passer_t {
+  static void pass(callback_t<void(T)> &action, const T &outcome) {
+    action(outcome);
+  }
+};
+
+template <typename T>
+struct promise_outcome_passer_t<T, false> {
+  static void pass(callback_t<void(T)> &action, const T &outcome) {
+    UNREACHABLE("action on non-copyable promise outcome");
+  }
+};
+
 template <typename T, typename E>
 promise_state_t<T, E>::promise_state_t()
-  : state_(atomic_int32_new(psPending)) {
-  guard_.initialize();
-  // These two overlap so really there is some redundancy here but the compiler
-  // can probably figure it out, if not it doesn't matter.
-  memset(memory_.as_value, 0, sizeof(T));
-  memset(memory_.as_error, 0, sizeof(E));
+  : state_(atomic_int32_new(psPending))
+  , continuations_(atomic_ptr_new(NULL))
+  , is_first_used_(atomic_int32_new(0)) {
+  first_.next = NULL;
 }
 
 template <typename T, typename E>
@@ -79,61 +121,173 @@ promise_state_t<T, E>::~promise_state_t() {
   } else if (is_rejected()) {
     unsafe_get_error().~E();
   }
+  // If the promise never settled there may be continuations left that will now
+  // never run.
+  Continuation *current = static_cast<Continuation*>(
+      atomic_ptr_load(&continuations_, moAcquire));
+  while (current != NULL && current != closed()) {
+    Continuation *next = current->next;
+    release_continuation(current);
+    current = next;
+  }
 }
 
 template <typename T, typename E>
-fat_bool_t promise_state_t<T, E>::fulfill(const T &value) {
+void promise_state_t<T, E>::release_continuation(Continuation *continuation) {
+  if (continuation == &first_) {
+    // Clearing the callbacks drops the references they hold to their binders.
+    first_.on_value = packed_callback_t<void(T)>();
+    first_.on_error = packed_callback_t<void(E)>();
+  } else {
+    default_delete_concrete(static_cast<HeapContinuation*>(continuation));
+  }
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::run_action(ValueCallback &on_value,
+    ErrorCallback &on_error) {
+  int32_t state = atomic_int32_load(&state_, moAcquire);
+  if (state == psFulfilled) {
+    if (!on_value.is_empty())
+      promise_outcome_passer_t<T>::pass(on_value, unsafe_get_value());
+  } else if (!on_error.is_empty()) {
+    promise_outcome_passer_t<E>::pass(on_error, unsafe_get_error());
+  }
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::run_continuation(Continuation *continuation) {
+  if (continuation == &first_) {
+    ValueCallback on_value = first_.on_value.unpack();
+    ErrorCallback on_error = first_.on_error.unpack();
+    run_action(on_value, on_error);
+  } else {
+    HeapContinuation *heap = static_cast<HeapContinuation*>(continuation);
+    run_action(heap->on_value, heap->on_error);
+  }
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::push_continuation(Continuation *continuation) {
+  void *head = atomic_ptr_load(&continuations_, moAcquire);
+  while (head != closed()) {
+    continuation->next = static_cast<Continuation*>(head);
+    if (atomic_ptr_compare_exchange(&continuations_, &head, continuation,
+        moAcqRel))
+      return;
+  }
+  // The list was closed so the promise has settled and whoever settled it
+  // won't be looking at the list again; run the continuation ourselves.
+  run_continuation(continuation);
+  release_continuation(continuation);
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::run_continuations() {
+  // After this anyone registering a continuation will see that the promise
+  // has settled and run it themselves so the list is ours.
+  Continuation *current = static_cast<Continuation*>(
+      atomic_ptr_exchange(&continuations_, closed(), moAcqRel));
+  // The list is newest first; reverse it so continuations run in the order
+  // they were registered.
+  Continuation *oldest = NULL;
+  while (current != NULL) {
+    Continuation *next = current->next;
+    current->next = oldest;
+    oldest = current;
+    current = next;
+  }
+  while (oldest != NULL) {
+    Continuation *next = oldest->next;
+    run_continuation(oldest);
+    release_continuation(oldest);
+    oldest = next;
+  }
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::on_settle(ValueCallback on_value,
+    ErrorCallback on_error) {
+  // Fast path: if the promise has already settled there's no need for a
+  // continuation at all.
+  if (atomic_ptr_load(&continuations_, moAcquire) == closed()) {
+    run_action(on_value, on_error);
+    return;
+  }
+  int32_t unused = 0;
+  if (atomic_int32_compare_exchange(&is_first_used_, &unused, 1, moRelaxed)) {
+    if (!first_.on_value.pack(on_value) || !first_.on_error.pack(on_error)) {
+      WARN("Failed to allocate promise continuation");
+      release_continuation(&first_);
+      return;
+    }
+    push_continuation(&first_);
+  } else {
+    HeapContinuation *continuation = new (kDefaultAlloc) HeapContinuation();
+    if (continuation == NULL) {
+      WARN("Failed to allocate promise continuation");
+      return;
+    }
+    continuation->on_value = on_value;
+    continuation->on_error = on_error;
+    push_continuation(continuation);
+  }
+}
+
+template <typename T, typename E>
+bool promise_state_t<T, E>::begin_settling() {
   // Try to put this promise in the resolving state. This can only be done once
   // by one thread so after this has happened we can safely update the state.
   // This also catches the case where the promise has already been resolved.
-  if (!atomic_int32_compare_and_set(&state_, psPending, psSettling))
+  return atomic_int32_compare_and_set(&state_, psPending, psSettling);
+}
+
+template <typename T, typename E>
+void promise_state_t<T, E>::end_settling(state_t state) {
+  // The value or error is set before the state such that it is safe to assume
+  // it is set when the state is settled. This is used by peek_value.
+  atomic_int32_store(&state_, state, moRelease);
+  run_continuations();
+  notify_settled();
+}
+
+template <typename T, typename E>
+fat_bool_t promise_state_t<T, E>::fulfill(const T &value) {
+  if (!begin_settling())
     return F_FALSE;
-  // Set the value before the state such that it is safe to assume the value
-  // is set when the state is non-empty. This is used by peek_value.
   unsafe_set_value(value);
-  atomic_int32_set(&state_, psFulfilled);
-  // At this point any new on_success added will be executed immediately so we
-  // have the vector to ourselves.
-  guard_.lock();
-  guard_.unlock();
-  for (size_t i = 0; i < on_fulfills_.size(); i++)
-    (on_fulfills_[i])(value);
-  on_failures_.clear();
-  on_fulfills_.clear();
+  end_settling(psFulfilled);
   return F_TRUE;
 }
 
 template <typename T, typename E>
-fat_bool_t sync_promise_state_t<T, E>::fulfill(const T &value) {
-  F_TRY((promise_state_t<T, E>::fulfill(value)));
-  F_TRY(drawbridge_.lower());
+fat_bool_t promise_state_t<T, E>::reject(const E &error) {
+  if (!begin_settling())
+    return F_FALSE;
+  unsafe_set_error(error);
+  end_settling(psRejected);
   return F_TRUE;
 }
 
+#ifdef IS_CPP11
 template <typename T, typename E>
-fat_bool_t promise_state_t<T, E>::reject(const E &error) {
-  if (!atomic_int32_compare_and_set(&state_, psPending, psSettling))
+fat_bool_t promise_state_t<T, E>::fulfill(T &&value) {
+  if (!begin_settling())
     return F_FALSE;
-  // See fulfill for why we set the error first.
-  unsafe_set_error(error);
-  atomic_int32_set(&state_, psRejected);
-  // At this point any new on_failure added will be executed immediately so we
-  // have the vector to ourselves.
-  guard_.lock();
-  guard_.unlock();
-  for (size_t i = 0; i < on_failures_.size(); i++)
-    (on_failures_[i])(error);
-  on_fulfills_.clear();
-  on_failures_.clear();
+  unsafe_set_value(MOVE(value));
+  end_settling(psFulfilled);
   return F_TRUE;
 }
 
 template <typename T, typename E>
-fat_bool_t sync_promise_state_t<T, E>::reject(const E &error) {
-  F_TRY((promise_state_t<T, E>::reject(error)));
-  F_TRY(drawbridge_.lower());
+fat_bool_t promise_state_t<T, E>::reject(E &&error) {
+  if (!begin_settling())
+    return F_FALSE;
+  unsafe_set_error(MOVE(error));
+  end_settling(psRejected);
   return F_TRUE;
 }
+#endif
 
 template <typename T, typename E>
 const T &promise_state_t<T, E>::peek_value(const T &if_unfulfilled) {
@@ -150,24 +304,12 @@ const E &promise_state_t<T, E>::peek_error(const E &if_unfulfilled) {
 
 template <typename T, typename E>
 void promise_state_t<T, E>::on_fulfill(ValueCallback action) {
-  guard_.lock();
-  int32_t state = atomic_int32_get(&state_);
-  if (state <= psSettling)
-    on_fulfills_.push_back(action);
-  guard_.unlock();
-  if (state == psFulfilled)
-    action(unsafe_get_value());
+  on_settle(action, ErrorCallback());
 }
 
 template <typename T, typename E>
 void promise_state_t<T, E>::on_reject(ErrorCallback action) {
-  guard_.lock();
-  int32_t state = atomic_int32_get(&state_);
-  if (state <= psSettling)
-    on_failures_.push_back(action);
-  guard_.unlock();
-  if (state == psRejected)
-    action(unsafe_get_error());
+  on_settle(ValueCallback(), action);
 }
 
 template <typename T, typename E>
@@ -193,18 +335,301 @@ void promise_t<T, E>::pass_on_rejection(promise_t<T2, E> dest, E error) {
 template <typename T, typename E>
 template <typename T2>
 promise_t<T2, E> promise_t<T, E>::then(callback_t<T2(T)> mapper) {
+  require_copyable_value();
+  require_copyable_error();
+  promise_t<T2, E> result = promise_t<T2, E>::pending();
+  state()->on_settle(new_callback(map_and_fulfill<T2, E>, result, mapper),
+      new_callback(pass_on_rejection<T2>, result));
+  return result;
+}
+
+template <typename T, typename E>
+template <typename T2, typename E2>
+promise_t<T2, E2> promise_t<T, E>::then(callback_t<T2(T)> vmap,
+    callback_t<E2(E)> emap) {
+  require_copyable_value();
+  require_copyable_error();
+  promise_t<T2, E2> result = promise_t<T2, E2>::pending();
+  state()->on_settle(new_callback(map_and_fulfill<T2, E2>, result, vmap),
+      new_callback(map_and_reject<T2, E2>, result, emap));
+  return result;
+}
+
+// Runs an action that was handed to an executor.
+template <typename A>
+opaque_t promise_run_dispatched(callback_t<void(A)> action, A arg) {
+  action(arg);
+  return o0();
+}
+
+// Runs the given action with the given argument on the given executor, or
+// right here if there's no point in handing it over.
+template <typename A>
+void promise_dispatch(Workpool *executor, callback_t<void(A)> action, A arg) {
+  if (executor == NULL || executor->is_worker_thread()) {
+    action(arg);
+    return;
+  }
+  if (executor->add_task(new_callback(promise_run_dispatched<A>, action, arg),
+      tfRequired))
+    return;
+  // Dropping the action would leave whoever depends on it waiting forever so
+  // it's better to run it late on the wrong thread.
+  WARN("Failed to dispatch promise continuation; running it inline");
+  action(arg);
+}
+
+template <typename T, typename E>
+void promise_t<T, E>::settle_on(Workpool *executor,
+    typename promise_state_t<T, E>::ValueCallback on_value,
+    typename promise_state_t<T, E>::ErrorCallback on_error, int32_t flags) {
+  if (executor == NULL || (flags & cfTrivial) != 0) {
+    state()->on_settle(on_value, on_error);
+    return;
+  }
+  typename promise_state_t<T, E>::ValueCallback dispatch_value;
+  if (!on_value.is_empty())
+    dispatch_value = new_callback(promise_dispatch<T>, executor, on_value);
+  typename promise_state_t<T, E>::ErrorCallback dispatch_error;
+  if (!on_error.is_empty())
+    dispatch_error = new_callback(promise_dispatch<E>, executor, on_error);
+  state()->on_settle(dispatch_value, dispatch_error);
+}
+
+template <typename T, typename E>
+template <typename T2>
+promise_t<T2, E> promise_t<T, E>::then_on(Workpool *executor,
+    callback_t<T2(T)> mapper, int32_t flags) {
+  require_copyable_value();
+  require_copyable_error();
   promise_t<T2, E> result = promise_t<T2, E>::pending();
-  on_fulfill(new_callback(map_and_fulfill<T2, E>, result, mapper));
-  on_reject(new_callback(pass_on_rejection<T2>, result));
+  callback_t<void(T)> on_value = new_callback(map_and_fulfill<T2, E>, result,
+      mapper);
+  if (executor != NULL && (flags & cfTrivial) == 0)
+    on_value = new_callback(promise_dispatch<T>, executor, on_value);
+  state()->on_settle(on_value, new_callback(pass_on_rejection<T2>, result));
   return result;
 }
 
 template <typename T, typename E>
 template <typename T2, typename E2>
-promise_t<T2, E2> promise_t<T, E>::then(callback_t<T2(T)> vmap, callback_t<E2(E)> emap) {
+promise_t<T2, E2> promise_t<T, E>::then_on(Workpool *executor,
+    callback_t<T2(T)> vmap, callback_t<E2(E)> emap, int32_t flags) {
+  require_copyable_value();
+  require_copyable_error();
   promise_t<T2, E2> result = promise_t<T2, E2>::pending();
-  on_fulfill(new_callback(map_and_fulfill<T2, E2>, result, vmap));
-  on_reject(new_callback(map_and_reject<T2, E2>, result, emap));
+  settle_on(executor, new_callback(map_and_fulfill<T2, E2>, result, vmap),
+      new_callback(map_and_reject<T2, E2>, result, emap), flags);
+  return result;
+}
+
+// --- C o m b i n a t o r s ---
+
+template <typename S, typename R>
+promise_fan_in_t<S, R>::promise_fan_in_t(size_t count, R result)
+  : result(result)
+  , count_(count)
+  , remaining_(atomic_int32_new(static_cast<int32_t>(count)))
+  , slots_(NULL)
+  , is_set_(NULL) { }
+
+template <typename S, typename R>
+promise_fan_in_t<S, R>::~promise_fan_in_t() {
+  for (size_t i = 0; i < count_; i++) {
+    if (is_set_[i])
+      slots_[i].~S();
+  }
+}
+
+template <typename S, typename R>
+size_t promise_fan_in_t<S, R>::slots_offset() {
+  return align_size(ALIGN_OF(S), sizeof(promise_fan_in_t<S, R>));
+}
+
+template <typename S, typename R>
+size_t promise_fan_in_t<S, R>::instance_size_for(size_t count) {
+  return slots_offset() + (sizeof(S) + 1) * count;
+}
+
+template <typename S, typename R>
+promise_fan_in_t<S, R> *promise_fan_in_t<S, R>::create(size_t count,
+    R result) {
+  // The state and its slots are allocated together and freed together by
+  // dispose, which asks instance_size how much to free.
+  blob_t memory = allocator_default_malloc(instance_size_for(count));
+  if (blob_is_empty(memory)) {
+    WARN("Failed to allocate promise combinator");
+    return NULL;
+  }
+  promise_fan_in_t<S, R> *state = new (memory.start) promise_fan_in_t<S, R>(
+      count, result);
+  uint8_t *start = static_cast<uint8_t*>(memory.start);
+  state->slots_ = reinterpret_cast<S*>(start + slots_offset());
+  state->is_set_ = reinterpret_cast<uint8_t*>(state->slots_ + count);
+  memset(state->is_set_, 0, count);
+  return state;
+}
+
+template <typename S, typename R>
+void promise_fan_in_t<S, R>::set(size_t index, const S &value) {
+  // See promise_state_t::unsafe_set_value for why this uses placement new.
+  new (&slots_[index]) S(value);
+  is_set_[index] = 1;
+}
+
+template <typename S, typename R>
+std::vector<S> promise_fan_in_t<S, R>::collect() {
+  std::vector<S> result;
+  result.reserve(count_);
+  for (size_t i = 0; i < count_; i++)
+    result.push_back(slots_[i]);
+  return result;
+}
+
+template <typename T, typename E>
+void promise_all_on_value(
+    typename promise_fan_in_t<T, promise_t<std::vector<T>, E> >::ref_t fan_in,
+    size_t index, T value) {
+  fan_in->set(index, value);
+  if (fan_in->count_down())
+    fan_in->result.fulfill(fan_in->collect());
+}
+
+template <typename T, typename E>
+void promise_all_on_error(
+    typename promise_fan_in_t<T, promise_t<std::vector<T>, E> >::ref_t fan_in,
+    E error) {
+  fan_in->result.reject(error);
+}
+
+template <typename T, typename E>
+promise_t<std::vector<T>, E> promise_all(
+    const std::vector< promise_t<T, E> > &promises) {
+  typedef promise_t<std::vector<T>, E> result_t;
+  typedef promise_fan_in_t<T, result_t> fan_in_t;
+  result_t result = result_t::pending();
+  if (promises.empty()) {
+    result.fulfill(std::vector<T>());
+    return result;
+  }
+  fan_in_t *state = fan_in_t::create(promises.size(), result);
+  if (state == NULL)
+    return result;
+  typename fan_in_t::ref_t fan_in(state);
+  for (size_t i = 0; i < promises.size(); i++) {
+    promise_t<T, E> input = promises[i];
+    input.on_settle(new_callback(promise_all_on_value<T, E>, fan_in, i),
+        new_callback(promise_all_on_error<T, E>, fan_in));
+  }
+  return result;
+}
+
+template <typename T, typename E>
+void promise_any_on_value(
+    typename promise_fan_in_t<E, promise_t<T, std::vector<E> > >::ref_t fan_in,
+    T value) {
+  fan_in->result.fulfill(value);
+}
+
+template <typename T, typename E>
+void promise_any_on_error(
+    typename promise_fan_in_t<E, promise_t<T, std::vector<E> > >::ref_t fan_in,
+    size_t index, E error) {
+  fan_in->set(index, error);
+  if (fan_in->count_down())
+    fan_in->result.reject(fan_in->collect());
+}
+
+template <typename T, typename E>
+promise_t<T, std::vector<E> > promise_any(
+    const std::vector< promise_t<T, E> > &promises) {
+  typedef promise_t<T, std::vector<E> > result_t;
+  typedef promise_fan_in_t<E, result_t> fan_in_t;
+  result_t result = result_t::pending();
+  if (promises.empty()) {
+    result.reject(std::vector<E>());
+    return result;
+  }
+  fan_in_t *state = fan_in_t::create(promises.size(), result);
+  if (state == NULL)
+    return result;
+  typename fan_in_t::ref_t fan_in(state);
+  for (size_t i = 0; i < promises.size(); i++) {
+    promise_t<T, E> input = promises[i];
+    input.on_settle(new_callback(promise_any_on_value<T, E>, fan_in),
+        new_callback(promise_any_on_error<T, E>, fan_in, i));
+  }
+  return result;
+}
+
+template <typename T, typename E>
+void promise_race_on_value(promise_t<T, E> result, T value) {
+  result.fulfill(value);
+}
+
+template <typename T, typename E>
+void promise_race_on_error(promise_t<T, E> result, E error) {
+  result.reject(error);
+}
+
+template <typename T, typename E>
+promise_t<T, E> promise_race(const std::vector< promise_t<T, E> > &promises) {
+  // Whoever settles first wins and the result ignores the rest so there's
+  // nothing to count or store.
+  promise_t<T, E> result = promise_t<T, E>::pending();
+  for (size_t i = 0; i < promises.size(); i++) {
+    promise_t<T, E> input = promises[i];
+    input.on_settle(new_callback(promise_race_on_value<T, E>, result),
+        new_callback(promise_race_on_error<T, E>, result));
+  }
+  return result;
+}
+
+template <typename T, typename E>
+void promise_all_settled_on_value(
+    typename promise_fan_in_t<promise_t<T, E>,
+        promise_t<std::vector< promise_t<T, E> >, E> >::ref_t fan_in,
+    size_t index, T value) {
+  // The slot gets a settled copy rather than the input itself since holding
+  // on to the inputs would make a cycle through their continuations.
+  promise_t<T, E> outcome = promise_t<T, E>::pending();
+  outcome.fulfill(value);
+  fan_in->set(index, outcome);
+  if (fan_in->count_down())
+    fan_in->result.fulfill(fan_in->collect());
+}
+
+template <typename T, typename E>
+void promise_all_settled_on_error(
+    typename promise_fan_in_t<promise_t<T, E>,
+        promise_t<std::vector< promise_t<T, E> >, E> >::ref_t fan_in,
+    size_t index, E error) {
+  promise_t<T, E> outcome = promise_t<T, E>::pending();
+  outcome.reject(error);
+  fan_in->set(index, outcome);
+  if (fan_in->count_down())
+    fan_in->result.fulfill(fan_in->collect());
+}
+
+template <typename T, typename E>
+promise_t<std::vector< promise_t<T, E> >, E> promise_all_settled(
+    const std::vector< promise_t<T, E> > &promises) {
+  typedef promise_t<std::vector< promise_t<T, E> >, E> result_t;
+  typedef promise_fan_in_t<promise_t<T, E>, result_t> fan_in_t;
+  result_t result = result_t::pending();
+  if (promises.empty()) {
+    result.fulfill(promises);
+    return result;
+  }
+  fan_in_t *state = fan_in_t::create(promises.size(), result);
+  if (state == NULL)
+    return result;
+  typename fan_in_t::ref_t fan_in(state);
+  for (size_t i = 0; i < promises.size(); i++) {
+    promise_t<T, E> input = promises[i];
+    input.on_settle(new_callback(promise_all_settled_on_value<T, E>, fan_in, i),
+        new_callback(promise_all_settled_on_error<T, E>, fan_in, i));
+  }
   return result;
 }
 
@@ -220,15 +645,38 @@ sync_promise_t<T, E> sync_promise_t<T, E>::pending() {
 
 template <typename T, typename E>
 fat_bool_t sync_promise_state_t<T, E>::wait(Duration timeout) {
-  F_TRY(drawbridge_.pass(timeout));
-  return F_TRUE;
+  if ((atomic_int32_load(&waiters_, moAcquire) & kIsDone) != 0)
+    return F_TRUE;
+  // Because the waiter count and the done bit share a word the settler either
+  // sets the bit before we register, and we see it, or after, and it sees us.
+  int32_t word = atomic_int32_fetch_add(&waiters_, kOneWaiter, moAcqRel)
+      + kOneWaiter;
+  uint64_t deadline = NativeFutex::deadline_after(timeout);
+  fat_bool_t result = F_TRUE;
+  while ((word & kIsDone) == 0) {
+    // Other waiters coming and going also change the word so this may return
+    // early, in which case we just go around again with the same deadline.
+    if (!NativeFutex::wait_until(&waiters_, word, deadline)) {
+      result = F_BOOL((atomic_int32_load(&waiters_, moAcquire) & kIsDone) != 0);
+      break;
+    }
+    word = atomic_int32_load(&waiters_, moAcquire);
+  }
+  atomic_int32_fetch_add(&waiters_, -kOneWaiter, moRelaxed);
+  return result;
 }
 
 template <typename T, typename E>
-sync_promise_state_t<T, E>::sync_promise_state_t() {
-  drawbridge_.initialize();
+void sync_promise_state_t<T, E>::notify_settled() {
+  int32_t word = atomic_int32_fetch_add(&waiters_, kIsDone, moAcqRel);
+  if (word >= kOneWaiter)
+    NativeFutex::wake_all(&waiters_);
 }
 
+template <typename T, typename E>
+sync_promise_state_t<T, E>::sync_promise_state_t()
+  : waiters_(atomic_int32_new(0)) { }
+
 } // namespace tclib
 
 #endif // _TCLIB_PROMISE_INL_HH
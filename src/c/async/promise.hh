@@ -6,8 +6,7 @@
 
 #include "c/stdc.h"
 #include "c/stdvector.hh"
-#include "sync/intex.hh"
-#include "sync/mutex.hh"
+#include "sync/futex.hh"
 #include "utils/callback.hh"
 #include "utils/refcount.hh"
 
@@ -17,6 +16,30 @@ END_C_INCLUDES
 
 namespace tclib {
 
+class Workpool;
+
+// Flags that control how continuations registered with an executor are run.
+typedef enum {
+  // The continuation is handed to the executor as a task, unless the promise
+  // is settled on one of the executor's own workers.
+  cfDispatch = 0x00,
+
+  // The continuation is cheap and doesn't care which thread runs it, so it is
+  // run directly on the settling thread since handing it over would cost more
+  // than running it.
+  cfTrivial = 0x01
+} continuation_flag_t;
+
+// The heap state shared between all the references to a promise.
+//
+// Continuations are kept in a lock-free intrusive list. Registering one pushes
+// it onto the list; settling the promise swaps the list out for a sentinel
+// that marks it closed and runs what was there. Anyone who finds the list
+// closed knows the promise has settled and runs their continuation
+// immediately. The first continuation, which is usually the only one, is
+// stored in the state itself so most promises don't allocate continuations,
+// and there's no mutex to initialize or take. To keep the state within two
+// cache lines its callbacks are packed so their binders live on the heap.
 template <typename T, typename E = void*>
 class promise_state_t : public refcount_shared_t {
 public:
@@ -24,8 +47,12 @@ public:
   typedef callback_t<void(E)> ErrorCallback;
   promise_state_t();
   virtual ~promise_state_t();
-  virtual fat_bool_t fulfill(const T &value);
-  virtual fat_bool_t reject(const E &value);
+  fat_bool_t fulfill(const T &value);
+  fat_bool_t reject(const E &value);
+#ifdef IS_CPP11
+  fat_bool_t fulfill(T &&value);
+  fat_bool_t reject(E &&value);
+#endif
   bool is_settled();
   bool is_fulfilled();
   bool is_rejected();
@@ -34,6 +61,11 @@ public:
   void on_fulfill(ValueCallback action);
   void on_reject(ErrorCallback action);
 
+  // Registers a continuation with actions for both outcomes, either of which
+  // can be empty. Uses only one continuation where on_fulfill followed by
+  // on_reject would use two.
+  void on_settle(ValueCallback on_value, ErrorCallback on_error);
+
 protected:
   typedef enum {
     psPending = 0,
@@ -47,31 +79,94 @@ protected:
   // promise has been fulfilled.
   const T &unsafe_get_value();
   const E &unsafe_get_error();
-  NativeMutex guard_;
-  std::vector<ValueCallback> on_fulfills_;
-  std::vector<ErrorCallback> on_failures_;
 
 protected:
   virtual size_t instance_size() { return sizeof(*this); }
 
+  // Called by the thread that settled the promise once the continuations have
+  // been run.
+  virtual void notify_settled() { }
+
 private:
+  // A continuation waiting for the promise to settle.
+  struct Continuation {
+    Continuation *next;
+  };
+
+  // A continuation allocated on the heap.
+  struct HeapContinuation : public Continuation {
+    ValueCallback on_value;
+    ErrorCallback on_error;
+  };
+
+  // The continuation stored in the state itself. Its callbacks are packed so
+  // the state stays small.
+  struct FirstContinuation : public Continuation {
+    packed_callback_t<void(T)> on_value;
+    packed_callback_t<void(E)> on_error;
+  };
+
+  // Calls whichever of the given actions matches the settled outcome.
+  void run_action(ValueCallback &on_value, ErrorCallback &on_error);
+
+  // Adds the given continuation to the list, or runs it right away if the
+  // promise has already settled.
+  void push_continuation(Continuation *continuation);
+
+  // Marks the list closed and runs all the continuations that were in it.
+  void run_continuations();
+
+  // Runs the given continuation against the settled outcome.
+  void run_continuation(Continuation *continuation);
+
+  // Releases the given continuation after it's been run or dropped.
+  void release_continuation(Continuation *continuation);
+
+  // Returns the sentinel stored in the list head once the promise settles.
+  static Continuation *closed() {
+    return reinterpret_cast<Continuation*>(static_cast<address_arith_t>(1));
+  }
+
+  // Moves the state from pending to settling. Returns false if someone else
+  // got there first, in which case the caller must leave the promise alone.
+  bool begin_settling();
+
+  // Publishes the value or error set since begin_settling by moving to the
+  // given final state and runs the continuations.
+  void end_settling(state_t state);
+
   // These must be used to set the value or error. If you try to set them by
   // assigning to one of the get_* methods you're going to have a bad time.
   void unsafe_set_value(const T &value);
   void unsafe_set_error(const E &error);
-  // The way values and errors are stored is a little intricate. Because of
-  // strict aliasing you can't just cast your way from the blocks of memory to
-  // the values, but -- the process of initializing the memory produces a
-  // pointer which is stored and used when reading the value.
-  union {
+#ifdef IS_CPP11
+  void unsafe_set_value(T &&value);
+  void unsafe_set_error(E &&error);
+#endif
+
+  // The most recently registered continuation, or closed() once settled.
+  atomic_ptr_t continuations_;
+  // Has first_ been taken?
+  atomic_int32_t is_first_used_;
+  // Storage for the first continuation.
+  FirstContinuation first_;
+  // Blank memory that the value or error gets copy-constructed into. The
+  // extra members align it for anything up to a pointer, int64 or double;
+  // values that need more than that aren't supported.
+  union value_memory_t {
     uint8_t as_value[sizeof(T)];
     uint8_t as_error[sizeof(E)];
+    void *align_pointer;
+    int64_t align_int64;
+    double align_double;
   } memory_;
-  // Important note: these are only valid after the promise has been fulfilled.
-  union {
-    T *as_value;
-    E *as_error;
-  } pointers_;
+
+#ifdef IS_CPP11
+  static_assert(alignof(T) <= alignof(value_memory_t),
+      "promise values can't be over-aligned");
+  static_assert(alignof(E) <= alignof(value_memory_t),
+      "promise errors can't be over-aligned");
+#endif
 };
 
 // The result of an operation that may or may not have completed.
@@ -81,8 +176,11 @@ private:
 // allocated implicitly and refcounted so the code that passes around promises
 // don't have to worry about ownership, which would be unmanageable.
 //
-// A plain promise is not thread safe; use a sync promise if you need to share
-// promises across threads.
+// Promises can be shared across threads: any thread can settle a promise or
+// add actions to it, and only the first attempt to settle it wins. The actions
+// run on whichever thread settles the promise, or on the thread adding them if
+// it has already settled. Use a sync promise if you need to block until a
+// promise settles.
 //
 // The terminology used around promises is as follows. A promise starts out
 // unresolved and, once its value has been set, is said to have become resolved.
@@ -103,6 +201,15 @@ public:
     return state()->fulfill(value);
   }
 
+#ifdef IS_CPP11
+  // Fulfills this promise by moving the value into it. This is how to fulfill
+  // promises whose values can't be copied; the value can then be read with
+  // peek_value but not passed to on_fulfill actions since they take a copy.
+  bool fulfill(T &&value) {
+    return state()->fulfill(MOVE(value));
+  }
+#endif
+
   // Reject this promise, causing the error to be set and any reject actions to
   // be performed, but only if this promise is currently pending. Returns true
   // iff that was the case.
@@ -110,6 +217,13 @@ public:
     return state()->reject(error);
   }
 
+#ifdef IS_CPP11
+  // Rejects this promise by moving the error into it.
+  bool reject(E &&error) {
+    return state()->reject(MOVE(error));
+  }
+#endif
+
   // Returns true iff this promise has been settled, that is, fulfilled or
   // rejected.
   bool is_settled() { return state()->is_settled(); }
@@ -132,15 +246,61 @@ public:
   // resolved. If this promise has already been resolved the action is invoked
   // with the value immediately.
   void on_fulfill(typename promise_state_t<T, E>::ValueCallback action) {
+    require_copyable_value();
     state()->on_fulfill(action);
   }
 
-  // Adds a callback to be invoked when (if) this promise fails. If this promise has already been resolved the action is invoked
-  // with the value immediately.
+  // Adds a callback to be invoked when (if) this promise fails. If this
+  // promise has already been resolved the action is invoked with the error
+  // immediately.
   void on_reject(typename promise_state_t<T, E>::ErrorCallback action) {
+    require_copyable_error();
     state()->on_reject(action);
   }
 
+  // Adds callbacks for both outcomes, either of which can be empty. Cheaper
+  // than calling on_fulfill and on_reject separately.
+  void on_settle(typename promise_state_t<T, E>::ValueCallback on_value,
+      typename promise_state_t<T, E>::ErrorCallback on_error) {
+    require_copyable_value();
+    require_copyable_error();
+    state()->on_settle(on_value, on_error);
+  }
+
+  // Variants of on_fulfill, on_reject, and on_settle that run the actions as
+  // tasks on the given executor rather than on whichever thread settles the
+  // promise. If the executor is NULL, the promise is settled on the
+  // executor's own worker, or the flags mark the actions as cfTrivial, the
+  // actions are run immediately instead since handing them over would gain
+  // nothing. The tasks are required so joining the executor waits for them.
+  //
+  // The executor is not referenced so it must outlive the promise, or at
+  // least stay alive until the promise has settled and the tasks have run.
+  void on_fulfill_on(Workpool *executor,
+      typename promise_state_t<T, E>::ValueCallback action,
+      int32_t flags = cfDispatch) {
+    require_copyable_value();
+    settle_on(executor, action,
+        typename promise_state_t<T, E>::ErrorCallback(), flags);
+  }
+
+  void on_reject_on(Workpool *executor,
+      typename promise_state_t<T, E>::ErrorCallback action,
+      int32_t flags = cfDispatch) {
+    require_copyable_error();
+    settle_on(executor, typename promise_state_t<T, E>::ValueCallback(),
+        action, flags);
+  }
+
+  void on_settle_on(Workpool *executor,
+      typename promise_state_t<T, E>::ValueCallback on_value,
+      typename promise_state_t<T, E>::ErrorCallback on_error,
+      int32_t flags = cfDispatch) {
+    require_copyable_value();
+    require_copyable_error();
+    settle_on(executor, on_value, on_error, flags);
+  }
+
   // Returns a new promise that resolves when this one does in the same way,
   // but on success the value will be the result of applying the mapping to the
   // value of this promise rather than the value itself. Failures are just
@@ -151,11 +311,49 @@ public:
   template <typename T2, typename E2>
   promise_t<T2, E2> then(callback_t<T2(T)> vmap, callback_t<E2(E)> emap);
 
+  // Like then but the mappers are run on the given executor, see
+  // on_settle_on. Passing a rejection through unchanged is trivial so that
+  // still happens on the settling thread.
+  template <typename T2>
+  promise_t<T2, E> then_on(Workpool *executor, callback_t<T2(T)> mapper,
+      int32_t flags = cfDispatch);
+
+  template <typename T2, typename E2>
+  promise_t<T2, E2> then_on(Workpool *executor, callback_t<T2(T)> vmap,
+      callback_t<E2(E)> emap, int32_t flags = cfDispatch);
+
   // Returns a fresh pending promise.
   static promise_t<T, E> pending();
 
+  // Returns true if this promise has no state, which only happens if pending
+  // failed to allocate it. An empty promise mustn't be used for anything else.
+  bool is_empty() { return state() == NULL; }
+
 protected:
-  promise_t<T, E>(promise_state_t<T, E> *state) : super_t(state) { }
+  promise_t(promise_state_t<T, E> *state) : super_t(state) { }
+
+  // Actions are passed the value or error by copy so registering one on a
+  // promise whose outcome can only be moved is rejected at compile time
+  // rather than failing when the promise settles.
+  static void require_copyable_value() {
+#ifdef IS_CPP11
+    static_assert(std::is_copy_constructible<T>::value,
+        "value actions require a copyable value type");
+#endif
+  }
+
+  static void require_copyable_error() {
+#ifdef IS_CPP11
+    static_assert(std::is_copy_constructible<E>::value,
+        "error actions require a copyable error type");
+#endif
+  }
+
+  // Does the work of on_settle_on, which is also what on_fulfill_on and
+  // on_reject_on use.
+  void settle_on(Workpool *executor,
+      typename promise_state_t<T, E>::ValueCallback on_value,
+      typename promise_state_t<T, E>::ErrorCallback on_error, int32_t flags);
 
   template <typename T2, typename E2>
   static void map_and_fulfill(promise_t<T2, E2> dest, callback_t<T2(T)> mapper,
@@ -169,26 +367,118 @@ protected:
   promise_state_t<T, E> *state() { return super_t::refcount_shared(); }
 };
 
+// Returns a promise that is fulfilled with the values of all the given promises,
+// in the same order, once they have all been fulfilled. If any of them is
+// rejected the result is rejected with the first error. If there are no
+// promises the result is fulfilled immediately.
+template <typename T, typename E>
+promise_t<std::vector<T>, E> promise_all(
+    const std::vector< promise_t<T, E> > &promises);
+
+// Returns a promise that is fulfilled with the value of the first of the given
+// promises to be fulfilled. If they are all rejected the result is rejected
+// with all their errors, in the same order as the promises. If there are no
+// promises the result is rejected immediately.
+template <typename T, typename E>
+promise_t<T, std::vector<E> > promise_any(
+    const std::vector< promise_t<T, E> > &promises);
+
+// Returns a promise that settles the same way as the first of the given
+// promises to settle. If there are no promises the result never settles.
+template <typename T, typename E>
+promise_t<T, E> promise_race(const std::vector< promise_t<T, E> > &promises);
+
+// Returns a promise that, once all the given promises have settled, is
+// fulfilled with settled promises that have the same outcomes, in the same
+// order. It is never rejected.
+template <typename T, typename E>
+promise_t<std::vector< promise_t<T, E> >, E> promise_all_settled(
+    const std::vector< promise_t<T, E> > &promises);
+
+// The shared state of a combinator: a preallocated array of slots that the
+// inputs store their outcomes in, how many inputs remain to be counted, and the
+// promise to settle with the combined result. The state doesn't reference the
+// inputs, only their continuations reference it, so an input that never
+// settles doesn't keep a cycle alive.
+template <typename S, typename R>
+class promise_fan_in_t : public refcount_shared_t {
+public:
+  virtual ~promise_fan_in_t();
+
+  // Returns a new state with the given number of slots, or NULL if allocation
+  // fails.
+  static promise_fan_in_t<S, R> *create(size_t count, R result);
+
+  // Stores the given value in the slot with the given index. Each slot must be
+  // set at most once.
+  void set(size_t index, const S &value);
+
+  // Counts down one input, returning true iff it was the last one.
+  bool count_down() {
+    return atomic_int32_fetch_add(&remaining_, -1, moAcqRel) == 1;
+  }
+
+  // Returns the contents of all the slots, which must all have been set.
+  std::vector<S> collect();
+
+  // The promise to settle with the combined result.
+  R result;
+
+  // A reference that can be bound into callbacks.
+  class ref_t : public refcount_reference_t< promise_fan_in_t<S, R> > {
+  public:
+    explicit ref_t(promise_fan_in_t<S, R> *state)
+      : refcount_reference_t< promise_fan_in_t<S, R> >(state) { }
+    promise_fan_in_t<S, R> *operator->() { return this->refcount_shared(); }
+  };
+
+protected:
+  virtual size_t instance_size() { return instance_size_for(count_); }
+
+private:
+  promise_fan_in_t(size_t count, R result);
+
+  // Returns the offset from the start of a state to its slots.
+  static size_t slots_offset();
+
+  // Returns the size of a state with the given number of slots.
+  static size_t instance_size_for(size_t count);
+
+  size_t count_;
+  atomic_int32_t remaining_;
+  // The slots live in the same block as the state, right after it, followed
+  // by a flag for each slot that tells whether it has been set.
+  S *slots_;
+  uint8_t *is_set_;
+};
+
 // Returns a new opaque promise that behaves the same as the given C++ promise.
 opaque_promise_t *to_opaque_promise(promise_t<opaque_t, opaque_t> value);
 
-class NativeSemaphore;
-
+// The state of a sync promise. Waiting is a futex wait on a single word so
+// there's nothing to set up beyond a plain promise's state, and settling only
+// has to make a system call if someone is actually waiting. The word is
+// separate from the promise's state because waiters must not wake up before
+// the continuations have run.
 template <typename T, typename E = void*>
 class sync_promise_state_t : public promise_state_t<T, E> {
 public:
   sync_promise_state_t();
   ~sync_promise_state_t() { }
   fat_bool_t wait(Duration timeout);
-  virtual fat_bool_t fulfill(const T &value);
-  virtual fat_bool_t reject(const E &value);
 protected:
   virtual size_t instance_size() { return sizeof(*this); }
+  virtual void notify_settled();
 
 private:
-
-  // Drawbridge that gets lowered when the promise gets its value.
-  Drawbridge drawbridge_;
+  // Set in the low bit of waiters_ once the promise has settled and its
+  // continuations have run.
+  static const int32_t kIsDone = 1;
+  // Each waiter adds this to waiters_ while it's waiting.
+  static const int32_t kOneWaiter = 2;
+
+  // The futex word: the done bit and the number of threads waiting.
+  atomic_int32_t waiters_;
 };
 
 // A sync promise is like a promise but safe to share between threads. Also, you
@@ -209,7 +499,7 @@ public:
 private:
   sync_promise_state_t<T, E> *state() { return static_cast<sync_promise_state_t<T, E>*>(promise_t<T, E>::state()); }
 
-  sync_promise_t<T, E>(sync_promise_state_t<T, E> *state) : promise_t<T, E>(state) { }
+  sync_promise_t(sync_promise_state_t<T, E> *state) : promise_t<T, E>(state) { }
 };
 
 } // namespace tclib
@@ -4,6 +4,7 @@
 #include "c/stdc.h"
 
 BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
 #include "utils/log.h"
 END_C_INCLUDES
 
@@ -40,9 +41,15 @@ Workpool::Workpool()
   , is_shutting_down_(false)
   , skip_daemons_(false)
   , worker_(NULL)
-  , action_count_(0) { }
+  , has_worker_id_(atomic_int32_new(0))
+  , action_count_(0) {
+  native_thread_options_init(&worker_options_);
+  worker_options_.name = "workpool";
+}
 
 opaque_t Workpool::run_worker() {
+  worker_id_ = NativeThread::get_current_id();
+  atomic_int32_store(&has_worker_id_, 1, moRelease);
   while (true) {
     Task *task = NULL;
     fat_bool_t polled = poll_task(&task);
@@ -58,13 +65,22 @@ opaque_t Workpool::run_worker() {
 }
 
 fat_bool_t Workpool::initialize() {
+  action_count_.set_profile_name("Workpool::action_count_");
+  guard_.set_profile_name("Workpool::guard_");
   F_TRY(action_count_.initialize());
   F_TRY(guard_.initialize());
   return F_TRUE;
 }
 
+void Workpool::set_worker_numa_node(const numa_topology_t *topology,
+    size_t index) {
+  CHECK_REL("numa node out of range", index, <, topology->node_count);
+  worker_options_.affinity = topology->nodes[index].cpus;
+}
+
 fat_bool_t Workpool::start() {
   worker_ = new NativeThread(new_callback(&Workpool::run_worker, this));
+  worker_->set_options(worker_options_);
   return worker_->start();
 }
 
@@ -82,11 +98,18 @@ fat_bool_t Workpool::join(bool skip_daemons) {
   F_TRY(action_count_.release());
   opaque_t value = o0();
   F_TRY(worker_->join(&value));
+  // Thread ids can be reused once the thread is gone.
+  atomic_int32_store(&has_worker_id_, 0, moRelaxed);
   delete worker_;
   worker_ = NULL;
   return o2f(value);
 }
 
+bool Workpool::is_worker_thread() {
+  return atomic_int32_load(&has_worker_id_, moAcquire)
+      && NativeThread::ids_equal(worker_id_, NativeThread::get_current_id());
+}
+
 fat_bool_t Workpool::add_task(task_thunk_t callback, int32_t flags) {
   Task *task = new (kDefaultAlloc) Task(callback, flags);
   if (task == NULL) {
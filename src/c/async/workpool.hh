@@ -10,6 +10,8 @@
 
 BEGIN_C_INCLUDES
 #include "async/promise.h"
+#include "sync/atomic.h"
+#include "sync/numa.h"
 END_C_INCLUDES
 
 namespace tclib {
@@ -36,6 +38,19 @@ public:
   // but after this you can add tasks.
   fat_bool_t initialize();
 
+  // Sets the options to start worker threads with, must be called before
+  // start. By default workers get the platform's default options except for
+  // their name.
+  void set_worker_options(const native_thread_options_t &options) {
+    worker_options_ = options;
+  }
+
+  // Restricts the worker thread(s) to the cpus of the node with the given
+  // index in the topology, such that they run next to memory allocated on
+  // that node, for instance with a numa_allocator_t. Must be called before
+  // start; replaces any affinity set through the worker options.
+  void set_worker_numa_node(const numa_topology_t *topology, size_t index);
+
   // Starts the worker thread(s) running.
   fat_bool_t start();
 
@@ -53,6 +68,11 @@ public:
   // testing.
   void set_skip_daemons(bool value);
 
+  // Returns true iff the calling thread is this workpool's worker. Work that
+  // would be handed to the pool from its own worker can be run directly
+  // instead. Thread safe.
+  bool is_worker_thread();
+
 private:
   // Entry-point for worker threads.
   opaque_t run_worker();
@@ -81,6 +101,16 @@ private:
   // Worker thread.
   NativeThread *worker_;
 
+  // The id of the worker thread, only valid while has_worker_id_ is set. The
+  // flag is stored with release after the id is written so loading it with
+  // acquire makes the id safe to read from any thread.
+  native_thread_id_t worker_id_;
+  atomic_int32_t has_worker_id_;
+
+  // Options used when starting worker threads. The name, if any, must outlive
+  // the call to start.
+  native_thread_options_t worker_options_;
+
   // How many actions are left to perform? An action can either be performing a
   // task or shutting down. When shutting down this should stay nonzero or, if
   // it becomes zero, should be released to allow all workers to terminate.
@@ -20,6 +20,10 @@
 #  define IS_MACH
 #endif
 
+#ifdef __linux__
+#  define IS_LINUX
+#endif
+
 // Include custom headers for each toolchain.
 #ifdef IS_MSVC
 #  include "stdc-msvc.h"
@@ -110,6 +114,31 @@
 #define ONLY_CPP(E) IF_CPP(E, )
 #define UNLESS_CPP(E) IF_CPP(, E)
 
+// The code is written to be valid C++98 but when it's built as C++11 or later
+// types that get passed around by value a lot also support being moved.
+#if defined(__cplusplus)                                                       \
+    && ((__cplusplus >= 201103L) || (defined(_MSC_VER) && _MSC_VER >= 1900))
+#  define IS_CPP11 1
+#  define IF_CPP11(T, F) T
+#else
+#  define IF_CPP11(T, F) F
+#endif
+
+#define ONLY_CPP11(E) IF_CPP11(E, )
+#define UNLESS_CPP11(E) IF_CPP11(, E)
+
+// Moves the given value if the language supports it, otherwise it's just the
+// value which will then typically be copied. FORWARD is the same except that
+// if the given type is a reference type the value is passed on as a reference.
+#ifdef IS_CPP11
+#  include <utility>
+#  define MOVE(E) std::move(E)
+#  define FORWARD(T, E) std::forward<T>(E)
+#else
+#  define MOVE(E) (E)
+#  define FORWARD(T, E) (E)
+#endif
+
 // Includes of C headers from C++ files should be surrounded by these macros to
 // ensure that they're linked appropriately.
 #if defined(IS_GCC) && defined(__cplusplus)
@@ -139,6 +168,10 @@
 // else ambiguity.
 #define USE(E) do { if (false) { E; } } while (false)
 
+// Evaluates to the alignment required by the given type. Works in both C and
+// C++98 unlike the standard versions.
+#define ALIGN_OF(T) IF_MSVC(__alignof(T), __alignof__(T))
+
 // Shorthand for bytes.
 typedef unsigned char byte_t;
 
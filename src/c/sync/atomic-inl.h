@@ -0,0 +1,419 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Inline atomic operations with explicit memory ordering.
+//
+// The out-of-line operations in atomic.h are convenient but every one of them
+// is a function call and they only come in a couple of fixed orderings. The
+// operations here are inlined into the caller and take the ordering as an
+// argument so hot paths, refcounting for instance, can use exactly the
+// ordering they need. The ordering should always be a constant, otherwise the
+// compiler may fall back to the strongest ordering.
+
+#ifndef _TCLIB_ATOMIC_INL_H
+#define _TCLIB_ATOMIC_INL_H
+
+#include "c/stdc.h"
+#include "sync/atomic.h"
+
+#ifdef IS_GCC
+
+// Gcc 4.7 and later, and clang, have the __atomic builtins which take the
+// memory order explicitly. Before that there are only the __sync builtins which
+// are all full barriers. Those are stronger than any order so it's always safe
+// to fall back on them.
+#ifdef __ATOMIC_RELAXED
+
+// Returns the gcc constant that corresponds to the given order.
+static always_inline int memory_order_to_gcc(memory_order_t order) {
+  switch (order) {
+    case moRelaxed: return __ATOMIC_RELAXED;
+    case moAcquire: return __ATOMIC_ACQUIRE;
+    case moRelease: return __ATOMIC_RELEASE;
+    case moAcqRel: return __ATOMIC_ACQ_REL;
+    default: return __ATOMIC_SEQ_CST;
+  }
+}
+
+// Returns the gcc constant to use as the failure order of a compare-exchange
+// whose success order is the given one. A failed compare-exchange doesn't write
+// so it can't have release semantics.
+static always_inline int memory_order_to_gcc_failure(memory_order_t order) {
+  switch (order) {
+    case moRelaxed: case moRelease: return __ATOMIC_RELAXED;
+    case moAcquire: case moAcqRel: return __ATOMIC_ACQUIRE;
+    default: return __ATOMIC_SEQ_CST;
+  }
+}
+
+#  define __TCLIB_ATOMIC_LOAD__(P, O) __atomic_load_n((P), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_STORE__(P, V, O) __atomic_store_n((P), (V), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_EXCHANGE__(P, V, O) __atomic_exchange_n((P), (V), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_FETCH_ADD__(P, V, O) __atomic_fetch_add((P), (V), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_FETCH_OR__(P, V, O) __atomic_fetch_or((P), (V), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_FETCH_AND__(P, V, O) __atomic_fetch_and((P), (V), memory_order_to_gcc(O))
+#  define __TCLIB_ATOMIC_CAS__(P, E, V, O) __atomic_compare_exchange_n((P), (E), (V), false, memory_order_to_gcc(O), memory_order_to_gcc_failure(O))
+
+#else // !__ATOMIC_RELAXED
+
+#  define __TCLIB_ATOMIC_LOAD__(P, O) __sync_val_compare_and_swap((P), 0, 0)
+#  define __TCLIB_ATOMIC_STORE__(P, V, O) do {                                 \
+  __sync_synchronize();                                                        \
+  __sync_lock_test_and_set((P), (V));                                          \
+  __sync_synchronize();                                                        \
+} while (false)
+#  define __TCLIB_ATOMIC_EXCHANGE__(P, V, O) (__sync_synchronize(), __sync_lock_test_and_set((P), (V)))
+#  define __TCLIB_ATOMIC_FETCH_ADD__(P, V, O) __sync_fetch_and_add((P), (V))
+#  define __TCLIB_ATOMIC_FETCH_OR__(P, V, O) __sync_fetch_and_or((P), (V))
+#  define __TCLIB_ATOMIC_FETCH_AND__(P, V, O) __sync_fetch_and_and((P), (V))
+#  define __TCLIB_ATOMIC_CAS__(P, E, V, O) ({                                  \
+  __typeof__(*(E)) __expected__ = *(E);                                        \
+  __typeof__(*(E)) __previous__ = __sync_val_compare_and_swap((P), __expected__, (V)); \
+  *(E) = __previous__;                                                         \
+  __previous__ == __expected__;                                                \
+})
+
+#endif // __ATOMIC_RELAXED
+
+// On gcc the builtins are generic so all widths use the same ones.
+#define __TCLIB_ATOMIC_LOAD_32__ __TCLIB_ATOMIC_LOAD__
+#define __TCLIB_ATOMIC_STORE_32__ __TCLIB_ATOMIC_STORE__
+#define __TCLIB_ATOMIC_EXCHANGE_32__ __TCLIB_ATOMIC_EXCHANGE__
+#define __TCLIB_ATOMIC_FETCH_ADD_32__ __TCLIB_ATOMIC_FETCH_ADD__
+#define __TCLIB_ATOMIC_FETCH_OR_32__ __TCLIB_ATOMIC_FETCH_OR__
+#define __TCLIB_ATOMIC_FETCH_AND_32__ __TCLIB_ATOMIC_FETCH_AND__
+#define __TCLIB_ATOMIC_CAS_32__ __TCLIB_ATOMIC_CAS__
+#define __TCLIB_ATOMIC_LOAD_64__ __TCLIB_ATOMIC_LOAD__
+#define __TCLIB_ATOMIC_STORE_64__ __TCLIB_ATOMIC_STORE__
+#define __TCLIB_ATOMIC_EXCHANGE_64__ __TCLIB_ATOMIC_EXCHANGE__
+#define __TCLIB_ATOMIC_FETCH_ADD_64__ __TCLIB_ATOMIC_FETCH_ADD__
+#define __TCLIB_ATOMIC_FETCH_OR_64__ __TCLIB_ATOMIC_FETCH_OR__
+#define __TCLIB_ATOMIC_FETCH_AND_64__ __TCLIB_ATOMIC_FETCH_AND__
+#define __TCLIB_ATOMIC_CAS_64__ __TCLIB_ATOMIC_CAS__
+#define __TCLIB_ATOMIC_LOAD_PTR__ __TCLIB_ATOMIC_LOAD__
+#define __TCLIB_ATOMIC_STORE_PTR__ __TCLIB_ATOMIC_STORE__
+#define __TCLIB_ATOMIC_EXCHANGE_PTR__ __TCLIB_ATOMIC_EXCHANGE__
+#define __TCLIB_ATOMIC_CAS_PTR__ __TCLIB_ATOMIC_CAS__
+
+#endif // IS_GCC
+
+#ifdef IS_MSVC
+
+#include <intrin.h>
+
+// The interlocked intrinsics are all full barriers and plain volatile accesses
+// have acquire/release semantics on x86 so the orders only matter for stores,
+// where seq_cst needs a locked instruction. Most of the 64-bit intrinsics only
+// exist on x64 so those are built from compare-exchange which exists on both.
+
+static always_inline bool msvc_atomic_int32_cas(volatile int32_t *ptr,
+    int32_t *expected, int32_t desired) {
+  int32_t previous = _InterlockedCompareExchange((volatile long*) ptr, desired,
+      *expected);
+  bool result = (previous == *expected);
+  *expected = previous;
+  return result;
+}
+
+static always_inline bool msvc_atomic_int64_cas(volatile int64_t *ptr,
+    int64_t *expected, int64_t desired) {
+  int64_t previous = _InterlockedCompareExchange64(ptr, desired, *expected);
+  bool result = (previous == *expected);
+  *expected = previous;
+  return result;
+}
+
+static always_inline bool msvc_atomic_ptr_cas(void *volatile *ptr,
+    void **expected, void *desired) {
+  void *previous = _InterlockedCompareExchangePointer(ptr, desired, *expected);
+  bool result = (previous == *expected);
+  *expected = previous;
+  return result;
+}
+
+static always_inline int64_t msvc_atomic_int64_load(volatile int64_t *ptr) {
+  // On 32-bit a plain read may be torn so use a compare-exchange that never
+  // changes anything.
+  return IF_32_BIT(_InterlockedCompareExchange64(ptr, 0, 0), *ptr);
+}
+
+static always_inline int64_t msvc_atomic_int64_exchange(volatile int64_t *ptr,
+    int64_t value) {
+  int64_t current = msvc_atomic_int64_load(ptr);
+  while (!msvc_atomic_int64_cas(ptr, &current, value))
+    ;
+  return current;
+}
+
+static always_inline int64_t msvc_atomic_int64_fetch_add(volatile int64_t *ptr,
+    int64_t delta) {
+  int64_t current = msvc_atomic_int64_load(ptr);
+  while (!msvc_atomic_int64_cas(ptr, &current, current + delta))
+    ;
+  return current;
+}
+
+static always_inline int64_t msvc_atomic_int64_fetch_or(volatile int64_t *ptr,
+    int64_t bits) {
+  int64_t current = msvc_atomic_int64_load(ptr);
+  while (!msvc_atomic_int64_cas(ptr, &current, current | bits))
+    ;
+  return current;
+}
+
+static always_inline int64_t msvc_atomic_int64_fetch_and(volatile int64_t *ptr,
+    int64_t bits) {
+  int64_t current = msvc_atomic_int64_load(ptr);
+  while (!msvc_atomic_int64_cas(ptr, &current, current & bits))
+    ;
+  return current;
+}
+
+static always_inline void *msvc_atomic_ptr_exchange(void *volatile *ptr,
+    void *value) {
+  void *current = *ptr;
+  while (!msvc_atomic_ptr_cas(ptr, &current, value))
+    ;
+  return current;
+}
+
+#define __TCLIB_ATOMIC_LOAD_32__(P, O) (*(P))
+#define __TCLIB_ATOMIC_STORE_32__(P, V, O) ((O) == moSeqCst ? (void) _InterlockedExchange((volatile long*) (P), (V)) : (void) (*(P) = (V)))
+#define __TCLIB_ATOMIC_EXCHANGE_32__(P, V, O) _InterlockedExchange((volatile long*) (P), (V))
+#define __TCLIB_ATOMIC_FETCH_ADD_32__(P, V, O) _InterlockedExchangeAdd((volatile long*) (P), (V))
+#define __TCLIB_ATOMIC_FETCH_OR_32__(P, V, O) _InterlockedOr((volatile long*) (P), (V))
+#define __TCLIB_ATOMIC_FETCH_AND_32__(P, V, O) _InterlockedAnd((volatile long*) (P), (V))
+#define __TCLIB_ATOMIC_CAS_32__(P, E, V, O) msvc_atomic_int32_cas((P), (E), (V))
+#define __TCLIB_ATOMIC_LOAD_64__(P, O) msvc_atomic_int64_load(P)
+#define __TCLIB_ATOMIC_STORE_64__(P, V, O) (((O) == moSeqCst || kIs32Bit) ? (void) msvc_atomic_int64_exchange((P), (V)) : (void) (*(P) = (V)))
+#define __TCLIB_ATOMIC_EXCHANGE_64__(P, V, O) msvc_atomic_int64_exchange((P), (V))
+#define __TCLIB_ATOMIC_FETCH_ADD_64__(P, V, O) msvc_atomic_int64_fetch_add((P), (V))
+#define __TCLIB_ATOMIC_FETCH_OR_64__(P, V, O) msvc_atomic_int64_fetch_or((P), (V))
+#define __TCLIB_ATOMIC_FETCH_AND_64__(P, V, O) msvc_atomic_int64_fetch_and((P), (V))
+#define __TCLIB_ATOMIC_CAS_64__(P, E, V, O) msvc_atomic_int64_cas((P), (E), (V))
+#define __TCLIB_ATOMIC_LOAD_PTR__(P, O) (*(P))
+#define __TCLIB_ATOMIC_STORE_PTR__(P, V, O) ((O) == moSeqCst ? (void) msvc_atomic_ptr_exchange((P), (V)) : (void) (*(P) = (V)))
+#define __TCLIB_ATOMIC_EXCHANGE_PTR__(P, V, O) msvc_atomic_ptr_exchange((P), (V))
+#define __TCLIB_ATOMIC_CAS_PTR__(P, E, V, O) msvc_atomic_ptr_cas((P), (E), (V))
+
+#endif // IS_MSVC
+
+// Tells the processor that the calling thread is busy-waiting for another
+// thread. This doesn't block but on hyperthreaded cores it frees up resources
+// for the other thread, and it saves power.
+static always_inline void atomic_spin_pause(void) {
+#if defined(IS_GCC) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_ia32_pause();
+#elif defined(IS_MSVC)
+  _mm_pause();
+#endif
+}
+
+// Issues a memory fence with the given order. Relaxed fences do nothing.
+static always_inline void atomic_fence(memory_order_t order) {
+  if (order == moRelaxed)
+    return;
+#if defined(IS_GCC) && defined(__ATOMIC_RELAXED)
+  __atomic_thread_fence(memory_order_to_gcc(order));
+#elif defined(IS_GCC)
+  __sync_synchronize();
+#elif defined(IS_MSVC)
+  // Only seq_cst needs a real fence on x86, the others just have to stop the
+  // compiler from reordering.
+  if (order == moSeqCst)
+    _mm_mfence();
+  else
+    _ReadWriteBarrier();
+#endif
+}
+
+// --- 3 2 - b i t ---
+
+// Returns the current value of the given atomic. The order must be relaxed,
+// acquire, or seq_cst.
+static always_inline int32_t atomic_int32_load(atomic_int32_t *atomic,
+    memory_order_t order) {
+  return __TCLIB_ATOMIC_LOAD_32__(&atomic->value, order);
+}
+
+// Sets the value of the given atomic. The order must be relaxed, release, or
+// seq_cst.
+static always_inline void atomic_int32_store(atomic_int32_t *atomic,
+    int32_t value, memory_order_t order) {
+  __TCLIB_ATOMIC_STORE_32__(&atomic->value, value, order);
+}
+
+// Sets the value of the given atomic, returning the previous value.
+static always_inline int32_t atomic_int32_exchange(atomic_int32_t *atomic,
+    int32_t value, memory_order_t order) {
+  return __TCLIB_ATOMIC_EXCHANGE_32__(&atomic->value, value, order);
+}
+
+// Adds the given delta to the given atomic, returning the previous value.
+static always_inline int32_t atomic_int32_fetch_add(atomic_int32_t *atomic,
+    int32_t delta, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_ADD_32__(&atomic->value, delta, order);
+}
+
+// Sets the given bits in the given atomic, returning the previous value.
+static always_inline int32_t atomic_int32_fetch_or(atomic_int32_t *atomic,
+    int32_t bits, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_OR_32__(&atomic->value, bits, order);
+}
+
+// Clears the bits not in the given mask in the given atomic, returning the
+// previous value.
+static always_inline int32_t atomic_int32_fetch_and(atomic_int32_t *atomic,
+    int32_t mask, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_AND_32__(&atomic->value, mask, order);
+}
+
+// If the given atomic holds the expected value sets it to the desired value and
+// returns true. Otherwise stores the value it actually held in expected and
+// returns false. A failed exchange is performed using the strongest of the
+// given order that doesn't involve a release.
+static always_inline bool atomic_int32_compare_exchange(atomic_int32_t *atomic,
+    int32_t *expected, int32_t desired, memory_order_t order) {
+  return __TCLIB_ATOMIC_CAS_32__(&atomic->value, expected, desired, order);
+}
+
+// --- 6 4 - b i t ---
+
+// Returns the current value of the given atomic. The order must be relaxed,
+// acquire, or seq_cst.
+static always_inline int64_t atomic_int64_load(atomic_int64_t *atomic,
+    memory_order_t order) {
+  return __TCLIB_ATOMIC_LOAD_64__(&atomic->value, order);
+}
+
+// Sets the value of the given atomic. The order must be relaxed, release, or
+// seq_cst.
+static always_inline void atomic_int64_store(atomic_int64_t *atomic,
+    int64_t value, memory_order_t order) {
+  __TCLIB_ATOMIC_STORE_64__(&atomic->value, value, order);
+}
+
+// Sets the value of the given atomic, returning the previous value.
+static always_inline int64_t atomic_int64_exchange(atomic_int64_t *atomic,
+    int64_t value, memory_order_t order) {
+  return __TCLIB_ATOMIC_EXCHANGE_64__(&atomic->value, value, order);
+}
+
+// Adds the given delta to the given atomic, returning the previous value.
+static always_inline int64_t atomic_int64_fetch_add(atomic_int64_t *atomic,
+    int64_t delta, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_ADD_64__(&atomic->value, delta, order);
+}
+
+// Sets the given bits in the given atomic, returning the previous value.
+static always_inline int64_t atomic_int64_fetch_or(atomic_int64_t *atomic,
+    int64_t bits, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_OR_64__(&atomic->value, bits, order);
+}
+
+// Clears the bits not in the given mask in the given atomic, returning the
+// previous value.
+static always_inline int64_t atomic_int64_fetch_and(atomic_int64_t *atomic,
+    int64_t mask, memory_order_t order) {
+  return __TCLIB_ATOMIC_FETCH_AND_64__(&atomic->value, mask, order);
+}
+
+// If the given atomic holds the expected value sets it to the desired value and
+// returns true. Otherwise stores the value it actually held in expected and
+// returns false. See atomic_int32_compare_exchange.
+static always_inline bool atomic_int64_compare_exchange(atomic_int64_t *atomic,
+    int64_t *expected, int64_t desired, memory_order_t order) {
+  return __TCLIB_ATOMIC_CAS_64__(&atomic->value, expected, desired, order);
+}
+
+// --- P o i n t e r ---
+
+// Returns the current value of the given atomic pointer. The order must be
+// relaxed, acquire, or seq_cst.
+static always_inline void *atomic_ptr_load(atomic_ptr_t *atomic,
+    memory_order_t order) {
+  return __TCLIB_ATOMIC_LOAD_PTR__(&atomic->value, order);
+}
+
+// Sets the value of the given atomic pointer. The order must be relaxed,
+// release, or seq_cst.
+static always_inline void atomic_ptr_store(atomic_ptr_t *atomic, void *value,
+    memory_order_t order) {
+  __TCLIB_ATOMIC_STORE_PTR__(&atomic->value, value, order);
+}
+
+// Sets the value of the given atomic pointer, returning the previous value.
+static always_inline void *atomic_ptr_exchange(atomic_ptr_t *atomic,
+    void *value, memory_order_t order) {
+  return __TCLIB_ATOMIC_EXCHANGE_PTR__(&atomic->value, value, order);
+}
+
+// If the given atomic pointer holds the expected value sets it to the desired
+// value and returns true. Otherwise stores the value it actually held in
+// expected and returns false. See atomic_int32_compare_exchange.
+static always_inline bool atomic_ptr_compare_exchange(atomic_ptr_t *atomic,
+    void **expected, void *desired, memory_order_t order) {
+  return __TCLIB_ATOMIC_CAS_PTR__(&atomic->value, expected, desired, order);
+}
+
+// --- P a i r ---
+
+#ifdef HAS_ATOMIC_PAIR
+
+// If the given atomic pair holds the expected words sets it to the desired
+// words and returns true. Otherwise stores the words it actually held in
+// expected and returns false. This is always a full barrier.
+static always_inline bool atomic_pair_compare_exchange(atomic_pair_t *atomic,
+    word_pair_t *expected, word_pair_t desired) {
+#if defined(IS_GCC) && defined(__x86_64__)
+  // Gcc only emits cmpxchg16b inline with -mcx16 so we do it by hand.
+  bool result;
+  __asm__ __volatile__(
+      "lock; cmpxchg16b %1\n\t"
+      "setz %0"
+      : "=q" (result), "+m" (atomic->value), "+a" (expected->first),
+        "+d" (expected->second)
+      : "b" (desired.first), "c" (desired.second)
+      : "cc", "memory");
+  return result;
+#elif defined(IS_GCC) && defined(__i386__)
+  // On 32-bit a pair of pointers is just a 64-bit value.
+  uint64_t old_bits;
+  uint64_t new_bits;
+  memcpy(&old_bits, expected, sizeof(old_bits));
+  memcpy(&new_bits, &desired, sizeof(new_bits));
+  uint64_t previous = __sync_val_compare_and_swap(
+      (volatile uint64_t*) &atomic->value, old_bits, new_bits);
+  memcpy(expected, &previous, sizeof(previous));
+  return previous == old_bits;
+#elif defined(IS_MSVC) && defined(IS_64_BIT)
+  // Conveniently this already updates the expected value on failure.
+  return _InterlockedCompareExchange128((volatile __int64*) &atomic->value,
+      (__int64) desired.second, (__int64) desired.first,
+      (__int64*) expected) != 0;
+#elif defined(IS_MSVC)
+  int64_t old_bits;
+  int64_t new_bits;
+  memcpy(&old_bits, expected, sizeof(old_bits));
+  memcpy(&new_bits, &desired, sizeof(new_bits));
+  int64_t previous = _InterlockedCompareExchange64(
+      (volatile int64_t*) &atomic->value, new_bits, old_bits);
+  memcpy(expected, &previous, sizeof(previous));
+  return previous == old_bits;
+#endif
+}
+
+// Returns the current words of the given atomic pair. The words are read
+// together so they're guaranteed to be consistent with each other.
+static always_inline word_pair_t atomic_pair_load(atomic_pair_t *atomic) {
+  // There's no plain double-width load so compare-exchange with an arbitrary
+  // value. If it happens to match the value is written back unchanged,
+  // otherwise we get the current value.
+  word_pair_t result = word_pair_new(NULL, NULL);
+  atomic_pair_compare_exchange(atomic, &result, result);
+  return result;
+}
+
+#endif // HAS_ATOMIC_PAIR
+
+#endif // _TCLIB_ATOMIC_INL_H
@@ -4,6 +4,7 @@
 #include "c/stdc.h"
 
 BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
 #include "sync/atomic.h"
 END_C_INCLUDES
 
@@ -21,7 +22,18 @@ atomic_int32_t atomic_int32_new(int32_t value) {
 }
 
 int64_t atomic_int64_get(atomic_int64_t *value) {
-  return value->value;
+  // A plain read of a 64-bit value may be torn on 32-bit platforms.
+  return atomic_int64_load(value, moRelaxed);
+}
+
+bool atomic_int64_compare_and_set(atomic_int64_t *value, int64_t old_value,
+    int64_t new_value) {
+  return atomic_int64_compare_exchange(value, &old_value, new_value, moSeqCst);
+}
+
+int64_t atomic_int64_set(atomic_int64_t *value, int64_t new_value) {
+  atomic_int64_store(value, new_value, moRelaxed);
+  return new_value;
 }
 
 atomic_int64_t atomic_int64_new(int64_t value) {
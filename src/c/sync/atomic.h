@@ -7,6 +7,22 @@
 #include "c/stdc.h"
 #include "sync/sync.h"
 
+// The memory ordering constraints that can be imposed on the inline atomic
+// operations in atomic-inl.h. These have the same meaning as the C11/C++11
+// memory orders of the same names. The out-of-line operations declared in this
+// file don't take an ordering, each documents what it uses.
+typedef enum {
+  moRelaxed,
+  moAcquire,
+  moRelease,
+  moAcqRel,
+  moSeqCst
+} memory_order_t;
+
+// The assumed size of a cache line. Atomics that are written frequently by
+// different threads should be padded to this to avoid false sharing.
+#define kCacheLineSize 64
+
 // A 32-bit value that can be manipulated atomically. Atomic ints are very
 // lightweight to create and maintain through the inc/dec operations may or may
 // not be slightly expensive. Clearing the memory of an atomic int32 to zeroes
@@ -15,7 +31,9 @@ typedef struct {
   volatile int32_t value;
 } atomic_int32_t;
 
-// Increment the given atomic value.
+// Increment the given atomic value. Like all the out-of-line read-modify-write
+// operations except compare_and_set this is relaxed, it imposes no ordering
+// on other memory operations.
 int32_t atomic_int32_increment(atomic_int32_t *value);
 
 // Decrement the given atomic value.
@@ -30,9 +48,12 @@ int32_t atomic_int32_subtract(atomic_int32_t *value, int32_t delta);
 // Returns the current value of the given atomic integer.
 int32_t atomic_int32_get(atomic_int32_t *value);
 
+// If the given atomic value is equal to old_value sets it to new_value and
+// returns true, otherwise returns false. This is a full barrier.
 bool atomic_int32_compare_and_set(atomic_int32_t *value, int32_t old_value,
     int32_t new_value);
 
+// Sets the value of the given atomic integer, returning the new value.
 int32_t atomic_int32_set(atomic_int32_t *value, int32_t new_value);
 
 // Returns a new atomic int32 that starts out with the given value. The result
@@ -62,8 +83,77 @@ int64_t atomic_int64_subtract(atomic_int64_t *value, int64_t delta);
 // Returns the current value of the given atomic integer.
 int64_t atomic_int64_get(atomic_int64_t *value);
 
+// If the given atomic value is equal to old_value sets it to new_value and
+// returns true, otherwise returns false. This is a full barrier.
+bool atomic_int64_compare_and_set(atomic_int64_t *value, int64_t old_value,
+    int64_t new_value);
+
+// Sets the value of the given atomic integer, returning the new value.
+int64_t atomic_int64_set(atomic_int64_t *value, int64_t new_value);
+
 // Returns a new atomic int64 that starts out with the given value. The result
 // does not have to be disposed.
 atomic_int64_t atomic_int64_new(int64_t value);
 
+// A pointer that can be manipulated atomically. All the operations on atomic
+// pointers are inline, see atomic-inl.h. As with the atomic ints clearing the
+// memory to zeroes is meaningful and causes the value to be cleared to NULL.
+typedef struct {
+  void *volatile value;
+} atomic_ptr_t;
+
+// Returns a new atomic pointer that starts out with the given value. The result
+// does not have to be disposed.
+static inline atomic_ptr_t atomic_ptr_new(void *value) {
+  atomic_ptr_t result = {value};
+  return result;
+}
+
+// Two pointer-sized words that are read and written together by the atomic
+// pair operations.
+typedef struct {
+  void *first;
+  void *second;
+} word_pair_t;
+
+// Returns a new word pair with the given contents.
+static inline word_pair_t word_pair_new(void *first, void *second) {
+  word_pair_t result = {first, second};
+  return result;
+}
+
+// Is double-width compare-and-swap, that is, atomic_pair_compare_exchange,
+// available on this platform? If it isn't the atomic pair type is still
+// defined but none of the operations on it are.
+#if defined(IS_GCC) && (defined(__x86_64__) || defined(__i386__))
+#  define HAS_ATOMIC_PAIR 1
+#elif defined(IS_MSVC)
+#  define HAS_ATOMIC_PAIR 1
+#endif
+
+#ifdef HAS_ATOMIC_PAIR
+#  define IF_ATOMIC_PAIR(T, F) T
+#else
+#  define IF_ATOMIC_PAIR(T, F) F
+#endif
+
+#define kHasAtomicPair IF_ATOMIC_PAIR(true, false)
+
+// Two pointer-sized words that can be compared and swapped together atomically,
+// for instance a pointer and a counter that protects it against ABA. The
+// hardware requires this to be aligned to its full width.
+typedef struct {
+  IF_MSVC(IF_32_BIT(__declspec(align(8)), __declspec(align(16))), )
+  word_pair_t value
+  IF_GCC(__attribute__((aligned(2 * WORD_SIZE))), );
+} atomic_pair_t;
+
+// Returns a new atomic pair that starts out with the given words.
+static inline atomic_pair_t atomic_pair_new(void *first, void *second) {
+  atomic_pair_t result;
+  result.value.first = first;
+  result.value.second = second;
+  return result;
+}
+
 #endif // _TCLIB_ATOMIC_H
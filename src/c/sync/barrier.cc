@@ -0,0 +1,219 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/barrier.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "utils/check.h"
+#include "utils/log.h"
+END_C_INCLUDES
+
+#include <new>
+
+using namespace tclib;
+
+// How many times a waiting thread checks whether it has been released before
+// blocking. This should be long enough to cover a typically short phase but no
+// longer, spinning threads are burning a core.
+static const size_t kSpinCount = 1024;
+
+// Spins until the given atomic is no longer equal to the given value or the
+// spin count runs out. Returns true iff the value changed.
+static bool spin_while_equal(atomic_int32_t *atomic, int32_t value) {
+  for (size_t i = 0; i < kSpinCount; i++) {
+    if (atomic_int32_load(atomic, moAcquire) != value)
+      return true;
+    atomic_spin_pause();
+  }
+  return false;
+}
+
+// Spins until the given atomic is zero or the spin count runs out. Returns true
+// iff it became zero.
+static bool spin_until_zero(atomic_int32_t *atomic) {
+  for (size_t i = 0; i < kSpinCount; i++) {
+    if (atomic_int32_load(atomic, moAcquire) == 0)
+      return true;
+    atomic_spin_pause();
+  }
+  return false;
+}
+
+NativeBarrier::NativeBarrier(uint32_t parties) {
+  is_initialized_ = false;
+  parties_ = remaining_ = parties;
+  sleepers_ = 0;
+  phase_ = atomic_int32_new(0);
+  new (guard()) NativeMutex();
+  new (cond()) NativeCondition();
+}
+
+NativeBarrier::~NativeBarrier() {
+  if (is_initialized_)
+    CHECK_EQ("disposing barrier with waiters", 0, sleepers_);
+  cond()->~NativeCondition();
+  guard()->~NativeMutex();
+}
+
+fat_bool_t NativeBarrier::initialize() {
+  if (parties_ == 0) {
+    WARN("Barrier must have at least one party");
+    return F_FALSE;
+  }
+  F_TRY(guard()->initialize());
+  F_TRY(cond()->initialize());
+  is_initialized_ = true;
+  return F_TRUE;
+}
+
+fat_bool_t NativeBarrier::pass(Duration timeout) {
+  CHECK_TRUE("not initialized", is_initialized_);
+  // The guard is only ever held briefly so the timeout only applies to waiting
+  // for the other parties.
+  F_TRY(guard()->lock());
+  int32_t phase = atomic_int32_load(&phase_, moRelaxed);
+  if (--remaining_ == 0) {
+    // We're the last to arrive so open the barrier and reset it for the next
+    // phase. Only threads that gave up spinning need to be woken.
+    remaining_ = parties_;
+    int32_t next_phase = static_cast<int32_t>(static_cast<uint32_t>(phase) + 1);
+    atomic_int32_store(&phase_, next_phase, moRelease);
+    fat_bool_t woken = (sleepers_ > 0) ? cond()->wake_all() : F_TRUE;
+    F_TRY(guard()->unlock());
+    return woken;
+  }
+  F_TRY(guard()->unlock());
+  if (!timeout.is_instant() && spin_while_equal(&phase_, phase))
+    return F_TRUE;
+  F_TRY(guard()->lock());
+  sleepers_++;
+  fat_bool_t result = F_TRUE;
+  while (atomic_int32_load(&phase_, moRelaxed) == phase) {
+    result = cond()->wait(guard(), timeout);
+    if (!result)
+      break;
+  }
+  sleepers_--;
+  if (atomic_int32_load(&phase_, moRelaxed) == phase) {
+    // We timed out before the barrier opened so we no longer count as having
+    // arrived.
+    remaining_++;
+  } else {
+    result = F_TRUE;
+  }
+  F_TRY(guard()->unlock());
+  return result;
+}
+
+void native_barrier_construct(native_barrier_t *barrier, uint32_t parties) {
+  new (barrier) NativeBarrier(parties);
+}
+
+bool native_barrier_initialize(native_barrier_t *barrier) {
+  return static_cast<NativeBarrier*>(barrier)->initialize();
+}
+
+void native_barrier_dispose(native_barrier_t *barrier) {
+  static_cast<NativeBarrier*>(barrier)->~NativeBarrier();
+}
+
+bool native_barrier_pass(native_barrier_t *barrier, duration_t timeout) {
+  return static_cast<NativeBarrier*>(barrier)->pass(timeout);
+}
+
+CountDownLatch::CountDownLatch(uint32_t count) {
+  is_initialized_ = false;
+  sleepers_ = 0;
+  count_ = atomic_int32_new(static_cast<int32_t>(count));
+  new (guard()) NativeMutex();
+  new (cond()) NativeCondition();
+}
+
+CountDownLatch::~CountDownLatch() {
+  if (is_initialized_)
+    CHECK_EQ("disposing latch with waiters", 0, sleepers_);
+  cond()->~NativeCondition();
+  guard()->~NativeMutex();
+}
+
+fat_bool_t CountDownLatch::initialize() {
+  if (atomic_int32_load(&count_, moRelaxed) < 0) {
+    WARN("Initial latch count too large");
+    return F_FALSE;
+  }
+  F_TRY(guard()->initialize());
+  F_TRY(cond()->initialize());
+  is_initialized_ = true;
+  return F_TRUE;
+}
+
+fat_bool_t CountDownLatch::count_down(uint32_t amount) {
+  CHECK_TRUE("not initialized", is_initialized_);
+  int32_t current = atomic_int32_load(&count_, moRelaxed);
+  int32_t next;
+  do {
+    if (current == 0)
+      return F_TRUE;
+    next = (static_cast<uint32_t>(current) <= amount)
+        ? 0
+        : current - static_cast<int32_t>(amount);
+  } while (!atomic_int32_compare_exchange(&count_, &current, next, moAcqRel));
+  if (next > 0)
+    return F_TRUE;
+  // Waiters check the count while holding the guard before they block so once
+  // we hold it here every thread that will ever block is already asleep.
+  F_TRY(guard()->lock());
+  fat_bool_t woken = (sleepers_ > 0) ? cond()->wake_all() : F_TRUE;
+  F_TRY(guard()->unlock());
+  return woken;
+}
+
+fat_bool_t CountDownLatch::wait(Duration timeout) {
+  CHECK_TRUE("not initialized", is_initialized_);
+  if (atomic_int32_load(&count_, moAcquire) == 0)
+    return F_TRUE;
+  if (timeout.is_instant())
+    return F_FALSE;
+  if (spin_until_zero(&count_))
+    return F_TRUE;
+  F_TRY(guard()->lock());
+  sleepers_++;
+  fat_bool_t result = F_TRUE;
+  while (atomic_int32_load(&count_, moAcquire) != 0) {
+    result = cond()->wait(guard(), timeout);
+    if (!result)
+      break;
+  }
+  sleepers_--;
+  F_TRY(guard()->unlock());
+  return result;
+}
+
+uint32_t CountDownLatch::count() {
+  return static_cast<uint32_t>(atomic_int32_load(&count_, moAcquire));
+}
+
+void count_down_latch_construct(count_down_latch_t *latch, uint32_t count) {
+  new (latch) CountDownLatch(count);
+}
+
+bool count_down_latch_initialize(count_down_latch_t *latch) {
+  return static_cast<CountDownLatch*>(latch)->initialize();
+}
+
+void count_down_latch_dispose(count_down_latch_t *latch) {
+  static_cast<CountDownLatch*>(latch)->~CountDownLatch();
+}
+
+bool count_down_latch_count_down(count_down_latch_t *latch, uint32_t amount) {
+  return static_cast<CountDownLatch*>(latch)->count_down(amount);
+}
+
+bool count_down_latch_wait(count_down_latch_t *latch, duration_t timeout) {
+  return static_cast<CountDownLatch*>(latch)->wait(timeout);
+}
+
+uint32_t count_down_latch_count(count_down_latch_t *latch) {
+  return static_cast<CountDownLatch*>(latch)->count();
+}
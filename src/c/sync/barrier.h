@@ -0,0 +1,80 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_BARRIER_H
+#define _TCLIB_BARRIER_H
+
+#include "c/stdc.h"
+#include "sync/atomic.h"
+#include "sync/condition.h"
+#include "sync/mutex.h"
+#include "sync/sync.h"
+
+// A reusable barrier that blocks threads until a fixed number of them, the
+// parties, have arrived. Once the last one arrives all of them are released
+// and the barrier resets so it can be used for the next phase.
+typedef struct {
+  bool is_initialized_;
+  native_mutex_t guard_;
+  native_condition_t cond_;
+  // The number of threads that have to arrive before the barrier opens.
+  uint32_t parties_;
+  // How many threads have yet to arrive in the current phase. Guarded by
+  // guard_.
+  uint32_t remaining_;
+  // How many threads are blocked on cond_. Guarded by guard_.
+  uint32_t sleepers_;
+  // Incremented each time the barrier opens. Only written while guard_ is held
+  // but waiting threads spin on it without holding it.
+  atomic_int32_t phase_;
+} native_barrier_t;
+
+// Constructs the given barrier for the given number of parties.
+void native_barrier_construct(native_barrier_t *barrier, uint32_t parties);
+
+// Initializes the state of this barrier, returning true iff initialization
+// succeeded.
+bool native_barrier_initialize(native_barrier_t *barrier);
+
+// Release any resources held by the given barrier.
+void native_barrier_dispose(native_barrier_t *barrier);
+
+// Arrives at the given barrier and waits the given duration for the rest of
+// the parties to arrive. Returns true iff they did.
+bool native_barrier_pass(native_barrier_t *barrier, duration_t timeout);
+
+// A one-shot latch that blocks threads until it has been counted down to zero
+// after which it stays open.
+typedef struct {
+  bool is_initialized_;
+  native_mutex_t guard_;
+  native_condition_t cond_;
+  // How many threads are blocked on cond_. Guarded by guard_.
+  uint32_t sleepers_;
+  // The remaining count. Counting down doesn't take guard_ except when the
+  // count reaches zero.
+  atomic_int32_t count_;
+} count_down_latch_t;
+
+// Constructs the given latch with the given initial count.
+void count_down_latch_construct(count_down_latch_t *latch, uint32_t count);
+
+// Initializes the state of this latch, returning true iff initialization
+// succeeded.
+bool count_down_latch_initialize(count_down_latch_t *latch);
+
+// Release any resources held by the given latch.
+void count_down_latch_dispose(count_down_latch_t *latch);
+
+// Decrements the count of the given latch by the given amount, releasing any
+// waiting threads if it reaches zero. Returns true iff successful.
+bool count_down_latch_count_down(count_down_latch_t *latch, uint32_t amount);
+
+// Waits the given duration for the given latch to reach zero. Returns true iff
+// it did.
+bool count_down_latch_wait(count_down_latch_t *latch, duration_t timeout);
+
+// Returns the current count of the given latch.
+uint32_t count_down_latch_count(count_down_latch_t *latch);
+
+#endif // _TCLIB_BARRIER_H
@@ -0,0 +1,82 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_BARRIER_HH
+#define _TCLIB_BARRIER_HH
+
+#include "c/stdc.h"
+
+#include "sync/condition.hh"
+#include "sync/mutex.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/barrier.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+// A reusable barrier that blocks threads until a fixed number of them, the
+// parties, have arrived. Once the last one arrives all of them are released
+// and the barrier resets so it can be used for the next phase.
+//
+// Phases are often short so waiting threads spin briefly before blocking, and
+// the last thread to arrive only has to wake anyone if some of them did block.
+class NativeBarrier : public native_barrier_t {
+public:
+  // Construct a barrier for the given number of parties, which must be at least
+  // one. Note that before use the barrier has to be explicitly initialized.
+  explicit NativeBarrier(uint32_t parties);
+
+  ~NativeBarrier();
+
+  // Initializes the state of this barrier, returning true if initialization
+  // succeeded.
+  fat_bool_t initialize();
+
+  // Arrives at this barrier and waits for the rest of the parties to arrive. If
+  // the timeout expires before they do this thread is no longer counted as
+  // having arrived.
+  fat_bool_t pass(Duration timeout = Duration::unlimited());
+
+  // Returns the number of parties this barrier waits for.
+  uint32_t parties() { return parties_; }
+
+private:
+  NativeMutex *guard() { return static_cast<NativeMutex*>(&guard_); }
+  NativeCondition *cond() { return static_cast<NativeCondition*>(&cond_); }
+};
+
+// A one-shot latch that blocks threads until it has been counted down to zero
+// after which it stays open. Counting down only takes a lock for the final
+// count and like the barrier waiting threads spin briefly before blocking.
+class CountDownLatch : public count_down_latch_t {
+public:
+  // Construct a latch with the given initial count. Note that before use the
+  // latch has to be explicitly initialized.
+  explicit CountDownLatch(uint32_t count);
+
+  ~CountDownLatch();
+
+  // Initializes the state of this latch, returning true if initialization
+  // succeeded.
+  fat_bool_t initialize();
+
+  // Decrements the count by the given amount, releasing all waiting threads if
+  // it reaches zero. Counting down by more than the remaining count just
+  // leaves it at zero.
+  fat_bool_t count_down(uint32_t amount = 1);
+
+  // Waits for the count to reach zero.
+  fat_bool_t wait(Duration timeout = Duration::unlimited());
+
+  // Returns the current count.
+  uint32_t count();
+
+private:
+  NativeMutex *guard() { return static_cast<NativeMutex*>(&guard_); }
+  NativeCondition *cond() { return static_cast<NativeCondition*>(&cond_); }
+};
+
+} // namespace tclib
+
+#endif // _TCLIB_BARRIER_HH
@@ -13,7 +13,7 @@ fat_bool_t NativeCondition::platform_dispose() {
   return F_TRUE;
 }
 
-fat_bool_t NativeCondition::wait(NativeMutex *mutex, Duration timeout) {
+fat_bool_t NativeCondition::platform_wait(NativeMutex *mutex, Duration timeout) {
   PCONDITION_VARIABLE cond = get_platform_condition(this);
   PCRITICAL_SECTION cs = get_platform_mutex(mutex);
   if (SleepConditionVariableCS(cond, cs, timeout.to_winapi_millis()))
@@ -22,7 +22,7 @@ fat_bool_t NativeCondition::platform_dispose() {
   return F_FALSE;
 }
 
-fat_bool_t NativeCondition::wait(NativeMutex *mutex, Duration timeout) {
+fat_bool_t NativeCondition::platform_wait(NativeMutex *mutex, Duration timeout) {
   int result;
   if (timeout.is_unlimited()) {
     result = pthread_cond_wait(&cond, &mutex->mutex);
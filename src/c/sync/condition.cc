@@ -3,9 +3,12 @@
 
 #include "sync/condition.hh"
 
+#include "sync/contention.hh"
+
 BEGIN_C_INCLUDES
 #include "sync/condition.h"
 #include "utils/alloc.h"
+#include "utils/clock.h"
 #include "utils/log.h"
 END_C_INCLUDES
 
@@ -21,12 +24,16 @@ using namespace tclib;
 
 NativeCondition::NativeCondition() {
   is_initialized = false;
+  profile_name = NULL;
 }
 
 NativeCondition::~NativeCondition() {
   if (!is_initialized)
     return;
   is_initialized = false;
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler != NULL)
+    profiler->forget(ckCondition, this, profile_name);
   platform_dispose();
   struct_zero_fill(*this);
 }
@@ -38,3 +45,17 @@ fat_bool_t NativeCondition::initialize() {
   }
   return F_TRUE;
 }
+
+fat_bool_t NativeCondition::wait(NativeMutex *mutex, Duration timeout) {
+  // The mutex is released while we wait so it mustn't count as being held.
+  uint32_t depth = mutex->enter_wait();
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  uint64_t start = (profiler == NULL) ? 0 : monotonic_clock_nanos();
+  fat_bool_t result = platform_wait(mutex, timeout);
+  if (profiler != NULL) {
+    uint64_t waited = monotonic_clock_nanos() - start;
+    profiler->record_acquire(ckCondition, this, profile_name, true, waited);
+  }
+  mutex->exit_wait(depth);
+  return result;
+}
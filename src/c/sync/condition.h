@@ -11,6 +11,9 @@
 typedef struct {
   bool is_initialized;
   platform_condition_t cond;
+  // The name this condition is reported under by the contention profiler. If
+  // it's NULL the condition is reported individually.
+  const char *profile_name;
 } native_condition_t;
 
 // Create a new uninitialized condition variable.
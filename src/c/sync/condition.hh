@@ -40,7 +40,14 @@ public:
   // Wake all threads waiting on this condition.
   fat_bool_t wake_all();
 
+  // Sets the name this condition is reported under by the contention profiler.
+  // The name is not copied so it should typically be a literal.
+  void set_profile_name(const char *name) { profile_name = name; }
+
 private:
+  // Platform-specific waiting, without profiling.
+  fat_bool_t platform_wait(NativeMutex *mutex, Duration timeout);
+
   // Platform-specific initialization.
   fat_bool_t platform_initialize();
 
@@ -0,0 +1,300 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/contention.hh"
+
+#include "io/stream.hh"
+
+BEGIN_C_INCLUDES
+#include "utils/alloc.h"
+#include "utils/check.h"
+END_C_INCLUDES
+
+#include <algorithm>
+#include <vector>
+
+using namespace tclib;
+
+atomic_ptr_t ContentionProfiler::current_;
+
+contention_stats_t::contention_stats_t()
+  : acquisitions(0)
+  , contended(0)
+  , total_wait_nanos(0)
+  , max_wait_nanos(0)
+  , total_hold_nanos(0)
+  , max_hold_nanos(0) { }
+
+void contention_stats_t::merge(const contention_stats_t &that) {
+  acquisitions += that.acquisitions;
+  contended += that.contended;
+  total_wait_nanos += that.total_wait_nanos;
+  if (that.max_wait_nanos > max_wait_nanos)
+    max_wait_nanos = that.max_wait_nanos;
+  total_hold_nanos += that.total_hold_nanos;
+  if (that.max_hold_nanos > max_hold_nanos)
+    max_hold_nanos = that.max_hold_nanos;
+}
+
+ContentionProfiler::ContentionProfiler()
+  : entries_(NULL)
+  , dropped_(atomic_int64_new(0)) { }
+
+ContentionProfiler::~ContentionProfiler() {
+  if (entries_ == NULL)
+    return;
+  allocator_default_free(blob_new(entries_,
+      sizeof(Entry) * kEntryCount * ckCount));
+  entries_ = NULL;
+}
+
+fat_bool_t ContentionProfiler::initialize() {
+  if (entries_ != NULL)
+    return F_TRUE;
+  blob_t memory = allocator_default_malloc(
+      sizeof(Entry) * kEntryCount * ckCount);
+  if (blob_is_empty(memory))
+    return F_FALSE;
+  // All-zero is an empty entry with zero counts.
+  blob_fill(memory, 0);
+  entries_ = static_cast<Entry*>(memory.start);
+  return F_TRUE;
+}
+
+ContentionProfiler *ContentionProfiler::install() {
+  CHECK_TRUE("profiler not initialized", entries_ != NULL);
+  return static_cast<ContentionProfiler*>(atomic_ptr_exchange(&current_, this,
+      moAcqRel));
+}
+
+void ContentionProfiler::uninstall(ContentionProfiler *previous) {
+  CHECK_PTREQ("not current profiler", this, current());
+  atomic_ptr_store(&current_, previous, moRelease);
+}
+
+contention_stats_t ContentionProfiler::Entry::get_stats() {
+  contention_stats_t result;
+  result.acquisitions = atomic_int64_load(&acquisitions, moRelaxed);
+  result.contended = atomic_int64_load(&contended, moRelaxed);
+  result.total_wait_nanos = atomic_int64_load(&total_wait_nanos, moRelaxed);
+  result.max_wait_nanos = atomic_int64_load(&max_wait_nanos, moRelaxed);
+  result.total_hold_nanos = atomic_int64_load(&total_hold_nanos, moRelaxed);
+  result.max_hold_nanos = atomic_int64_load(&max_hold_nanos, moRelaxed);
+  return result;
+}
+
+void ContentionProfiler::Entry::clear() {
+  key = NULL;
+  name = NULL;
+  instance = NULL;
+  atomic_int64_store(&acquisitions, 0, moRelaxed);
+  atomic_int64_store(&contended, 0, moRelaxed);
+  atomic_int64_store(&total_wait_nanos, 0, moRelaxed);
+  atomic_int64_store(&max_wait_nanos, 0, moRelaxed);
+  atomic_int64_store(&total_hold_nanos, 0, moRelaxed);
+  atomic_int64_store(&max_hold_nanos, 0, moRelaxed);
+}
+
+size_t ContentionProfiler::get_home_index(const void *key) {
+  address_arith_t hash = reinterpret_cast<address_arith_t>(key);
+  hash ^= (hash >> 4) ^ (hash >> 12);
+  return static_cast<size_t>(hash % kEntryCount);
+}
+
+ContentionProfiler::Entry *ContentionProfiler::get_entry(
+    contention_kind_t kind, const void *instance, const char *name) {
+  const void *key = (name == NULL) ? instance : name;
+  Entry *entries = entries_ + (kind * kEntryCount);
+  size_t home = get_home_index(key);
+  for (size_t probe = 0; probe < kMaxProbeCount; probe++) {
+    Entry *entry = &entries[(home + probe) % kEntryCount];
+    int32_t state = atomic_int32_load(&entry->state, moAcquire);
+    while (true) {
+      if (state == esEmpty) {
+        if (atomic_int32_compare_exchange(&entry->state, &state, esClaiming,
+            moAcquire)) {
+          entry->key = key;
+          entry->name = name;
+          entry->instance = instance;
+          atomic_int32_store(&entry->state, esReady, moRelease);
+          return entry;
+        }
+      }
+      if (state != esClaiming)
+        break;
+      // Someone else is claiming or forgetting this entry, possibly for the
+      // same key, so wait for them to finish. It's only a few stores.
+      atomic_spin_pause();
+      state = atomic_int32_load(&entry->state, moAcquire);
+    }
+    if (entry->key == key)
+      return entry;
+  }
+  atomic_int64_fetch_add(&dropped_, 1, moRelaxed);
+  return NULL;
+}
+
+void ContentionProfiler::forget(contention_kind_t kind, const void *instance,
+    const char *name) {
+  if (name != NULL)
+    return;
+  Entry *entries = entries_ + (kind * kEntryCount);
+  size_t home = get_home_index(instance);
+  // An entry that's forgotten may be claimed by a key that's already further
+  // along so there can be more than one entry per key. Clear them all.
+  for (size_t probe = 0; probe < kMaxProbeCount; probe++) {
+    Entry *entry = &entries[(home + probe) % kEntryCount];
+    int32_t state = esReady;
+    if (entry->key != instance || !atomic_int32_compare_exchange(&entry->state,
+        &state, esClaiming, moAcquire))
+      continue;
+    if (entry->key == instance) {
+      entry->clear();
+      atomic_int32_store(&entry->state, esEmpty, moRelease);
+    } else {
+      atomic_int32_store(&entry->state, esReady, moRelease);
+    }
+  }
+}
+
+// Raises the given atomic to the given value if it's smaller.
+static void atomic_int64_raise(atomic_int64_t *atomic, int64_t value) {
+  int64_t current = atomic_int64_load(atomic, moRelaxed);
+  while (value > current && !atomic_int64_compare_exchange(atomic, &current,
+      value, moRelaxed))
+    ;
+}
+
+void ContentionProfiler::record_acquire(contention_kind_t kind,
+    const void *instance, const char *name, bool contended,
+    uint64_t wait_nanos) {
+  Entry *entry = get_entry(kind, instance, name);
+  if (entry == NULL)
+    return;
+  atomic_int64_fetch_add(&entry->acquisitions, 1, moRelaxed);
+  if (contended) {
+    int64_t wait = static_cast<int64_t>(wait_nanos);
+    atomic_int64_fetch_add(&entry->contended, 1, moRelaxed);
+    atomic_int64_fetch_add(&entry->total_wait_nanos, wait, moRelaxed);
+    atomic_int64_raise(&entry->max_wait_nanos, wait);
+  }
+}
+
+void ContentionProfiler::record_hold(contention_kind_t kind,
+    const void *instance, const char *name, uint64_t hold_nanos) {
+  Entry *entry = get_entry(kind, instance, name);
+  if (entry == NULL)
+    return;
+  int64_t hold = static_cast<int64_t>(hold_nanos);
+  atomic_int64_fetch_add(&entry->total_hold_nanos, hold, moRelaxed);
+  atomic_int64_raise(&entry->max_hold_nanos, hold);
+}
+
+contention_stats_t ContentionProfiler::get_stats(contention_kind_t kind,
+    const char *name) {
+  contention_stats_t result;
+  Entry *entries = entries_ + (kind * kEntryCount);
+  for (size_t i = 0; i < kEntryCount; i++) {
+    Entry *entry = &entries[i];
+    if (atomic_int32_load(&entry->state, moAcquire) != esReady)
+      continue;
+    if (entry->name != NULL && strcmp(entry->name, name) == 0)
+      result.merge(entry->get_stats());
+  }
+  return result;
+}
+
+const char *ContentionProfiler::kind_name(contention_kind_t kind) {
+  switch (kind) {
+    case ckMutex: return "mutex";
+    case ckCondition: return "condition";
+    case ckSemaphore: return "semaphore";
+    case ckIntex: return "intex";
+    default: return "?";
+  }
+}
+
+namespace {
+
+// A line in the report.
+struct ReportLine {
+  contention_kind_t kind;
+  const char *name;
+  const void *instance;
+  contention_stats_t stats;
+};
+
+// Orders report lines most contended first.
+static bool is_more_contended(const ReportLine &a, const ReportLine &b) {
+  if (a.stats.total_wait_nanos != b.stats.total_wait_nanos)
+    return a.stats.total_wait_nanos > b.stats.total_wait_nanos;
+  return a.stats.contended > b.stats.contended;
+}
+
+} // namespace
+
+// Returns the given number of nanoseconds as whole microseconds in the type
+// printf expects for %llu.
+static unsigned long long to_micros(uint64_t nanos) {
+  return static_cast<unsigned long long>(nanos / 1000);
+}
+
+void ContentionProfiler::write_report(OutStream *out, size_t limit) {
+  std::vector<ReportLine> lines;
+  for (size_t kind = 0; kind < ckCount; kind++) {
+    Entry *entries = entries_ + (kind * kEntryCount);
+    for (size_t i = 0; i < kEntryCount; i++) {
+      Entry *entry = &entries[i];
+      if (atomic_int32_load(&entry->state, moAcquire) != esReady)
+        continue;
+      // Different copies of the same name literal are reported as one, as are
+      // the entries of a primitive that has more than one.
+      bool merged = false;
+      for (size_t j = 0; j < lines.size(); j++) {
+        ReportLine &line = lines[j];
+        if (line.kind != kind)
+          continue;
+        bool is_same = (entry->name == NULL)
+            ? (line.name == NULL && line.instance == entry->instance)
+            : (line.name != NULL && strcmp(line.name, entry->name) == 0);
+        if (is_same) {
+          line.stats.merge(entry->get_stats());
+          merged = true;
+          break;
+        }
+      }
+      if (merged)
+        continue;
+      ReportLine line;
+      line.kind = static_cast<contention_kind_t>(kind);
+      line.name = entry->name;
+      line.instance = entry->instance;
+      line.stats = entry->get_stats();
+      lines.push_back(line);
+    }
+  }
+  std::stable_sort(lines.begin(), lines.end(), is_more_contended);
+  if (limit > 0 && lines.size() > limit)
+    lines.resize(limit);
+  out->printf("%14s %12s %10s %10s %14s %12s  %s\n", "wait-us", "max-wait-us",
+      "contended", "acquired", "hold-us", "max-hold-us", "primitive");
+  for (size_t i = 0; i < lines.size(); i++) {
+    ReportLine &line = lines[i];
+    contention_stats_t &stats = line.stats;
+    out->printf("%14llu %12llu %10llu %10llu %14llu %12llu  %s ",
+        to_micros(stats.total_wait_nanos), to_micros(stats.max_wait_nanos),
+        static_cast<unsigned long long>(stats.contended),
+        static_cast<unsigned long long>(stats.acquisitions),
+        to_micros(stats.total_hold_nanos), to_micros(stats.max_hold_nanos),
+        kind_name(line.kind));
+    if (line.name == NULL) {
+      out->printf("%p\n", line.instance);
+    } else {
+      out->printf("%s\n", line.name);
+    }
+  }
+  uint64_t dropped = dropped_count();
+  if (dropped > 0)
+    out->printf("%llu records dropped, the table was full\n",
+        static_cast<unsigned long long>(dropped));
+}
@@ -0,0 +1,183 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_CONTENTION_HH
+#define _TCLIB_CONTENTION_HH
+
+#include "c/stdc.h"
+
+#include "utils/fatbool.hh"
+
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "sync/atomic.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+class OutStream;
+
+// The kinds of synchronization primitives the contention profiler knows about.
+enum contention_kind_t {
+  ckMutex,
+  ckCondition,
+  ckSemaphore,
+  ckIntex,
+  ckCount
+};
+
+// Statistics about how one primitive, or all the primitives with the same
+// profile name, have been used.
+struct contention_stats_t {
+  contention_stats_t();
+
+  // Adds the given stats to these ones.
+  void merge(const contention_stats_t &that);
+
+  // How many times the primitive was acquired or waited on.
+  uint64_t acquisitions;
+  // How many of those had to wait because the primitive wasn't available.
+  uint64_t contended;
+  // Total and longest time spent waiting, in nanoseconds.
+  uint64_t total_wait_nanos;
+  uint64_t max_wait_nanos;
+  // Total and longest time the primitive was held, in nanoseconds. Only
+  // mutexes have a meaningful hold time.
+  uint64_t total_hold_nanos;
+  uint64_t max_hold_nanos;
+};
+
+// Records how contended mutexes, conditions, semaphores and intexes are. While
+// no profiler is installed the primitives only pay for checking that, while
+// one is installed every acquisition and release is timed and recorded.
+//
+// Primitives are tracked individually unless they've been given a profile
+// name, in which case all the primitives with the same name are reported
+// together. That way, for instance, the waiter conditions of all intexes show
+// up as one entry rather than thousands.
+//
+// Recording never takes a lock, otherwise the profiler would serialize the
+// very operations it is measuring. Entries live in a fixed size table where
+// they're claimed with a compare-and-swap and their counters are updated
+// atomically. A primitive is only looked for in the few entries after the one
+// its key hashes to; if those are all taken its records are counted as dropped
+// rather than searching the whole table on every acquisition.
+//
+// Unnamed primitives forget their entry when they're destroyed, otherwise a
+// new primitive at the same address would inherit their statistics, so they
+// only show up in reports while they're alive.
+class ContentionProfiler {
+public:
+  ContentionProfiler();
+  ~ContentionProfiler();
+
+  // Initializes the state of this profiler, returning true if initialization
+  // succeeded.
+  fat_bool_t initialize();
+
+  // Installs this profiler such that all primitives will report to it. Returns
+  // the profiler that was installed before.
+  ContentionProfiler *install();
+
+  // Uninstalls this profiler, which must be the current one, and restores the
+  // given previous profiler. Primitives that are in the middle of reporting may
+  // still be using this profiler for a short while after so it should only be
+  // destroyed once the threads using them are quiet.
+  void uninstall(ContentionProfiler *previous);
+
+  // Returns the profiler currently installed, NULL if there is none.
+  static ContentionProfiler *current() {
+    return static_cast<ContentionProfiler*>(atomic_ptr_load(&current_,
+        moAcquire));
+  }
+
+  // Records that the given primitive was acquired or waited on. If it was
+  // contended the time spent waiting is also recorded.
+  void record_acquire(contention_kind_t kind, const void *instance,
+      const char *name, bool contended, uint64_t wait_nanos);
+
+  // Records that the given primitive was held for the given duration.
+  void record_hold(contention_kind_t kind, const void *instance,
+      const char *name, uint64_t hold_nanos);
+
+  // Forgets what has been recorded for the given primitive, which is being
+  // destroyed. Named primitives share their entry so they're left alone.
+  void forget(contention_kind_t kind, const void *instance, const char *name);
+
+  // Writes a report of the recorded statistics to the given stream ranked by
+  // total wait time, most contended first. If the limit is nonzero at most that
+  // many entries are written.
+  void write_report(OutStream *out, size_t limit = 0);
+
+  // Returns the combined statistics for all primitives of the given kind with
+  // the given profile name.
+  contention_stats_t get_stats(contention_kind_t kind, const char *name);
+
+  // Returns the number of records that were dropped because the table was
+  // full.
+  uint64_t dropped_count() {
+    return static_cast<uint64_t>(atomic_int64_load(&dropped_, moRelaxed));
+  }
+
+  // Returns the display name of the given kind.
+  static const char *kind_name(contention_kind_t kind);
+
+  // How many distinct primitives or profile names of each kind can be tracked.
+  static const size_t kEntryCount = 512;
+
+  // How many entries, starting from the one a key hashes to, are tried before
+  // giving up.
+  static const size_t kMaxProbeCount = 16;
+
+private:
+  // The states an entry goes through. While it's ready its key, name and
+  // instance don't change; forgetting an entry takes it back through claiming
+  // to empty.
+  enum entry_state_t {
+    esEmpty,
+    esClaiming,
+    esReady
+  };
+
+  // An entry for a single primitive or profile name.
+  struct Entry {
+    atomic_int32_t state;
+    // The address of the profile name, if there is one, otherwise the address
+    // of the instance. Names are merged by value when reporting.
+    const void *key;
+    const char *name;
+    const void *instance;
+    atomic_int64_t acquisitions;
+    atomic_int64_t contended;
+    atomic_int64_t total_wait_nanos;
+    atomic_int64_t max_wait_nanos;
+    atomic_int64_t total_hold_nanos;
+    atomic_int64_t max_hold_nanos;
+
+    // Returns a snapshot of this entry's statistics.
+    contention_stats_t get_stats();
+
+    // Clears this entry's key and statistics.
+    void clear();
+  };
+
+  // Returns the entry to record the given primitive's data in, claiming one if
+  // necessary, or NULL if there's no room for it.
+  Entry *get_entry(contention_kind_t kind, const void *instance,
+      const char *name);
+
+  // Returns the index of the first entry to try for the given key.
+  static size_t get_home_index(const void *key);
+
+  // The entries for all kinds, kEntryCount for each.
+  Entry *entries_;
+  atomic_int64_t dropped_;
+
+  // The profiler primitives should currently report to.
+  static atomic_ptr_t current_;
+};
+
+} // namespace tclib
+
+#endif // _TCLIB_CONTENTION_HH
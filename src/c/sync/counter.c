@@ -0,0 +1,59 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/atomic-inl.h"
+#include "sync/counter.h"
+#include "utils/blob.h"
+#include "utils/check.h"
+
+// Which stripe does the current thread use, plus 1 so the zero-initialized
+// value means that none has been assigned yet.
+static IF_MSVC(__declspec(thread), __thread) int32_t current_stripe_plus_one;
+
+// The index of the stripe to assign to the next thread.
+static atomic_int32_t next_stripe;
+
+// Returns the index of the stripe the current thread should use. Threads are
+// assigned stripes round-robin the first time they ask so as long as there
+// are fewer threads than stripes each gets one to itself.
+static int32_t get_current_stripe() {
+  int32_t plus_one = current_stripe_plus_one;
+  if (plus_one == 0) {
+    int32_t index = atomic_int32_fetch_add(&next_stripe, 1, moRelaxed);
+    plus_one = (index & (kStripedCounterStripes - 1)) + 1;
+    current_stripe_plus_one = plus_one;
+  }
+  return plus_one - 1;
+}
+
+void striped_counter_initialize(striped_counter_t *counter, int64_t batch) {
+  CHECK_REL("invalid batch size", batch, >=, 1);
+  struct_zero_fill(*counter);
+  counter->batch = batch;
+}
+
+void striped_counter_add(striped_counter_t *counter, int64_t delta) {
+  atomic_int64_t *cell = &counter->cells[get_current_stripe()].value;
+  int64_t local = atomic_int64_fetch_add(cell, delta, moRelaxed) + delta;
+  if (local >= counter->batch || local <= -counter->batch) {
+    // Another thread may have bumped the cell too in the meantime so fold
+    // whatever is actually there rather than what we think it is.
+    int64_t folded = atomic_int64_exchange(cell, 0, moRelaxed);
+    atomic_int64_fetch_add(&counter->total.value, folded, moRelaxed);
+  }
+}
+
+int64_t striped_counter_get(striped_counter_t *counter) {
+  int64_t result = atomic_int64_load(&counter->total.value, moRelaxed);
+  for (size_t i = 0; i < kStripedCounterStripes; i++)
+    result += atomic_int64_load(&counter->cells[i].value, moRelaxed);
+  return result;
+}
+
+int64_t striped_counter_get_approx(striped_counter_t *counter) {
+  return atomic_int64_load(&counter->total.value, moRelaxed);
+}
+
+int64_t striped_counter_slack(striped_counter_t *counter) {
+  return kStripedCounterStripes * (counter->batch - 1);
+}
@@ -0,0 +1,59 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_COUNTER_H
+#define _TCLIB_COUNTER_H
+
+#include "c/stdc.h"
+#include "sync/atomic.h"
+
+// The number of stripes in a striped counter. Must be a power of 2.
+#define kStripedCounterStripes 16
+
+// A single stripe of a striped counter, padded so no two stripes share a
+// cache line.
+typedef struct {
+  IF_MSVC(__declspec(align(kCacheLineSize)), )
+  atomic_int64_t value
+  IF_GCC(__attribute__((aligned(kCacheLineSize))), );
+} striped_counter_cell_t;
+
+// A 64-bit counter that can be updated concurrently by many threads without
+// them all contending for the same cache line. Each thread adds to its own
+// stripe and once a stripe has drifted more than the batch size away from 0
+// it is folded into the shared total. Writes to the total are rare so reading
+// the approximate value is cheap; getting the exact value means summing all
+// the stripes. Clearing a striped counter to zeroes and setting the batch
+// size is a valid way to initialize it.
+typedef struct {
+  // The folded total.
+  striped_counter_cell_t total;
+  // The per-thread stripes.
+  striped_counter_cell_t cells[kStripedCounterStripes];
+  // How far each stripe can drift before it gets folded into the total.
+  int64_t batch;
+} striped_counter_t;
+
+// Initializes a striped counter to 0 with the given batch size, which must be
+// at least 1. A batch size of 1 folds every change immediately, which makes the
+// approximate value exact but means all threads contend for the total.
+void striped_counter_initialize(striped_counter_t *counter, int64_t batch);
+
+// Adds the given delta to the given counter.
+void striped_counter_add(striped_counter_t *counter, int64_t delta);
+
+// Returns the value of the given counter. This has to look at every stripe so
+// it's relatively expensive. The result is only exact if there are no updates
+// happening concurrently.
+int64_t striped_counter_get(striped_counter_t *counter);
+
+// Returns an approximation of the value of the given counter. This is cheap.
+// When no updates are in progress it is within striped_counter_slack of the
+// exact value; while they are the error can be larger by the size of the
+// in-flight updates.
+int64_t striped_counter_get_approx(striped_counter_t *counter);
+
+// Returns the most the approximate value of the given counter can be off by.
+int64_t striped_counter_slack(striped_counter_t *counter);
+
+#endif // _TCLIB_COUNTER_H
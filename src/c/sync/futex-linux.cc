@@ -0,0 +1,51 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+fat_bool_t NativeFutex::wait(atomic_int32_t *word, int32_t expected,
+    Duration timeout) {
+  if (timeout.is_instant())
+    return F_BOOL(atomic_int32_load(word, moAcquire) != expected);
+  return wait_until(word, expected, deadline_after(timeout));
+}
+
+fat_bool_t NativeFutex::wait_until(atomic_int32_t *word, int32_t expected,
+    uint64_t deadline) {
+  struct timespec spec;
+  struct timespec *spec_ptr = NULL;
+  if (deadline != kNoDeadline) {
+    // Deadlines are on the monotonic clock which is what FUTEX_WAIT_BITSET
+    // measures absolute timeouts against.
+    spec.tv_sec = static_cast<time_t>(deadline / 1000000000ULL);
+    spec.tv_nsec = static_cast<long>(deadline % 1000000000ULL);
+    spec_ptr = &spec;
+  }
+  // Unlike plain FUTEX_WAIT, FUTEX_WAIT_BITSET takes an absolute timeout.
+  long result = syscall(SYS_futex, &word->value,
+      FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, expected, spec_ptr, NULL,
+      FUTEX_BITSET_MATCH_ANY);
+  if (result == 0 || errno == EAGAIN || errno == EINTR)
+    return F_TRUE;
+  if (errno != ETIMEDOUT)
+    WARN("Call to futex_wait failed: %s", strerror(errno));
+  return F_FALSE;
+}
+
+fat_bool_t NativeFutex::wake(atomic_int32_t *word, int32_t count) {
+  long result = syscall(SYS_futex, &word->value,
+      FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+  if (result >= 0)
+    return F_TRUE;
+  WARN("Call to futex_wake failed: %s", strerror(errno));
+  return F_FALSE;
+}
+
+fat_bool_t NativeFutex::wake_all(atomic_int32_t *word) {
+  return wake(word, INT_MAX);
+}
@@ -0,0 +1,31 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "c/winhdr.h"
+
+#pragma comment(lib, "synchronization.lib")
+
+fat_bool_t NativeFutex::wait(atomic_int32_t *word, int32_t expected,
+    Duration timeout) {
+  if (WaitOnAddress(&word->value, &expected, sizeof(int32_t),
+      timeout.to_winapi_millis()))
+    return F_TRUE;
+  dword_t error = GetLastError();
+  if (error != ERROR_TIMEOUT)
+    WARN("Call to WaitOnAddress failed: %i", error);
+  return F_FALSE;
+}
+
+fat_bool_t NativeFutex::wake(atomic_int32_t *word, int32_t count) {
+  if (count == 1) {
+    WakeByAddressSingle(&word->value);
+  } else {
+    WakeByAddressAll(&word->value);
+  }
+  return F_TRUE;
+}
+
+fat_bool_t NativeFutex::wake_all(atomic_int32_t *word) {
+  WakeByAddressAll(&word->value);
+  return F_TRUE;
+}
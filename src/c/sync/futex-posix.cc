@@ -0,0 +1,80 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "utils/clock.hh"
+
+// How many buckets waiters are spread over. Words that hash to the same bucket
+// share a condition so waking one word may spuriously wake waiters on another.
+#define kFutexBucketCount 64
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} futex_bucket_t;
+
+static futex_bucket_t futex_buckets[kFutexBucketCount];
+static pthread_once_t futex_buckets_once = PTHREAD_ONCE_INIT;
+
+static void futex_init_buckets() {
+  for (size_t i = 0; i < kFutexBucketCount; i++) {
+    pthread_mutex_init(&futex_buckets[i].mutex, NULL);
+    pthread_cond_init(&futex_buckets[i].cond, NULL);
+  }
+}
+
+// Returns the bucket that waiters on the given word park in.
+static futex_bucket_t *futex_get_bucket(atomic_int32_t *word) {
+  pthread_once(&futex_buckets_once, futex_init_buckets);
+  address_arith_t addr = reinterpret_cast<address_arith_t>(word);
+  // The low bits are mostly alignment so mix in the higher ones.
+  return &futex_buckets[((addr >> 4) ^ (addr >> 12)) % kFutexBucketCount];
+}
+
+fat_bool_t NativeFutex::wait(atomic_int32_t *word, int32_t expected,
+    Duration timeout) {
+  if (timeout.is_instant())
+    return F_BOOL(atomic_int32_load(word, moAcquire) != expected);
+  NativeTime deadline = NativeTime::zero();
+  if (!timeout.is_unlimited())
+    deadline = RealTimeClock::system()->time_since_epoch_utc() + timeout;
+  futex_bucket_t *bucket = futex_get_bucket(word);
+  pthread_mutex_lock(&bucket->mutex);
+  // Wakers change the word before taking the bucket's mutex so if it still
+  // holds the expected value while we hold the mutex any wakeup comes after we
+  // start waiting.
+  int result = 0;
+  if (atomic_int32_load(word, moAcquire) == expected) {
+    result = timeout.is_unlimited()
+        ? pthread_cond_wait(&bucket->cond, &bucket->mutex)
+        : pthread_cond_timedwait(&bucket->cond, &bucket->mutex,
+            &deadline.to_platform());
+  }
+  pthread_mutex_unlock(&bucket->mutex);
+  if (result == 0)
+    return F_TRUE;
+  if (result != ETIMEDOUT)
+    WARN("Call to pthread_cond_wait failed: %i (error: %s)", result,
+        strerror(result));
+  return F_FALSE;
+}
+
+fat_bool_t NativeFutex::wake(atomic_int32_t *word, int32_t count) {
+  // Waiters on different words share the bucket's condition so there's no
+  // telling which of them a signal would reach.
+  return wake_all(word);
+}
+
+fat_bool_t NativeFutex::wake_all(atomic_int32_t *word) {
+  futex_bucket_t *bucket = futex_get_bucket(word);
+  pthread_mutex_lock(&bucket->mutex);
+  int result = pthread_cond_broadcast(&bucket->cond);
+  pthread_mutex_unlock(&bucket->mutex);
+  if (result == 0)
+    return F_TRUE;
+  WARN("Call to pthread_cond_broadcast failed: %i (error: %s)", result,
+      strerror(result));
+  return F_FALSE;
+}
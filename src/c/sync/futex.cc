@@ -0,0 +1,46 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/futex.hh"
+
+#include "utils/clock.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "utils/clock.h"
+#include "utils/log.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+#ifdef IS_GCC
+#  if defined(IS_LINUX)
+#    include "futex-linux.cc"
+#  else
+#    include "futex-posix.cc"
+#  endif
+#endif
+
+#ifdef IS_MSVC
+#  include "futex-msvc.cc"
+#endif
+
+uint64_t NativeFutex::deadline_after(Duration timeout) {
+  if (timeout.is_unlimited())
+    return kNoDeadline;
+  return monotonic_clock_nanos() + timeout.to_millis() * 1000000ULL;
+}
+
+#ifndef IS_LINUX
+fat_bool_t NativeFutex::wait_until(atomic_int32_t *word, int32_t expected,
+    uint64_t deadline) {
+  if (deadline == kNoDeadline)
+    return wait(word, expected);
+  uint64_t now = monotonic_clock_nanos();
+  if (now >= deadline)
+    return F_BOOL(atomic_int32_load(word, moAcquire) != expected);
+  // Round up, waking just before the deadline would only mean waiting again.
+  uint64_t millis = (deadline - now + 999999) / 1000000;
+  return wait(word, expected, Duration::millis(millis));
+}
+#endif
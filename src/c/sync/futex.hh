@@ -0,0 +1,62 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_FUTEX_HH
+#define _TCLIB_FUTEX_HH
+
+#include "c/stdc.h"
+
+#include "utils/duration.hh"
+#include "utils/fatbool.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+// Blocking on the value of an atomic word. This is what to use when a word
+// already tells whether a thread should wait; rather than pairing it with a
+// mutex and condition, waiters block on the word itself and whoever changes
+// it wakes them. Neither needs any state beyond the word and changing it
+// while nobody waits costs nothing extra.
+//
+// On linux this is a futex, on windows WaitOnAddress. Elsewhere waiters park
+// on one of a fixed set of mutex/condition pairs chosen by hashing the address
+// of the word.
+class NativeFutex {
+public:
+  // If the given word holds the expected value blocks until another thread
+  // wakes waiters on it or the timeout elapses. Returns true if woken or the
+  // value was already different, false on timeout. Wakeups can be spurious so
+  // callers must check the word again.
+  static fat_bool_t wait(atomic_int32_t *word, int32_t expected,
+      Duration timeout = Duration::unlimited());
+
+  // Like wait but until the given deadline, as returned by deadline_after.
+  // Callers that wait in a loop should use this so that wakeups that don't
+  // concern them don't keep pushing the deadline out.
+  static fat_bool_t wait_until(atomic_int32_t *word, int32_t expected,
+      uint64_t deadline);
+
+  // Returns the deadline the given timeout from now. An unlimited timeout
+  // gives kNoDeadline.
+  static uint64_t deadline_after(Duration timeout);
+
+  // Wakes at least the given number of threads waiting on the given word, or
+  // all of them if there are fewer. Some platforms may wake more. Must be
+  // called after the word has been changed.
+  static fat_bool_t wake(atomic_int32_t *word, int32_t count);
+
+  // Wakes all threads waiting on the given word. Must be called after the
+  // word has been changed.
+  static fat_bool_t wake_all(atomic_int32_t *word);
+
+  // The deadline that never passes. Deadlines are in nanoseconds on the
+  // monotonic clock.
+  static const uint64_t kNoDeadline = ~static_cast<uint64_t>(0);
+};
+
+} // namespace tclib
+
+#endif // _TCLIB_FUTEX_HH
@@ -3,7 +3,10 @@
 
 #include "sync/intex.hh"
 
+#include "utils/alloc.hh"
+
 BEGIN_C_INCLUDES
+#include "utils/check.h"
 #include "utils/log.h"
 END_C_INCLUDES
 
@@ -14,13 +17,14 @@ using namespace tclib;
 Intex::Intex(uint64_t init_value) {
   value_ = init_value;
   new (guard()) NativeMutex();
-  new (cond()) NativeCondition();
+  waiters_ = NULL;
+  spare_waiters_ = NULL;
+  profile_name_ = NULL;
   is_initialized_ = false;
 }
 
 fat_bool_t Intex::initialize() {
   F_TRY(guard()->initialize());
-  F_TRY(cond()->initialize());
   is_initialized_ = true;
   return F_TRUE;
 }
@@ -28,13 +32,28 @@ fat_bool_t Intex::initialize() {
 Intex::~Intex() {
   if (!is_initialized_)
     return;
+  CHECK_TRUE("disposing intex with waiters", waiters_ == NULL);
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler != NULL)
+    profiler->forget(ckIntex, this, profile_name_);
+  while (spare_waiters_ != NULL) {
+    intex_waiter_t *waiter = spare_waiters_;
+    spare_waiters_ = waiter->next;
+    default_delete_concrete(waiter);
+  }
   guard()->~NativeMutex();
-  cond()->~NativeCondition();
 }
 
 fat_bool_t Intex::set(uint64_t value) {
   value_ = value;
-  return cond()->wake_all();
+  // Only wake the waiters that can be released by the new value; the rest
+  // would just wake up, take the lock, and go back to sleep. Each waiter is a
+  // single thread so waking one is enough.
+  for (intex_waiter_t *waiter = waiters_; waiter != NULL; waiter = waiter->next) {
+    if (waiter->accepts(value))
+      F_TRY(waiter->cond.wake_one());
+  }
+  return F_TRUE;
 }
 
 fat_bool_t Intex::add(int64_t value) {
@@ -49,6 +68,70 @@ fat_bool_t Intex::unlock() {
   return guard()->unlock();
 }
 
+void Intex::set_profile_name(const char *name) {
+  profile_name_ = name;
+  guard()->set_profile_name(name);
+}
+
+size_t Intex::waiter_count() {
+  size_t result = 0;
+  for (intex_waiter_t *waiter = waiters_; waiter != NULL; waiter = waiter->next)
+    result++;
+  return result;
+}
+
+void Intex::add_waiter(intex_waiter_t *waiter) {
+  waiter->prev = NULL;
+  waiter->next = waiters_;
+  if (waiters_ != NULL)
+    waiters_->prev = waiter;
+  waiters_ = waiter;
+}
+
+void Intex::remove_waiter(intex_waiter_t *waiter) {
+  if (waiter->prev == NULL) {
+    waiters_ = waiter->next;
+  } else {
+    waiter->prev->next = waiter->next;
+  }
+  if (waiter->next != NULL)
+    waiter->next->prev = waiter->prev;
+  waiter->prev = waiter->next = NULL;
+}
+
+fat_bool_t Intex::take_waiter(intex_waiter_t::predicate_t predicate,
+    uint64_t target, intex_waiter_t **waiter_out) {
+  intex_waiter_t *waiter = spare_waiters_;
+  if (waiter == NULL) {
+    intex_waiter_t *memory = allocator_default_malloc_struct(intex_waiter_t);
+    if (memory == NULL)
+      return F_FALSE;
+    waiter = new (memory) intex_waiter_t(predicate, target);
+    fat_bool_t initialized = waiter->cond.initialize();
+    if (!initialized) {
+      default_delete_concrete(waiter);
+      return initialized;
+    }
+  } else {
+    spare_waiters_ = waiter->next;
+    waiter->predicate = predicate;
+    waiter->target = target;
+    waiter->next = NULL;
+  }
+  // The waiters' conditions are shared by whoever happens to wait so reporting
+  // them individually would be meaningless.
+  waiter->cond.set_profile_name(profile_name_ == NULL
+      ? "intex waiter"
+      : profile_name_);
+  *waiter_out = waiter;
+  return F_TRUE;
+}
+
+void Intex::spare_waiter(intex_waiter_t *waiter) {
+  waiter->next = spare_waiters_;
+  spare_waiters_ = waiter;
+}
+
 void intex_construct(intex_t *intex, uint64_t init_value) {
   new (intex) Intex(init_value);
 }
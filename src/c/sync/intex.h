@@ -5,10 +5,14 @@
 #define _TCLIB_INTEX_H
 
 #include "c/stdc.h"
-#include "sync/condition.h"
 #include "sync/mutex.h"
 #include "sync/sync.h"
 
+// A thread blocked waiting for an intex to reach a particular value. Waiters
+// belong to the intex, which keeps the ones no thread is using so their
+// conditions can be used again by later waits.
+typedef struct intex_waiter_t intex_waiter_t;
+
 // An intex is like a mutex except that in addition to the standard lock and
 // unlock behavior it can also be locked conditionally on an integer value. So
 // a thread will not only wait for the lock to become available but for the
@@ -16,8 +20,16 @@
 typedef struct {
   bool is_initialized_;
   native_mutex_t guard_;
-  native_condition_t cond_;
+  // The threads currently blocked waiting for the value to change. Guarded by
+  // guard_.
+  intex_waiter_t *waiters_;
+  // Waiters no thread is currently using, with their conditions still
+  // initialized. Guarded by guard_.
+  intex_waiter_t *spare_waiters_;
   volatile uint64_t value_;
+  // The name this intex is reported under by the contention profiler. If it's
+  // NULL the intex is reported individually.
+  const char *profile_name_;
 } intex_t;
 
 // Constructs the given intex with the given initial value.
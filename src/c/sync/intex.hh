@@ -7,12 +7,37 @@
 #include "c/stdc.h"
 
 #include "sync/condition.hh"
+#include "sync/contention.hh"
 #include "sync/mutex.hh"
 
 BEGIN_C_INCLUDES
 #include "sync/intex.h"
+#include "utils/clock.h"
 END_C_INCLUDES
 
+// A thread blocked in Intex::lock_when, keyed by the predicate it is waiting
+// to become true and the target value it is comparing against. Each waiter has
+// its own condition so that changing the value only wakes the threads whose
+// predicate has become true, not every thread blocked on the intex.
+struct intex_waiter_t {
+  typedef bool (*predicate_t)(uint64_t value, uint64_t target);
+
+  intex_waiter_t(predicate_t predicate, uint64_t target)
+    : predicate(predicate)
+    , target(target)
+    , prev(NULL)
+    , next(NULL) { }
+
+  // Returns true iff this waiter would be released by the given value.
+  bool accepts(uint64_t value) { return (predicate)(value, target); }
+
+  predicate_t predicate;
+  uint64_t target;
+  tclib::NativeCondition cond;
+  intex_waiter_t *prev;
+  intex_waiter_t *next;
+};
+
 namespace tclib {
 
 class Intex;
@@ -54,6 +79,16 @@ public:
   // Releases this intex which must already be held.
   fat_bool_t unlock();
 
+  // Returns the number of threads currently blocked waiting for this intex to
+  // reach a value. The intex must be held by the calling thread. This is
+  // visible for testing, you typically don't want to use it for anything else.
+  size_t waiter_count();
+
+  // Sets the name this intex, and the mutex that guards it, is reported under
+  // by the contention profiler. The name is not copied so it should typically
+  // be a literal.
+  void set_profile_name(const char *name);
+
 private:
   // Classes that implement the different operators so they can be passed as
   // template parameters to lock_cond by the dispatcher.
@@ -71,7 +106,22 @@ private:
 
   NativeMutex *guard() { return static_cast<NativeMutex*>(&guard_); }
 
-  NativeCondition *cond() { return static_cast<NativeCondition*>(&cond_); }
+  // Links the given waiter into the set that will be considered when the value
+  // changes. The intex must be held.
+  void add_waiter(intex_waiter_t *waiter);
+
+  // Unlinks a waiter previously added with add_waiter. The intex must be held.
+  void remove_waiter(intex_waiter_t *waiter);
+
+  // Stores a waiter for the given predicate and target in the given out
+  // parameter, reusing a spare one if there is one so its condition doesn't
+  // have to be created again. The intex must be held.
+  fat_bool_t take_waiter(intex_waiter_t::predicate_t predicate,
+      uint64_t target, intex_waiter_t **waiter_out);
+
+  // Returns a waiter from take_waiter to the spares once its thread is done
+  // waiting. The intex must be held.
+  void spare_waiter(intex_waiter_t *waiter);
 
   class Dispatcher {
   public:
@@ -119,16 +169,38 @@ public:
 template <typename C>
 fat_bool_t Intex::lock_cond(Duration timeout, uint64_t target) {
   F_TRY(guard()->lock(timeout));
-  // We now have to lock, now spin around waiting for the value to become what
-  // we're waiting for.
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  // If the value is already what we're waiting for there's no need to register
+  // as a waiter.
+  if (C::eval(value_, target)) {
+    if (profiler != NULL)
+      profiler->record_acquire(ckIntex, this, profile_name_, false, 0);
+    return F_TRUE;
+  }
+  uint64_t start = (profiler == NULL) ? 0 : monotonic_clock_nanos();
+  intex_waiter_t *waiter = NULL;
+  fat_bool_t result = take_waiter(C::eval, target, &waiter);
+  if (!result) {
+    guard()->unlock();
+    return result;
+  }
+  // We now have the lock, register so set will wake us once the value becomes
+  // what we're waiting for and spin around until it does.
+  add_waiter(waiter);
   while (!C::eval(value_, target)) {
-    fat_bool_t waited = cond()->wait(guard(), timeout);
-    if (!waited) {
-      guard()->unlock();
-      return waited;
-    }
+    result = waiter->cond.wait(guard(), timeout);
+    if (!result)
+      break;
+  }
+  remove_waiter(waiter);
+  spare_waiter(waiter);
+  if (profiler != NULL) {
+    uint64_t waited = monotonic_clock_nanos() - start;
+    profiler->record_acquire(ckIntex, this, profile_name_, true, waited);
   }
-  return F_TRUE;
+  if (!result)
+    guard()->unlock();
+  return result;
 }
 
 // A drawbridge is a simple wrapper around an intex. It allows threads to be
@@ -13,7 +13,7 @@ fat_bool_t NativeMutex::platform_dispose() {
   return F_TRUE;
 }
 
-fat_bool_t NativeMutex::lock(Duration timeout) {
+fat_bool_t NativeMutex::platform_lock(Duration timeout) {
   CRITICAL_SECTION *mutex = get_platform_mutex(this);
   if (timeout.is_unlimited()) {
     EnterCriticalSection(mutex);
@@ -26,7 +26,7 @@ fat_bool_t NativeMutex::lock(Duration timeout) {
   }
 }
 
-fat_bool_t NativeMutex::unlock() {
+fat_bool_t NativeMutex::platform_unlock() {
   LeaveCriticalSection(get_platform_mutex(this));
   return F_TRUE;
 }
@@ -23,7 +23,7 @@ fat_bool_t NativeMutex::platform_dispose() {
   return F_FALSE;
 }
 
-fat_bool_t NativeMutex::lock(Duration timeout) {
+fat_bool_t NativeMutex::platform_lock(Duration timeout) {
   int result;
   if (timeout.is_unlimited()) {
     result = pthread_mutex_lock(&mutex);
@@ -42,7 +42,7 @@ fat_bool_t NativeMutex::lock(Duration timeout) {
   return F_FALSE;
 }
 
-fat_bool_t NativeMutex::unlock() {
+fat_bool_t NativeMutex::platform_unlock() {
   int result = pthread_mutex_unlock(&mutex);
   if (result == 0)
     return F_TRUE;
@@ -3,9 +3,12 @@
 
 #include "sync/mutex.hh"
 
+#include "sync/contention.hh"
+
 BEGIN_C_INCLUDES
 #include "sync/mutex.h"
 #include "utils/alloc.h"
+#include "utils/clock.h"
 #include "utils/log.h"
 END_C_INCLUDES
 
@@ -23,6 +26,7 @@ using namespace tclib;
 
 NativeMutex::NativeMutex() {
   is_initialized = false;
+  profile_name = NULL;
 #if defined(kPlatformMutexInit)
   platform_mutex_t init = kPlatformMutexInit;
   mutex = init;
@@ -33,6 +37,9 @@ NativeMutex::~NativeMutex() {
   if (!is_initialized)
     return;
   is_initialized = false;
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler != NULL)
+    profiler->forget(ckMutex, this, profile_name);
   platform_dispose();
   struct_zero_fill(*this);
 }
@@ -45,6 +52,113 @@ fat_bool_t NativeMutex::initialize() {
   return F_TRUE;
 }
 
+// A profiled mutex held by the current thread, with how many times it's been
+// locked recursively and when it was first acquired.
+struct held_mutex_t {
+  NativeMutex *mutex;
+  uint32_t depth;
+  uint64_t locked_at;
+};
+
+// How many profiled mutexes a thread can hold at once before further ones
+// are no longer timed.
+#define kMaxHeldMutexCount 16
+
+// Hold times are tracked per thread, not in the mutexes, so mutexes don't get
+// any bigger and only the holder ever touches the bookkeeping. While no
+// profiler is installed nothing is added here so there is nothing to do.
+static IF_MSVC(__declspec(thread), __thread) held_mutex_t
+    held_mutexes[kMaxHeldMutexCount];
+static IF_MSVC(__declspec(thread), __thread) size_t held_mutex_count;
+
+// Returns the current thread's record of the given mutex, NULL if there is
+// none.
+static held_mutex_t *find_held_mutex(NativeMutex *mutex) {
+  for (size_t i = 0; i < held_mutex_count; i++) {
+    if (held_mutexes[i].mutex == mutex)
+      return &held_mutexes[i];
+  }
+  return NULL;
+}
+
+// Forgets the given record.
+static void remove_held_mutex(held_mutex_t *held) {
+  *held = held_mutexes[--held_mutex_count];
+}
+
+// Records the time the given mutex was held, now that it has been released.
+static void record_held_mutex(NativeMutex *mutex, uint64_t locked_at) {
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler == NULL)
+    return;
+  uint64_t held = monotonic_clock_nanos() - locked_at;
+  profiler->record_hold(ckMutex, mutex, mutex->profile_name, held);
+}
+
+fat_bool_t NativeMutex::lock(Duration timeout) {
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler == NULL)
+    return platform_lock(timeout);
+  // Try without blocking first so we can tell whether there was contention.
+  fat_bool_t result = platform_lock(Duration::instant());
+  bool contended = !result;
+  uint64_t waited = 0;
+  if (contended && !timeout.is_instant()) {
+    uint64_t start = monotonic_clock_nanos();
+    result = platform_lock(timeout);
+    waited = monotonic_clock_nanos() - start;
+  }
+  if (result) {
+    held_mutex_t *held = find_held_mutex(this);
+    if (held != NULL) {
+      held->depth++;
+    } else if (held_mutex_count < kMaxHeldMutexCount) {
+      held = &held_mutexes[held_mutex_count++];
+      held->mutex = this;
+      held->depth = 1;
+      held->locked_at = monotonic_clock_nanos();
+    }
+  }
+  profiler->record_acquire(ckMutex, this, profile_name, contended, waited);
+  return result;
+}
+
+fat_bool_t NativeMutex::unlock() {
+  F_TRY(platform_unlock());
+  // Only the holder touches its own records so this is safe after letting go
+  // of the mutex. The count check keeps the unprofiled case cheap.
+  if (held_mutex_count == 0)
+    return F_TRUE;
+  held_mutex_t *held = find_held_mutex(this);
+  if (held == NULL || --held->depth > 0)
+    return F_TRUE;
+  uint64_t locked_at = held->locked_at;
+  remove_held_mutex(held);
+  record_held_mutex(this, locked_at);
+  return F_TRUE;
+}
+
+uint32_t NativeMutex::enter_wait() {
+  held_mutex_t *held = (held_mutex_count == 0) ? NULL : find_held_mutex(this);
+  if (held == NULL)
+    return 0;
+  uint32_t depth = held->depth;
+  uint64_t locked_at = held->locked_at;
+  remove_held_mutex(held);
+  record_held_mutex(this, locked_at);
+  return depth;
+}
+
+void NativeMutex::exit_wait(uint32_t depth) {
+  if (depth == 0 || held_mutex_count >= kMaxHeldMutexCount
+      || ContentionProfiler::current() == NULL)
+    return;
+  held_mutex_t *held = &held_mutexes[held_mutex_count++];
+  held->mutex = this;
+  held->depth = depth;
+  held->locked_at = monotonic_clock_nanos();
+}
+
 fat_bool_t NativeMutex::try_lock() {
   return lock(Duration::instant());
 }
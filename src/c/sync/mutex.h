@@ -11,6 +11,9 @@
 typedef struct native_mutex_t {
   bool is_initialized;
   platform_mutex_t mutex;
+  // The name this mutex is reported under by the contention profiler. If it's
+  // NULL the mutex is reported individually.
+  const char *profile_name;
 } native_mutex_t;
 
 // Create a new uninitialized mutex.
@@ -55,7 +55,27 @@ public:
   // testing obviously.
   static bool checks_consistency() { return kPlatformMutexChecksConsistency; }
 
+  // Sets the name this mutex is reported under by the contention profiler. The
+  // name is not copied so it should typically be a literal.
+  void set_profile_name(const char *name) { profile_name = name; }
+
 private:
+  friend class NativeCondition;
+
+  // Platform-specific locking, without profiling.
+  fat_bool_t platform_lock(Duration timeout);
+
+  // Platform-specific unlocking, without profiling.
+  fat_bool_t platform_unlock();
+
+  // Called by a condition before it atomically releases this mutex to wait.
+  // Returns the profiled lock depth, 0 if the mutex isn't being profiled, which
+  // must be passed to exit_wait once the mutex has been reacquired.
+  uint32_t enter_wait();
+
+  // Called by a condition when it has reacquired this mutex after waiting.
+  void exit_wait(uint32_t depth);
+
   // Platform-specific initialization.
   fat_bool_t platform_initialize();
 
@@ -0,0 +1,60 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define kSysNodePath "/sys/devices/system/node"
+
+// Reads a kernel cpu or node list from the given file into the given set.
+static bool numa_read_list(const char *path, native_cpu_set_t *set) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  // Lists are short unless the machine is very irregular; a line this long
+  // holds well over kMaxCpuCount entries.
+  char line[4096];
+  bool result = (fgets(line, sizeof(line), file) != NULL)
+      && numa_parse_cpu_list(line, set);
+  fclose(file);
+  return result;
+}
+
+static void numa_get_all_cpus(native_cpu_set_t *cpus) {
+  if (numa_read_list("/sys/devices/system/cpu/online", cpus))
+    return;
+  long count = sysconf(_SC_NPROCESSORS_CONF);
+  for (long i = 0; i < count; i++)
+    native_cpu_set_add(cpus, static_cast<size_t>(i));
+}
+
+static bool numa_platform_discover(numa_topology_t *topology) {
+  // Node ids are listed the same way as cpus so a cpu set does for them too.
+  native_cpu_set_t ids;
+  native_cpu_set_clear(&ids);
+  if (!numa_read_list(kSysNodePath "/online", &ids))
+    return false;
+  for (size_t id = 0; id < kMaxCpuCount; id++) {
+    if (!native_cpu_set_contains(&ids, id))
+      continue;
+    if (topology->node_count == kMaxNumaNodeCount) {
+      WARN("More than %i numa nodes; ignoring the rest", kMaxNumaNodeCount);
+      break;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), kSysNodePath "/node%i/cpulist",
+        static_cast<int>(id));
+    numa_node_t *node = &topology->nodes[topology->node_count];
+    node->id = static_cast<int32_t>(id);
+    native_cpu_set_clear(&node->cpus);
+    if (!numa_read_list(path, &node->cpus))
+      return false;
+    topology->node_count++;
+  }
+  return true;
+}
+
+static int numa_platform_current_cpu() {
+  return sched_getcpu();
+}
@@ -0,0 +1,42 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "c/winhdr.h"
+
+// Processor groups are ignored, only the calling process's group is seen.
+
+// Adds the cpus in the given processor mask to the given set.
+static void numa_add_mask(ULONGLONG mask, native_cpu_set_t *cpus) {
+  for (size_t i = 0; i < 64; i++) {
+    if ((mask & (static_cast<ULONGLONG>(1) << i)) != 0)
+      native_cpu_set_add(cpus, i);
+  }
+}
+
+static void numa_get_all_cpus(native_cpu_set_t *cpus) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  numa_add_mask(info.dwActiveProcessorMask, cpus);
+}
+
+static bool numa_platform_discover(numa_topology_t *topology) {
+  ULONG highest = 0;
+  if (!GetNumaHighestNodeNumber(&highest))
+    return false;
+  for (ULONG id = 0; id <= highest; id++) {
+    ULONGLONG mask = 0;
+    if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(id), &mask) || mask == 0)
+      continue;
+    if (topology->node_count == kMaxNumaNodeCount)
+      break;
+    numa_node_t *node = &topology->nodes[topology->node_count++];
+    node->id = static_cast<int32_t>(id);
+    native_cpu_set_clear(&node->cpus);
+    numa_add_mask(mask, &node->cpus);
+  }
+  return true;
+}
+
+static int numa_platform_current_cpu() {
+  return static_cast<int>(GetCurrentProcessorNumber());
+}
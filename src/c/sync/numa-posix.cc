@@ -0,0 +1,20 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <unistd.h>
+
+// Posix doesn't know about numa so everything is one node.
+
+static void numa_get_all_cpus(native_cpu_set_t *cpus) {
+  long count = sysconf(_SC_NPROCESSORS_CONF);
+  for (long i = 0; i < count; i++)
+    native_cpu_set_add(cpus, static_cast<size_t>(i));
+}
+
+static bool numa_platform_discover(numa_topology_t *topology) {
+  return false;
+}
+
+static int numa_platform_current_cpu() {
+  return -1;
+}
@@ -0,0 +1,85 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "c/stdc.h"
+
+BEGIN_C_INCLUDES
+#include "sync/numa.h"
+#include "utils/log.h"
+END_C_INCLUDES
+
+// Stores the cpus of this machine in the given set, used when the topology
+// can't be discovered.
+static void numa_get_all_cpus(native_cpu_set_t *cpus);
+
+// Fills in the topology using the platform's mechanism. Returns false if that
+// fails.
+static bool numa_platform_discover(numa_topology_t *topology);
+
+// Returns the cpu the calling thread is running on or -1 if that can't be
+// determined.
+static int numa_platform_current_cpu();
+
+#if defined(IS_LINUX)
+#  include "numa-linux.cc"
+#elif defined(IS_MSVC)
+#  include "numa-msvc.cc"
+#else
+#  include "numa-posix.cc"
+#endif
+
+bool numa_parse_cpu_list(const char *list, native_cpu_set_t *set) {
+  const char *pos = list;
+  while (true) {
+    while (*pos == ' ')
+      pos++;
+    if (*pos == '\0' || *pos == '\n')
+      return true;
+    char *end = NULL;
+    unsigned long first = strtoul(pos, &end, 10);
+    if (end == pos)
+      return false;
+    unsigned long last = first;
+    pos = end;
+    if (*pos == '-') {
+      pos++;
+      last = strtoul(pos, &end, 10);
+      if (end == pos || last < first)
+        return false;
+      pos = end;
+    }
+    for (unsigned long cpu = first; cpu <= last && cpu < kMaxCpuCount; cpu++)
+      native_cpu_set_add(set, cpu);
+    if (*pos == ',') {
+      pos++;
+    } else if (*pos != '\0' && *pos != '\n') {
+      return false;
+    }
+  }
+}
+
+bool numa_topology_discover(numa_topology_t *topology) {
+  topology->node_count = 0;
+  if (numa_platform_discover(topology) && topology->node_count > 0)
+    return true;
+  topology->node_count = 1;
+  topology->nodes[0].id = 0;
+  native_cpu_set_clear(&topology->nodes[0].cpus);
+  numa_get_all_cpus(&topology->nodes[0].cpus);
+  return false;
+}
+
+size_t numa_topology_node_of_cpu(const numa_topology_t *topology, size_t cpu) {
+  for (size_t i = 0; i < topology->node_count; i++) {
+    if (native_cpu_set_contains(&topology->nodes[i].cpus, cpu))
+      return i;
+  }
+  return kNoNumaNode;
+}
+
+size_t numa_topology_current_node(const numa_topology_t *topology) {
+  int cpu = numa_platform_current_cpu();
+  return (cpu < 0)
+      ? kNoNumaNode
+      : numa_topology_node_of_cpu(topology, static_cast<size_t>(cpu));
+}
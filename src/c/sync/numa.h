@@ -0,0 +1,54 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Discovery of the machine's numa topology, which cpus belong to which memory
+// node.
+
+#ifndef _TCLIB_NUMA_H
+#define _TCLIB_NUMA_H
+
+#include "c/stdc.h"
+
+#include "sync/thread.h"
+
+// The largest number of numa nodes a topology can hold.
+#define kMaxNumaNodeCount 64
+
+// Node index returned when a cpu doesn't belong to any known node.
+#define kNoNumaNode ((size_t) -1)
+
+// A single numa node.
+typedef struct {
+  // The system's id for the node, which is what memory is bound to. Ids may
+  // have gaps so they aren't necessarily the same as the node's index.
+  int32_t id;
+  // The cpus that belong to this node.
+  native_cpu_set_t cpus;
+} numa_node_t;
+
+// The numa nodes of the machine. Machines that aren't numa, or platforms where
+// the topology can't be discovered, have a single node that holds all cpus.
+typedef struct {
+  size_t node_count;
+  numa_node_t nodes[kMaxNumaNodeCount];
+} numa_topology_t;
+
+// Fills in the given topology with the nodes of this machine. Returns false if
+// discovery failed, in which case the topology has a single node with all
+// cpus.
+bool numa_topology_discover(numa_topology_t *topology);
+
+// Returns the index of the node the given cpu belongs to, or kNoNumaNode if it
+// doesn't belong to any.
+size_t numa_topology_node_of_cpu(const numa_topology_t *topology, size_t cpu);
+
+// Returns the index of the node the calling thread is currently running on, or
+// kNoNumaNode if that can't be determined.
+size_t numa_topology_current_node(const numa_topology_t *topology);
+
+// Parses a list of cpus or nodes in the format the linux kernel uses, for
+// instance "0-3,8,10-11", and adds them to the given set. Returns false if the
+// list is malformed.
+bool numa_parse_cpu_list(const char *list, native_cpu_set_t *set);
+
+#endif // _TCLIB_NUMA_H
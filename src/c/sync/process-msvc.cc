@@ -66,7 +66,10 @@ void NativeProcess::mark_terminated(bool timer_or_wait_fired) {
   }
   if (exit_code == STILL_ACTIVE)
     WARN("Marking still active process as terminated.");
-  exit_code_.fulfill(exit_code);
+  // Whoever is waiting for the exit code may dispose this process as soon as
+  // it's set so settle it through a reference of our own.
+  sync_promise_t<int> exit_code_ref = exit_code_;
+  exit_code_ref.fulfill(exit_code);
 }
 
 // A wrapper around a reference to memory in a different process.
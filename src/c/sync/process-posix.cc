@@ -64,9 +64,17 @@ public:
   // Returns the singleton process registry instance, creating it if necessary.
   static ProcessRegistry *get();
 
+  // Must be called before forking a child that will be added to this registry.
+  // Each call must be followed by a call to add or, if forking failed,
+  // abort_fork.
+  bool begin_fork();
+
   // Registers a child process with this registry.
   bool add(pid_t pid, NativeProcess *process);
 
+  // Called instead of add when forking failed.
+  bool abort_fork();
+
 private:
   // Create the registry including starting the signal dispatcher thread.
   ProcessRegistry();
@@ -76,6 +84,7 @@ private:
   ~ProcessRegistry();
 
   typedef platform_hash_map<pid_t, NativeProcess*> ProcessMap;
+  typedef platform_hash_map<pid_t, int> ResultMap;
 
   // Entry-point for the signal dispatcher thread.
   opaque_t run_signal_dispatcher();
@@ -120,6 +129,17 @@ private:
   // Mapping from pid to process.
   ProcessMap children_;
 
+  // Results of children that terminated before they were added. The child
+  // signal is only blocked on the thread that forks so the dispatcher can reap
+  // a short-lived child before the parent gets around to adding it. The
+  // dispatcher reaps all children, including ones other code forked, so
+  // results are only kept while a fork is in progress and dropped once the
+  // last one has been added.
+  ResultMap early_results_;
+
+  // The number of forks that have begun but whose child hasn't been added.
+  size_t pending_forks_;
+
   // Mutex that guards the shutdown flag and children map. This isn't used by
   // incoming signals, only by the dispatcher thread itself and other threads
   // adding new processes.
@@ -283,15 +303,18 @@ fat_bool_t NativeProcess::start(utf8_t executable, size_t argc, utf8_t *argv) {
     WARN("Call to sigprocmask failed: %s", strerror(errno));
 
   // Fork the child.
+  ProcessRegistry *registry = ProcessRegistry::get();
+  registry->begin_fork();
   pid_t fork_pid = fork();
   fat_bool_t result = F_TRUE;
   if (fork_pid == -1) {
     // Forking failed for some reason.
+    registry->abort_fork();
     WARN("Call to fork failed: %i", fork_pid);
     exit_code_.fulfill(-1);
     result = F_FALSE;
   } else if (fork_pid > 0) {
-    ProcessRegistry::get()->add(fork_pid, this);
+    registry->add(fork_pid, this);
     // We're in the parent so just record the child's pid and we're done.
     this->handle()->set_process(fork_pid);
     this->state = nsRunning;
@@ -319,9 +342,14 @@ fat_bool_t NativeProcessHandle::kill() {
 }
 
 bool NativeProcess::mark_terminated(int result) {
-  bool fulfilled = this->exit_code_.fulfill(WEXITSTATUS(result));
+  // Once the exit code is set whoever is waiting for it may dispose this
+  // process, and the promise member with it, so settle it through a reference
+  // of our own and don't touch this afterwards.
+  pid_t guid = this->handle()->guid();
+  sync_promise_t<int> exit_code = exit_code_;
+  bool fulfilled = exit_code.fulfill(WEXITSTATUS(result));
   if (!fulfilled)
-    WARN("Failed to fulfill for %lli", this->handle()->guid());
+    WARN("Failed to fulfill for %lli", guid);
   return fulfilled;
 }
 
@@ -360,13 +388,44 @@ bool ProcessRegistry::handle_signal(int signum, siginfo_t *info, void *context)
   return action_count_.release();
 }
 
-bool ProcessRegistry::add(pid_t pid, NativeProcess *child) {
+bool ProcessRegistry::begin_fork() {
+  if (!guard_.lock())
+    return false;
+  pending_forks_++;
+  return guard_.unlock();
+}
+
+bool ProcessRegistry::abort_fork() {
   if (!guard_.lock())
     return false;
-  children_[pid] = child;
+  if (--pending_forks_ == 0)
+    early_results_.clear();
   return guard_.unlock();
 }
 
+bool ProcessRegistry::add(pid_t pid, NativeProcess *child) {
+  if (!guard_.lock())
+    return false;
+  ResultMap::iterator early = early_results_.find(pid);
+  bool has_terminated = (early != early_results_.end());
+  int result = 0;
+  if (has_terminated) {
+    result = early->second;
+    early_results_.erase(pid);
+  } else {
+    children_[pid] = child;
+  }
+  // Whatever is left once no forks are in progress belongs to children that
+  // were never ours.
+  if (--pending_forks_ == 0)
+    early_results_.clear();
+  if (!guard_.unlock())
+    return false;
+  if (has_terminated)
+    child->mark_terminated(result);
+  return true;
+}
+
 void ProcessRegistry::install() {
   CHECK_TRUE("multiple process registries", current_ == NULL);
   current_ = new ProcessRegistry();
@@ -431,7 +490,10 @@ bool ProcessRegistry::dispatch_pending_terminations() {
     }
     ProcessMap::iterator iter = children_.find(next);
     if (iter == children_.end()) {
-      // We don't know about this child; just skip it and keep going.
+      // We don't know about this child (yet); if one of ours is being forked
+      // keep the result around in case it gets added later and keep going.
+      if (pending_forks_ > 0)
+        early_results_[next] = result;
       if (!guard_.unlock()) {
         WARN("Failed to unlock process registry guard");
         return false;
@@ -453,9 +515,12 @@ bool ProcessRegistry::dispatch_pending_terminations() {
 }
 
 ProcessRegistry::ProcessRegistry()
-  : shutdown_(false)
+  : pending_forks_(0)
+  , shutdown_(false)
   , action_count_(0) {
   bool alls_well = true;
+  guard_.set_profile_name("ProcessRegistry::guard_");
+  action_count_.set_profile_name("ProcessRegistry::action_count_");
   alls_well = guard_.initialize() && alls_well;
   alls_well = action_count_.initialize() && alls_well;
   dispatcher_.set_callback(new_callback(&ProcessRegistry::run_signal_dispatcher, this));
@@ -91,7 +91,7 @@ fat_bool_t NativeProcess::wait_sync(Duration timeout) {
     return F_TRUE;
   }
 
-  // Once the process terminates the drawbridge will be lowered.
+  // Once the process terminates the exit code promise will be settled.
   fat_bool_t passed = exit_code_.wait(timeout);
   if (passed)
     this->state = nsComplete;
@@ -0,0 +1,300 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/atomic-inl.h"
+#include "sync/reclaim.h"
+#include "utils/check.h"
+
+// Returns the allocator to use given the one a domain was configured with.
+static allocator_t *resolve_allocator(allocator_t *allocator) {
+  return (allocator == NULL) ? allocator_get_default() : allocator;
+}
+
+// Frees all the nodes in the given list, returning how many there were.
+static size_t reclaim_free_list(allocator_t *allocator, reclaim_node_t *node) {
+  size_t count = 0;
+  while (node != NULL) {
+    // The node typically lives inside the memory being freed so read next
+    // first.
+    reclaim_node_t *next = node->next;
+    allocator_free(allocator, node->memory);
+    node = next;
+    count++;
+  }
+  return count;
+}
+
+// --- E p o c h s ---
+
+// Is memory retired in the given epoch safe to free when the global epoch is
+// the given current one? Readers can lag at most one epoch behind so once the
+// global epoch is two past the retiring one no reader can still see the node.
+static bool is_epoch_expired(int64_t retired, int64_t current) {
+  return retired + 2 <= current;
+}
+
+bool epoch_domain_init(epoch_domain_t *domain, allocator_t *allocator) {
+  domain->epoch = atomic_int64_new(0);
+  domain->allocator = allocator;
+  domain->participants = NULL;
+  domain->orphans = NULL;
+  native_mutex_construct(&domain->guard);
+  return native_mutex_initialize(&domain->guard);
+}
+
+void epoch_domain_dispose(epoch_domain_t *domain) {
+  CHECK_TRUE("disposing epoch domain with participants",
+      domain->participants == NULL);
+  reclaim_free_list(resolve_allocator(domain->allocator), domain->orphans);
+  domain->orphans = NULL;
+  native_mutex_dispose(&domain->guard);
+}
+
+void epoch_participant_register(epoch_domain_t *domain,
+    epoch_participant_t *participant) {
+  participant->announced = atomic_int64_new(0);
+  participant->depth = 0;
+  participant->retired = NULL;
+  participant->retired_since_advance = 0;
+  participant->domain = domain;
+  native_mutex_lock(&domain->guard);
+  participant->next = domain->participants;
+  domain->participants = participant;
+  native_mutex_unlock(&domain->guard);
+}
+
+void epoch_participant_unregister(epoch_participant_t *participant) {
+  CHECK_EQ("unregistering in critical region", 0, participant->depth);
+  epoch_collect(participant);
+  epoch_domain_t *domain = participant->domain;
+  native_mutex_lock(&domain->guard);
+  epoch_participant_t **link = &domain->participants;
+  while (*link != participant)
+    link = &(*link)->next;
+  *link = participant->next;
+  // Whatever couldn't be freed yet becomes the domain's responsibility.
+  reclaim_node_t *node = participant->retired;
+  while (node != NULL) {
+    reclaim_node_t *next = node->next;
+    node->next = domain->orphans;
+    domain->orphans = node;
+    node = next;
+  }
+  native_mutex_unlock(&domain->guard);
+  participant->retired = NULL;
+  participant->domain = NULL;
+  participant->next = NULL;
+}
+
+void epoch_enter(epoch_participant_t *participant) {
+  if (participant->depth++ > 0)
+    return;
+  atomic_int64_t *global = &participant->domain->epoch;
+  int64_t epoch = atomic_int64_load(global, moRelaxed);
+  while (true) {
+    // The announcement has to be visible to other threads before we read
+    // anything from the shared structure, hence the full barrier.
+    atomic_int64_exchange(&participant->announced, (epoch << 1) | 1, moSeqCst);
+    // If the epoch moved before the announcement became visible the advancing
+    // thread may not have seen us so announce again.
+    int64_t current = atomic_int64_load(global, moSeqCst);
+    if (current == epoch)
+      break;
+    epoch = current;
+  }
+}
+
+void epoch_leave(epoch_participant_t *participant) {
+  CHECK_REL("leaving without entering", participant->depth, >, 0);
+  if (--participant->depth > 0)
+    return;
+  atomic_int64_store(&participant->announced, 0, moRelease);
+}
+
+// Attempts to advance the global epoch. That's only possible if every
+// participant that's currently in a critical region has seen the current
+// epoch. Returns the global epoch after the attempt.
+static int64_t epoch_try_advance(epoch_domain_t *domain) {
+  // If someone else is already advancing there's no point in waiting for them.
+  if (!native_mutex_try_lock(&domain->guard))
+    return atomic_int64_load(&domain->epoch, moSeqCst);
+  int64_t epoch = atomic_int64_load(&domain->epoch, moSeqCst);
+  bool can_advance = true;
+  epoch_participant_t *current = domain->participants;
+  for (; current != NULL; current = current->next) {
+    int64_t announced = atomic_int64_load(&current->announced, moSeqCst);
+    if ((announced & 1) != 0 && (announced >> 1) != epoch) {
+      can_advance = false;
+      break;
+    }
+  }
+  if (can_advance) {
+    epoch++;
+    atomic_int64_store(&domain->epoch, epoch, moSeqCst);
+    // While we hold the guard we might as well free what we can of the
+    // orphans.
+    reclaim_node_t **link = &domain->orphans;
+    allocator_t *allocator = resolve_allocator(domain->allocator);
+    while (*link != NULL) {
+      reclaim_node_t *node = *link;
+      if (is_epoch_expired(node->epoch, epoch)) {
+        *link = node->next;
+        allocator_free(allocator, node->memory);
+      } else {
+        link = &node->next;
+      }
+    }
+  }
+  native_mutex_unlock(&domain->guard);
+  return epoch;
+}
+
+void epoch_retire(epoch_participant_t *participant, reclaim_node_t *node,
+    blob_t memory) {
+  epoch_domain_t *domain = participant->domain;
+  node->memory = memory;
+  // The node has been unlinked so any reader that can still see it must have
+  // entered no later than now.
+  node->epoch = atomic_int64_load(&domain->epoch, moSeqCst);
+  node->next = participant->retired;
+  participant->retired = node;
+  if (++participant->retired_since_advance >= kEpochAdvanceInterval)
+    epoch_collect(participant);
+}
+
+size_t epoch_collect(epoch_participant_t *participant) {
+  participant->retired_since_advance = 0;
+  int64_t epoch = epoch_try_advance(participant->domain);
+  // The retired list is newest first so once we find a node that can be freed
+  // all the ones after it can be too.
+  reclaim_node_t **link = &participant->retired;
+  while (*link != NULL && !is_epoch_expired((*link)->epoch, epoch))
+    link = &(*link)->next;
+  reclaim_node_t *expired = *link;
+  *link = NULL;
+  return reclaim_free_list(resolve_allocator(participant->domain->allocator),
+      expired);
+}
+
+// --- H a z a r d   p o i n t e r s ---
+
+void hazard_domain_init(hazard_domain_t *domain, allocator_t *allocator) {
+  domain->records = atomic_ptr_new(NULL);
+  domain->record_count = atomic_int32_new(0);
+  domain->allocator = allocator;
+}
+
+void hazard_domain_dispose(hazard_domain_t *domain) {
+  allocator_t *allocator = resolve_allocator(domain->allocator);
+  hazard_record_t *record = (hazard_record_t*) atomic_ptr_load(&domain->records,
+      moAcquire);
+  while (record != NULL) {
+    CHECK_EQ("disposing hazard domain with active records", 0,
+        atomic_int32_load(&record->is_active, moRelaxed));
+    hazard_record_t *next = record->next;
+    reclaim_free_list(allocator, record->retired);
+    allocator_free(allocator, blob_new(record, sizeof(hazard_record_t)));
+    record = next;
+  }
+  domain->records = atomic_ptr_new(NULL);
+}
+
+hazard_record_t *hazard_record_acquire(hazard_domain_t *domain) {
+  // First try to reuse a record someone else has released.
+  hazard_record_t *record = (hazard_record_t*) atomic_ptr_load(&domain->records,
+      moAcquire);
+  for (; record != NULL; record = record->next) {
+    int32_t inactive = 0;
+    if (atomic_int32_compare_exchange(&record->is_active, &inactive, 1,
+        moAcquire))
+      return record;
+  }
+  // There are none so make a new one.
+  blob_t memory = allocator_malloc(resolve_allocator(domain->allocator),
+      sizeof(hazard_record_t));
+  if (blob_is_empty(memory))
+    return NULL;
+  blob_fill(memory, 0);
+  record = (hazard_record_t*) memory.start;
+  record->is_active = atomic_int32_new(1);
+  record->domain = domain;
+  void *head = atomic_ptr_load(&domain->records, moRelaxed);
+  do {
+    record->next = (hazard_record_t*) head;
+  } while (!atomic_ptr_compare_exchange(&domain->records, &head, record,
+      moRelease));
+  atomic_int32_fetch_add(&domain->record_count, 1, moRelaxed);
+  return record;
+}
+
+void hazard_record_release(hazard_record_t *record) {
+  for (size_t i = 0; i < kHazardSlotCount; i++)
+    hazard_clear(record, i);
+  atomic_int32_store(&record->is_active, 0, moRelease);
+}
+
+void *hazard_protect(hazard_record_t *record, size_t slot,
+    atomic_ptr_t *source) {
+  CHECK_REL("invalid hazard slot", slot, <, kHazardSlotCount);
+  void *value = atomic_ptr_load(source, moAcquire);
+  while (true) {
+    // Publish the pointer and then check that it's still there. If it is then
+    // it hadn't been unlinked when we published it so whoever unlinks it will
+    // see the hazard when they scan.
+    atomic_ptr_store(&record->slots[slot], value, moSeqCst);
+    void *current = atomic_ptr_load(source, moSeqCst);
+    if (current == value)
+      return value;
+    value = current;
+  }
+}
+
+void hazard_clear(hazard_record_t *record, size_t slot) {
+  atomic_ptr_store(&record->slots[slot], NULL, moRelease);
+}
+
+void hazard_retire(hazard_record_t *record, reclaim_node_t *node,
+    blob_t memory) {
+  node->memory = memory;
+  node->epoch = 0;
+  node->next = record->retired;
+  record->retired = node;
+  record->retired_count++;
+  // Scanning costs time proportional to the number of hazard pointers so it's
+  // only worth it once there's at least that much retired.
+  int32_t records = atomic_int32_load(&record->domain->record_count, moRelaxed);
+  if (record->retired_count >= 2 * kHazardSlotCount * (size_t) records)
+    hazard_collect(record);
+}
+
+// Returns true if any record in the given domain protects the given address.
+static bool is_hazardous(hazard_domain_t *domain, void *address) {
+  hazard_record_t *record = (hazard_record_t*) atomic_ptr_load(&domain->records,
+      moAcquire);
+  for (; record != NULL; record = record->next) {
+    for (size_t i = 0; i < kHazardSlotCount; i++) {
+      if (atomic_ptr_load(&record->slots[i], moSeqCst) == address)
+        return true;
+    }
+  }
+  return false;
+}
+
+size_t hazard_collect(hazard_record_t *record) {
+  hazard_domain_t *domain = record->domain;
+  allocator_t *allocator = resolve_allocator(domain->allocator);
+  size_t freed = 0;
+  reclaim_node_t **link = &record->retired;
+  while (*link != NULL) {
+    reclaim_node_t *node = *link;
+    if (is_hazardous(domain, node->memory.start)) {
+      link = &node->next;
+    } else {
+      *link = node->next;
+      allocator_free(allocator, node->memory);
+      freed++;
+    }
+  }
+  record->retired_count -= freed;
+  return freed;
+}
@@ -0,0 +1,193 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Safe memory reclamation for lock-free data structures.
+//
+// When a node is unlinked from a lock-free structure other threads may still be
+// reading it so it can't be freed right away. Instead it is retired and freed
+// later, once no thread can still hold a reference to it. There are two
+// schemes here for deciding when that is.
+//
+// Epoch-based reclamation is the cheapest for readers: entering and leaving a
+// critical region is a couple of stores to thread-owned memory. The downside
+// is that a reader that stalls inside a critical region holds back
+// reclamation for everyone.
+//
+// Hazard pointers make readers publish each pointer they're about to
+// dereference which is more expensive per access but bounds how much memory
+// can be waiting to be freed, even if a reader stalls.
+//
+// In both cases retired memory is freed through an allocator_t.
+
+#ifndef _TCLIB_RECLAIM_H
+#define _TCLIB_RECLAIM_H
+
+#include "c/stdc.h"
+
+#include "sync/atomic.h"
+#include "sync/mutex.h"
+#include "utils/alloc.h"
+
+// Bookkeeping for a retired block of memory. This is intrusive, the node being
+// retired must embed one of these which is written when it is retired, so
+// retiring never has to allocate. Readers of the structure don't look at it so
+// it's safe to write even while they may still be reading the rest of the
+// node.
+typedef struct reclaim_node_t {
+  // The next node retired by the same thread.
+  struct reclaim_node_t *next;
+  // The memory to free, typically the whole node that contains this.
+  blob_t memory;
+  // The epoch the node was retired in. Only used by epoch-based reclamation.
+  int64_t epoch;
+} reclaim_node_t;
+
+// --- E p o c h s ---
+
+// The state of a single thread participating in epoch-based reclamation. A
+// participant must only be used by one thread at a time.
+typedef struct epoch_participant_t {
+  // The epoch this participant was in when it entered its current critical
+  // region shifted up by one with the low bit set, or 0 if it's outside.
+  atomic_int64_t announced;
+  // How many times the owning thread has entered without leaving.
+  uint32_t depth;
+  // Nodes retired by this participant that haven't been freed yet, newest
+  // first.
+  reclaim_node_t *retired;
+  // How many nodes have been retired since the last attempt to advance.
+  uint32_t retired_since_advance;
+  // The domain this participant belongs to.
+  struct epoch_domain_t *domain;
+  // The next participant in the domain's list.
+  struct epoch_participant_t *next;
+} epoch_participant_t;
+
+// A set of threads that share lock-free data and hence have to agree on when
+// it can be freed.
+typedef struct epoch_domain_t {
+  // The current global epoch. Only ever increases.
+  atomic_int64_t epoch;
+  // The allocator retired memory is freed through. If this is NULL memory is
+  // freed through the default allocator.
+  allocator_t *allocator;
+  // Guards the participant and orphan lists.
+  native_mutex_t guard;
+  // All the registered participants.
+  epoch_participant_t *participants;
+  // Nodes retired by participants that have since unregistered.
+  reclaim_node_t *orphans;
+} epoch_domain_t;
+
+// How many nodes a participant retires between attempts to advance the epoch.
+#define kEpochAdvanceInterval 64
+
+// Initializes an epoch domain that frees retired memory through the given
+// allocator, or the default one if it is NULL. Returns true iff successful.
+bool epoch_domain_init(epoch_domain_t *domain, allocator_t *allocator);
+
+// Disposes the given domain, freeing all memory that's still retired. There
+// must be no participants still registered.
+void epoch_domain_dispose(epoch_domain_t *domain);
+
+// Registers the given participant with the given domain.
+void epoch_participant_register(epoch_domain_t *domain,
+    epoch_participant_t *participant);
+
+// Unregisters the given participant. It must not be in a critical region.
+// Memory it has retired but that can't be freed yet is handed over to the
+// domain.
+void epoch_participant_unregister(epoch_participant_t *participant);
+
+// Enters a critical region. While inside, any node the calling thread reads
+// out of a shared structure stays valid even if another thread retires it.
+// Critical regions can be nested.
+void epoch_enter(epoch_participant_t *participant);
+
+// Leaves a critical region entered with epoch_enter.
+void epoch_leave(epoch_participant_t *participant);
+
+// Retires the given node, which must already be unreachable from the shared
+// structure, such that its memory will be freed once no critical region can
+// still see it.
+void epoch_retire(epoch_participant_t *participant, reclaim_node_t *node,
+    blob_t memory);
+
+// Tries to advance the epoch and frees whatever of this participant's retired
+// memory is safe to free. Called automatically every so often when retiring
+// nodes. Returns the number of nodes freed.
+size_t epoch_collect(epoch_participant_t *participant);
+
+// --- H a z a r d   p o i n t e r s ---
+
+// How many pointers a single thread can protect at the same time.
+#define kHazardSlotCount 4
+
+// The state of a single thread using hazard pointers. A record must only be
+// used by one thread at a time but records are recycled when a thread is done
+// with them.
+typedef struct hazard_record_t {
+  // The pointers this thread is currently protecting.
+  atomic_ptr_t slots[kHazardSlotCount];
+  // Is this record owned by a thread?
+  atomic_int32_t is_active;
+  // Nodes retired through this record that haven't been freed yet.
+  reclaim_node_t *retired;
+  // How many nodes are in the retired list.
+  size_t retired_count;
+  // The domain this record belongs to.
+  struct hazard_domain_t *domain;
+  // The next record in the domain. Records are never unlinked while the
+  // domain is alive so this can be followed without synchronization.
+  struct hazard_record_t *next;
+} hazard_record_t;
+
+// A set of threads that share lock-free data protected by hazard pointers.
+typedef struct hazard_domain_t {
+  // All records ever created in this domain.
+  atomic_ptr_t records;
+  // How many records have been created.
+  atomic_int32_t record_count;
+  // The allocator retired memory and the records themselves are allocated
+  // through. If this is NULL the default allocator is used.
+  allocator_t *allocator;
+} hazard_domain_t;
+
+// Initializes a hazard pointer domain that frees retired memory through the
+// given allocator, or the default one if it is NULL.
+void hazard_domain_init(hazard_domain_t *domain, allocator_t *allocator);
+
+// Disposes the given domain, freeing all records and all memory that's still
+// retired. All records must have been released.
+void hazard_domain_dispose(hazard_domain_t *domain);
+
+// Returns a record the calling thread can use to protect pointers, reusing a
+// released one if there is one. Returns NULL if allocation fails.
+hazard_record_t *hazard_record_acquire(hazard_domain_t *domain);
+
+// Releases a record acquired with hazard_record_acquire. Its protected pointers
+// are cleared; memory retired through it stays with the record and is freed
+// by its next user or when the domain is disposed.
+void hazard_record_release(hazard_record_t *record);
+
+// Reads the pointer stored in the given atomic and protects it in the given
+// slot. Once this returns the result can be dereferenced until the slot is
+// cleared or reused, even if another thread retires it in the meantime.
+void *hazard_protect(hazard_record_t *record, size_t slot, atomic_ptr_t *source);
+
+// Stops protecting whatever is in the given slot.
+void hazard_clear(hazard_record_t *record, size_t slot);
+
+// Retires the given node, which must already be unreachable from the shared
+// structure, such that its memory will be freed once no hazard pointer
+// protects it. The memory counts as protected if a hazard pointer points to
+// its start so the structure must store pointers to the start of its nodes.
+void hazard_retire(hazard_record_t *record, reclaim_node_t *node,
+    blob_t memory);
+
+// Frees whatever of this record's retired memory is no longer protected.
+// Called automatically when enough memory has been retired. Returns the number
+// of nodes freed.
+size_t hazard_collect(hazard_record_t *record);
+
+#endif // _TCLIB_RECLAIM_H
@@ -0,0 +1,177 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Semaphores on linux are built directly on futexes, through NativeFutex. The
+// permit count lives in user space so acquiring while permits are available,
+// and releasing while nobody is waiting, never enters the kernel. Deadlines
+// are measured against the monotonic clock so changes to the system time don't
+// affect timeouts.
+//
+// Release is called from signal handlers (see ProcessRegistry::handle_signal)
+// so it must only use atomics and raw system calls on the non-error path.
+
+#include <limits.h>
+
+#include "sync/futex.hh"
+#include "sync/thread.hh"
+
+// The units the waiter counts are kept in within the semaphore's state.
+static const int64_t kSemaphoreWaiterUnit = static_cast<int64_t>(1) << 32;
+static const int64_t kSemaphoreWideWaiterUnit = static_cast<int64_t>(1) << 48;
+
+// The most waiters the state has room for.
+static const int32_t kSemaphoreMaxWaiters = 0xFFFF;
+
+// Returns the number of permits in the given state.
+static int32_t semaphore_state_count(int64_t state) {
+  return static_cast<int32_t>(state & 0xFFFFFFFF);
+}
+
+// Returns the number of waiters in the given state.
+static int32_t semaphore_state_waiters(int64_t state) {
+  return static_cast<int32_t>((state >> 32) & 0xFFFF);
+}
+
+// Returns the number of wide waiters in the given state.
+static int32_t semaphore_state_wide_waiters(int64_t state) {
+  return static_cast<int32_t>((state >> 48) & 0xFFFF);
+}
+
+// Returns the half of the semaphore's state that holds the count, which is
+// what waiters block on.
+static atomic_int32_t *semaphore_count_word(linux_platform_semaphore_t *sema) {
+  atomic_int32_t *halves = reinterpret_cast<atomic_int32_t*>(
+      const_cast<int64_t*>(&sema->state));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return halves + 1;
+#else
+  return halves;
+#endif
+}
+
+// Attempts to take the given number of permits without blocking. Only fails if
+// there aren't enough permits, contention from other threads just causes it to
+// try again.
+static bool futex_semaphore_try_take(linux_platform_semaphore_t *sema,
+    int32_t permits) {
+  while (true) {
+    int64_t state = sema->state;
+    if (semaphore_state_count(state) < permits)
+      return false;
+    if (__sync_bool_compare_and_swap(&sema->state, state, state - permits))
+      return true;
+  }
+}
+
+fat_bool_t NativeSemaphore::platform_initialize() {
+  if (initial_count > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Initial semaphore count too large: %u", initial_count);
+    return F_FALSE;
+  }
+  sema.state = static_cast<int64_t>(initial_count);
+  return F_TRUE;
+}
+
+fat_bool_t NativeSemaphore::platform_dispose() {
+  CHECK_EQ("disposing semaphore with waiters", 0,
+      semaphore_state_waiters(sema.state));
+  return F_TRUE;
+}
+
+// Registers the caller as waiting in the given units. If the waiter count is
+// full there's no room to register so it yields until someone leaves instead;
+// adding anyway would carry into the next field.
+static void futex_semaphore_add_waiter(linux_platform_semaphore_t *sema,
+    int64_t units) {
+  while (true) {
+    int64_t state = sema->state;
+    if (semaphore_state_waiters(state) >= kSemaphoreMaxWaiters) {
+      NativeThread::yield();
+      continue;
+    }
+    if (__sync_bool_compare_and_swap(&sema->state, state, state + units))
+      return;
+  }
+}
+
+fat_bool_t NativeSemaphore::platform_acquire(uint32_t permits, Duration timeout) {
+  CHECK_TRUE("not initialized", is_initialized);
+  if (permits > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Acquiring too many semaphore permits: %u", permits);
+    return F_FALSE;
+  }
+  int32_t wanted = static_cast<int32_t>(permits);
+  if (futex_semaphore_try_take(&sema, wanted))
+    return F_TRUE;
+  if (timeout.is_instant())
+    return F_FALSE;
+  uint64_t deadline = NativeFutex::deadline_after(timeout);
+  // Register as a waiter before looking at the count again. Release adds to
+  // the count and reads the waiters in one atomic step so either we see the
+  // new count or the releaser sees us and wakes us.
+  int64_t units = kSemaphoreWaiterUnit
+      + ((wanted > 1) ? kSemaphoreWideWaiterUnit : 0);
+  futex_semaphore_add_waiter(&sema, units);
+  atomic_int32_t *word = semaphore_count_word(&sema);
+  fat_bool_t result = F_TRUE;
+  while (true) {
+    int64_t state = sema.state;
+    int32_t count = semaphore_state_count(state);
+    if (count >= wanted) {
+      if (__sync_bool_compare_and_swap(&sema.state, state, state - wanted))
+        break;
+      continue;
+    }
+    // If the count changes between reading it and blocking the kernel notices
+    // and returns immediately so no wakeups are lost.
+    if (!NativeFutex::wait_until(word, count, deadline)) {
+      result = F_FALSE;
+      break;
+    }
+    // A wide waiter that started waiting after a release decided who to
+    // wake can take one of the wakes meant for single permit waiters without
+    // being able to use it. If that may have happened pass it on.
+    int64_t now = sema.state;
+    int32_t now_count = semaphore_state_count(now);
+    if (wanted > 1 && now_count > 0 && now_count < wanted
+        && semaphore_state_waiters(now) > semaphore_state_wide_waiters(now))
+      NativeFutex::wake(word, 1);
+  }
+  __sync_fetch_and_sub(&sema.state, units);
+  return result;
+}
+
+fat_bool_t NativeSemaphore::release(uint32_t permits) {
+  CHECK_TRUE("not initialized", is_initialized);
+  if (permits == 0)
+    return F_TRUE;
+  if (permits > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Releasing too many semaphore permits: %u", permits);
+    return F_FALSE;
+  }
+  // Once the permits have been added a waiter may take them and dispose the
+  // semaphore so after this only the kernel gets to look at the count word.
+  atomic_int32_t *word = semaphore_count_word(&sema);
+  int64_t state;
+  while (true) {
+    state = sema.state;
+    // Going past INT_MAX would make the count negative, and past the low 32
+    // bits would carry into the waiters.
+    int32_t count = semaphore_state_count(state);
+    if (count > INT_MAX - static_cast<int32_t>(permits)) {
+      WARN("Semaphore count overflow releasing %u permits", permits);
+      return F_FALSE;
+    }
+    if (__sync_bool_compare_and_swap(&sema.state, state,
+        state + static_cast<int64_t>(permits)))
+      break;
+  }
+  if (semaphore_state_waiters(state) == 0)
+    return F_TRUE;
+  // If everyone is waiting for a single permit we wake exactly as many as we
+  // released. If someone wants more than one we can't tell who can be
+  // satisfied by the new count so everyone gets a chance to look.
+  return (semaphore_state_wide_waiters(state) == 0)
+      ? NativeFutex::wake(word, static_cast<int32_t>(permits))
+      : NativeFutex::wake_all(word);
+}
@@ -3,48 +3,60 @@
 
 // Mach looks like it supports posix-style unnamed semaphores through the posix
 // api but actually it doesn't, the calls fail.
+//
+// Here they're only the doorbell that waiters block on, the permits are
+// counted in semaphore.cc.
 
 #include "utils/clock.hh"
 
-bool NativeSemaphore::platform_initialize() {
-  kern_return_t result = semaphore_create(mach_task_self(), &sema,
-      SYNC_POLICY_FIFO, initial_count);
+static fat_bool_t semaphore_doorbell_initialize(platform_semaphore_t *sema) {
+  kern_return_t result = semaphore_create(mach_task_self(), &sema->doorbell,
+      SYNC_POLICY_FIFO, 0);
   if (result == KERN_SUCCESS)
-    return true;
+    return F_TRUE;
   WARN("Call to semaphore_create failed: %i", result);
-  return false;
+  return F_FALSE;
 }
 
-bool NativeSemaphore::platform_dispose() {
-  kern_return_t result = semaphore_destroy(mach_task_self(), sema);
+static fat_bool_t semaphore_doorbell_dispose(platform_semaphore_t *sema) {
+  kern_return_t result = semaphore_destroy(mach_task_self(), sema->doorbell);
   if (result != KERN_SUCCESS) {
     WARN("Call to semaphore_destroy failed: %i", result);
-    return false;
+    return F_FALSE;
   }
-  return true;
+  return F_TRUE;
 }
 
-bool NativeSemaphore::acquire(Duration timeout) {
+static fat_bool_t semaphore_doorbell_wait(platform_semaphore_t *sema,
+    uint64_t deadline) {
   kern_return_t result;
-  if (timeout.is_unlimited()) {
-    result = semaphore_wait(sema);
-  } else {
-    // Unlike sem_timedwait on posix, semaphore_timedwait takes the time to
-    // wait, not the deadline, so constructing the timespec is simpler here.
-    NativeTime time = NativeTime::zero() + timeout;
-    result = semaphore_timedwait(sema, time.to_platform());
-  }
+  do {
+    // Being interrupted doesn't take a ring so just wait again.
+    Duration left = semaphore_time_left(deadline);
+    if (left.is_unlimited()) {
+      result = semaphore_wait(sema->doorbell);
+    } else {
+      // Unlike sem_timedwait on posix, semaphore_timedwait takes the time to
+      // wait, not the deadline, so constructing the timespec is simpler here.
+      NativeTime time = NativeTime::zero() + left;
+      result = semaphore_timedwait(sema->doorbell, time.to_platform());
+    }
+  } while (result == KERN_ABORTED);
   if (result == KERN_SUCCESS)
-    return true;
+    return F_TRUE;
   if (result != KERN_OPERATION_TIMED_OUT)
     WARN("Waiting for semaphore failed: %i", result);
-  return false;
+  return F_FALSE;
 }
 
-bool NativeSemaphore::release() {
-  kern_return_t result = semaphore_signal(sema);
-  if (result == KERN_SUCCESS)
-    return true;
-  WARN("Call to semaphore_signal failed: %i", result);
-  return false;
+static fat_bool_t semaphore_doorbell_ring(platform_semaphore_t *sema,
+    int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    kern_return_t result = semaphore_signal(sema->doorbell);
+    if (result != KERN_SUCCESS) {
+      WARN("Call to semaphore_signal failed: %i", result);
+      return F_FALSE;
+    }
+  }
+  return F_TRUE;
 }
@@ -3,23 +3,26 @@
 
 #include "c/winhdr.h"
 
-fat_bool_t NativeSemaphore::platform_initialize() {
+// Windows semaphores are only the doorbell that waiters block on, the permits
+// are counted in semaphore.cc.
+
+static fat_bool_t semaphore_doorbell_initialize(platform_semaphore_t *sema) {
   handle_t result = CreateSemaphore(
       NULL, // lpSemaphoreAttributes
-      initial_count, // lInitialCount
+      0, // lInitialCount
       0x7FFFFFFF, // lMaximumCount
       NULL); // lpName
   if (result == NULL) {
     WARN("Call to CreateSemaphore failed: %i", GetLastError());
     return F_FALSE;
   }
-  sema = result;
+  sema->doorbell = result;
   return F_TRUE;
 }
 
-fat_bool_t NativeSemaphore::platform_dispose() {
-  if (sema != INVALID_HANDLE_VALUE) {
-    if (!CloseHandle(sema)) {
+static fat_bool_t semaphore_doorbell_dispose(platform_semaphore_t *sema) {
+  if (sema->doorbell != INVALID_HANDLE_VALUE) {
+    if (!CloseHandle(sema->doorbell)) {
       WARN("Call to CloseHandle failed: %i", GetLastError());
       return F_FALSE;
     }
@@ -27,8 +30,10 @@ fat_bool_t NativeSemaphore::platform_dispose() {
   return F_TRUE;
 }
 
-fat_bool_t NativeSemaphore::acquire(Duration timeout) {
-  dword_t result = WaitForSingleObject(sema, timeout.to_winapi_millis());
+static fat_bool_t semaphore_doorbell_wait(platform_semaphore_t *sema,
+    uint64_t deadline) {
+  dword_t result = WaitForSingleObject(sema->doorbell,
+      semaphore_time_left(deadline).to_winapi_millis());
   if (result == WAIT_OBJECT_0)
     return F_TRUE;
   if (result == WAIT_FAILED)
@@ -36,11 +41,12 @@ fat_bool_t NativeSemaphore::acquire(Duration timeout) {
   return F_FALSE;
 }
 
-fat_bool_t NativeSemaphore::release() {
+static fat_bool_t semaphore_doorbell_ring(platform_semaphore_t *sema,
+    int32_t count) {
   bool result = ReleaseSemaphore(
-      sema,  // hSemaphore
-      1,     // lReleaseCount
-      NULL); // lpPreviousCount
+      sema->doorbell, // hSemaphore
+      count,          // lReleaseCount
+      NULL);          // lpPreviousCount
   if (result)
     return F_TRUE;
   WARN("Call to ReleaseSemaphore failed: %i", GetLastError());
@@ -9,49 +9,54 @@
 // Posix semaphores are different from the other concurrency primitives in that
 // they return error codes through errno instead of their result values which
 // will always be -1 on errors. It's okay though, errno should be thread safe.
+//
+// Here they're only the doorbell that waiters block on, the permits are
+// counted in semaphore.cc.
 
-fat_bool_t NativeSemaphore::platform_initialize() {
-  int result = sem_init(&sema, false, initial_count);
+static fat_bool_t semaphore_doorbell_initialize(platform_semaphore_t *sema) {
+  int result = sem_init(&sema->doorbell, false, 0);
   if (result == 0)
     return F_TRUE;
   WARN("Call to sem_init failed: %i (error: %s)", result, strerror(errno));
   return F_FALSE;
 }
 
-fat_bool_t NativeSemaphore::platform_dispose() {
-  int result = sem_destroy(&sema);
+static fat_bool_t semaphore_doorbell_dispose(platform_semaphore_t *sema) {
+  int result = sem_destroy(&sema->doorbell);
   if (result != 0)
     WARN("Call to sem_destroy failed: %i (error: %s)", result, strerror(errno));
   return F_BOOL(result == 0);
 }
 
-fat_bool_t NativeSemaphore::acquire(Duration timeout) {
-  CHECK_TRUE("not initialized", is_initialized);
+static fat_bool_t semaphore_doorbell_wait(platform_semaphore_t *sema,
+    uint64_t deadline) {
   int result;
-  errno = 0;
-  if (timeout.is_unlimited()) {
-    result = sem_wait(&sema);
-  } else if (timeout.is_instant()) {
-    result = sem_trywait(&sema);
-  } else {
-    NativeTime current = RealTimeClock::system()->time_since_epoch_utc();
-    NativeTime deadline = current + timeout;
-    result = sem_timedwait(&sema, &deadline.to_platform());
-  }
+  do {
+    // Being interrupted by a signal doesn't take a ring so just wait again.
+    Duration left = semaphore_time_left(deadline);
+    errno = 0;
+    if (left.is_unlimited()) {
+      result = sem_wait(&sema->doorbell);
+    } else {
+      NativeTime time = RealTimeClock::system()->time_since_epoch_utc() + left;
+      result = sem_timedwait(&sema->doorbell, &time.to_platform());
+    }
+  } while (result != 0 && errno == EINTR);
   if (result == 0)
     return F_TRUE;
-  if (errno != ETIMEDOUT && errno != EAGAIN)
-    // Timing out or unavailability is fine so only warn if it's a different
-    // error.
+  if (errno != ETIMEDOUT)
     WARN("Waiting for semaphore failed: %i (error: %s)", result, strerror(errno));
   return F_FALSE;
 }
 
-fat_bool_t NativeSemaphore::release() {
-  CHECK_TRUE("not initialized", is_initialized);
-  int result = sem_post(&sema);
-  if (result == 0)
-    return F_TRUE;
-  WARN("Call to sem_post failed: %i (error: %s)", result, strerror(errno));
-  return F_FALSE;
+static fat_bool_t semaphore_doorbell_ring(platform_semaphore_t *sema,
+    int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    int result = sem_post(&sema->doorbell);
+    if (result != 0) {
+      WARN("Call to sem_post failed: %i (error: %s)", result, strerror(errno));
+      return F_FALSE;
+    }
+  }
+  return F_TRUE;
 }
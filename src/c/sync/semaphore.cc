@@ -3,18 +3,40 @@
 
 #include "sync/semaphore.hh"
 
+#include "sync/contention.hh"
+#include "sync/futex.hh"
+#include "sync/thread.hh"
+
 BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "utils/clock.h"
 #include "utils/log.h"
 #include "sync/semaphore.h"
 END_C_INCLUDES
 
+#include <limits.h>
 #include <new>
 
 using namespace tclib;
 
+#ifndef IS_LINUX
+// Returns the time left until the given deadline, as returned by
+// NativeFutex::deadline_after. Rounds up since waking just before the deadline
+// would only mean waiting again.
+static Duration semaphore_time_left(uint64_t deadline) {
+  if (deadline == NativeFutex::kNoDeadline)
+    return Duration::unlimited();
+  uint64_t now = monotonic_clock_nanos();
+  uint64_t left = (now >= deadline) ? 0 : (deadline - now + 999999) / 1000000;
+  return Duration::millis(left);
+}
+#endif
+
 #ifdef IS_GCC
-#  ifdef IS_MACH
+#  if defined(IS_MACH)
 #    include "semaphore-mach.cc"
+#  elif defined(IS_LINUX)
+#    include "semaphore-linux.cc"
 #  else
 #    include "semaphore-posix.cc"
 #  endif
@@ -24,9 +46,226 @@ using namespace tclib;
 #  include "semaphore-msvc.cc"
 #endif
 
+#ifndef IS_LINUX
+
+// Except on linux, where they're built directly on futexes, semaphores count
+// their permits in user space next to the number of waiters and use the
+// platform's semaphore only as a doorbell that waiters block on. Taking any
+// number of permits is then a single compare-and-swap on the count so no
+// thread ever holds some of the permits it wants while it blocks for the rest.
+// Releasing only takes atomics and a call to ring the doorbell so it's still
+// safe from signal handlers (see ProcessRegistry::handle_signal).
+//
+// A release that finds waiters bumps the epoch and rings once for each of
+// them; there's no telling which of them the new count satisfies so they all
+// get to look. Rings aren't addressed though so a waiter that can't use the
+// count and blocks again may take one meant for someone else. Each waiter
+// knows how many rings it's owed from how far the epoch has moved since it
+// started waiting so it can tell when that happens and ring again for whoever
+// it took it from.
+
+// The units the waiters and the epoch are kept in within the state.
+static const uint64_t kSemaphoreWaiterUnit = static_cast<uint64_t>(1) << 32;
+static const uint64_t kSemaphoreEpochUnit = static_cast<uint64_t>(1) << 48;
+
+// The most waiters the state has room for.
+static const int32_t kSemaphoreMaxWaiters = 0xFFFF;
+
+// Returns the number of permits in the given state.
+static int32_t semaphore_state_count(int64_t state) {
+  return static_cast<int32_t>(state & 0xFFFFFFFF);
+}
+
+// Returns the number of waiters in the given state.
+static int32_t semaphore_state_waiters(int64_t state) {
+  return static_cast<int32_t>((state >> 32) & 0xFFFF);
+}
+
+// Returns the epoch of the given state.
+static uint16_t semaphore_state_epoch(int64_t state) {
+  return static_cast<uint16_t>((state >> 48) & 0xFFFF);
+}
+
+// Returns the given state with the given units added. The epoch wraps so this
+// is done unsigned.
+static int64_t semaphore_state_add(int64_t state, uint64_t units) {
+  return static_cast<int64_t>(static_cast<uint64_t>(state) + units);
+}
+
+// Returns the semaphore's state as an atomic. sync.h can't depend on atomic.h
+// so the field is a plain int64_t but it's laid out the same.
+static atomic_int64_t *semaphore_state(platform_semaphore_t *sema) {
+  return reinterpret_cast<atomic_int64_t*>(const_cast<int64_t*>(&sema->state));
+}
+
+// Returns the semaphore's ringer count as an atomic.
+static atomic_int32_t *semaphore_ringers(platform_semaphore_t *sema) {
+  return reinterpret_cast<atomic_int32_t*>(
+      const_cast<int32_t*>(&sema->ringers));
+}
+
+// Attempts to take the given number of permits without blocking. Only fails if
+// there aren't enough permits, contention from other threads just causes it to
+// try again.
+static bool counted_semaphore_try_take(platform_semaphore_t *sema,
+    int32_t permits) {
+  atomic_int64_t *state = semaphore_state(sema);
+  int64_t current = atomic_int64_load(state, moAcquire);
+  while (true) {
+    if (semaphore_state_count(current) < permits)
+      return false;
+    if (atomic_int64_compare_exchange(state, &current, current - permits,
+        moSeqCst))
+      return true;
+  }
+}
+
+// Registers the caller as waiting, returning the epoch it started waiting in.
+// If the waiter count is full there's no room to register so it yields until
+// someone leaves instead; adding anyway would carry into the epoch.
+static uint16_t counted_semaphore_add_waiter(platform_semaphore_t *sema) {
+  atomic_int64_t *state = semaphore_state(sema);
+  int64_t current = atomic_int64_load(state, moAcquire);
+  while (true) {
+    if (semaphore_state_waiters(current) >= kSemaphoreMaxWaiters) {
+      NativeThread::yield();
+      current = atomic_int64_load(state, moAcquire);
+      continue;
+    }
+    if (atomic_int64_compare_exchange(state, &current,
+        semaphore_state_add(current, kSemaphoreWaiterUnit), moSeqCst))
+      return semaphore_state_epoch(current);
+  }
+}
+
+// Unregisters the caller as waiting, returning the epoch it stopped waiting in.
+static uint16_t counted_semaphore_remove_waiter(platform_semaphore_t *sema) {
+  int64_t previous = atomic_int64_fetch_add(semaphore_state(sema),
+      -static_cast<int64_t>(kSemaphoreWaiterUnit), moSeqCst);
+  return semaphore_state_epoch(previous);
+}
+
+fat_bool_t NativeSemaphore::platform_initialize() {
+  if (initial_count > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Initial semaphore count too large: %u", initial_count);
+    return F_FALSE;
+  }
+  atomic_int64_store(semaphore_state(&sema), initial_count, moSeqCst);
+  atomic_int32_store(semaphore_ringers(&sema), 0, moSeqCst);
+  return semaphore_doorbell_initialize(&sema);
+}
+
+fat_bool_t NativeSemaphore::platform_dispose() {
+  CHECK_EQ("disposing semaphore with waiters", 0,
+      semaphore_state_waiters(atomic_int64_load(semaphore_state(&sema),
+          moAcquire)));
+  // A releaser may have handed its permits to a waiter that's now disposing
+  // the semaphore before it's done ringing the doorbell. Ringing is short so
+  // wait for it rather than pull the doorbell out from under it.
+  while (atomic_int32_load(semaphore_ringers(&sema), moAcquire) > 0)
+    NativeThread::yield();
+  return semaphore_doorbell_dispose(&sema);
+}
+
+fat_bool_t NativeSemaphore::platform_acquire(uint32_t permits, Duration timeout) {
+  CHECK_TRUE("not initialized", is_initialized);
+  if (permits > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Acquiring too many semaphore permits: %u", permits);
+    return F_FALSE;
+  }
+  int32_t wanted = static_cast<int32_t>(permits);
+  if (counted_semaphore_try_take(&sema, wanted))
+    return F_TRUE;
+  if (timeout.is_instant())
+    return F_FALSE;
+  // The deadline is fixed up front so being woken without getting the permits
+  // doesn't extend the wait.
+  uint64_t deadline = NativeFutex::deadline_after(timeout);
+  // Register as a waiter before looking at the count again. Release adds to
+  // the count and reads the waiters in one atomic step so either we see the
+  // new count or the releaser sees us and rings for us. Rings aren't lost, the
+  // doorbell counts them.
+  uint16_t start = counted_semaphore_add_waiter(&sema);
+  uint16_t rings = 0;
+  fat_bool_t result = F_TRUE;
+  while (!counted_semaphore_try_take(&sema, wanted)) {
+    if (!semaphore_doorbell_wait(&sema, deadline)) {
+      result = F_BOOL(counted_semaphore_try_take(&sema, wanted));
+      break;
+    }
+    rings++;
+    uint16_t owed = static_cast<uint16_t>(semaphore_state_epoch(
+        atomic_int64_load(semaphore_state(&sema), moAcquire)) - start);
+    if (rings != owed && static_cast<uint16_t>(rings - owed) < 0x8000) {
+      // We've had more rings than there have been releases since we started
+      // waiting so this one was someone else's. Pass it on and give them a
+      // chance to take it before we block again.
+      semaphore_doorbell_ring(&sema, 1);
+      rings--;
+      NativeThread::yield();
+    }
+  }
+  // Rings meant for us that we don't take would be taken later by waiters that
+  // aren't owed them. They have been or are about to be rung so this doesn't
+  // block for long.
+  uint16_t owed = static_cast<uint16_t>(
+      counted_semaphore_remove_waiter(&sema) - start);
+  for (; rings != owed; rings++)
+    semaphore_doorbell_wait(&sema, NativeFutex::kNoDeadline);
+  return result;
+}
+
+fat_bool_t NativeSemaphore::release(uint32_t permits) {
+  CHECK_TRUE("not initialized", is_initialized);
+  if (permits == 0)
+    return F_TRUE;
+  if (permits > static_cast<uint32_t>(INT_MAX)) {
+    WARN("Releasing too many semaphore permits: %u", permits);
+    return F_FALSE;
+  }
+  atomic_int64_t *state = semaphore_state(&sema);
+  atomic_int32_t *ringers = semaphore_ringers(&sema);
+  int64_t current = atomic_int64_load(state, moAcquire);
+  bool is_ringer = false;
+  while (true) {
+    // Going past INT_MAX would make the count negative, and past the low 32
+    // bits would carry into the waiters.
+    int32_t count = semaphore_state_count(current);
+    if (count > INT_MAX - static_cast<int32_t>(permits)) {
+      WARN("Semaphore count overflow releasing %u permits", permits);
+      if (is_ringer)
+        atomic_int32_fetch_add(ringers, -1, moSeqCst);
+      return F_FALSE;
+    }
+    uint64_t units = permits;
+    if (semaphore_state_waiters(current) > 0) {
+      // We'll be ringing after the waiters may have taken the permits and
+      // disposed the semaphore so we have to say so before adding them.
+      if (!is_ringer) {
+        atomic_int32_fetch_add(ringers, 1, moSeqCst);
+        is_ringer = true;
+      }
+      units += kSemaphoreEpochUnit;
+    }
+    if (atomic_int64_compare_exchange(state, &current,
+        semaphore_state_add(current, units), moSeqCst))
+      break;
+  }
+  int32_t waiters = semaphore_state_waiters(current);
+  fat_bool_t result = F_TRUE;
+  if (waiters > 0)
+    result = semaphore_doorbell_ring(&sema, waiters);
+  if (is_ringer)
+    atomic_int32_fetch_add(ringers, -1, moSeqCst);
+  return result;
+}
+
+#endif // IS_LINUX
+
 NativeSemaphore::NativeSemaphore() {
   initial_count = 1;
   is_initialized = false;
+  profile_name = NULL;
 #ifdef kNativeSemaphoreInit
   native_semaphore_t init = kNativeSemaphoreInit;
   sema = init;
@@ -36,6 +275,7 @@ NativeSemaphore::NativeSemaphore() {
 NativeSemaphore::NativeSemaphore(uint32_t count) {
   initial_count = count;
   is_initialized = false;
+  profile_name = NULL;
 #ifdef kNativeSemaphoreInit
   native_semaphore_t init = kNativeSemaphoreInit;
   sema = init;
@@ -46,6 +286,9 @@ NativeSemaphore::~NativeSemaphore() {
   if (!is_initialized)
     return;
   is_initialized = false;
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler != NULL)
+    profiler->forget(ckSemaphore, this, profile_name);
   platform_dispose();
 }
 
@@ -57,6 +300,27 @@ fat_bool_t NativeSemaphore::initialize() {
   return F_TRUE;
 }
 
+fat_bool_t NativeSemaphore::acquire(Duration timeout) {
+  return acquire(1, timeout);
+}
+
+fat_bool_t NativeSemaphore::acquire(uint32_t permits, Duration timeout) {
+  ContentionProfiler *profiler = ContentionProfiler::current();
+  if (profiler == NULL)
+    return platform_acquire(permits, timeout);
+  // Try without blocking first so we can tell whether there was contention.
+  fat_bool_t result = platform_acquire(permits, Duration::instant());
+  bool contended = !result;
+  uint64_t waited = 0;
+  if (contended && !timeout.is_instant()) {
+    uint64_t start = monotonic_clock_nanos();
+    result = platform_acquire(permits, timeout);
+    waited = monotonic_clock_nanos() - start;
+  }
+  profiler->record_acquire(ckSemaphore, this, profile_name, contended, waited);
+  return result;
+}
+
 fat_bool_t NativeSemaphore::try_acquire() {
   return acquire(Duration::instant());
 }
@@ -82,6 +346,11 @@ bool native_semaphore_acquire(native_semaphore_t *sema, duration_t timeout) {
   return static_cast<NativeSemaphore*>(sema)->acquire(timeout);
 }
 
+bool native_semaphore_acquire_many(native_semaphore_t *sema, uint32_t permits,
+    duration_t timeout) {
+  return static_cast<NativeSemaphore*>(sema)->acquire(permits, timeout);
+}
+
 bool native_semaphore_try_acquire(native_semaphore_t *sema) {
   return static_cast<NativeSemaphore*>(sema)->try_acquire();
 }
@@ -90,6 +359,10 @@ bool native_semaphore_release(native_semaphore_t *sema) {
   return static_cast<NativeSemaphore*>(sema)->release();
 }
 
+bool native_semaphore_release_many(native_semaphore_t *sema, uint32_t permits) {
+  return static_cast<NativeSemaphore*>(sema)->release(permits);
+}
+
 void native_semaphore_dispose(native_semaphore_t *sema) {
   static_cast<NativeSemaphore*>(sema)->~NativeSemaphore();
 }
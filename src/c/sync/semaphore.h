@@ -15,6 +15,9 @@ typedef struct {
   bool is_initialized;
   // Platform-specific data.
   platform_semaphore_t sema;
+  // The name this semaphore is reported under by the contention profiler. If
+  // it's NULL the semaphore is reported individually.
+  const char *profile_name;
 } native_semaphore_t;
 
 // Construct a new uninitialized semaphore with an initial count of 1.
@@ -35,6 +38,12 @@ bool native_semaphore_initialize(native_semaphore_t *sema);
 // given duration if necessary.
 bool native_semaphore_acquire(native_semaphore_t *sema, duration_t timeout);
 
+// Attempt to acquire the given number of permits from the given semaphore,
+// blocking up to the given duration if necessary. Either all the permits are
+// acquired or none of them are.
+bool native_semaphore_acquire_many(native_semaphore_t *sema, uint32_t permits,
+    duration_t timeout);
+
 // Attempt to acquire a permit from the given semaphore but will not wait if no
 // permits are available. Shorthand for native_semaphore_acquire(sema,
 // duration_instant()).
@@ -43,6 +52,9 @@ bool native_semaphore_try_acquire(native_semaphore_t *sema);
 // Release a permit to the given semaphore.
 bool native_semaphore_release(native_semaphore_t *sema);
 
+// Release the given number of permits to the given semaphore.
+bool native_semaphore_release_many(native_semaphore_t *sema, uint32_t permits);
+
 // Dispose the given semaphore.
 void native_semaphore_dispose(native_semaphore_t *sema);
 
@@ -39,14 +39,27 @@ public:
   // duration if necessary.
   fat_bool_t acquire(Duration timeout = Duration::unlimited());
 
+  // Attempt to acquire the given number of permits from this semaphore,
+  // blocking up to the given duration if necessary. Either all the permits are
+  // acquired or none of them are.
+  fat_bool_t acquire(uint32_t permits, Duration timeout = Duration::unlimited());
+
   // Attempt to acquire a permit from this semaphore but will not wait if no
   // permits are available. Shorthand for acquire(duration_instant()).
   fat_bool_t try_acquire();
 
-  // Release a permit to this semaphore.
-  fat_bool_t release();
+  // Release the given number of permits to this semaphore, by default one.
+  // Releasing n permits at once is cheaper than releasing one n times.
+  fat_bool_t release(uint32_t permits = 1);
+
+  // Sets the name this semaphore is reported under by the contention profiler.
+  // The name is not copied so it should typically be a literal.
+  void set_profile_name(const char *name) { profile_name = name; }
 
 private:
+  // Platform-specific acquisition, without profiling.
+  fat_bool_t platform_acquire(uint32_t permits, Duration timeout);
+
   // Platform-specific initialization.
   fat_bool_t platform_initialize();
 
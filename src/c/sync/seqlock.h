@@ -0,0 +1,111 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Sequence locks for small read-mostly data.
+//
+// A seqlock protects data with a sequence number that is odd while a write is
+// in progress. Readers never write to shared memory: they read the sequence,
+// copy the data, and read the sequence again. If it changed, or was odd to
+// begin with, they raced with a writer and try again. That makes reads scale
+// with the number of cores where a mutex would have them all contend for the
+// same cache line, at the cost of writers being able to starve readers. Only
+// use it for data that is small, cheap to copy, and rarely written.
+//
+// The data is read while it may be being written so readers must only copy it
+// out, never follow pointers in it, and must not use the copy until the read
+// has been validated.
+
+#ifndef _TCLIB_SEQLOCK_H
+#define _TCLIB_SEQLOCK_H
+
+#include "c/stdc.h"
+
+#include "sync/atomic-inl.h"
+#include "sync/atomic.h"
+
+// A sequence lock. Clearing it to zeroes is a valid way to initialize it.
+typedef struct {
+  // Even when the data is stable, odd while a write is in progress.
+  atomic_int64_t sequence;
+} seqlock_t;
+
+// Initializes the given seqlock.
+static always_inline void seqlock_init(seqlock_t *lock) {
+  lock->sequence = atomic_int64_new(0);
+}
+
+// Begins a read, returning the sequence number to pass to seqlock_read_retry
+// once the data has been read. Waits for any write in progress to complete.
+static always_inline int64_t seqlock_read_begin(seqlock_t *lock) {
+  while (true) {
+    int64_t sequence = atomic_int64_load(&lock->sequence, moAcquire);
+    if ((sequence & 1) == 0)
+      return sequence;
+    atomic_spin_pause();
+  }
+}
+
+// Returns true if the data read since the given sequence number was returned
+// by seqlock_read_begin may be inconsistent, in which case the read must be
+// retried.
+static always_inline bool seqlock_read_retry(seqlock_t *lock,
+    int64_t sequence) {
+  // The reads of the data must not be moved after the second read of the
+  // sequence.
+  atomic_fence(moAcquire);
+  return atomic_int64_load(&lock->sequence, moRelaxed) != sequence;
+}
+
+// Begins a write. Writers exclude each other so there's no need for a separate
+// lock to serialize them, but they spin rather than block so writes should be
+// short.
+static always_inline void seqlock_write_begin(seqlock_t *lock) {
+  int64_t sequence = atomic_int64_load(&lock->sequence, moRelaxed);
+  while (true) {
+    if ((sequence & 1) == 0
+        && atomic_int64_compare_exchange(&lock->sequence, &sequence,
+            sequence + 1, moAcquire))
+      break;
+    atomic_spin_pause();
+    sequence = atomic_int64_load(&lock->sequence, moRelaxed);
+  }
+  // The writes to the data must not be moved before the sequence becomes odd.
+  atomic_fence(moRelease);
+}
+
+// Ends a write begun with seqlock_write_begin.
+static always_inline void seqlock_write_end(seqlock_t *lock) {
+  atomic_int64_fetch_add(&lock->sequence, 1, moRelease);
+}
+
+// Copies size bytes from src, which is protected by the given lock, to dest
+// such that the copy is consistent. The size must be a multiple of the word
+// size and both pointers must be word aligned.
+static always_inline void seqlock_read_words(seqlock_t *lock, void *dest,
+    const void *src, size_t size) {
+  const volatile address_arith_t *from = (const volatile address_arith_t*) src;
+  address_arith_t *to = (address_arith_t*) dest;
+  size_t count = size / sizeof(address_arith_t);
+  int64_t sequence;
+  do {
+    sequence = seqlock_read_begin(lock);
+    for (size_t i = 0; i < count; i++)
+      to[i] = from[i];
+  } while (seqlock_read_retry(lock, sequence));
+}
+
+// Copies size bytes from src to dest, which is protected by the given lock,
+// such that readers never see a partial update. The same restrictions apply
+// as for seqlock_read_words.
+static always_inline void seqlock_write_words(seqlock_t *lock, void *dest,
+    const void *src, size_t size) {
+  const address_arith_t *from = (const address_arith_t*) src;
+  volatile address_arith_t *to = (volatile address_arith_t*) dest;
+  size_t count = size / sizeof(address_arith_t);
+  seqlock_write_begin(lock);
+  for (size_t i = 0; i < count; i++)
+    to[i] = from[i];
+  seqlock_write_end(lock);
+}
+
+#endif // _TCLIB_SEQLOCK_H
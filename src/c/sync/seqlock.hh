@@ -0,0 +1,78 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_SEQLOCK_HH
+#define _TCLIB_SEQLOCK_HH
+
+#include "c/stdc.h"
+
+BEGIN_C_INCLUDES
+#include "sync/seqlock.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+// A sequence lock, see seqlock.h for how it works. Unlike the other primitives
+// this one needs no initialization beyond construction and no disposal.
+class SeqLock : public seqlock_t {
+public:
+  SeqLock() { seqlock_init(this); }
+
+  // Begins a read, returning the sequence number to validate it against.
+  int64_t read_begin() { return seqlock_read_begin(this); }
+
+  // Returns true if the read that began with the given sequence number must be
+  // retried.
+  bool read_retry(int64_t sequence) {
+    return seqlock_read_retry(this, sequence);
+  }
+
+  // Begins a write.
+  void write_begin() { seqlock_write_begin(this); }
+
+  // Ends a write.
+  void write_end() { seqlock_write_end(this); }
+};
+
+// A snapshot value protected by a seqlock. Reading returns a consistent copy
+// without ever writing to shared memory. The type must be plain data since
+// it's copied as raw memory, possibly while it's being overwritten.
+template <typename T>
+class SeqLocked {
+public:
+  SeqLocked() {
+    T value = T();
+    set(value);
+  }
+
+  explicit SeqLocked(const T &value) { set(value); }
+
+  // Returns a consistent copy of the current value.
+  T get() {
+    address_arith_t snapshot[kWordCount];
+    seqlock_read_words(&lock_, snapshot, storage_, sizeof(storage_));
+    T result;
+    memcpy(&result, snapshot, sizeof(T));
+    return result;
+  }
+
+  // Replaces the current value.
+  void set(const T &value) {
+    address_arith_t words[kWordCount];
+    memset(words, 0, sizeof(words));
+    memcpy(words, &value, sizeof(T));
+    seqlock_write_words(&lock_, storage_, words, sizeof(storage_));
+  }
+
+private:
+  // The value is stored as whole words so it can be copied a word at a time.
+  static const size_t kWordCount = (sizeof(T) + sizeof(address_arith_t) - 1)
+      / sizeof(address_arith_t);
+
+  SeqLock lock_;
+  address_arith_t storage_[kWordCount];
+};
+
+} // namespace tclib
+
+#endif // _TCLIB_SEQLOCK_HH
@@ -0,0 +1,19 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync-posix.h"
+
+// Linux semaphores are built directly on futexes rather than posix semaphores,
+// see semaphore-linux.cc. Same trick as on mach: this isn't a public header so
+// it's okay.
+#define platform_semaphore_t linux_platform_semaphore_t
+typedef struct {
+  // The number of permits currently available in the low 32 bits, the number
+  // of threads that are, or are about to be, blocked in the kernel in the next
+  // 16, and how many of those are waiting for more than one permit in the top
+  // 16. The count half is also the futex word that waiters block on. Keeping
+  // everything in one word means releasing sees the waiters in the same atomic
+  // step that adds the permits and doesn't have to touch the semaphore again
+  // after a waiter may have taken them and disposed it.
+  volatile int64_t state;
+} linux_platform_semaphore_t;
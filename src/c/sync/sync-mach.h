@@ -8,7 +8,17 @@
 
 // This is yucky but this isn't a public header so I'll allow it.
 #define platform_semaphore_t mach_platform_semaphore_t
-typedef semaphore_t mach_platform_semaphore_t;
+typedef struct {
+  // The number of permits currently available in the low 32 bits, the number
+  // of threads that are, or are about to be, blocked on the doorbell in the
+  // next 16, and the number of releases that found waiters, wrapping, in the
+  // top 16.
+  volatile int64_t state;
+  // The number of releasers that may still ring the doorbell.
+  volatile int32_t ringers;
+  // Rung once for every waiter when permits are released.
+  semaphore_t doorbell;
+} mach_platform_semaphore_t;
 
 #undef platform_time_t
 #define platform_time_t struct mach_timespec
@@ -14,12 +14,28 @@ typedef byte_t platform_mutex_t[IF_32_BIT(24, 40)];
 #define kPlatformMutexChecksConsistency false
 #define get_platform_mutex(MUTEX) (reinterpret_cast<PCRITICAL_SECTION>(&(MUTEX)->mutex))
 
-typedef void *platform_semaphore_t;
-#define kPlatformSemaphoreInit INVALID_HANDLE_VALUE
+// Except on linux the permit count lives in user space and the platform's
+// semaphore is only a doorbell for waiters to block on, see semaphore.cc.
+typedef struct {
+  // The number of permits currently available in the low 32 bits, the number
+  // of threads that are, or are about to be, blocked on the doorbell in the
+  // next 16, and the number of releases that found waiters, wrapping, in the
+  // top 16.
+  volatile int64_t state;
+  // The number of releasers that may still ring the doorbell.
+  volatile int32_t ringers;
+  // Rung once for every waiter when permits are released.
+  void *doorbell;
+} platform_semaphore_t;
+#define kPlatformSemaphoreInit {0, 0, INVALID_HANDLE_VALUE}
 
 typedef byte_t platform_condition_t[8];
 #define get_platform_condition(COND) (reinterpret_cast<PCONDITION_VARIABLE>(&(COND)->cond))
 
+// A fiber-local storage index, which unlike a plain tls index supports
+// destructors.
+typedef uint32_t platform_thread_local_t;
+
 typedef struct {
   void *read_;
   void *write_;
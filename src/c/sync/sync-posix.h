@@ -14,10 +14,24 @@ typedef pthread_mutex_t platform_mutex_t;
 #define kPlatformMutexInit PTHREAD_MUTEX_INITIALIZER
 #define kPlatformMutexChecksConsistency true
 
-typedef sem_t platform_semaphore_t;
+// Except on linux the permit count lives in user space and the platform's
+// semaphore is only a doorbell for waiters to block on, see semaphore.cc.
+typedef struct {
+  // The number of permits currently available in the low 32 bits, the number
+  // of threads that are, or are about to be, blocked on the doorbell in the
+  // next 16, and the number of releases that found waiters, wrapping, in the
+  // top 16.
+  volatile int64_t state;
+  // The number of releasers that may still ring the doorbell.
+  volatile int32_t ringers;
+  // Rung once for every waiter when permits are released.
+  sem_t doorbell;
+} platform_semaphore_t;
 
 typedef pthread_cond_t platform_condition_t;
 
+typedef pthread_key_t platform_thread_local_t;
+
 typedef int platform_pipe_t[2];
 
 #define platform_time_t struct timespec
@@ -10,8 +10,10 @@
 #include "utils/duration.h"
 
 #ifdef IS_GCC
-# ifdef IS_MACH
+# if defined(IS_MACH)
 #   include "sync-mach.h"
+# elif defined(IS_LINUX)
+#   include "sync-linux.h"
 # else
 #   include "sync-posix.h"
 # endif
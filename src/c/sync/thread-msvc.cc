@@ -23,19 +23,55 @@ unsigned long __stdcall NativeThread::entry_point(void *arg) {
   return 0;
 }
 
+void NativeThread::apply_own_options() {
+  // Thread names can only be set through SetThreadDescription which doesn't
+  // exist on older versions of windows so names are ignored.
+}
+
+// Returns the windows thread priority to use for the given options, or
+// THREAD_PRIORITY_ERROR_RETURN to leave the priority unchanged.
+static int get_windows_priority(const native_thread_options_t &options) {
+  switch (options.policy) {
+    case spIdle: return THREAD_PRIORITY_IDLE;
+    case spFifo: case spRoundRobin: return THREAD_PRIORITY_TIME_CRITICAL;
+    default: break;
+  }
+  if (options.nice < 0)
+    return THREAD_PRIORITY_ABOVE_NORMAL;
+  if (options.nice > 0)
+    return THREAD_PRIORITY_BELOW_NORMAL;
+  return THREAD_PRIORITY_ERROR_RETURN;
+}
+
 fat_bool_t NativeThread::platform_start() {
+  // The guard size can't be controlled, windows always uses a single guard
+  // page. Priority and affinity are set while the thread is suspended so it
+  // never runs without them.
+  DWORD flags = CREATE_SUSPENDED | STACK_SIZE_PARAM_IS_A_RESERVATION;
   handle_t result = CreateThread(
-      NULL,         // lpThreadAttributes
-      0,            // dwStackSize
-      entry_point,  // lpStartAddress
-      this,         // lpParameter
-      0,            // dwCreationFlags
-      NULL);        // lpThreadId
+      NULL,                 // lpThreadAttributes
+      options_.stack_size,  // dwStackSize
+      entry_point,          // lpStartAddress
+      this,                 // lpParameter
+      flags,                // dwCreationFlags
+      NULL);                // lpThreadId
   if (result == NULL) {
     WARN("Call to CreateThread failed: %i", GetLastError());
     return F_FALSE;
   }
   thread_ = result;
+  int priority = get_windows_priority(options_);
+  if (priority != THREAD_PRIORITY_ERROR_RETURN
+      && !SetThreadPriority(thread_, priority))
+    WARN("Call to SetThreadPriority failed: %i", GetLastError());
+  // Only the first 64 cpus can be addressed with a plain affinity mask.
+  DWORD_PTR mask = static_cast<DWORD_PTR>(options_.affinity.bits[0]);
+  if (mask != 0 && SetThreadAffinityMask(thread_, mask) == 0)
+    WARN("Call to SetThreadAffinityMask failed: %i", GetLastError());
+  if (ResumeThread(thread_) == static_cast<DWORD>(-1)) {
+    WARN("Call to ResumeThread failed: %i", GetLastError());
+    return F_FALSE;
+  }
   return F_TRUE;
 }
 
@@ -55,6 +91,13 @@ native_thread_id_t NativeThread::get_current_id() {
   return GetCurrentThreadId();
 }
 
+fat_bool_t NativeThread::get_current_name(char *buf, size_t size) {
+  // Names aren't supported, see apply_own_options.
+  if (size > 0)
+    buf[0] = '\0';
+  return F_TRUE;
+}
+
 fat_bool_t NativeThread::yield() {
   return F_BOOL(SwitchToThread());
 }
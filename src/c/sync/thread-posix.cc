@@ -2,20 +2,160 @@
 //- Licensed under the Apache License, Version 2.0 (see LICENSE).
 
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef IS_LINUX
+#include <sys/syscall.h>
+#endif
 
 #include "thread.hh"
 #include "utils/clock.hh"
+
+BEGIN_C_INCLUDES
+#include "utils/misc-inl.h"
+END_C_INCLUDES
+
 using namespace tclib;
 
+// Returns the pthread scheduling policy that corresponds to the given policy,
+// or -1 if it isn't supported on this platform.
+static int get_pthread_policy(scheduling_policy_t policy) {
+  switch (policy) {
+    case spDefault: return SCHED_OTHER;
+#ifdef IS_LINUX
+    case spBatch: return SCHED_BATCH;
+    case spIdle: return SCHED_IDLE;
+#endif
+    case spFifo: return SCHED_FIFO;
+    case spRoundRobin: return SCHED_RR;
+    default: return -1;
+  }
+}
+
+// Returns true if the given pthread policy is one of the real-time ones, which
+// are set through the thread attributes. Glibc rejects the linux specific
+// policies there so everything else is set by the new thread itself.
+static bool is_realtime_policy(int policy) {
+  return (policy == SCHED_FIFO) || (policy == SCHED_RR);
+}
+
 void *NativeThread::entry_point(void *arg) {
   NativeThread *thread = static_cast<NativeThread*>(arg);
   CHECK_EQ("thread interaction out of order", thread->state_, tsStarted);
+  thread->apply_own_options();
   thread->result_ = (thread->callback_)();
   return NULL;
 }
 
+void NativeThread::apply_own_options() {
+  if (name_[0] != '\0') {
+    int result = IF_MACH(pthread_setname_np(name_),
+        pthread_setname_np(pthread_self(), name_));
+    if (result != 0)
+      WARN("Call to pthread_setname_np failed: %i (error: %s)", result,
+          strerror(result));
+  }
+  int policy = get_pthread_policy(options_.policy);
+  if (options_.policy != spInherit && !is_realtime_policy(policy)) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int result = pthread_setschedparam(pthread_self(), policy, &param);
+    if (result != 0)
+      WARN("Call to pthread_setschedparam failed: %i (error: %s)", result,
+          strerror(result));
+  }
+#ifdef IS_LINUX
+  // Linux is the only one where nice values apply to individual threads, which
+  // are identified by their kernel thread id.
+  if (options_.nice != 0) {
+    id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, options_.nice) != 0)
+      WARN("Call to setpriority failed: %s", strerror(errno));
+  }
+#endif
+}
+
+// Configures the given attributes according to the given options.
+static fat_bool_t configure_thread_attributes(pthread_attr_t *attr,
+    const native_thread_options_t &options) {
+  int result = 0;
+  if (options.stack_size != 0) {
+    // Asking for less than the minimum fails so round up rather than make the
+    // caller figure out what the minimum is.
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t stack_size = max_size(align_size(page_size, options.stack_size),
+        static_cast<size_t>(PTHREAD_STACK_MIN));
+    if ((result = pthread_attr_setstacksize(attr, stack_size)) != 0) {
+      WARN("Call to pthread_attr_setstacksize failed: %i (error: %s)", result,
+          strerror(result));
+      return F_FALSE;
+    }
+  }
+  if (options.guard_size != 0) {
+    if ((result = pthread_attr_setguardsize(attr, options.guard_size)) != 0) {
+      WARN("Call to pthread_attr_setguardsize failed: %i (error: %s)", result,
+          strerror(result));
+      return F_FALSE;
+    }
+  }
+  if (options.policy != spInherit) {
+    int policy = get_pthread_policy(options.policy);
+    if (policy == -1) {
+      WARN("Unsupported scheduling policy: %i", options.policy);
+      return F_FALSE;
+    }
+    if (is_realtime_policy(policy)) {
+      struct sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = options.priority;
+      int inherit = PTHREAD_EXPLICIT_SCHED;
+      if ((result = pthread_attr_setinheritsched(attr, inherit)) != 0
+          || (result = pthread_attr_setschedpolicy(attr, policy)) != 0
+          || (result = pthread_attr_setschedparam(attr, &param)) != 0) {
+        WARN("Setting scheduling policy failed: %i (error: %s)", result,
+            strerror(result));
+        return F_FALSE;
+      }
+    }
+  }
+#ifdef IS_LINUX
+  if (!native_cpu_set_is_empty(&options.affinity)) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (size_t i = 0; i < kMaxCpuCount && i < CPU_SETSIZE; i++) {
+      if (native_cpu_set_contains(&options.affinity, i))
+        CPU_SET(i, &cpus);
+    }
+    result = pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    if (result != 0) {
+      WARN("Call to pthread_attr_setaffinity_np failed: %i (error: %s)", result,
+          strerror(result));
+      return F_FALSE;
+    }
+  }
+#endif
+  // Mach has no way to bind a thread to particular cpus, only affinity tags
+  // that are hints, so there affinity is ignored.
+  return F_TRUE;
+}
+
 fat_bool_t NativeThread::platform_start() {
-  int result = pthread_create(&thread_, NULL, entry_point, this);
+  pthread_attr_t attr;
+  int result = pthread_attr_init(&attr);
+  if (result != 0) {
+    WARN("Call to pthread_attr_init failed: %i (error: %s)", result,
+        strerror(result));
+    return F_FALSE;
+  }
+  fat_bool_t configured = configure_thread_attributes(&attr, options_);
+  if (configured)
+    result = pthread_create(&thread_, &attr, entry_point, this);
+  pthread_attr_destroy(&attr);
+  if (!configured)
+    return configured;
   if (result == 0)
     return F_TRUE;
   WARN("Call to pthread_create failed: %i (error: %s)", result, strerror(result));
@@ -48,6 +188,15 @@ fat_bool_t NativeThread::yield() {
   return F_BOOL(IF_MACH(sched_yield(), pthread_yield()) == 0);
 }
 
+fat_bool_t NativeThread::get_current_name(char *buf, size_t size) {
+  int result = pthread_getname_np(pthread_self(), buf, size);
+  if (result == 0)
+    return F_TRUE;
+  WARN("Call to pthread_getname_np failed: %i (error: %s)", result,
+      strerror(result));
+  return F_FALSE;
+}
+
 bool NativeThread::ids_equal(native_thread_id_t a, native_thread_id_t b) {
   return pthread_equal(a, b) != 0;
 }
@@ -25,6 +25,8 @@ NativeThread::NativeThread(run_callback_t callback)
   , result_(o0()) {
   platform_thread_t init = kPlatformThreadInit;
   thread_ = init;
+  native_thread_options_init(&options_);
+  name_[0] = '\0';
 }
 
 NativeThread::NativeThread()
@@ -32,6 +34,8 @@ NativeThread::NativeThread()
   , result_(o0()) {
   platform_thread_t init = kPlatformThreadInit;
   thread_ = init;
+  native_thread_options_init(&options_);
+  name_[0] = '\0';
 }
 
 NativeThread::~NativeThread() {
@@ -61,6 +65,52 @@ void NativeThread::set_callback(run_callback_t callback) {
   callback_ = callback;
 }
 
+void NativeThread::set_options(const native_thread_options_t &options) {
+  CHECK_EQ("thread interaction out of order", state_, tsCreated);
+  options_ = options;
+  if (options.name == NULL) {
+    name_[0] = '\0';
+  } else {
+    strncpy(name_, options.name, kMaxThreadNameSize - 1);
+    name_[kMaxThreadNameSize - 1] = '\0';
+    options_.name = name_;
+  }
+}
+
+void native_cpu_set_clear(native_cpu_set_t *set) {
+  memset(set->bits, 0, sizeof(set->bits));
+}
+
+void native_cpu_set_add(native_cpu_set_t *set, size_t cpu) {
+  if (cpu >= kMaxCpuCount)
+    return;
+  set->bits[cpu / 64] |= (static_cast<uint64_t>(1) << (cpu % 64));
+}
+
+bool native_cpu_set_contains(const native_cpu_set_t *set, size_t cpu) {
+  if (cpu >= kMaxCpuCount)
+    return false;
+  return (set->bits[cpu / 64] & (static_cast<uint64_t>(1) << (cpu % 64))) != 0;
+}
+
+bool native_cpu_set_is_empty(const native_cpu_set_t *set) {
+  for (size_t i = 0; i < kMaxCpuCount / 64; i++) {
+    if (set->bits[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+void native_thread_options_init(native_thread_options_t *options) {
+  options->stack_size = 0;
+  options->guard_size = 0;
+  options->name = NULL;
+  options->nice = 0;
+  options->policy = spInherit;
+  options->priority = 0;
+  native_cpu_set_clear(&options->affinity);
+}
+
 opaque_t thread_start_trampoline(nullary_callback_t *callback) {
   return nullary_callback_call(callback);
 }
@@ -75,6 +125,11 @@ void native_thread_destroy(native_thread_t *thread) {
   delete reinterpret_cast<NativeThread*>(thread);
 }
 
+void native_thread_set_options(native_thread_t *thread,
+    const native_thread_options_t *options) {
+  reinterpret_cast<NativeThread*>(thread)->set_options(*options);
+}
+
 bool native_thread_start(native_thread_t *thread) {
   return reinterpret_cast<NativeThread*>(thread)->start();
 }
@@ -10,6 +10,72 @@
 // Opaque thread type.
 typedef struct native_thread_t native_thread_t;
 
+// The largest number of cpus a cpu set can hold.
+#define kMaxCpuCount 256
+
+// A set of cpus, used to restrict which cpus a thread can run on.
+typedef struct {
+  uint64_t bits[kMaxCpuCount / 64];
+} native_cpu_set_t;
+
+// Removes all cpus from the given set.
+void native_cpu_set_clear(native_cpu_set_t *set);
+
+// Adds the given cpu to the given set. Cpus beyond kMaxCpuCount are ignored.
+void native_cpu_set_add(native_cpu_set_t *set, size_t cpu);
+
+// Returns true iff the given cpu is in the given set.
+bool native_cpu_set_contains(const native_cpu_set_t *set, size_t cpu);
+
+// Returns true iff the given set contains no cpus.
+bool native_cpu_set_is_empty(const native_cpu_set_t *set);
+
+// How a thread should be scheduled relative to other threads.
+typedef enum {
+  // Use whatever policy the creating thread has.
+  spInherit,
+  // The platform's default time-sharing policy.
+  spDefault,
+  // Time-sharing but for throughput-oriented work that doesn't need to be
+  // responsive. Only supported on linux.
+  spBatch,
+  // Only run when nothing else wants to. Only supported on linux and windows.
+  spIdle,
+  // Real-time first-in first-out. Typically requires privileges.
+  spFifo,
+  // Real-time round robin. Typically requires privileges.
+  spRoundRobin
+} scheduling_policy_t;
+
+// The longest thread name that will be kept, including the terminating null.
+// Linux allows no more than this and longer names are truncated.
+#define kMaxThreadNameSize 16
+
+// Settings that control how a thread is created. A zero, NULL, or empty value
+// means the platform's default.
+typedef struct {
+  // Size of the thread's stack in bytes. Will be rounded up to the smallest
+  // size the platform supports.
+  size_t stack_size;
+  // Size of the guard region beyond the end of the stack in bytes.
+  size_t guard_size;
+  // Name to give the thread, as shown by debuggers and tools like perf and top.
+  // The name is copied when the options are set.
+  const char *name;
+  // The thread's nice value. Because zero means the default the thread can't
+  // explicitly be given a nice value of 0 if its creator has a different one.
+  int32_t nice;
+  // The scheduling policy.
+  scheduling_policy_t policy;
+  // The priority within the policy, only used for the real-time policies.
+  int32_t priority;
+  // The cpus the thread is allowed to run on. Empty means any.
+  native_cpu_set_t affinity;
+} native_thread_options_t;
+
+// Initializes the given options such that all settings are the defaults.
+void native_thread_options_init(native_thread_options_t *options);
+
 // Creates and returns a new native thread that will run the given callback
 // when started.
 native_thread_t *native_thread_new(nullary_callback_t *callback);
@@ -17,6 +83,11 @@ native_thread_t *native_thread_new(nullary_callback_t *callback);
 // Destroys the given native thread.
 void native_thread_destroy(native_thread_t *thread);
 
+// Sets the options to use when starting the given thread. Must be called
+// before the thread is started.
+void native_thread_set_options(native_thread_t *thread,
+    const native_thread_options_t *options);
+
 // Starts the given thread running.
 bool native_thread_start(native_thread_t *thread);
 
@@ -10,6 +10,10 @@
 #include "utils/callback.hh"
 #include "utils/fatbool.hh"
 
+BEGIN_C_INCLUDES
+#include "sync/thread.h"
+END_C_INCLUDES
+
 namespace tclib {
 
 // An os-native thread.
@@ -37,6 +41,13 @@ public:
   // If no callback was given at initialization this sets it to the given value.
   void set_callback(run_callback_t callback);
 
+  // Sets the options to use when starting this thread. Must be called before
+  // the thread is started.
+  void set_options(const native_thread_options_t &options);
+
+  // Returns the options this thread will be, or was, started with.
+  const native_thread_options_t &options() { return options_; }
+
   // Returns the id of the current thread. The value is opaque and can only be
   // used for equality testing.
   static native_thread_id_t get_current_id();
@@ -44,6 +55,10 @@ public:
   // Returns true iff the two given thread ids are identical.
   static bool ids_equal(native_thread_id_t a, native_thread_id_t b);
 
+  // Stores the name of the current thread in the given buffer which must be at
+  // least kMaxThreadNameSize long.
+  static fat_bool_t get_current_name(char *buf, size_t size);
+
   // Yield execution to another thread.
   static fat_bool_t yield();
 
@@ -64,6 +79,10 @@ private:
   // Platform-specific start routine.
   fat_bool_t platform_dispose();
 
+  // Applies the options that can only be set from within the thread itself.
+  // Failures are logged but don't stop the thread from running.
+  void apply_own_options();
+
   static PLATFORM_THREAD_ENTRY_POINT;
 
   // Callback to run on start.
@@ -73,6 +92,11 @@ private:
 
   opaque_t result_;
 
+  // Options to start the thread with, and a copy of the name since the one
+  // given in the options may not live long enough.
+  native_thread_options_t options_;
+  char name_[kMaxThreadNameSize];
+
   // Platform-specific data.
   platform_thread_t thread_;
 };
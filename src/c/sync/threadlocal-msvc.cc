@@ -0,0 +1,73 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "c/winhdr.h"
+
+BEGIN_C_INCLUDES
+#include "utils/alloc.h"
+END_C_INCLUDES
+
+// Plain tls indices don't support destructors but fiber-local storage does and
+// when fibers aren't used it behaves exactly like tls. The fls callback gets
+// only the value and uses a different calling convention on 32 bits so each
+// thread's slot holds a cell that records the destructor next to the value.
+typedef struct {
+  thread_local_destructor_t destructor;
+  void *value;
+} fls_cell_t;
+
+static void NTAPI destroy_fls_cell(void *data) {
+  fls_cell_t *cell = static_cast<fls_cell_t*>(data);
+  if (cell->value != NULL && cell->destructor != NULL)
+    (cell->destructor)(cell->value);
+  allocator_default_free_struct(fls_cell_t, cell);
+}
+
+fat_bool_t NativeThreadLocal::platform_initialize() {
+  DWORD index = FlsAlloc(destroy_fls_cell);
+  if (index == FLS_OUT_OF_INDEXES) {
+    WARN("Call to FlsAlloc failed: %i", GetLastError());
+    return F_FALSE;
+  }
+  key = index;
+  return F_TRUE;
+}
+
+fat_bool_t NativeThreadLocal::platform_dispose() {
+  // Unlike pthread_key_delete, FlsFree calls the callback for every thread's
+  // cell. The current thread's value has already been destroyed so clear it
+  // first.
+  fls_cell_t *cell = static_cast<fls_cell_t*>(FlsGetValue(key));
+  if (cell != NULL)
+    cell->value = NULL;
+  if (FlsFree(key))
+    return F_TRUE;
+  WARN("Call to FlsFree failed: %i", GetLastError());
+  return F_FALSE;
+}
+
+void *NativeThreadLocal::get() {
+  CHECK_TRUE("not initialized", is_initialized);
+  fls_cell_t *cell = static_cast<fls_cell_t*>(FlsGetValue(key));
+  return (cell == NULL) ? NULL : cell->value;
+}
+
+fat_bool_t NativeThreadLocal::set(void *value) {
+  CHECK_TRUE("not initialized", is_initialized);
+  fls_cell_t *cell = static_cast<fls_cell_t*>(FlsGetValue(key));
+  if (cell == NULL) {
+    if (value == NULL)
+      return F_TRUE;
+    cell = allocator_default_malloc_struct(fls_cell_t);
+    if (cell == NULL)
+      return F_FALSE;
+    cell->destructor = destructor;
+    if (!FlsSetValue(key, cell)) {
+      WARN("Call to FlsSetValue failed: %i", GetLastError());
+      allocator_default_free_struct(fls_cell_t, cell);
+      return F_FALSE;
+    }
+  }
+  cell->value = value;
+  return F_TRUE;
+}
@@ -0,0 +1,37 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <pthread.h>
+
+fat_bool_t NativeThreadLocal::platform_initialize() {
+  int result = pthread_key_create(&key, destructor);
+  if (result == 0)
+    return F_TRUE;
+  WARN("Call to pthread_key_create failed: %i (error: %s)", result,
+      strerror(result));
+  return F_FALSE;
+}
+
+fat_bool_t NativeThreadLocal::platform_dispose() {
+  int result = pthread_key_delete(key);
+  if (result == 0)
+    return F_TRUE;
+  WARN("Call to pthread_key_delete failed: %i (error: %s)", result,
+      strerror(result));
+  return F_FALSE;
+}
+
+void *NativeThreadLocal::get() {
+  CHECK_TRUE("not initialized", is_initialized);
+  return pthread_getspecific(key);
+}
+
+fat_bool_t NativeThreadLocal::set(void *value) {
+  CHECK_TRUE("not initialized", is_initialized);
+  int result = pthread_setspecific(key, value);
+  if (result == 0)
+    return F_TRUE;
+  WARN("Call to pthread_setspecific failed: %i (error: %s)", result,
+      strerror(result));
+  return F_FALSE;
+}
@@ -0,0 +1,67 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/threadlocal.hh"
+
+BEGIN_C_INCLUDES
+#include "utils/log.h"
+#include "sync/threadlocal.h"
+END_C_INCLUDES
+
+#include <new>
+
+using namespace tclib;
+
+#ifdef IS_GCC
+#  include "threadlocal-posix.cc"
+#endif
+
+#ifdef IS_MSVC
+#  include "threadlocal-msvc.cc"
+#endif
+
+NativeThreadLocal::NativeThreadLocal(thread_local_destructor_t destructor) {
+  this->destructor = destructor;
+  is_initialized = false;
+}
+
+NativeThreadLocal::~NativeThreadLocal() {
+  if (!is_initialized)
+    return;
+  // The platform only destroys values as threads exit so the current thread's
+  // value has to be destroyed explicitly.
+  void *value = get();
+  if (value != NULL && destructor != NULL)
+    (destructor)(value);
+  is_initialized = false;
+  platform_dispose();
+}
+
+fat_bool_t NativeThreadLocal::initialize() {
+  if (!is_initialized) {
+    F_TRY(platform_initialize());
+    is_initialized = true;
+  }
+  return F_TRUE;
+}
+
+void thread_local_construct(thread_local_t *local,
+    thread_local_destructor_t destructor) {
+  new (local) NativeThreadLocal(destructor);
+}
+
+bool thread_local_initialize(thread_local_t *local) {
+  return static_cast<NativeThreadLocal*>(local)->initialize();
+}
+
+void *thread_local_get(thread_local_t *local) {
+  return static_cast<NativeThreadLocal*>(local)->get();
+}
+
+bool thread_local_set(thread_local_t *local, void *value) {
+  return static_cast<NativeThreadLocal*>(local)->set(value);
+}
+
+void thread_local_dispose(thread_local_t *local) {
+  static_cast<NativeThreadLocal*>(local)->~NativeThreadLocal();
+}
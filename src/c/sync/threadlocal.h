@@ -0,0 +1,46 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_THREADLOCAL_H
+#define _TCLIB_THREADLOCAL_H
+
+#include "c/stdc.h"
+#include "sync/sync.h"
+
+// Function called on a thread's value when the thread exits.
+typedef void (*thread_local_destructor_t)(void *value);
+
+// A variable that holds a separate pointer value for each thread. Each thread's
+// value starts out NULL and when a thread exits with a non-NULL value the
+// destructor, if there is one, is called on it.
+typedef struct {
+  // Called on each thread's value as the thread exits.
+  thread_local_destructor_t destructor;
+  // Has this variable been initialized?
+  bool is_initialized;
+  // Platform-specific data.
+  platform_thread_local_t key;
+} thread_local_t;
+
+// Construct a new uninitialized thread-local variable with the given
+// destructor, which may be NULL.
+void thread_local_construct(thread_local_t *local,
+    thread_local_destructor_t destructor);
+
+// Initialize the given thread-local variable, returning true on success.
+bool thread_local_initialize(thread_local_t *local);
+
+// Returns the calling thread's value of the given variable.
+void *thread_local_get(thread_local_t *local);
+
+// Sets the calling thread's value of the given variable, returning true on
+// success.
+bool thread_local_set(thread_local_t *local, void *value);
+
+// Disposes the given variable. The calling thread's value is destroyed but
+// whether the values of other threads that are still running are depends on
+// the platform, so typically this should only be called once those threads
+// have exited.
+void thread_local_dispose(thread_local_t *local);
+
+#endif // _TCLIB_THREADLOCAL_H
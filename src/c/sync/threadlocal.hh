@@ -0,0 +1,92 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#ifndef _TCLIB_THREADLOCAL_HH
+#define _TCLIB_THREADLOCAL_HH
+
+#include "c/stdc.h"
+
+#include "utils/alloc.hh"
+#include "utils/fatbool.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/threadlocal.h"
+END_C_INCLUDES
+
+namespace tclib {
+
+// A variable that holds a separate pointer value for each thread, see
+// thread_local_t.
+class NativeThreadLocal : public thread_local_t {
+public:
+  // Construct a variable whose values are destroyed with the given destructor
+  // when their threads exit. Note that before use the variable has to be
+  // explicitly initialized.
+  explicit NativeThreadLocal(thread_local_destructor_t destructor = NULL);
+
+  ~NativeThreadLocal();
+
+  // Initializes the state of this variable, returning true if initialization
+  // succeeded.
+  fat_bool_t initialize();
+
+  // Returns the calling thread's value, NULL if it hasn't been set.
+  void *get();
+
+  // Sets the calling thread's value.
+  fat_bool_t set(void *value);
+
+private:
+  // Platform-specific initialization.
+  fat_bool_t platform_initialize();
+
+  // Platform-specific destruction.
+  fat_bool_t platform_dispose();
+};
+
+// A per-thread instance of T. Each thread's instance is default-constructed
+// the first time the thread asks for it and destroyed when the thread exits,
+// both using the default allocator.
+template <typename T>
+class ThreadLocal {
+public:
+  ThreadLocal() : local_(destroy_value) { }
+
+  // Initializes the state of this variable, returning true if initialization
+  // succeeded.
+  fat_bool_t initialize() { return local_.initialize(); }
+
+  // Returns the calling thread's instance, creating it if necessary. Returns
+  // NULL if creating it fails.
+  T *get();
+
+  // Returns the calling thread's instance if it has been created, otherwise
+  // NULL.
+  T *peek() { return static_cast<T*>(local_.get()); }
+
+private:
+  static void destroy_value(void *value) {
+    default_delete_concrete(static_cast<T*>(value));
+  }
+
+  NativeThreadLocal local_;
+};
+
+template <typename T>
+T *ThreadLocal<T>::get() {
+  T *value = peek();
+  if (value != NULL)
+    return value;
+  value = new (kDefaultAlloc) T();
+  if (value == NULL)
+    return NULL;
+  if (!local_.set(value)) {
+    destroy_value(value);
+    return NULL;
+  }
+  return value;
+}
+
+} // namespace tclib
+
+#endif // _TCLIB_THREADLOCAL_HH
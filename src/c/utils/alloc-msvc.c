@@ -0,0 +1,96 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Page-level memory management using VirtualAlloc.
+
+#include "c/winhdr.h"
+
+#include <malloc.h>
+
+// Blocks on the heap that need an alignment must be freed with _aligned_free so
+// all blocks are allocated with the _aligned_ functions, making them all safe
+// to free the same way.
+
+static void *system_heap_malloc(size_t size) {
+  return _aligned_malloc(size, kAllocatorDefaultAlignment);
+}
+
+static void *system_heap_malloc_aligned(size_t size, size_t alignment) {
+  return _aligned_malloc(size, alignment);
+}
+
+static void *system_heap_realloc(void *start, size_t size) {
+  return _aligned_realloc(start, size, kAllocatorDefaultAlignment);
+}
+
+static void system_heap_free(void *start) {
+  _aligned_free(start);
+}
+
+static size_t system_page_size() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+}
+
+static void *system_reserve_pages(size_t size) {
+  void *result = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+  if (result == NULL)
+    WARN("VirtualAlloc(_, %i, _, _): %i", (int) size, GetLastError());
+  return result;
+}
+
+static bool system_protect_pages(void *start, size_t size, bool accessible) {
+  if (accessible) {
+    if (VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+      WARN("VirtualAlloc(%p, %i, _, _): %i", start, (int) size, GetLastError());
+      return false;
+    }
+  } else {
+    if (!VirtualFree(start, size, MEM_DECOMMIT)) {
+      WARN("VirtualFree(%p, %i, _): %i", start, (int) size, GetLastError());
+      return false;
+    }
+  }
+  return true;
+}
+
+static void system_release_pages(void *start, size_t size) {
+  VirtualFree(start, 0, MEM_RELEASE);
+}
+
+static size_t system_huge_page_size() {
+  size_t result = GetLargePageMinimum();
+  return (result == 0) ? system_page_size() : result;
+}
+
+static void *system_map_pages(size_t size, huge_page_mode_t huge_pages) {
+  void *result = NULL;
+  // Large pages are only available to processes that hold the lock memory
+  // privilege so this quietly falls back to normal pages. There are no
+  // transparent huge pages.
+  if (huge_pages == hpExplicit)
+    result = VirtualAlloc(NULL, size,
+        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  if (result == NULL)
+    result = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+        PAGE_READWRITE);
+  if (result == NULL)
+    WARN("VirtualAlloc(_, %i, _, _): %i", (int) size, GetLastError());
+  return result;
+}
+
+static void *system_remap_pages(void *start, size_t old_size, size_t new_size) {
+  // There's no way to move a mapping so the caller has to map new pages and
+  // copy.
+  return NULL;
+}
+
+static void *system_map_node_pages(size_t size, int32_t node_id) {
+  void *result = VirtualAllocExNuma(GetCurrentProcess(), NULL, size,
+      MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD) node_id);
+  if (result == NULL)
+    WARN("VirtualAllocExNuma(_, _, %i, _, _, %i): %i", (int) size,
+        (int) node_id, GetLastError());
+  return result;
+}
@@ -0,0 +1,161 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Page-level memory management using mmap.
+
+// Anonymous mappings, madvise, and mremap on linux, are outside plain c99 and
+// posix; alloc.c asks for them before including anything.
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef IS_LINUX
+#  include <errno.h>
+#  include <sys/syscall.h>
+#endif
+
+static void *system_heap_malloc(size_t size) {
+  return malloc(size);
+}
+
+static void *system_heap_malloc_aligned(size_t size, size_t alignment) {
+  // posix_memalign doesn't accept alignments smaller than a pointer.
+  if (alignment < sizeof(void*))
+    alignment = sizeof(void*);
+  void *result = NULL;
+  return (posix_memalign(&result, alignment, size) == 0) ? result : NULL;
+}
+
+static void *system_heap_realloc(void *start, size_t size) {
+  return realloc(start, size);
+}
+
+static void system_heap_free(void *start) {
+  free(start);
+}
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static size_t system_page_size() {
+  return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static void *system_reserve_pages(size_t size) {
+  void *result = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+      0);
+  if (result == MAP_FAILED) {
+    WARN("mmap(_, %i, _, _, _, _) failed", (int) size);
+    return NULL;
+  }
+  return result;
+}
+
+static bool system_protect_pages(void *start, size_t size, bool accessible) {
+  int prot = accessible ? (PROT_READ | PROT_WRITE) : PROT_NONE;
+  if (mprotect(start, size, prot) != 0) {
+    WARN("mprotect(%p, %i, %i) failed", start, (int) size, prot);
+    return false;
+  }
+  // Give the memory back to the system while it's inaccessible, the next
+  // user will see fresh zero pages.
+  if (!accessible)
+    madvise(start, size, MADV_DONTNEED);
+  return true;
+}
+
+static void system_release_pages(void *start, size_t size) {
+  munmap(start, size);
+}
+
+static size_t system_huge_page_size() {
+#ifdef IS_LINUX
+  // There is no posix way to ask; linux reports the default huge page size,
+  // which differs between architectures, in /proc/meminfo.
+  FILE *meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo != NULL) {
+    char line[128];
+    unsigned long kilobytes = 0;
+    while (fgets(line, sizeof(line), meminfo) != NULL) {
+      if (sscanf(line, "Hugepagesize: %lu kB", &kilobytes) == 1)
+        break;
+    }
+    fclose(meminfo);
+    if (kilobytes != 0)
+      return (size_t) kilobytes * 1024;
+  }
+#endif
+  return system_page_size();
+}
+
+static void *system_map_pages(size_t size, huge_page_mode_t huge_pages) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *result = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // Explicit huge pages fail unless the administrator has reserved some so
+  // this quietly falls back to normal pages.
+  if (huge_pages == hpExplicit)
+    result = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+        -1, 0);
+#endif
+  if (result == MAP_FAILED)
+    result = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (result == MAP_FAILED) {
+    WARN("mmap(_, %i, _, _, _, _) failed", (int) size);
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (huge_pages != hpNone)
+    madvise(result, size, MADV_HUGEPAGE);
+#endif
+  return result;
+}
+
+static void *system_remap_pages(void *start, size_t old_size, size_t new_size) {
+#ifdef MREMAP_MAYMOVE
+  void *result = mremap(start, old_size, new_size, MREMAP_MAYMOVE);
+  return (result == MAP_FAILED) ? NULL : result;
+#else
+  // Without mremap the caller has to map new pages and copy.
+  return NULL;
+#endif
+}
+
+#ifdef IS_LINUX
+// From linux/mempolicy.h. Preferring the node rather than binding to it means
+// that allocation falls back to other nodes instead of failing when the node
+// runs out of memory.
+#define kMpolPreferred 1
+#endif
+
+static void *system_map_node_pages(size_t size, int32_t node_id) {
+#ifdef IS_LINUX
+  // The mask below only has room for 64 nodes. Memory for nodes outside it
+  // couldn't be bound so rather than quietly place it wherever it's touched
+  // the mapping fails.
+  if (node_id < 0 || node_id >= 64) {
+    WARN("Can't bind pages to numa node %i", (int) node_id);
+    return NULL;
+  }
+#endif
+  void *result = system_map_pages(size, hpNone);
+#ifdef IS_LINUX
+  if (result != NULL) {
+    // The mask is an array of longs with one bit per node. Calling mbind
+    // directly avoids depending on libnuma.
+    unsigned long mask[64 / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    size_t bits = 8 * sizeof(unsigned long);
+    mask[node_id / bits] = 1UL << (node_id % bits);
+    // The kernel reads one bit less than the maximum node it's given so
+    // that's one more than the number of bits in the mask. If binding fails,
+    // for instance because the kernel doesn't support numa, the pages are
+    // placed on first touch.
+    unsigned long max_node = 8 * sizeof(mask) + 1;
+    if (syscall(SYS_mbind, result, size, kMpolPreferred, mask, max_node, 0)
+        != 0)
+      WARN("mbind(%p, %i, _, _, _, _) failed: %i", result, (int) size, errno);
+  }
+#endif
+  return result;
+}
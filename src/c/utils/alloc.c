@@ -1,16 +1,66 @@
 //- Copyright 2014 the Neutrino authors (see AUTHORS).
 //- Licensed under the Apache License, Version 2.0 (see LICENSE).
 
+// The posix page functions use anonymous mappings, madvise and
+// posix_memalign which plain c99 doesn't declare, and on linux mremap which
+// is a gnu extension. Asking for them only works before the first system
+// header has been included.
+#ifndef _DEFAULT_SOURCE
+#  define _DEFAULT_SOURCE 1
+#endif
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE 1
+#endif
+
 #include "utils/alloc.h"
 #include "utils/log.h"
+#include "utils/misc-inl.h"
+#include "sync/atomic-inl.h"
 #include "sync/mutex.h"
 
+#ifdef IS_MSVC
+#  include "alloc-msvc.c"
+#else
+#  include "alloc-posix.c"
+#endif
+
 static const uint8_t kMallocHeapMarker = 0xB0;
 static const uint8_t kMallocFreedMarker = 0xC0;
 
+// Resizes the given block by allocating a new one from the given allocator,
+// copying, and freeing the old one. This is how blocks are resized by
+// allocators that can't do better.
+static blob_t allocator_realloc_by_copy(allocator_t *alloc, blob_t memory,
+    size_t new_size) {
+  blob_t result = allocator_malloc(alloc, new_size);
+  if (blob_is_empty(result))
+    return result;
+  memcpy(result.start, memory.start, min_size(memory.size, new_size));
+  allocator_free(alloc, memory);
+  return result;
+}
+
+// Returns true iff the given block starts at a multiple of the given
+// alignment.
+static bool allocator_is_aligned(blob_t memory, size_t alignment) {
+  return (((address_arith_t) memory.start) & (alignment - 1)) == 0;
+}
+
 // Throws away the data argument and just calls malloc.
 static blob_t system_malloc_trampoline(allocator_t *self, size_t size) {
-  void *chunk = malloc(size);
+  void *chunk = system_heap_malloc(size);
+  if (chunk == NULL) {
+    return blob_empty();
+  } else {
+    blob_t result = blob_new(chunk, size);
+    blob_fill(result, kMallocHeapMarker);
+    return result;
+  }
+}
+
+static blob_t system_malloc_aligned_trampoline(allocator_t *self, size_t size,
+    size_t alignment) {
+  void *chunk = system_heap_malloc_aligned(size, alignment);
   if (chunk == NULL) {
     return blob_empty();
   } else {
@@ -24,7 +74,14 @@ static blob_t system_malloc_trampoline(allocator_t *self, size_t size) {
 static void system_free_trampoline(allocator_t *self, blob_t memory) {
   if (!blob_is_empty(memory))
     blob_fill(memory, kMallocFreedMarker);
-  free(memory.start);
+  system_heap_free(memory.start);
+}
+
+// Resizing by copying means that the old block gets marked as freed and the
+// new part of the block as uninitialized, which realloc wouldn't do.
+static blob_t system_realloc_trampoline(allocator_t *self, blob_t memory,
+    size_t new_size) {
+  return allocator_realloc_by_copy(self, memory, new_size);
 }
 
 allocator_t allocator_system() {
@@ -32,6 +89,41 @@ allocator_t allocator_system() {
   struct_zero_fill(result);
   result.malloc = system_malloc_trampoline;
   result.free = system_free_trampoline;
+  result.malloc_aligned = system_malloc_aligned_trampoline;
+  result.realloc = system_realloc_trampoline;
+  return result;
+}
+
+static blob_t system_unpoisoned_malloc_trampoline(allocator_t *self,
+    size_t size) {
+  void *chunk = system_heap_malloc(size);
+  return (chunk == NULL) ? blob_empty() : blob_new(chunk, size);
+}
+
+static blob_t system_unpoisoned_malloc_aligned_trampoline(allocator_t *self,
+    size_t size, size_t alignment) {
+  void *chunk = system_heap_malloc_aligned(size, alignment);
+  return (chunk == NULL) ? blob_empty() : blob_new(chunk, size);
+}
+
+static void system_unpoisoned_free_trampoline(allocator_t *self,
+    blob_t memory) {
+  system_heap_free(memory.start);
+}
+
+static blob_t system_unpoisoned_realloc_trampoline(allocator_t *self,
+    blob_t memory, size_t new_size) {
+  void *chunk = system_heap_realloc(memory.start, new_size);
+  return (chunk == NULL) ? blob_empty() : blob_new(chunk, new_size);
+}
+
+allocator_t allocator_system_unpoisoned() {
+  allocator_t result;
+  struct_zero_fill(result);
+  result.malloc = system_unpoisoned_malloc_trampoline;
+  result.free = system_unpoisoned_free_trampoline;
+  result.malloc_aligned = system_unpoisoned_malloc_aligned_trampoline;
+  result.realloc = system_unpoisoned_realloc_trampoline;
   return result;
 }
 
@@ -39,6 +131,30 @@ blob_t allocator_malloc(allocator_t *alloc, size_t size) {
   return (alloc->malloc)(alloc, size);
 }
 
+blob_t allocator_malloc_aligned(allocator_t *alloc, size_t size,
+    size_t alignment) {
+  if (alloc->malloc_aligned != NULL)
+    return (alloc->malloc_aligned)(alloc, size, alignment);
+  blob_t result = allocator_malloc(alloc, size);
+  if (blob_is_empty(result) || allocator_is_aligned(result, alignment))
+    return result;
+  allocator_free(alloc, result);
+  WARN("Allocator doesn't support alignment %i", (int) alignment);
+  return blob_empty();
+}
+
+blob_t allocator_realloc(allocator_t *alloc, blob_t memory, size_t new_size) {
+  if (blob_is_empty(memory))
+    return allocator_malloc(alloc, new_size);
+  if (new_size == 0) {
+    allocator_free(alloc, memory);
+    return blob_empty();
+  }
+  return (alloc->realloc == NULL)
+      ? allocator_realloc_by_copy(alloc, memory, new_size)
+      : (alloc->realloc)(alloc, memory, new_size);
+}
+
 void allocator_free(allocator_t *alloc, blob_t memory) {
   (alloc->free)(alloc, memory);
 }
@@ -47,6 +163,14 @@ blob_t allocator_default_malloc(size_t size) {
   return allocator_malloc(allocator_get_default(), size);
 }
 
+blob_t allocator_default_malloc_aligned(size_t size, size_t alignment) {
+  return allocator_malloc_aligned(allocator_get_default(), size, alignment);
+}
+
+blob_t allocator_default_realloc(blob_t memory, size_t new_size) {
+  return allocator_realloc(allocator_get_default(), memory, new_size);
+}
+
 void allocator_default_free(blob_t block) {
   allocator_free(allocator_get_default(), block);
 }
@@ -56,7 +180,8 @@ allocator_t *allocator_default = NULL;
 
 allocator_t *allocator_get_default() {
   if (allocator_default == NULL) {
-    kSystemAllocator = allocator_system();
+    kSystemAllocator = IF_CHECKS(allocator_system(),
+        allocator_system_unpoisoned());
     allocator_default = &kSystemAllocator;
   }
   return allocator_default;
@@ -68,43 +193,107 @@ allocator_t *allocator_set_default(allocator_t *value) {
   return previous;
 }
 
+// The batch sizes of the limited allocator's counters. Larger batches mean
+// less contention but the limit check has to look at the exact values more
+// often.
+#define kLimitedAllocatorMemoryBatch 65536
+#define kLimitedAllocatorBlockBatch 64
+
+// Returns the exact amount of live memory if the approximate amount is within
+// the counter's slack of the given threshold, otherwise the approximate
+// amount. This is enough to compare against the threshold precisely.
+static size_t limited_allocator_live_memory(limited_allocator_t *data,
+    size_t threshold) {
+  int64_t approx = striped_counter_get_approx(&data->live_memory);
+  int64_t slack = striped_counter_slack(&data->live_memory);
+  int64_t distance = approx - (int64_t) threshold;
+  if (-slack <= distance && distance <= slack)
+    approx = striped_counter_get(&data->live_memory);
+  return (approx < 0) ? 0 : (size_t) approx;
+}
+
 static void limited_allocator_free(allocator_t *raw_self, blob_t memory) {
   if (blob_is_empty(memory))
     return;
   limited_allocator_t *data = (limited_allocator_t*) raw_self;
-  size_t live_memory = (size_t) atomic_int64_get(&data->live_memory);
+  size_t live_memory = limited_allocator_live_memory(data, memory.size);
   if (memory.size > live_memory) {
     data->has_warned = true;
     FATAL("Unbalanced free of %ib with %ib live", memory.size, live_memory);
   }
-  atomic_int64_subtract(&data->live_memory, memory.size);
-  atomic_int64_decrement(&data->live_blocks);
+  striped_counter_add(&data->live_memory, -(int64_t) memory.size);
+  striped_counter_add(&data->live_blocks, -1);
   allocator_free(data->outer, memory);
 }
 
+// Accounts for the given number of additional bytes of live memory if that
+// keeps the total within the limit, otherwise warns and returns false.
+static bool limited_allocator_reserve(limited_allocator_t *data, size_t size) {
+  size_t headroom = (size > data->limit) ? 0 : (data->limit - size);
+  size_t live_memory = limited_allocator_live_memory(data, headroom);
+  if (size > data->limit || live_memory > headroom) {
+    data->has_warned = true;
+    WARN("Tried to allocate more than %i of system memory. At %i, requested %i.",
+        data->limit, live_memory, size);
+    return false;
+  }
+  striped_counter_add(&data->live_memory, (int64_t) size);
+  return true;
+}
+
 static blob_t limited_allocator_malloc(allocator_t *raw_self, size_t size) {
   if (size == 0)
     return blob_empty();
   limited_allocator_t *data = (limited_allocator_t*) raw_self;
-  size_t live_memory = (size_t) atomic_int64_get(&data->live_memory);
-  if (live_memory + size > data->limit) {
-    data->has_warned = true;
-    WARN("Tried to allocate more than %i of system memory. At %i, requested %i.",
-        data->limit, live_memory, size);
+  if (!limited_allocator_reserve(data, size))
+    return blob_empty();
+  striped_counter_add(&data->live_blocks, 1);
+  return allocator_malloc(data->outer, size);
+}
+
+static blob_t limited_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  if (size == 0)
+    return blob_empty();
+  limited_allocator_t *data = (limited_allocator_t*) raw_self;
+  if (!limited_allocator_reserve(data, size))
     return blob_empty();
+  blob_t result = allocator_malloc_aligned(data->outer, size, alignment);
+  if (blob_is_empty(result)) {
+    striped_counter_add(&data->live_memory, -(int64_t) size);
   } else {
-    atomic_int64_add(&data->live_memory, size);
-    atomic_int64_increment(&data->live_blocks);
-    return allocator_malloc(data->outer, size);
+    // The block may be larger than requested and will be freed as such.
+    striped_counter_add(&data->live_memory,
+        (int64_t) result.size - (int64_t) size);
+    striped_counter_add(&data->live_blocks, 1);
+  }
+  return result;
+}
+
+static blob_t limited_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  limited_allocator_t *data = (limited_allocator_t*) raw_self;
+  size_t growth = (new_size > memory.size) ? (new_size - memory.size) : 0;
+  if (growth > 0 && !limited_allocator_reserve(data, growth))
+    return blob_empty();
+  blob_t result = allocator_realloc(data->outer, memory, new_size);
+  if (blob_is_empty(result)) {
+    striped_counter_add(&data->live_memory, -(int64_t) growth);
+  } else if (growth == 0) {
+    striped_counter_add(&data->live_memory,
+        -(int64_t) (memory.size - new_size));
   }
+  return result;
 }
 
 void limited_allocator_install(limited_allocator_t *alloc, size_t limit) {
   struct_zero_fill(*alloc);
   alloc->header.malloc = limited_allocator_malloc;
   alloc->header.free = limited_allocator_free;
-  alloc->live_memory = atomic_int64_new(0);
-  alloc->live_blocks = atomic_int64_new(0);
+  alloc->header.malloc_aligned = limited_allocator_malloc_aligned;
+  alloc->header.realloc = limited_allocator_realloc;
+  striped_counter_initialize(&alloc->live_memory, kLimitedAllocatorMemoryBatch);
+  striped_counter_initialize(&alloc->live_blocks, kLimitedAllocatorBlockBatch);
   alloc->limit = limit;
   alloc->has_warned = false;
   alloc->outer = allocator_set_default(&alloc->header);
@@ -113,9 +302,9 @@ void limited_allocator_install(limited_allocator_t *alloc, size_t limit) {
 bool limited_allocator_uninstall(limited_allocator_t *alloc) {
   CHECK_PTREQ("not current allocator", &alloc->header, allocator_get_default());
   allocator_set_default(alloc->outer);
-  size_t live_memory = (size_t) atomic_int64_get(&alloc->live_memory);
-  size_t live_blocks = (size_t) atomic_int64_get(&alloc->live_blocks);
-  bool had_leaks = (live_memory > 0) || (live_blocks > 0);
+  int64_t live_memory = striped_counter_get(&alloc->live_memory);
+  int64_t live_blocks = striped_counter_get(&alloc->live_blocks);
+  bool had_leaks = (live_memory != 0) || (live_blocks != 0);
   if (had_leaks) {
     WARN("Disposing with %ib of live memory in %i blocks", live_memory,
         live_blocks);
@@ -139,9 +328,9 @@ static blob_t fingerprinting_allocator_malloc(allocator_t *raw_self, size_t size
   blob_t result = allocator_malloc(self->outer, size);
   if (blob_is_empty(result))
     return result;
-  size_t fprint = calc_fingerprint(result);
-  atomic_int64_increment(&self->blocks[fprint]);
-  atomic_int64_add(&self->bytes[fprint], size);
+  fingerprint_bucket_t *bucket = &self->buckets[calc_fingerprint(result)];
+  atomic_int64_fetch_add(&bucket->blocks, 1, moRelaxed);
+  atomic_int64_fetch_add(&bucket->bytes, (int64_t) size, moRelaxed);
   return result;
 }
 
@@ -150,45 +339,1313 @@ static void fingerprinting_allocator_free(allocator_t *raw_self, blob_t memory)
   if (blob_is_empty(memory))
     return;
   size_t fprint = calc_fingerprint(memory);
-  size_t blocks = (size_t) atomic_int64_get(&self->blocks[fprint]);
-  size_t bytes = (size_t) atomic_int64_get(&self->bytes[fprint]);
-  if (blocks == 0 || bytes < memory.size) {
+  fingerprint_bucket_t *bucket = &self->buckets[fprint];
+  int64_t blocks = atomic_int64_fetch_add(&bucket->blocks, -1, moRelaxed);
+  int64_t bytes = atomic_int64_fetch_add(&bucket->bytes,
+      -(int64_t) memory.size, moRelaxed);
+  if (blocks <= 0 || bytes < (int64_t) memory.size) {
     self->has_warned = true;
     WARN("Unbalanced free of %ib with fingerprint %04X", memory.size, fprint);
   }
-  atomic_int64_decrement(&self->blocks[fprint]);
-  atomic_int64_subtract(&self->bytes[fprint], memory.size);
   allocator_free(self->outer, memory);
 }
 
+static blob_t fingerprinting_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  fingerprinting_allocator_t *self = (fingerprinting_allocator_t*) raw_self;
+  blob_t result = allocator_malloc_aligned(self->outer, size, alignment);
+  if (blob_is_empty(result))
+    return result;
+  fingerprint_bucket_t *bucket = &self->buckets[calc_fingerprint(result)];
+  atomic_int64_fetch_add(&bucket->blocks, 1, moRelaxed);
+  atomic_int64_fetch_add(&bucket->bytes, (int64_t) result.size, moRelaxed);
+  return result;
+}
+
+// The fingerprint depends on the address and size so a resized block is a
+// new block as far as this allocator is concerned.
+static blob_t fingerprinting_allocator_realloc(allocator_t *raw_self,
+    blob_t memory, size_t new_size) {
+  return allocator_realloc_by_copy(raw_self, memory, new_size);
+}
+
 void fingerprinting_allocator_install(fingerprinting_allocator_t *alloc) {
   struct_zero_fill(*alloc);
   alloc->header.malloc = fingerprinting_allocator_malloc;
   alloc->header.free = fingerprinting_allocator_free;
+  alloc->header.malloc_aligned = fingerprinting_allocator_malloc_aligned;
+  alloc->header.realloc = fingerprinting_allocator_realloc;
   alloc->has_warned = false;
   alloc->outer = allocator_set_default(&alloc->header);
-  blob_t blocks = allocator_malloc(alloc->outer, kAllocFingerprintBuckets * sizeof(atomic_int64_t));
-  blob_fill(blocks, 0);
-  blob_t bytes = allocator_malloc(alloc->outer, kAllocFingerprintBuckets * sizeof(atomic_int64_t));
-  blob_fill(bytes, 0);
-  alloc->blocks = (atomic_int64_t*) blocks.start;
-  alloc->bytes = (atomic_int64_t*) bytes.start;
+  blob_t buckets = allocator_malloc(alloc->outer,
+      kAllocFingerprintBuckets * sizeof(fingerprint_bucket_t));
+  blob_fill(buckets, 0);
+  alloc->buckets = (fingerprint_bucket_t*) buckets.start;
 }
 
 bool fingerprinting_allocator_uninstall(fingerprinting_allocator_t *alloc) {
   bool had_leaks = false;
   for (size_t i = 0; i < kAllocFingerprintBuckets; i++) {
-    size_t blocks = (size_t) atomic_int64_get(&alloc->blocks[i]);
-    size_t bytes = (size_t) atomic_int64_get(&alloc->bytes[i]);
-    if (blocks > 0 || bytes > 0) {
+    fingerprint_bucket_t *bucket = &alloc->buckets[i];
+    int64_t blocks = atomic_int64_load(&bucket->blocks, moRelaxed);
+    int64_t bytes = atomic_int64_load(&bucket->bytes, moRelaxed);
+    if (blocks != 0 || bytes != 0) {
       had_leaks = true;
       WARN("Disposing with %ib of live memory in %i allocations with fingerprint %04X",
           bytes, blocks, i);
     }
   }
-  blob_t blocks = blob_new(alloc->blocks, kAllocFingerprintBuckets * sizeof(atomic_int64_t));
-  blob_t bytes = blob_new(alloc->bytes, kAllocFingerprintBuckets * sizeof(atomic_int64_t));
-  allocator_free(alloc->outer, blocks);
-  allocator_free(alloc->outer, bytes);
+  blob_t buckets = blob_new(alloc->buckets,
+      kAllocFingerprintBuckets * sizeof(fingerprint_bucket_t));
+  allocator_free(alloc->outer, buckets);
   return allocator_set_default(alloc->outer) && !had_leaks && !alloc->has_warned;
 }
+
+// Arena allocations are aligned like malloc aligns them.
+#define kArenaAlignment 16
+
+// Allocations larger than this fraction of the chunk size get their own chunk
+// so they don't waste what's left of the current one.
+#define kArenaLargeFraction 4
+
+// Rounds the given size up to the arena alignment.
+static size_t arena_align(size_t size) {
+  return (size + (kArenaAlignment - 1)) & ~((size_t) (kArenaAlignment - 1));
+}
+
+// Returns the size of a chunk's header including padding up to where the
+// allocations start.
+static size_t arena_chunk_header_size() {
+  return arena_align(sizeof(arena_chunk_t));
+}
+
+// Returns the address of the start of the given chunk's allocations.
+static uint8_t *arena_chunk_payload(arena_chunk_t *chunk) {
+  return ((uint8_t*) chunk) + arena_chunk_header_size();
+}
+
+// Returns the number of bytes available for allocations in the given chunk.
+static size_t arena_chunk_capacity(arena_chunk_t *chunk) {
+  return chunk->size - arena_chunk_header_size();
+}
+
+// Allocates a chunk with room for the given number of bytes of allocations,
+// the first of which are already marked as used.
+static arena_chunk_t *arena_chunk_new(arena_allocator_t *arena,
+    size_t capacity, size_t used) {
+  size_t size = arena_chunk_header_size() + capacity;
+  blob_t memory = allocator_malloc(arena->outer, size);
+  if (blob_is_empty(memory))
+    return NULL;
+  arena_chunk_t *chunk = (arena_chunk_t*) memory.start;
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = atomic_int64_new((int64_t) used);
+  return chunk;
+}
+
+static void arena_chunk_free(arena_allocator_t *arena, arena_chunk_t *chunk) {
+  allocator_free(arena->outer, blob_new(chunk, chunk->size));
+}
+
+// Adds the given chunk to the arena's list of chunks.
+static void arena_push_chunk(arena_allocator_t *arena, arena_chunk_t *chunk) {
+  void *head = atomic_ptr_load(&arena->chunks, moRelaxed);
+  do {
+    chunk->next = (arena_chunk_t*) head;
+  } while (!atomic_ptr_compare_exchange(&arena->chunks, &head, chunk,
+      moRelease));
+}
+
+static blob_t arena_allocator_malloc(allocator_t *raw_self, size_t size) {
+  if (size == 0)
+    return blob_empty();
+  arena_allocator_t *arena = (arena_allocator_t*) raw_self;
+  size_t aligned = arena_align(size);
+  size_t standard_capacity = arena->chunk_size - arena_chunk_header_size();
+  if (aligned > standard_capacity / kArenaLargeFraction) {
+    // Large blocks get a chunk of their own which is never made current.
+    arena_chunk_t *chunk = arena_chunk_new(arena, aligned, aligned);
+    if (chunk == NULL)
+      return blob_empty();
+    arena_push_chunk(arena, chunk);
+    return blob_new(arena_chunk_payload(chunk), size);
+  }
+  while (true) {
+    arena_chunk_t *current = (arena_chunk_t*) atomic_ptr_load(&arena->current,
+        moAcquire);
+    if (current != NULL) {
+      int64_t offset = atomic_int64_fetch_add(&current->used,
+          (int64_t) aligned, moRelaxed);
+      if ((size_t) offset + aligned <= arena_chunk_capacity(current))
+        return blob_new(arena_chunk_payload(current) + offset, size);
+    }
+    // The current chunk is full so start a new one. If someone else gets
+    // there first we use theirs instead.
+    arena_chunk_t *fresh = arena_chunk_new(arena, standard_capacity, aligned);
+    if (fresh == NULL)
+      return blob_empty();
+    void *expected = current;
+    if (atomic_ptr_compare_exchange(&arena->current, &expected, fresh,
+        moAcqRel)) {
+      arena_push_chunk(arena, fresh);
+      return blob_new(arena_chunk_payload(fresh), size);
+    }
+    arena_chunk_free(arena, fresh);
+  }
+}
+
+static void arena_allocator_free(allocator_t *raw_self, blob_t memory) {
+  // Individual blocks are never freed, they all go when the arena is reset.
+}
+
+static blob_t arena_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  if (alignment <= kArenaAlignment)
+    return arena_allocator_malloc(raw_self, size);
+  // Allocate enough that there's room for an aligned block wherever the
+  // allocation ends up. The padding is lost but so is everything else in an
+  // arena until it is reset.
+  blob_t padded = arena_allocator_malloc(raw_self,
+      size + alignment - kArenaAlignment);
+  if (blob_is_empty(padded))
+    return padded;
+  address_arith_t start = (address_arith_t) padded.start;
+  return blob_new((void*) align_size(alignment, start), size);
+}
+
+static blob_t arena_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  arena_allocator_t *arena = (arena_allocator_t*) raw_self;
+  size_t old_aligned = arena_align(memory.size);
+  size_t new_aligned = arena_align(new_size);
+  if (new_aligned <= old_aligned)
+    return blob_new(memory.start, new_size);
+  // If this is the most recent block in the current chunk it can grow into
+  // the unused space after it, as long as no one allocates that first.
+  arena_chunk_t *current = (arena_chunk_t*) atomic_ptr_load(&arena->current,
+      moAcquire);
+  if (current != NULL) {
+    uint8_t *payload = arena_chunk_payload(current);
+    uint8_t *start = (uint8_t*) memory.start;
+    size_t capacity = arena_chunk_capacity(current);
+    if (payload <= start && start < payload + capacity) {
+      size_t offset = (size_t) (start - payload);
+      int64_t expected = (int64_t) (offset + old_aligned);
+      if (offset + new_aligned <= capacity
+          && atomic_int64_compare_exchange(&current->used, &expected,
+              (int64_t) (offset + new_aligned), moRelaxed))
+        return blob_new(memory.start, new_size);
+    }
+  }
+  return allocator_realloc_by_copy(raw_self, memory, new_size);
+}
+
+void arena_allocator_init(arena_allocator_t *arena, allocator_t *outer,
+    size_t chunk_size) {
+  struct_zero_fill(*arena);
+  arena->header.malloc = arena_allocator_malloc;
+  arena->header.free = arena_allocator_free;
+  arena->header.malloc_aligned = arena_allocator_malloc_aligned;
+  arena->header.realloc = arena_allocator_realloc;
+  arena->outer = outer;
+  // A chunk must at least have room for a few allocations beyond its header.
+  size_t min_size = arena_chunk_header_size() + kArenaLargeFraction
+      * kArenaAlignment;
+  arena->chunk_size = (chunk_size < min_size) ? min_size : chunk_size;
+  arena->current = atomic_ptr_new(NULL);
+  arena->chunks = atomic_ptr_new(NULL);
+}
+
+// Frees all the arena's chunks except the given one, which may be NULL.
+static void arena_free_chunks_except(arena_allocator_t *arena,
+    arena_chunk_t *keep) {
+  arena_chunk_t *chunk = (arena_chunk_t*) atomic_ptr_load(&arena->chunks,
+      moAcquire);
+  while (chunk != NULL) {
+    arena_chunk_t *next = chunk->next;
+    if (chunk != keep)
+      arena_chunk_free(arena, chunk);
+    chunk = next;
+  }
+  if (keep != NULL) {
+    keep->next = NULL;
+    atomic_int64_store(&keep->used, 0, moRelaxed);
+  }
+  atomic_ptr_store(&arena->chunks, keep, moRelease);
+  atomic_ptr_store(&arena->current, keep, moRelease);
+}
+
+void arena_allocator_reset(arena_allocator_t *arena) {
+  arena_free_chunks_except(arena, (arena_chunk_t*) atomic_ptr_load(
+      &arena->current, moAcquire));
+}
+
+void arena_allocator_dispose(arena_allocator_t *arena) {
+  arena_free_chunks_except(arena, NULL);
+}
+
+void arena_allocator_install(arena_allocator_t *arena, size_t chunk_size) {
+  arena_allocator_init(arena, allocator_get_default(), chunk_size);
+  allocator_set_default(&arena->header);
+}
+
+void arena_allocator_uninstall(arena_allocator_t *arena) {
+  CHECK_PTREQ("not current allocator", &arena->header, allocator_get_default());
+  allocator_set_default(arena->outer);
+  arena_allocator_dispose(arena);
+}
+
+size_t arena_allocator_footprint(arena_allocator_t *arena) {
+  size_t result = 0;
+  arena_chunk_t *chunk = (arena_chunk_t*) atomic_ptr_load(&arena->chunks,
+      moAcquire);
+  for (; chunk != NULL; chunk = chunk->next)
+    result += chunk->size;
+  return result;
+}
+
+// The size classes go up in steps of 16 bytes to 128 and above that each
+// doubling of the size is split into four classes, which keeps the space lost
+// to rounding below 25%.
+#define kSlabSmallClassCount 8
+#define kSlabSmallClassStep 16
+#define kSlabClassesPerDoubling 4
+
+// Returns the index of the size class that holds blocks of the given size,
+// which must be between 1 and kSlabMaxBlockSize.
+static size_t slab_size_class(size_t size) {
+  size_t small_max = kSlabSmallClassCount * kSlabSmallClassStep;
+  if (size <= small_max)
+    return (size - 1) / kSlabSmallClassStep;
+  size_t index = kSlabSmallClassCount;
+  size_t base = small_max;
+  while (size > 2 * base) {
+    base *= 2;
+    index += kSlabClassesPerDoubling;
+  }
+  return index + (size - base - 1) / (base / kSlabClassesPerDoubling);
+}
+
+// Returns the size of the blocks in the size class with the given index.
+static size_t slab_class_block_size(size_t index) {
+  if (index < kSlabSmallClassCount)
+    return (index + 1) * kSlabSmallClassStep;
+  size_t large = index - kSlabSmallClassCount;
+  size_t base = (kSlabSmallClassCount * kSlabSmallClassStep)
+      << (large / kSlabClassesPerDoubling);
+  size_t step = base / kSlabClassesPerDoubling;
+  return base + step * ((large % kSlabClassesPerDoubling) + 1);
+}
+
+// The header at the start of each slab. Slabs are aligned to their size so
+// the header of the slab a block belongs to can be found from the block's
+// address.
+typedef struct slab_header_t {
+  struct slab_header_t *next;
+  // The allocator the slab belongs to.
+  slab_allocator_t *owner;
+  // The size of the block the slab was allocated as, which may be larger than
+  // kSlabSize.
+  size_t size;
+  // Always kSlabTag; together with the owner this tells slabs apart from
+  // memory that just happens to be at a slab-aligned address.
+  uint32_t tag;
+} slab_header_t;
+
+#define kSlabTag 0x51AB7A95
+
+// The blocks in a slab start after the header, aligned like malloc would.
+#define kSlabHeaderSize 32
+
+static void slab_class_lock(slab_class_t *cls) {
+  int32_t unlocked = 0;
+  while (!atomic_int32_compare_exchange(&cls->lock, &unlocked, 1, moAcquire)) {
+    atomic_spin_pause();
+    unlocked = 0;
+  }
+}
+
+static void slab_class_unlock(slab_class_t *cls) {
+  atomic_int32_store(&cls->lock, 0, moRelease);
+}
+
+// Allocates a new slab from the given allocator's outer allocator. Returns
+// NULL if that fails.
+static slab_header_t *slab_new(slab_allocator_t *alloc) {
+  blob_t memory = allocator_malloc_aligned(alloc->outer, kSlabSize, kSlabSize);
+  if (blob_is_empty(memory))
+    return NULL;
+  slab_header_t *slab = (slab_header_t*) memory.start;
+  slab->next = NULL;
+  slab->owner = alloc;
+  slab->size = memory.size;
+  slab->tag = kSlabTag;
+  return slab;
+}
+
+static void slab_delete(slab_allocator_t *alloc, slab_header_t *slab) {
+  // Clear the tag so a block that happens to end up at the same address
+  // later isn't mistaken for being ours.
+  slab->tag = 0;
+  allocator_free(alloc->outer, blob_new(slab, slab->size));
+}
+
+// Makes the blocks of the given new slab available in the given class. The
+// class must be locked.
+static void slab_class_add_slab(slab_class_t *cls, slab_header_t *slab) {
+  slab->next = (slab_header_t*) cls->slabs;
+  cls->slabs = slab;
+  cls->slab_count++;
+  cls->next = ((uint8_t*) slab) + kSlabHeaderSize;
+  cls->limit = ((uint8_t*) slab) + kSlabSize;
+}
+
+// Takes up to the given number of blocks from the given class, storing them
+// in the given array. Returns the number of blocks taken, which is less than
+// requested only if the outer allocator fails.
+static size_t slab_class_take(slab_allocator_t *alloc, slab_class_t *cls,
+    void **blocks, size_t count) {
+  size_t taken = 0;
+  slab_header_t *spare = NULL;
+  slab_class_lock(cls);
+  while (taken < count) {
+    if (cls->free_list != NULL) {
+      void *block = cls->free_list;
+      cls->free_list = *((void**) block);
+      blocks[taken++] = block;
+    } else if (cls->next + cls->block_size <= cls->limit) {
+      blocks[taken++] = cls->next;
+      cls->next += cls->block_size;
+    } else if (spare != NULL) {
+      slab_class_add_slab(cls, spare);
+      spare = NULL;
+    } else {
+      // Other threads using this class would spin for as long as the outer
+      // allocator takes so the slab is allocated without holding the lock.
+      // Someone else may refill the class meanwhile in which case the new
+      // slab isn't needed after all.
+      slab_class_unlock(cls);
+      spare = slab_new(alloc);
+      slab_class_lock(cls);
+      if (spare == NULL)
+        break;
+    }
+  }
+  slab_class_unlock(cls);
+  if (spare != NULL)
+    slab_delete(alloc, spare);
+  return taken;
+}
+
+// Returns true iff the given small block was carved out of one of the given
+// allocator's slabs. A slab is no larger than a page so the header this reads
+// is on the same page as the block itself, which makes reading it safe even
+// for blocks that came from somewhere else.
+static bool slab_allocator_owns(slab_allocator_t *alloc, void *block) {
+  uintptr_t address = (uintptr_t) block;
+  uintptr_t start = address & ~((uintptr_t) kSlabSize - 1);
+  slab_header_t *slab = (slab_header_t*) start;
+  return start != address
+      && slab->owner == alloc
+      && slab->tag == kSlabTag;
+}
+
+// Returns the given blocks to the given class.
+static void slab_class_give(slab_class_t *cls, void **blocks, size_t count) {
+  if (count == 0)
+    return;
+  // Link the blocks together before taking the lock so the critical section
+  // is just splicing them onto the free list.
+  for (size_t i = 0; i + 1 < count; i++)
+    *((void**) blocks[i]) = blocks[i + 1];
+  slab_class_lock(cls);
+  *((void**) blocks[count - 1]) = cls->free_list;
+  cls->free_list = blocks[0];
+  slab_class_unlock(cls);
+}
+
+static blob_t slab_allocator_malloc(allocator_t *raw_self, size_t size) {
+  if (size == 0)
+    return blob_empty();
+  slab_allocator_t *alloc = (slab_allocator_t*) raw_self;
+  if (size > kSlabMaxBlockSize)
+    return allocator_malloc(alloc->outer, size);
+  slab_class_t *cls = &alloc->classes[slab_size_class(size)];
+  void *block = NULL;
+  return (slab_class_take(alloc, cls, &block, 1) == 0)
+      ? blob_empty()
+      : blob_new(block, size);
+}
+
+static void slab_allocator_free(allocator_t *raw_self, blob_t memory) {
+  if (blob_is_empty(memory))
+    return;
+  slab_allocator_t *alloc = (slab_allocator_t*) raw_self;
+  // Blocks that were allocated before this allocator was installed, or that
+  // needed more alignment than the slabs give, belong to the outer allocator.
+  if (memory.size > kSlabMaxBlockSize
+      || !slab_allocator_owns(alloc, memory.start)) {
+    allocator_free(alloc->outer, memory);
+    return;
+  }
+  slab_class_t *cls = &alloc->classes[slab_size_class(memory.size)];
+  slab_class_give(cls, &memory.start, 1);
+}
+
+// Blocks in slabs are only aligned like malloc aligns them. Blocks that need
+// more are allocated from the outer allocator and go back there when they're
+// freed since they're not in any slab.
+static blob_t slab_malloc_aligned_outer(allocator_t *outer, size_t size,
+    size_t alignment) {
+  return allocator_malloc_aligned(outer, size, alignment);
+}
+
+// Returns true iff blocks of the two given sizes are in the same place as far
+// as the slab allocator is concerned, meaning that resizing from one to the
+// other can be done in place.
+static bool slab_same_size_class(size_t old_size, size_t new_size) {
+  if (old_size > kSlabMaxBlockSize || new_size > kSlabMaxBlockSize)
+    return false;
+  return slab_size_class(old_size) == slab_size_class(new_size);
+}
+
+static blob_t slab_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  slab_allocator_t *alloc = (slab_allocator_t*) raw_self;
+  return (alignment <= kAllocatorDefaultAlignment)
+      ? slab_allocator_malloc(raw_self, size)
+      : slab_malloc_aligned_outer(alloc->outer, size, alignment);
+}
+
+static blob_t slab_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  slab_allocator_t *alloc = (slab_allocator_t*) raw_self;
+  if (slab_same_size_class(memory.size, new_size))
+    return blob_new(memory.start, new_size);
+  if (memory.size > kSlabMaxBlockSize && new_size > kSlabMaxBlockSize)
+    return allocator_realloc(alloc->outer, memory, new_size);
+  return allocator_realloc_by_copy(raw_self, memory, new_size);
+}
+
+void slab_allocator_init(slab_allocator_t *alloc, allocator_t *outer) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = slab_allocator_malloc;
+  alloc->header.free = slab_allocator_free;
+  alloc->header.malloc_aligned = slab_allocator_malloc_aligned;
+  alloc->header.realloc = slab_allocator_realloc;
+  alloc->outer = outer;
+  for (size_t i = 0; i < kSlabClassCount; i++) {
+    slab_class_t *cls = &alloc->classes[i];
+    cls->lock = atomic_int32_new(0);
+    cls->block_size = slab_class_block_size(i);
+  }
+}
+
+void slab_allocator_dispose(slab_allocator_t *alloc) {
+  for (size_t i = 0; i < kSlabClassCount; i++) {
+    slab_class_t *cls = &alloc->classes[i];
+    slab_header_t *slab = (slab_header_t*) cls->slabs;
+    while (slab != NULL) {
+      slab_header_t *next = slab->next;
+      slab_delete(alloc, slab);
+      slab = next;
+    }
+    cls->slabs = NULL;
+    cls->slab_count = 0;
+    cls->free_list = NULL;
+    cls->next = cls->limit = NULL;
+  }
+}
+
+void slab_allocator_install(slab_allocator_t *alloc) {
+  slab_allocator_init(alloc, allocator_get_default());
+  allocator_set_default(&alloc->header);
+}
+
+void slab_allocator_uninstall(slab_allocator_t *alloc) {
+  CHECK_PTREQ("not current allocator", &alloc->header, allocator_get_default());
+  allocator_set_default(alloc->outer);
+  slab_allocator_dispose(alloc);
+}
+
+size_t slab_allocator_free_block_count(slab_allocator_t *alloc) {
+  size_t result = 0;
+  for (size_t i = 0; i < kSlabClassCount; i++) {
+    slab_class_t *cls = &alloc->classes[i];
+    slab_class_lock(cls);
+    for (void *block = cls->free_list; block != NULL; block = *((void**) block))
+      result++;
+    slab_class_unlock(cls);
+  }
+  return result;
+}
+
+size_t slab_allocator_footprint(slab_allocator_t *alloc) {
+  size_t result = 0;
+  for (size_t i = 0; i < kSlabClassCount; i++) {
+    slab_class_t *cls = &alloc->classes[i];
+    slab_class_lock(cls);
+    result += cls->slab_count * kSlabSize;
+    slab_class_unlock(cls);
+  }
+  return result;
+}
+
+// A single size class of a thread's cache.
+typedef struct {
+  size_t count;
+  void *blocks[kThreadCacheMagazineSize];
+} thread_cache_magazine_t;
+
+// The blocks cached by a single thread.
+typedef struct thread_cache_t {
+  // The allocator this cache belongs to.
+  thread_cache_allocator_t *owner;
+  // The neighbours in the owner's list of caches.
+  struct thread_cache_t *prev;
+  struct thread_cache_t *next;
+  thread_cache_magazine_t magazines[kSlabClassCount];
+} thread_cache_t;
+
+static void thread_cache_list_lock(thread_cache_allocator_t *alloc) {
+  int32_t unlocked = 0;
+  while (!atomic_int32_compare_exchange(&alloc->caches_lock, &unlocked, 1,
+      moAcquire)) {
+    atomic_spin_pause();
+    unlocked = 0;
+  }
+}
+
+static void thread_cache_list_unlock(thread_cache_allocator_t *alloc) {
+  atomic_int32_store(&alloc->caches_lock, 0, moRelease);
+}
+
+// Returns all the blocks in the given cache to the back end.
+static void thread_cache_flush(thread_cache_t *cache) {
+  slab_allocator_t *back_end = &cache->owner->back_end;
+  for (size_t i = 0; i < kSlabClassCount; i++) {
+    thread_cache_magazine_t *magazine = &cache->magazines[i];
+    slab_class_give(&back_end->classes[i], magazine->blocks, magazine->count);
+    magazine->count = 0;
+  }
+}
+
+static void thread_cache_free_struct(thread_cache_allocator_t *alloc,
+    thread_cache_t *cache) {
+  allocator_free(alloc->outer, blob_new(cache, sizeof(thread_cache_t)));
+}
+
+// Called on a thread's cache when the thread exits.
+static void thread_cache_destroy(void *raw_cache) {
+  thread_cache_t *cache = (thread_cache_t*) raw_cache;
+  thread_cache_allocator_t *alloc = cache->owner;
+  thread_cache_flush(cache);
+  thread_cache_list_lock(alloc);
+  if (cache->prev == NULL) {
+    alloc->all_caches = cache->next;
+  } else {
+    cache->prev->next = cache->next;
+  }
+  if (cache->next != NULL)
+    cache->next->prev = cache->prev;
+  thread_cache_list_unlock(alloc);
+  thread_cache_free_struct(alloc, cache);
+}
+
+// Returns the calling thread's cache, creating it if necessary. Returns NULL
+// if there is no cache and one couldn't be created.
+static thread_cache_t *thread_cache_get(thread_cache_allocator_t *alloc) {
+  thread_cache_t *cache = (thread_cache_t*) thread_local_get(&alloc->caches);
+  if (cache != NULL)
+    return cache;
+  blob_t memory = allocator_malloc(alloc->outer, sizeof(thread_cache_t));
+  if (blob_is_empty(memory))
+    return NULL;
+  cache = (thread_cache_t*) memory.start;
+  struct_zero_fill(*cache);
+  cache->owner = alloc;
+  if (!thread_local_set(&alloc->caches, cache)) {
+    thread_cache_free_struct(alloc, cache);
+    return NULL;
+  }
+  thread_cache_list_lock(alloc);
+  cache->next = alloc->all_caches;
+  if (cache->next != NULL)
+    cache->next->prev = cache;
+  alloc->all_caches = cache;
+  thread_cache_list_unlock(alloc);
+  return cache;
+}
+
+static blob_t thread_cache_allocator_malloc(allocator_t *raw_self,
+    size_t size) {
+  if (size == 0)
+    return blob_empty();
+  thread_cache_allocator_t *alloc = (thread_cache_allocator_t*) raw_self;
+  if (size > kSlabMaxBlockSize)
+    return allocator_malloc(alloc->outer, size);
+  size_t index = slab_size_class(size);
+  thread_cache_t *cache = thread_cache_get(alloc);
+  if (cache == NULL)
+    return allocator_malloc(&alloc->back_end.header, size);
+  thread_cache_magazine_t *magazine = &cache->magazines[index];
+  if (magazine->count == 0) {
+    magazine->count = slab_class_take(&alloc->back_end,
+        &alloc->back_end.classes[index], magazine->blocks,
+        kThreadCacheBatchSize);
+    if (magazine->count == 0)
+      return blob_empty();
+  }
+  return blob_new(magazine->blocks[--magazine->count], size);
+}
+
+static void thread_cache_allocator_free(allocator_t *raw_self, blob_t memory) {
+  if (blob_is_empty(memory))
+    return;
+  thread_cache_allocator_t *alloc = (thread_cache_allocator_t*) raw_self;
+  // Like the back end, blocks that don't come from its slabs go back to the
+  // outer allocator rather than into the cache.
+  if (memory.size > kSlabMaxBlockSize
+      || !slab_allocator_owns(&alloc->back_end, memory.start)) {
+    allocator_free(alloc->outer, memory);
+    return;
+  }
+  size_t index = slab_size_class(memory.size);
+  thread_cache_t *cache = thread_cache_get(alloc);
+  if (cache == NULL) {
+    allocator_free(&alloc->back_end.header, memory);
+    return;
+  }
+  thread_cache_magazine_t *magazine = &cache->magazines[index];
+  if (magazine->count == kThreadCacheMagazineSize) {
+    // Hand back the oldest half, keeping the most recently freed blocks
+    // which are more likely to still be in this core's cache.
+    slab_class_give(&alloc->back_end.classes[index], magazine->blocks,
+        kThreadCacheBatchSize);
+    magazine->count -= kThreadCacheBatchSize;
+    memmove(magazine->blocks, magazine->blocks + kThreadCacheBatchSize,
+        magazine->count * sizeof(void*));
+  }
+  magazine->blocks[magazine->count++] = memory.start;
+}
+
+static blob_t thread_cache_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  thread_cache_allocator_t *alloc = (thread_cache_allocator_t*) raw_self;
+  return (alignment <= kAllocatorDefaultAlignment)
+      ? thread_cache_allocator_malloc(raw_self, size)
+      : slab_malloc_aligned_outer(alloc->outer, size, alignment);
+}
+
+static blob_t thread_cache_allocator_realloc(allocator_t *raw_self,
+    blob_t memory, size_t new_size) {
+  thread_cache_allocator_t *alloc = (thread_cache_allocator_t*) raw_self;
+  if (slab_same_size_class(memory.size, new_size))
+    return blob_new(memory.start, new_size);
+  if (memory.size > kSlabMaxBlockSize && new_size > kSlabMaxBlockSize)
+    return allocator_realloc(alloc->outer, memory, new_size);
+  return allocator_realloc_by_copy(raw_self, memory, new_size);
+}
+
+bool thread_cache_allocator_init(thread_cache_allocator_t *alloc,
+    allocator_t *outer) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = thread_cache_allocator_malloc;
+  alloc->header.free = thread_cache_allocator_free;
+  alloc->header.malloc_aligned = thread_cache_allocator_malloc_aligned;
+  alloc->header.realloc = thread_cache_allocator_realloc;
+  alloc->outer = outer;
+  slab_allocator_init(&alloc->back_end, outer);
+  alloc->caches_lock = atomic_int32_new(0);
+  alloc->all_caches = NULL;
+  thread_local_construct(&alloc->caches, thread_cache_destroy);
+  return thread_local_initialize(&alloc->caches);
+}
+
+void thread_cache_allocator_dispose(thread_cache_allocator_t *alloc) {
+  // This destroys the calling thread's cache. Other threads' caches won't be
+  // destroyed when those threads exit once the variable is gone so they're
+  // freed below.
+  thread_local_dispose(&alloc->caches);
+  thread_cache_t *cache = alloc->all_caches;
+  while (cache != NULL) {
+    thread_cache_t *next = cache->next;
+    thread_cache_free_struct(alloc, cache);
+    cache = next;
+  }
+  alloc->all_caches = NULL;
+  slab_allocator_dispose(&alloc->back_end);
+}
+
+void thread_cache_allocator_flush(thread_cache_allocator_t *alloc) {
+  thread_cache_t *cache = (thread_cache_t*) thread_local_get(&alloc->caches);
+  if (cache != NULL)
+    thread_cache_flush(cache);
+}
+
+bool thread_cache_allocator_install(thread_cache_allocator_t *alloc) {
+  if (!thread_cache_allocator_init(alloc, allocator_get_default()))
+    return false;
+  allocator_set_default(&alloc->header);
+  return true;
+}
+
+void thread_cache_allocator_uninstall(thread_cache_allocator_t *alloc) {
+  CHECK_PTREQ("not current allocator", &alloc->header, allocator_get_default());
+  allocator_set_default(alloc->outer);
+  thread_cache_allocator_dispose(alloc);
+}
+
+// Blocks in guarded slots are aligned to this.
+#define kGuardedAlignment 16
+
+static const uint8_t kGuardedSlackMarker = 0xD0;
+
+// Information about one guarded page.
+typedef struct guarded_slot_t {
+  // The live block in this slot, empty if the slot is free.
+  blob_t block;
+} guarded_slot_t;
+
+// The state of the current thread's sampling random generator, which is 0
+// until the thread has drawn its first value.
+static IF_MSVC(__declspec(thread), __thread) uint64_t sampling_random_state;
+
+// Used to give each thread a different random seed.
+static atomic_int64_t sampling_seed_counter;
+
+uint64_t allocator_sampling_random() {
+  uint64_t x = sampling_random_state;
+  if (x == 0) {
+    int64_t count = atomic_int64_fetch_add(&sampling_seed_counter, 1,
+        moRelaxed);
+    x = ((uint64_t) (address_arith_t) &sampling_random_state)
+        ^ (((uint64_t) count + 1) * 0x9E3779B97F4A7C15ULL);
+    if (x == 0)
+      x = 1;
+  }
+  // Xorshift64.
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  sampling_random_state = x;
+  return x;
+}
+
+// The number of allocations the current thread has left before the next
+// sampled one, which is 0 until the thread has been set up.
+static IF_MSVC(__declspec(thread), __thread) int64_t guarded_until_sample;
+
+// Returns the number of allocations until the next sampled one. The intervals
+// are random with the sample rate as their mean so allocation patterns can't
+// line up with the sampling and avoid it.
+static int64_t guarded_next_interval(guarded_allocator_t *alloc) {
+  uint64_t span = 2 * (uint64_t) alloc->sample_rate - 1;
+  return (int64_t) (1 + (allocator_sampling_random() % span));
+}
+
+// Returns true iff the next allocation on this thread should be guarded.
+static bool guarded_should_sample(guarded_allocator_t *alloc) {
+  // The countdown is shared between all guarded allocators so one left over
+  // from an allocator with a larger sample rate must be redrawn.
+  if (guarded_until_sample <= 0
+      || guarded_until_sample >= 2 * (int64_t) alloc->sample_rate)
+    guarded_until_sample = guarded_next_interval(alloc);
+  if (--guarded_until_sample > 0)
+    return false;
+  guarded_until_sample = guarded_next_interval(alloc);
+  return true;
+}
+
+static void guarded_lock(guarded_allocator_t *alloc) {
+  int32_t unlocked = 0;
+  while (!atomic_int32_compare_exchange(&alloc->lock, &unlocked, 1,
+      moAcquire)) {
+    atomic_spin_pause();
+    unlocked = 0;
+  }
+}
+
+static void guarded_unlock(guarded_allocator_t *alloc) {
+  atomic_int32_store(&alloc->lock, 0, moRelease);
+}
+
+// Returns the start of the page belonging to the slot with the given index.
+static uint8_t *guarded_slot_page(guarded_allocator_t *alloc, size_t index) {
+  return alloc->pool + (2 * index + 1) * alloc->page_size;
+}
+
+static void guarded_report_error(guarded_allocator_t *alloc, const char *what,
+    void *address) {
+  atomic_int64_fetch_add(&alloc->error_count, 1, moRelaxed);
+  ERROR("Guarded allocator: %s at %p", what, address);
+}
+
+// Places a block of the given size and alignment in a free slot. Returns an
+// empty blob if there are no free slots or the slot couldn't be made
+// accessible.
+static blob_t guarded_allocator_place(guarded_allocator_t *alloc, size_t size,
+    size_t alignment) {
+  guarded_lock(alloc);
+  if (alloc->free_count == 0) {
+    guarded_unlock(alloc);
+    return blob_empty();
+  }
+  size_t index = alloc->free_slots[alloc->free_start];
+  alloc->free_start = (alloc->free_start + 1) % alloc->slot_count;
+  alloc->free_count--;
+  uint8_t *page = guarded_slot_page(alloc, index);
+  if (!system_protect_pages(page, alloc->page_size, true)) {
+    // Put the slot back at the end of the queue.
+    size_t end = (alloc->free_start + alloc->free_count) % alloc->slot_count;
+    alloc->free_slots[end] = index;
+    alloc->free_count++;
+    guarded_unlock(alloc);
+    return blob_empty();
+  }
+  size_t padded = align_size(alignment, size);
+  uint8_t *start = page + alloc->page_size - padded;
+  blob_t block = blob_new(start, size);
+  alloc->slots[index].block = block;
+  guarded_unlock(alloc);
+  // The padding is the only part of the page we can't protect with the
+  // hardware so it gets a marker that is checked on free.
+  memset(start + size, kGuardedSlackMarker, padded - size);
+  return block;
+}
+
+static blob_t guarded_allocator_malloc(allocator_t *raw_self, size_t size) {
+  guarded_allocator_t *alloc = (guarded_allocator_t*) raw_self;
+  if (size == 0 || size > alloc->page_size || !guarded_should_sample(alloc))
+    return allocator_malloc(alloc->outer, size);
+  blob_t result = guarded_allocator_place(alloc, size, kGuardedAlignment);
+  // If the block can't be guarded, for instance because all slots are taken,
+  // it just doesn't get guarded.
+  return blob_is_empty(result) ? allocator_malloc(alloc->outer, size) : result;
+}
+
+static blob_t guarded_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  guarded_allocator_t *alloc = (guarded_allocator_t*) raw_self;
+  if (alignment < kGuardedAlignment)
+    alignment = kGuardedAlignment;
+  if (size == 0 || alignment > alloc->page_size
+      || align_size(alignment, size) > alloc->page_size
+      || !guarded_should_sample(alloc))
+    return allocator_malloc_aligned(alloc->outer, size, alignment);
+  blob_t result = guarded_allocator_place(alloc, size, alignment);
+  return blob_is_empty(result)
+      ? allocator_malloc_aligned(alloc->outer, size, alignment)
+      : result;
+}
+
+// Resizing counts as an allocation for sampling purposes. Guarded blocks are
+// always moved; blocks that stay with the outer allocator are resized by it.
+static blob_t guarded_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  guarded_allocator_t *alloc = (guarded_allocator_t*) raw_self;
+  if (guarded_allocator_owns(alloc, memory.start))
+    return allocator_realloc_by_copy(raw_self, memory, new_size);
+  if (new_size <= alloc->page_size && guarded_should_sample(alloc)) {
+    blob_t result = guarded_allocator_place(alloc, new_size,
+        kGuardedAlignment);
+    if (!blob_is_empty(result)) {
+      memcpy(result.start, memory.start, min_size(memory.size, new_size));
+      allocator_free(alloc->outer, memory);
+      return result;
+    }
+  }
+  return allocator_realloc(alloc->outer, memory, new_size);
+}
+
+static void guarded_allocator_free(allocator_t *raw_self, blob_t memory) {
+  guarded_allocator_t *alloc = (guarded_allocator_t*) raw_self;
+  if (!guarded_allocator_owns(alloc, memory.start)) {
+    allocator_free(alloc->outer, memory);
+    return;
+  }
+  size_t page_index = ((uint8_t*) memory.start - alloc->pool)
+      / alloc->page_size;
+  if (page_index % 2 == 0) {
+    guarded_report_error(alloc, "free of guard page", memory.start);
+    return;
+  }
+  size_t index = page_index / 2;
+  guarded_lock(alloc);
+  blob_t block = alloc->slots[index].block;
+  if (block.start != memory.start) {
+    // Either the block is already free or this isn't the start of it.
+    guarded_unlock(alloc);
+    guarded_report_error(alloc, "invalid or double free", memory.start);
+    return;
+  }
+  uint8_t *end = (uint8_t*) block.start + block.size;
+  uint8_t *page_end = guarded_slot_page(alloc, index) + alloc->page_size;
+  for (uint8_t *p = end; p < page_end; p++) {
+    if (*p != kGuardedSlackMarker) {
+      guarded_report_error(alloc, "buffer overflow", p);
+      break;
+    }
+  }
+  alloc->slots[index].block = blob_empty();
+  system_protect_pages(guarded_slot_page(alloc, index), alloc->page_size,
+      false);
+  size_t tail = (alloc->free_start + alloc->free_count) % alloc->slot_count;
+  alloc->free_slots[tail] = index;
+  alloc->free_count++;
+  guarded_unlock(alloc);
+}
+
+bool guarded_allocator_init(guarded_allocator_t *alloc, allocator_t *outer,
+    size_t sample_rate, size_t slot_count) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = guarded_allocator_malloc;
+  alloc->header.free = guarded_allocator_free;
+  alloc->header.malloc_aligned = guarded_allocator_malloc_aligned;
+  alloc->header.realloc = guarded_allocator_realloc;
+  alloc->outer = outer;
+  alloc->sample_rate = (sample_rate == 0) ? 1 : sample_rate;
+  alloc->slot_count = (slot_count == 0) ? 1 : slot_count;
+  alloc->page_size = system_page_size();
+  alloc->lock = atomic_int32_new(0);
+  alloc->error_count = atomic_int64_new(0);
+  alloc->pool_size = (2 * alloc->slot_count + 1) * alloc->page_size;
+  blob_t slots = allocator_malloc(outer,
+      alloc->slot_count * sizeof(guarded_slot_t));
+  blob_t free_slots = allocator_malloc(outer,
+      alloc->slot_count * sizeof(size_t));
+  alloc->pool = (uint8_t*) system_reserve_pages(alloc->pool_size);
+  if (blob_is_empty(slots) || blob_is_empty(free_slots)
+      || alloc->pool == NULL) {
+    allocator_free(outer, slots);
+    allocator_free(outer, free_slots);
+    if (alloc->pool != NULL)
+      system_release_pages(alloc->pool, alloc->pool_size);
+    return false;
+  }
+  alloc->slots = (guarded_slot_t*) slots.start;
+  alloc->free_slots = (size_t*) free_slots.start;
+  for (size_t i = 0; i < alloc->slot_count; i++) {
+    alloc->slots[i].block = blob_empty();
+    alloc->free_slots[i] = i;
+  }
+  alloc->free_start = 0;
+  alloc->free_count = alloc->slot_count;
+  return true;
+}
+
+void guarded_allocator_dispose(guarded_allocator_t *alloc) {
+  system_release_pages(alloc->pool, alloc->pool_size);
+  allocator_free(alloc->outer, blob_new(alloc->slots,
+      alloc->slot_count * sizeof(guarded_slot_t)));
+  allocator_free(alloc->outer, blob_new(alloc->free_slots,
+      alloc->slot_count * sizeof(size_t)));
+  alloc->pool = NULL;
+  alloc->slots = NULL;
+  alloc->free_slots = NULL;
+}
+
+bool guarded_allocator_install(guarded_allocator_t *alloc, size_t sample_rate,
+    size_t slot_count) {
+  if (!guarded_allocator_init(alloc, allocator_get_default(), sample_rate,
+      slot_count))
+    return false;
+  allocator_set_default(&alloc->header);
+  return true;
+}
+
+void guarded_allocator_uninstall(guarded_allocator_t *alloc) {
+  CHECK_PTREQ("not current allocator", &alloc->header, allocator_get_default());
+  allocator_set_default(alloc->outer);
+  guarded_allocator_dispose(alloc);
+}
+
+bool guarded_allocator_owns(guarded_allocator_t *alloc, void *address) {
+  uint8_t *pos = (uint8_t*) address;
+  return alloc->pool <= pos && pos < alloc->pool + alloc->pool_size;
+}
+
+int64_t guarded_allocator_error_count(guarded_allocator_t *alloc) {
+  return atomic_int64_load(&alloc->error_count, moRelaxed);
+}
+
+// A block mapped by a large allocator.
+typedef struct large_mapping_t {
+  // The next mapping in the same bucket.
+  struct large_mapping_t *next;
+  void *start;
+  size_t size;
+} large_mapping_t;
+
+static void large_allocator_lock(large_allocator_t *alloc) {
+  int32_t unlocked = 0;
+  while (!atomic_int32_compare_exchange(&alloc->mappings_lock, &unlocked, 1,
+      moAcquire)) {
+    atomic_spin_pause();
+    unlocked = 0;
+  }
+}
+
+static void large_allocator_unlock(large_allocator_t *alloc) {
+  atomic_int32_store(&alloc->mappings_lock, 0, moRelease);
+}
+
+// Returns the bucket mappings that start at the given address go in.
+static large_mapping_t **large_allocator_bucket(large_allocator_t *alloc,
+    void *start) {
+  uint64_t value = ((uint64_t) (address_arith_t) start) >> 12;
+  uint64_t hash = (value * 0x9E3779B97F4A7C15ULL) >> 32;
+  return &alloc->mappings[hash & (kLargeAllocatorBucketCount - 1)];
+}
+
+// Returns a pointer to the link that points to the mapping that starts at the
+// given address, or NULL if there is no such mapping. The allocator must be
+// locked.
+static large_mapping_t **large_allocator_find(large_allocator_t *alloc,
+    void *start) {
+  large_mapping_t **cursor = large_allocator_bucket(alloc, start);
+  for (; *cursor != NULL; cursor = &(*cursor)->next) {
+    if ((*cursor)->start == start)
+      return cursor;
+  }
+  return NULL;
+}
+
+// Removes the mapping that starts at the given address from the given
+// allocator's table and returns it, or returns NULL if there is no such
+// mapping in which case the block didn't come from this allocator.
+static large_mapping_t *large_allocator_take_mapping(large_allocator_t *alloc,
+    void *start) {
+  large_allocator_lock(alloc);
+  large_mapping_t **link = large_allocator_find(alloc, start);
+  large_mapping_t *result = NULL;
+  if (link != NULL) {
+    result = *link;
+    *link = result->next;
+  }
+  large_allocator_unlock(alloc);
+  return result;
+}
+
+// Adds the given mapping to the given allocator's table.
+static void large_allocator_put_mapping(large_allocator_t *alloc,
+    large_mapping_t *mapping) {
+  large_allocator_lock(alloc);
+  large_mapping_t **bucket = large_allocator_bucket(alloc, mapping->start);
+  mapping->next = *bucket;
+  *bucket = mapping;
+  large_allocator_unlock(alloc);
+}
+
+static void large_allocator_unmap(large_allocator_t *alloc,
+    large_mapping_t *mapping) {
+  system_release_pages(mapping->start, mapping->size);
+  atomic_int64_fetch_add(&alloc->footprint, -((int64_t) mapping->size),
+      moRelaxed);
+  allocator_free(alloc->outer, blob_new(mapping, sizeof(large_mapping_t)));
+}
+
+// Returns the size of the mapping the given large allocator uses for a block
+// of the given size.
+static size_t large_allocator_mapping_size(large_allocator_t *alloc,
+    size_t size) {
+  size_t granularity = (alloc->huge_pages == hpExplicit)
+      ? alloc->huge_page_size
+      : alloc->page_size;
+  return align_size(granularity, size);
+}
+
+static blob_t large_allocator_malloc(allocator_t *raw_self, size_t size) {
+  large_allocator_t *alloc = (large_allocator_t*) raw_self;
+  if (size < alloc->threshold)
+    return allocator_malloc(alloc->outer, size);
+  blob_t record = allocator_malloc(alloc->outer, sizeof(large_mapping_t));
+  if (blob_is_empty(record))
+    return blob_empty();
+  size_t mapping_size = large_allocator_mapping_size(alloc, size);
+  void *start = system_map_pages(mapping_size, alloc->huge_pages);
+  if (start == NULL) {
+    allocator_free(alloc->outer, record);
+    return blob_empty();
+  }
+  large_mapping_t *mapping = (large_mapping_t*) record.start;
+  mapping->start = start;
+  mapping->size = mapping_size;
+  large_allocator_put_mapping(alloc, mapping);
+  atomic_int64_fetch_add(&alloc->footprint, (int64_t) mapping_size,
+      moRelaxed);
+  return blob_new(start, size);
+}
+
+static void large_allocator_free(allocator_t *raw_self, blob_t memory) {
+  large_allocator_t *alloc = (large_allocator_t*) raw_self;
+  // Blocks below the threshold are never mapped so there's no need to look
+  // for them.
+  large_mapping_t *mapping = (memory.size < alloc->threshold)
+      ? NULL
+      : large_allocator_take_mapping(alloc, memory.start);
+  if (mapping == NULL) {
+    allocator_free(alloc->outer, memory);
+    return;
+  }
+  large_allocator_unmap(alloc, mapping);
+}
+
+static blob_t large_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  large_allocator_t *alloc = (large_allocator_t*) raw_self;
+  // Mappings are only page aligned so blocks that need more than that are left
+  // to the outer allocator. Freeing them works the same as for small blocks
+  // since they're not found among the mappings.
+  if (size < alloc->threshold || alignment > alloc->page_size)
+    return allocator_malloc_aligned(alloc->outer, size, alignment);
+  return large_allocator_malloc(raw_self, size);
+}
+
+static blob_t large_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  large_allocator_t *alloc = (large_allocator_t*) raw_self;
+  size_t old_mapping = 0;
+  if (memory.size >= alloc->threshold) {
+    large_allocator_lock(alloc);
+    large_mapping_t **link = large_allocator_find(alloc, memory.start);
+    if (link != NULL)
+      old_mapping = (*link)->size;
+    large_allocator_unlock(alloc);
+  }
+  bool was_mapped = (old_mapping != 0);
+  bool is_large = (new_size >= alloc->threshold);
+  if (!was_mapped && !is_large)
+    return allocator_realloc(alloc->outer, memory, new_size);
+  if (!was_mapped || !is_large)
+    return allocator_realloc_by_copy(raw_self, memory, new_size);
+  size_t new_mapping = large_allocator_mapping_size(alloc, new_size);
+  if (old_mapping == new_mapping)
+    return blob_new(memory.start, new_size);
+  // Remapping moves the pages without copying them, where it's supported.
+  // The record is taken out while the block moves and put back under the
+  // block's new address.
+  large_mapping_t *mapping = large_allocator_take_mapping(alloc,
+      memory.start);
+  void *start = system_remap_pages(memory.start, old_mapping, new_mapping);
+  if (start == NULL) {
+    large_allocator_put_mapping(alloc, mapping);
+    return allocator_realloc_by_copy(raw_self, memory, new_size);
+  }
+  mapping->start = start;
+  mapping->size = new_mapping;
+  large_allocator_put_mapping(alloc, mapping);
+  atomic_int64_fetch_add(&alloc->footprint,
+      (int64_t) new_mapping - (int64_t) old_mapping, moRelaxed);
+  return blob_new(start, new_size);
+}
+
+void large_allocator_init(large_allocator_t *alloc, allocator_t *outer,
+    size_t threshold, huge_page_mode_t huge_pages) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = large_allocator_malloc;
+  alloc->header.free = large_allocator_free;
+  alloc->header.malloc_aligned = large_allocator_malloc_aligned;
+  alloc->header.realloc = large_allocator_realloc;
+  alloc->outer = outer;
+  // Zero-size blocks must never be mapped.
+  alloc->threshold = (threshold == 0) ? 1 : threshold;
+  alloc->huge_pages = huge_pages;
+  alloc->page_size = system_page_size();
+  alloc->huge_page_size = system_huge_page_size();
+  alloc->footprint = atomic_int64_new(0);
+  alloc->mappings_lock = atomic_int32_new(0);
+}
+
+void large_allocator_dispose(large_allocator_t *alloc) {
+  for (size_t i = 0; i < kLargeAllocatorBucketCount; i++) {
+    large_mapping_t *mapping = alloc->mappings[i];
+    while (mapping != NULL) {
+      large_mapping_t *next = mapping->next;
+      large_allocator_unmap(alloc, mapping);
+      mapping = next;
+    }
+    alloc->mappings[i] = NULL;
+  }
+}
+
+void large_allocator_install(large_allocator_t *alloc, size_t threshold,
+    huge_page_mode_t huge_pages) {
+  large_allocator_init(alloc, allocator_get_default(), threshold, huge_pages);
+  allocator_set_default(&alloc->header);
+}
+
+void large_allocator_uninstall(large_allocator_t *alloc) {
+  CHECK_PTREQ("not current allocator", &alloc->header, allocator_get_default());
+  allocator_set_default(alloc->outer);
+  large_allocator_dispose(alloc);
+}
+
+size_t large_allocator_footprint(large_allocator_t *alloc) {
+  return (size_t) atomic_int64_load(&alloc->footprint, moRelaxed);
+}
+
+static blob_t numa_allocator_malloc(allocator_t *raw_self, size_t size) {
+  if (size == 0)
+    return blob_empty();
+  numa_allocator_t *alloc = (numa_allocator_t*) raw_self;
+  size_t mapping_size = align_size(alloc->page_size, size);
+  void *start = system_map_node_pages(mapping_size, alloc->node_id);
+  if (start == NULL)
+    return blob_empty();
+  atomic_int64_fetch_add(&alloc->footprint, (int64_t) mapping_size,
+      moRelaxed);
+  return blob_new(start, size);
+}
+
+static void numa_allocator_free(allocator_t *raw_self, blob_t memory) {
+  if (blob_is_empty(memory))
+    return;
+  numa_allocator_t *alloc = (numa_allocator_t*) raw_self;
+  size_t mapping_size = align_size(alloc->page_size, memory.size);
+  system_release_pages(memory.start, mapping_size);
+  atomic_int64_fetch_add(&alloc->footprint, -((int64_t) mapping_size),
+      moRelaxed);
+}
+
+static blob_t numa_allocator_malloc_aligned(allocator_t *raw_self,
+    size_t size, size_t alignment) {
+  numa_allocator_t *alloc = (numa_allocator_t*) raw_self;
+  if (alignment > alloc->page_size) {
+    WARN("Can't map blocks with alignment %i", (int) alignment);
+    return blob_empty();
+  }
+  return numa_allocator_malloc(raw_self, size);
+}
+
+static blob_t numa_allocator_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  numa_allocator_t *alloc = (numa_allocator_t*) raw_self;
+  size_t old_mapping = align_size(alloc->page_size, memory.size);
+  size_t new_mapping = align_size(alloc->page_size, new_size);
+  if (old_mapping == new_mapping)
+    return blob_new(memory.start, new_size);
+  // A remapped range keeps its memory policy so it stays on the node.
+  void *start = system_remap_pages(memory.start, old_mapping, new_mapping);
+  if (start == NULL)
+    return allocator_realloc_by_copy(raw_self, memory, new_size);
+  atomic_int64_fetch_add(&alloc->footprint,
+      (int64_t) new_mapping - (int64_t) old_mapping, moRelaxed);
+  return blob_new(start, new_size);
+}
+
+void numa_allocator_init(numa_allocator_t *alloc, int32_t node_id) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = numa_allocator_malloc;
+  alloc->header.free = numa_allocator_free;
+  alloc->header.malloc_aligned = numa_allocator_malloc_aligned;
+  alloc->header.realloc = numa_allocator_realloc;
+  alloc->node_id = node_id;
+  alloc->page_size = system_page_size();
+  alloc->footprint = atomic_int64_new(0);
+}
+
+size_t numa_allocator_footprint(numa_allocator_t *alloc) {
+  return (size_t) atomic_int64_load(&alloc->footprint, moRelaxed);
+}
@@ -7,27 +7,74 @@
 #include "c/stdc.h"
 
 #include "sync/atomic.h"
+#include "sync/counter.h"
+#include "sync/threadlocal.h"
 #include "utils/blob.h"
 #include "utils/check.h"
 
-// An allocator encapsulates a source of memory from the system.
+// An allocator encapsulates a source of memory from the system. The functions
+// that may be NULL make it possible to add new ones without touching every
+// allocator, but only if allocators are zero-filled before their functions are
+// set, for instance with struct_zero_fill, so ones they don't set are NULL.
 typedef struct allocator_t {
   // Function to call to do allocation.
   blob_t (*malloc)(struct allocator_t *self, size_t size);
   // Function to call to dispose memory. Note: the memory to deallocate is
   // the second arguments.
   void (*free)(struct allocator_t *self, blob_t memory);
+  // Function to call to allocate memory with a particular alignment. If this
+  // is NULL blocks are allocated with malloc and only succeed if they happen
+  // to be aligned.
+  blob_t (*malloc_aligned)(struct allocator_t *self, size_t size,
+      size_t alignment);
+  // Function to call to resize a block. The block is never empty and the new
+  // size never 0. If this is NULL blocks are resized by allocating a new block
+  // and copying.
+  blob_t (*realloc)(struct allocator_t *self, blob_t memory, size_t new_size);
 } allocator_t;
 
-// Returns an allocator that uses system malloc/free.
+// The alignment of blocks returned by malloc, and the alignment blocks keep
+// when they're reallocated.
+#define kAllocatorDefaultAlignment 16
+
+// Returns an allocator that uses system malloc/free. Blocks are filled with a
+// marker value when they're allocated and again when they're freed which makes
+// uses of uninitialized or freed memory easier to spot but touches every byte
+// twice.
 allocator_t allocator_system();
 
+// Returns an allocator that uses system malloc/free without filling the
+// blocks. This is the default when checks are disabled.
+allocator_t allocator_system_unpoisoned();
+
 // Allocates a block of memory using the given allocator.
 blob_t allocator_malloc(allocator_t *alloc, size_t size);
 
 // Allocates the specified amount of memory using the default allocator.
 blob_t allocator_default_malloc(size_t size);
 
+// Allocates a block of at least the given size whose start is a multiple of
+// the given alignment, which must be a power of 2, using the given allocator.
+// The block may be larger than requested and must be freed as returned, with
+// the size of the result. Returns an empty blob if allocation fails.
+blob_t allocator_malloc_aligned(allocator_t *alloc, size_t size,
+    size_t alignment);
+
+// Allocates an aligned block using the default allocator.
+blob_t allocator_default_malloc_aligned(size_t size, size_t alignment);
+
+// Resizes the given block, which must have been allocated by the given
+// allocator, to the given size, extending it in place if the allocator can
+// and otherwise moving it. The contents are preserved up to the smaller of
+// the two sizes. Resizing an empty block allocates a new one and resizing to
+// 0 frees the block. If resizing fails an empty blob is returned and the
+// original block is left as it was. A resized block only has the default
+// alignment so blocks allocated with a larger one shouldn't be resized.
+blob_t allocator_realloc(allocator_t *alloc, blob_t memory, size_t new_size);
+
+// Resizes a block allocated with the default allocator.
+blob_t allocator_default_realloc(blob_t memory, size_t new_size);
+
 // Allocates a struct of the given type using the current default allocator. If
 // allocation fails NULL is returned. The result must be deallocated using
 // allocator_default_free_struct with the exact same type.
@@ -58,6 +105,12 @@ allocator_t *allocator_get_default();
 // Sets the default allocator, returning the previous value.
 allocator_t *allocator_set_default(allocator_t *value);
 
+// Returns the next value of a cheap per-thread pseudo-random sequence, seeded
+// differently on each thread. This is what sampling allocators use to pick
+// which allocations to sample; it is neither uniform enough nor unpredictable
+// enough for anything else.
+uint64_t allocator_sampling_random();
+
 // An allocator that keeps track of the total amount allocated and limits how
 // much allocation it will allow.
 typedef struct {
@@ -66,10 +119,11 @@ typedef struct {
   allocator_t *outer;
   // How much memory to allow in total.
   size_t limit;
-  // The total amount of live memory.
-  atomic_int64_t live_memory;
+  // The total amount of live memory. This is updated on every malloc and free
+  // from every thread so it's striped.
+  striped_counter_t live_memory;
   // Total number of blocks allocated.
-  atomic_int64_t live_blocks;
+  striped_counter_t live_blocks;
   // Has this allocator issued any warnings?
   bool has_warned;
 } limited_allocator_t;
@@ -83,6 +137,15 @@ void limited_allocator_install(limited_allocator_t *alloc, size_t limit);
 // was leaked.
 bool limited_allocator_uninstall(limited_allocator_t *alloc);
 
+// The allocations counted for a single fingerprint. The two counts are kept
+// together so updating them only touches one cache line.
+typedef struct {
+  // How many blocks of memory have been allocated for this fingerprint?
+  atomic_int64_t blocks;
+  // How many bytes of memory have been allocated for this fingerprint?
+  atomic_int64_t bytes;
+} fingerprint_bucket_t;
+
 // A fingerprinting allocator computes a fingerprint for each allocation and
 // matches up the fingerprint of allocations and frees, reporting errors if they
 // don't match. Similar to the limited allocator but may narrow down the site
@@ -91,10 +154,8 @@ typedef struct {
   allocator_t header;
   // The default allocator this one is replacing.
   allocator_t *outer;
-  // How many blocks of memory have been allocated for a given fingerprint?
-  atomic_int64_t *blocks;
-  // How many bytes of memory have been allocated for a given fingerprint?
-  atomic_int64_t *bytes;
+  // The allocation counts for each fingerprint.
+  fingerprint_bucket_t *buckets;
   // Has this allocator issued any warnings?
   bool has_warned;
 } fingerprinting_allocator_t;
@@ -106,4 +167,365 @@ void fingerprinting_allocator_install(fingerprinting_allocator_t *alloc);
 // restores the previous one.
 bool fingerprinting_allocator_uninstall(fingerprinting_allocator_t *alloc);
 
+// A chunk of memory that an arena allocator carves allocations out of. The
+// allocations follow directly after the header.
+typedef struct arena_chunk_t {
+  // The next chunk in the arena's list of chunks.
+  struct arena_chunk_t *next;
+  // The size of the whole chunk, including this header.
+  size_t size;
+  // How many bytes have been carved out of the chunk. This may go past the
+  // size when a request didn't fit.
+  atomic_int64_t used;
+} arena_chunk_t;
+
+// An arena allocator carves allocations out of large chunks and frees them
+// all at once when it is reset or disposed; freeing an individual block does
+// nothing. This is for work that does many small allocations which all die
+// together, like handling a single request.
+//
+// Allocation is thread safe since an installed arena may be used by any
+// thread. Reset and dispose are not and must only be called when nobody is
+// allocating.
+typedef struct {
+  allocator_t header;
+  // The allocator chunks are allocated from.
+  allocator_t *outer;
+  // The size of a standard chunk, including its header.
+  size_t chunk_size;
+  // The chunk currently being carved out of.
+  atomic_ptr_t current;
+  // All chunks owned by this arena, most recent first.
+  atomic_ptr_t chunks;
+} arena_allocator_t;
+
+// The default size of arena chunks.
+#define kArenaDefaultChunkSize 65536
+
+// Initializes an arena that allocates chunks of the given size from the given
+// outer allocator.
+void arena_allocator_init(arena_allocator_t *arena, allocator_t *outer,
+    size_t chunk_size);
+
+// Frees everything allocated from the given arena, keeping a chunk around for
+// the next allocations.
+void arena_allocator_reset(arena_allocator_t *arena);
+
+// Frees everything allocated from the given arena, including all chunks.
+void arena_allocator_dispose(arena_allocator_t *arena);
+
+// Initializes the given arena with chunks allocated from the current default
+// allocator and installs it as the default. Arenas nest: installing one while
+// another is the default makes the new one get its chunks from the old one.
+void arena_allocator_install(arena_allocator_t *arena, size_t chunk_size);
+
+// Uninstalls the given arena, which must be the current default, restores the
+// previous allocator, and disposes the arena.
+void arena_allocator_uninstall(arena_allocator_t *arena);
+
+// Returns the total size of the chunks currently owned by the given arena.
+size_t arena_allocator_footprint(arena_allocator_t *arena);
+
+// The number of size classes in a slab allocator.
+#define kSlabClassCount 16
+
+// The largest block a slab allocator serves from its slabs. Larger requests
+// are passed straight through to the outer allocator.
+#define kSlabMaxBlockSize 512
+
+// The size of the slabs blocks are carved from, including the slab's header.
+#define kSlabSize 4096
+
+// The state kept for a single size class of a slab allocator. Each class has
+// its own lock, padded so no two classes share a cache line.
+typedef struct {
+  // A spinlock that protects the rest of this class.
+  IF_MSVC(__declspec(align(kCacheLineSize)), )
+  atomic_int32_t lock
+  IF_GCC(__attribute__((aligned(kCacheLineSize))), );
+  // The size of the blocks in this class.
+  size_t block_size;
+  // Blocks that have been freed, linked through their first word.
+  void *free_list;
+  // The part of the most recent slab that has not been handed out yet.
+  uint8_t *next;
+  uint8_t *limit;
+  // All the slabs of this class, linked through their headers.
+  void *slabs;
+  // How many slabs have been allocated for this class.
+  size_t slab_count;
+} slab_class_t;
+
+// A slab allocator serves small blocks from per size class free lists and
+// carves new ones out of page-sized slabs obtained from the outer allocator.
+// Blocks don't have headers; the size passed to free determines which class
+// a block goes back to so it must be the size that was requested. Slabs are
+// only returned to the outer allocator when the slab allocator is disposed.
+// Slabs are aligned to their size and tagged with their owner so freeing a
+// block that didn't come from a slab, for instance one allocated before the
+// slab allocator was installed, passes it on to the outer allocator.
+//
+// As with the other allocators that can be installed as the default this is
+// thread safe.
+typedef struct {
+  allocator_t header;
+  // The allocator slabs and large blocks are allocated from.
+  allocator_t *outer;
+  // The size classes, smallest first.
+  slab_class_t classes[kSlabClassCount];
+} slab_allocator_t;
+
+// Initializes a slab allocator that gets its memory from the given outer
+// allocator.
+void slab_allocator_init(slab_allocator_t *alloc, allocator_t *outer);
+
+// Returns all the slabs of the given allocator to the outer allocator. Blocks
+// still allocated from the slabs become invalid.
+void slab_allocator_dispose(slab_allocator_t *alloc);
+
+// Initializes the given slab allocator with memory from the current default
+// allocator and installs it as the default.
+void slab_allocator_install(slab_allocator_t *alloc);
+
+// Uninstalls the given slab allocator, which must be the current default,
+// restores the previous allocator, and disposes the slab allocator.
+void slab_allocator_uninstall(slab_allocator_t *alloc);
+
+// Returns the total size of the slabs currently owned by the given allocator.
+size_t slab_allocator_footprint(slab_allocator_t *alloc);
+
+// Returns the number of blocks on the given allocator's free lists. This walks
+// all the lists so it's meant for tests and diagnostics.
+size_t slab_allocator_free_block_count(slab_allocator_t *alloc);
+
+// How many blocks a thread cache holds per size class before it hands some
+// back to the shared back end.
+#define kThreadCacheMagazineSize 32
+
+// How many blocks move between a thread cache and the back end at a time.
+#define kThreadCacheBatchSize 16
+
+struct thread_cache_t;
+
+// A thread-caching allocator keeps a cache of free blocks per thread and size
+// class in front of a shared slab allocator. Small allocations and frees are
+// served from the calling thread's cache without touching any shared state;
+// only when a cache runs empty or full does it move a batch of blocks to or
+// from the back end, taking the lock on that class once per batch. Large
+// blocks, and freed blocks that weren't carved out of the back end's slabs,
+// go straight to the outer allocator.
+//
+// Threads that exit return their cached blocks to the back end. A block may
+// be freed by a different thread than the one that allocated it, it then ends
+// up in the freeing thread's cache.
+typedef struct {
+  allocator_t header;
+  // The allocator the back end gets slabs from, also used for large blocks
+  // and for the caches themselves.
+  allocator_t *outer;
+  // The shared back end.
+  slab_allocator_t back_end;
+  // Each thread's cache.
+  thread_local_t caches;
+  // Spinlock protecting the list of caches.
+  atomic_int32_t caches_lock;
+  // All the caches that belong to live threads.
+  struct thread_cache_t *all_caches;
+} thread_cache_allocator_t;
+
+// Initializes a thread-caching allocator that gets its memory from the given
+// outer allocator. Returns false if initialization fails.
+bool thread_cache_allocator_init(thread_cache_allocator_t *alloc,
+    allocator_t *outer);
+
+// Disposes the given allocator, releasing all the memory it holds. This must
+// only be called once no other threads are using the allocator.
+void thread_cache_allocator_dispose(thread_cache_allocator_t *alloc);
+
+// Returns the calling thread's cached blocks to the back end.
+void thread_cache_allocator_flush(thread_cache_allocator_t *alloc);
+
+// Initializes the given allocator with memory from the current default
+// allocator and installs it as the default. Returns false if initialization
+// fails, in which case the default is left unchanged.
+bool thread_cache_allocator_install(thread_cache_allocator_t *alloc);
+
+// Uninstalls the given allocator, which must be the current default, restores
+// the previous allocator, and disposes the thread-caching one.
+void thread_cache_allocator_uninstall(thread_cache_allocator_t *alloc);
+
+// The default number of allocations a guarded allocator can have live at once.
+#define kGuardedDefaultSlotCount 64
+
+// The default average number of allocations per guarded allocation.
+#define kGuardedDefaultSampleRate 1000
+
+struct guarded_slot_t;
+
+// A guarded allocator places a small random sample of allocations on pages of
+// their own, surrounded by inaccessible guard pages, and passes the rest on to
+// an outer allocator. A sampled block ends where its page ends so running off
+// the end of it faults immediately, and its page is made inaccessible when it
+// is freed so using it after that also faults. The few bytes between the end
+// of a block and the end of its page, there to keep blocks aligned, are
+// checked when the block is freed, as are frees of blocks that aren't live.
+//
+// Allocations that aren't sampled cost a thread-local countdown and frees of
+// blocks that weren't sampled cost a range check, so this is cheap enough to
+// leave on in production where it will, given enough time, catch memory
+// errors the way a full debugging allocator would.
+typedef struct {
+  allocator_t header;
+  // The allocator that handles the allocations that aren't sampled, also used
+  // for the guarded allocator's own data.
+  allocator_t *outer;
+  // One in how many allocations, on average, to sample.
+  size_t sample_rate;
+  size_t page_size;
+  // The number of pages available to sampled blocks.
+  size_t slot_count;
+  // The reserved pages. Slot pages alternate with guard pages, starting and
+  // ending with a guard page.
+  uint8_t *pool;
+  size_t pool_size;
+  // Information about each slot.
+  struct guarded_slot_t *slots;
+  // The slots that are free, as a ring buffer in the order they were freed.
+  // Slots are reused least recently freed first so a freed page stays
+  // inaccessible for as long as possible.
+  size_t *free_slots;
+  size_t free_start;
+  size_t free_count;
+  // Spinlock protecting the slots.
+  atomic_int32_t lock;
+  // The number of errors detected so far.
+  atomic_int64_t error_count;
+} guarded_allocator_t;
+
+// Initializes a guarded allocator on top of the given outer allocator that
+// guards one in sample_rate allocations on average, with room for slot_count
+// guarded blocks at a time. A sample rate of 1 guards every allocation that
+// fits. Returns false if initialization fails.
+bool guarded_allocator_init(guarded_allocator_t *alloc, allocator_t *outer,
+    size_t sample_rate, size_t slot_count);
+
+// Disposes the given allocator and releases the guarded pages. Any guarded
+// blocks still live become inaccessible.
+void guarded_allocator_dispose(guarded_allocator_t *alloc);
+
+// Initializes the given allocator on top of the current default allocator and
+// installs it as the default. Returns false if initialization fails, in which
+// case the default is left unchanged.
+bool guarded_allocator_install(guarded_allocator_t *alloc, size_t sample_rate,
+    size_t slot_count);
+
+// Uninstalls the given allocator, which must be the current default, restores
+// the previous allocator, and disposes the guarded one.
+void guarded_allocator_uninstall(guarded_allocator_t *alloc);
+
+// Returns true iff the given address is within a guarded page owned by the
+// given allocator.
+bool guarded_allocator_owns(guarded_allocator_t *alloc, void *address);
+
+// Returns the number of errors the given allocator has detected.
+int64_t guarded_allocator_error_count(guarded_allocator_t *alloc);
+
+// How a large allocator should use huge pages.
+typedef enum {
+  // Use normal pages.
+  hpNone,
+  // Ask the system to back the blocks with huge pages where it can but don't
+  // require it (transparent huge pages on linux).
+  hpTransparent,
+  // Map the blocks from the system's pool of huge pages if there are any
+  // available, otherwise fall back to normal pages. Blocks are rounded up to
+  // whole huge pages.
+  hpExplicit
+} huge_page_mode_t;
+
+// The default size from which a large allocator maps blocks directly.
+#define kLargeAllocatorDefaultThreshold (256 * 1024)
+
+// The number of buckets in the table a large allocator keeps its mappings in.
+#define kLargeAllocatorBucketCount 64
+
+struct large_mapping_t;
+
+// A large allocator maps blocks at or above a threshold size directly from the
+// system and unmaps them again when they're freed. Smaller blocks are passed
+// on to an outer allocator. Keeping big buffers out of the heap means they
+// don't fragment it and, with huge pages, take fewer TLB entries to access.
+//
+// The allocator keeps track of the blocks it has mapped so large blocks that
+// came from elsewhere, for instance ones allocated before it was installed,
+// are passed on to the outer allocator when they're freed. Blocks this large
+// are expensive to map anyway so the bookkeeping takes a lock.
+typedef struct {
+  allocator_t header;
+  // The allocator that handles small blocks.
+  allocator_t *outer;
+  // Blocks of this size or larger are mapped directly.
+  size_t threshold;
+  huge_page_mode_t huge_pages;
+  // The granularity mappings are made with.
+  size_t page_size;
+  size_t huge_page_size;
+  // The total size of the mappings currently live.
+  atomic_int64_t footprint;
+  // A spinlock that protects the mappings.
+  atomic_int32_t mappings_lock;
+  // The live mappings, hashed by their start address.
+  struct large_mapping_t *mappings[kLargeAllocatorBucketCount];
+} large_allocator_t;
+
+// Initializes a large allocator that maps blocks of the given size or larger
+// and passes smaller ones on to the given outer allocator.
+void large_allocator_init(large_allocator_t *alloc, allocator_t *outer,
+    size_t threshold, huge_page_mode_t huge_pages);
+
+// Unmaps all the blocks the given allocator has mapped that haven't been freed
+// yet; they become invalid.
+void large_allocator_dispose(large_allocator_t *alloc);
+
+// Initializes the given allocator on top of the current default allocator and
+// installs it as the default.
+void large_allocator_install(large_allocator_t *alloc, size_t threshold,
+    huge_page_mode_t huge_pages);
+
+// Uninstalls the given allocator, which must be the current default, restores
+// the previous allocator, and disposes the large allocator. Any blocks it
+// mapped that are still live become invalid since the restored allocator
+// wouldn't know how to free them.
+void large_allocator_uninstall(large_allocator_t *alloc);
+
+// Returns the total size of the mappings currently held by blocks allocated
+// through the given allocator.
+size_t large_allocator_footprint(large_allocator_t *alloc);
+
+// A numa allocator maps memory that is placed on a particular numa node.
+// Every block is a mapping of its own, rounded up to whole pages, so this is
+// meant to be the outer allocator of an arena, slab, or thread-caching
+// allocator which then hands out the node's memory in smaller pieces.
+//
+// Where the platform supports it the pages are bound to the node when they're
+// mapped; elsewhere they are placed, as usual, on the node of the thread that
+// first touches them so the memory should be initialized from a thread that
+// runs on the node.
+typedef struct {
+  allocator_t header;
+  // The system's id for the node, see numa_node_t.
+  int32_t node_id;
+  size_t page_size;
+  // The total size of the mappings currently live.
+  atomic_int64_t footprint;
+} numa_allocator_t;
+
+// Initializes a numa allocator that places memory on the node with the given
+// id.
+void numa_allocator_init(numa_allocator_t *alloc, int32_t node_id);
+
+// Returns the total size of the mappings currently held by blocks allocated
+// through the given allocator.
+size_t numa_allocator_footprint(numa_allocator_t *alloc);
+
 #endif // _TCLIB_ALLOC_H
@@ -15,6 +15,12 @@
 #include "sync/mutex.hh"
 #include "utils/refcount.hh"
 
+#include <new>
+
+#ifdef IS_CPP11
+#  include <type_traits>
+#endif
+
 BEGIN_C_INCLUDES
 #include "utils/callback.h"
 END_C_INCLUDES
@@ -77,11 +83,12 @@ public:
     no_arg_t();
   };
 
-  // How was this binder allocated? Is it shared so that it mustn't be freed or
-  // was it allocated on the heap?
+  // How was this binder allocated? Is it shared so that it mustn't be freed,
+  // was it allocated on the heap, or is it stored inline in a callback?
   typedef enum {
     amShared,
-    amAlloced
+    amAlloced,
+    amInline
   } alloc_mode_t;
 
   abstract_binder_t(alloc_mode_t mode)
@@ -95,10 +102,67 @@ public:
       refcount_shared_t::dispose();
   }
 
+  // Creates a copy of this binder in the given memory which is the inline
+  // binder storage of a callback. Only binders that can be stored inline
+  // support this.
+  virtual abstract_binder_t *copy_inline(void *memory) { return NULL; }
+
+  // Creates a copy of this inline binder on the heap. Like an inline copy the
+  // result holds one ref, which is the caller's. Returns NULL if allocation
+  // fails.
+  abstract_binder_t *copy_alloced() {
+    blob_t memory = allocator_default_malloc(instance_size());
+    if (blob_is_empty(memory))
+      return NULL;
+    abstract_binder_t *result = copy_inline(memory.start);
+    result->mode_ = amAlloced;
+    return result;
+  }
+
 private:
+  // Callbacks mark the binders they store inline.
+  friend class abstract_callback_t;
+
   alloc_mode_t mode_;
 };
 
+// Can a bound argument of type T be stored in a binder inline in a callback?
+// Inline binders get copied whenever the callback is copied, where heap
+// binders are shared, so this is limited to types where copying is cheap and
+// has no side effects. Other types can be bound just fine, the binder just
+// lives on the heap.
+template <typename T>
+struct is_inline_bindable_t {
+  static const bool kValue = IF_CPP11(std::is_trivially_copyable<T>::value,
+      false);
+};
+
+template <typename T>
+struct is_inline_bindable_t<T*> {
+  static const bool kValue = true;
+};
+
+#define __DECLARE_INLINE_BINDABLE__(T)                                         \
+  template <>                                                                  \
+  struct is_inline_bindable_t<T> {                                             \
+    static const bool kValue = true;                                           \
+  };
+__DECLARE_INLINE_BINDABLE__(bool)
+__DECLARE_INLINE_BINDABLE__(char)
+__DECLARE_INLINE_BINDABLE__(signed char)
+__DECLARE_INLINE_BINDABLE__(unsigned char)
+__DECLARE_INLINE_BINDABLE__(short)
+__DECLARE_INLINE_BINDABLE__(unsigned short)
+__DECLARE_INLINE_BINDABLE__(int)
+__DECLARE_INLINE_BINDABLE__(unsigned int)
+__DECLARE_INLINE_BINDABLE__(long)
+__DECLARE_INLINE_BINDABLE__(unsigned long)
+__DECLARE_INLINE_BINDABLE__(long long)
+__DECLARE_INLINE_BINDABLE__(unsigned long long)
+__DECLARE_INLINE_BINDABLE__(double)
+__DECLARE_INLINE_BINDABLE__(opaque_t)
+#undef __DECLARE_INLINE_BINDABLE__
+
 // A generic binder that any concrete binder conforms to.
 template <typename R,
           typename A0 = abstract_binder_t::no_arg_t,
@@ -133,15 +197,16 @@ public:
   }
 
   virtual R call(opaque_invoker_t invoker, A0 a0) {
-    return (invoker.open<R(*)(A0)>())(a0);
+    return (invoker.open<R(*)(A0)>())(FORWARD(A0, a0));
   }
 
   virtual R call(opaque_invoker_t invoker, A0 a0, A1 a1) {
-    return (invoker.open<R(*)(A0, A1)>())(a0, a1);
+    return (invoker.open<R(*)(A0, A1)>())(FORWARD(A0, a0), FORWARD(A1, a1));
   }
 
   virtual R call(opaque_invoker_t invoker, A0 a0, A1 a1, A2 a2) {
-    return (invoker.open<R(*)(A0, A1, A2)>())(a0, a1, a2);
+    return (invoker.open<R(*)(A0, A1, A2)>())(FORWARD(A0, a0), FORWARD(A1, a1),
+        FORWARD(A2, a2));
   }
 
   virtual size_t instance_size() {
@@ -182,11 +247,12 @@ public:
   }
 
   virtual R call(opaque_invoker_t invoker, A0 *a0, A1 a1) {
-    return (a0->*(invoker.open<R(A0::*)(A1)>()))(a1);
+    return (a0->*(invoker.open<R(A0::*)(A1)>()))(FORWARD(A1, a1));
   }
 
   virtual R call(opaque_invoker_t invoker, A0 *a0, A1 a1, A2 a2) {
-    return (a0->*(invoker.open<R(A0::*)(A1, A2)>()))(a1, a2);
+    return (a0->*(invoker.open<R(A0::*)(A1, A2)>()))(FORWARD(A1, a1),
+        FORWARD(A2, a2));
   }
 
   virtual size_t instance_size() {
@@ -219,28 +285,37 @@ class function_binder_1_t : public binder_t<R, A1, A2, A3> {
 public:
   function_binder_1_t(B0 b0)
     : binder_t<R, A1, A2, A3>(abstract_binder_t::amAlloced)
-    , b0_(b0) { }
+    , b0_(MOVE(b0)) { }
 
   virtual R call(opaque_invoker_t invoker) {
     return (invoker.open<R(*)(B0)>())(b0_);
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1) {
-    return (invoker.open<R(*)(B0, A1)>())(b0_, a1);
+    return (invoker.open<R(*)(B0, A1)>())(b0_, FORWARD(A1, a1));
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1, A2 a2) {
-    return (invoker.open<R(*)(B0, A1, A2)>())(b0_, a1, a2);
+    return (invoker.open<R(*)(B0, A1, A2)>())(b0_, FORWARD(A1, a1),
+        FORWARD(A2, a2));
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1, A2 a2, A3 a3) {
-    return (invoker.open<R(*)(B0, A1, A2, A3)>())(b0_, a1, a2, a3);
+    return (invoker.open<R(*)(B0, A1, A2, A3)>())(b0_, FORWARD(A1, a1),
+        FORWARD(A2, a2), FORWARD(A3, a3));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) function_binder_1_t<R, B0, A1, A2, A3>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable = is_inline_bindable_t<B0>::kValue;
+
 private:
   B0 b0_;
 };
@@ -261,21 +336,30 @@ public:
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1) {
-    return (b0_->*(invoker.open<R(B0::*)(A1)>()))(a1);
+    return (b0_->*(invoker.open<R(B0::*)(A1)>()))(FORWARD(A1, a1));
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1, A2 a2) {
-    return (b0_->*(invoker.open<R(B0::*)(A1, A2)>()))(a1, a2);
+    return (b0_->*(invoker.open<R(B0::*)(A1, A2)>()))(FORWARD(A1, a1),
+        FORWARD(A2, a2));
   }
 
   virtual R call(opaque_invoker_t invoker, A1 a1, A2 a2, A3 a3) {
-    return (b0_->*(invoker.open<R(B0::*)(A1, A2, A3)>()))(a1, a2, a3);
+    return (b0_->*(invoker.open<R(B0::*)(A1, A2, A3)>()))(FORWARD(A1, a1),
+        FORWARD(A2, a2), FORWARD(A3, a3));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) method_binder_1_t<R, B0, A1, A2, A3>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable = true;
+
 private:
   B0 *b0_;
 };
@@ -292,29 +376,40 @@ class function_binder_2_t : public binder_t<R, A2, A3, A4> {
 public:
   function_binder_2_t(B0 b0, B1 b1)
     : binder_t<R, A2, A3, A4>(abstract_binder_t::amAlloced)
-    , b0_(b0)
-    , b1_(b1) { }
+    , b0_(MOVE(b0))
+    , b1_(MOVE(b1)) { }
 
   virtual R call(opaque_invoker_t invoker) {
     return (invoker.open<R(*)(B0, B1)>())(b0_, b1_);
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2) {
-    return (invoker.open<R(*)(B0, B1, A2)>())(b0_, b1_, a2);
+    return (invoker.open<R(*)(B0, B1, A2)>())(b0_, b1_, FORWARD(A2, a2));
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2, A3 a3) {
-    return (invoker.open<R(*)(B0, B1, A2, A3)>())(b0_, b1_, a2, a3);
+    return (invoker.open<R(*)(B0, B1, A2, A3)>())(b0_, b1_, FORWARD(A2, a2),
+        FORWARD(A3, a3));
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2, A3 a3, A4 a4) {
-    return (invoker.open<R(*)(B0, B1, A2, A3, A4)>())(b0_, b1_, a2, a3, a4);
+    return (invoker.open<R(*)(B0, B1, A2, A3, A4)>())(b0_, b1_, FORWARD(A2, a2),
+        FORWARD(A3, a3), FORWARD(A4, a4));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) function_binder_2_t<R, B0, B1, A2, A3, A4>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable =
+      is_inline_bindable_t<B0>::kValue &&
+      is_inline_bindable_t<B1>::kValue;
+
 private:
   B0 b0_;
   B1 b1_;
@@ -333,30 +428,43 @@ class function_binder_3_t : public binder_t<R, A3, A4, A5> {
 public:
   function_binder_3_t(B0 b0, B1 b1, B2 b2)
     : binder_t<R, A3, A4, A5>(abstract_binder_t::amAlloced)
-    , b0_(b0)
-    , b1_(b1)
-    , b2_(b2) { }
+    , b0_(MOVE(b0))
+    , b1_(MOVE(b1))
+    , b2_(MOVE(b2)) { }
 
   virtual R call(opaque_invoker_t invoker) {
     return (invoker.open<R(*)(B0, B1, B2)>())(b0_, b1_, b2_);
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3) {
-    return (invoker.open<R(*)(B0, B1, B2, A3)>())(b0_, b1_, b2_, a3);
+    return (invoker.open<R(*)(B0, B1, B2, A3)>())(b0_, b1_, b2_,
+        FORWARD(A3, a3));
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3, A4 a4) {
-    return (invoker.open<R(*)(B0, B1, B2, A3, A4)>())(b0_, b1_, b2_, a3, a4);
+    return (invoker.open<R(*)(B0, B1, B2, A3, A4)>())(b0_, b1_, b2_,
+        FORWARD(A3, a3), FORWARD(A4, a4));
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3, A4 a4, A5 a5) {
-    return (invoker.open<R(*)(B0, B1, B2, A3, A4, A5)>())(b0_, b1_, b2_, a3, a4, a5);
+    return (invoker.open<R(*)(B0, B1, B2, A3, A4, A5)>())(b0_, b1_, b2_,
+        FORWARD(A3, a3), FORWARD(A4, a4), FORWARD(A5, a5));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) function_binder_3_t<R, B0, B1, B2, A3, A4, A5>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable =
+      is_inline_bindable_t<B0>::kValue &&
+      is_inline_bindable_t<B1>::kValue &&
+      is_inline_bindable_t<B2>::kValue;
+
 private:
   B0 b0_;
   B1 b1_;
@@ -374,28 +482,37 @@ public:
   method_binder_2_t(B0 *b0, B1 b1)
     : binder_t<R, A2, A3, A4>(abstract_binder_t::amAlloced)
     , b0_(b0)
-    , b1_(b1) { }
+    , b1_(MOVE(b1)) { }
 
   virtual R call(opaque_invoker_t invoker) {
     return (b0_->*(invoker.open<R(B0::*)(B1)>()))(b1_);
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, A2)>()))(b1_, a2);
+    return (b0_->*(invoker.open<R(B0::*)(B1, A2)>()))(b1_, FORWARD(A2, a2));
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2, A3 a3) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, A2, A3)>()))(b1_, a2, a3);
+    return (b0_->*(invoker.open<R(B0::*)(B1, A2, A3)>()))(b1_, FORWARD(A2, a2),
+        FORWARD(A3, a3));
   }
 
   virtual R call(opaque_invoker_t invoker, A2 a2, A3 a3, A4 a4) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, A2, A3, A4)>()))(b1_, a2, a3, a4);
+    return (b0_->*(invoker.open<R(B0::*)(B1, A2, A3, A4)>()))(b1_,
+        FORWARD(A2, a2), FORWARD(A3, a3), FORWARD(A4, a4));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) method_binder_2_t<R, B0, B1, A2, A3, A4>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable = is_inline_bindable_t<B1>::kValue;
+
 private:
   B0 *b0_;
   B1 b1_;
@@ -413,29 +530,41 @@ public:
   method_binder_3_t(B0 *b0, B1 b1, B2 b2)
     : binder_t<R, A3, A4, A5>(abstract_binder_t::amAlloced)
     , b0_(b0)
-    , b1_(b1)
-    , b2_(b2) { }
+    , b1_(MOVE(b1))
+    , b2_(MOVE(b2)) { }
 
   virtual R call(opaque_invoker_t invoker) {
     return (b0_->*(invoker.open<R(B0::*)(B1, B2)>()))(b1_, b2_);
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3)>()))(b1_, b2_, a3);
+    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3)>()))(b1_, b2_,
+        FORWARD(A3, a3));
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3, A4 a4) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3, A4)>()))(b1_, b2_, a3, a4);
+    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3, A4)>()))(b1_, b2_,
+        FORWARD(A3, a3), FORWARD(A4, a4));
   }
 
   virtual R call(opaque_invoker_t invoker, A3 a3, A4 a4, A5 a5) {
-    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3, A4, A5)>()))(b1_, b2_, a3, a4, a5);
+    return (b0_->*(invoker.open<R(B0::*)(B1, B2, A3, A4, A5)>()))(b1_, b2_,
+        FORWARD(A3, a3), FORWARD(A4, a4), FORWARD(A5, a5));
   }
 
   virtual size_t instance_size() {
     return sizeof(*this);
   }
 
+  virtual abstract_binder_t *copy_inline(void *memory) {
+    return new (memory) method_binder_3_t<R, B0, B1, B2, A3, A4, A5>(*this);
+  }
+
+  // Can this binder be stored inline in a callback?
+  static const bool kIsInlinable =
+      is_inline_bindable_t<B1>::kValue &&
+      is_inline_bindable_t<B2>::kValue;
+
 private:
   B0 *b0_;
   B1 b1_;
@@ -453,24 +582,57 @@ class callback_t;
 // keep track of the types involved and allow the same binder to be passed
 // around and disposed as appropriate, without the client having to keep track
 // of it explicitly.
+//
+// Binders that only bind a few small arguments are stored inline in the
+// callback rather than on the heap. Inline binders are never shared; copying
+// the callback copies the binder so they cost neither an allocation nor any
+// refcounting.
 class abstract_callback_t : public refcount_reference_t<abstract_binder_t> {
 public:
   // Initializes an empty callback.
   abstract_callback_t() : refcount_reference_t() { }
 
-  // Copy constructor that makes sure to ref the binder so it doesn't get
-  // disposed when 'that' is deleted.
+  // Copy constructor that makes sure to ref or copy the binder so it doesn't
+  // get disposed when 'that' is deleted.
   abstract_callback_t(const abstract_callback_t &that)
-    : refcount_reference_t(that)
-    , invoker_(that.invoker_) { }
+    : refcount_reference_t()
+    , invoker_(that.invoker_) {
+    copy_binder(that);
+  }
 
   // Assignment operator, also needs to ensure that binders are reffed and
   // dereffed appropriately.
   abstract_callback_t &operator=(const abstract_callback_t &that) {
-    refcount_reference_t::operator=(that);
-    invoker_ = that.invoker_;
+    if (this != &that) {
+      release_binder();
+      copy_binder(that);
+      invoker_ = that.invoker_;
+    }
+    return *this;
+  }
+
+#ifdef IS_CPP11
+  // Moving a callback hands over the binder without reffing it and leaves the
+  // source empty.
+  abstract_callback_t(abstract_callback_t &&that)
+    : refcount_reference_t()
+    , invoker_(that.invoker_) {
+    take_binder(that);
+  }
+
+  abstract_callback_t &operator=(abstract_callback_t &&that) {
+    if (this != &that) {
+      release_binder();
+      invoker_ = that.invoker_;
+      take_binder(that);
+    }
     return *this;
   }
+#endif
+
+  ~abstract_callback_t() {
+    release_binder();
+  }
 
   // Has this callback been set to an actual value?
   bool is_empty() {
@@ -481,6 +643,20 @@ public:
   // no need to ever use this directly.
   abstract_binder_t *binder() { return refcount_shared(); }
 
+  // Is this callback's binder stored inline? This is visible for testing.
+  bool has_inline_binder() const {
+    address_arith_t binder = reinterpret_cast<address_arith_t>(
+        refcount_shared());
+    address_arith_t start = reinterpret_cast<address_arith_t>(
+        inline_binder_.memory);
+    return (start <= binder) && (binder < start + kInlineBinderSize);
+  }
+
+  // The largest binder that can be stored inline: one that binds three
+  // pointers.
+  static const size_t kInlineBinderSize =
+      sizeof(function_binder_3_t<void, void*, void*, void*>);
+
 protected:
   // Binders are born zero-reffed so this way the number of refs and derefs
   // always matches: ref on construction, deref on disposal.
@@ -488,8 +664,116 @@ protected:
     : refcount_reference_t(binder)
     , invoker_(invoker) { }
 
+  // Makes this empty callback call the given invoker through a copy of the
+  // given binder, stored inline if possible and otherwise on the heap.
+  template <typename B>
+  void bind(opaque_invoker_t invoker, B &binder);
+
   // The binder to call to invoke this callback.
   opaque_invoker_t invoker_;
+
+private:
+  // Makes this callback, which must not have a binder, use the same binder as
+  // the given callback.
+  void copy_binder(const abstract_callback_t &that) {
+    if (that.has_inline_binder()) {
+      // Inline binders are born with a single ref that is never released so
+      // copying one gives a binder that also holds one ref.
+      set_refcount_shared(that.refcount_shared()->copy_inline(
+          inline_binder_.memory));
+    } else {
+      refcount_reference_t::operator=(that);
+    }
+  }
+
+#ifdef IS_CPP11
+  // Makes this callback, which must not have a binder, take over the binder
+  // of the given callback, leaving that one empty.
+  void take_binder(abstract_callback_t &that) {
+    if (that.has_inline_binder()) {
+      copy_binder(that);
+      that.release_binder();
+    } else {
+      refcount_reference_t::operator=(MOVE(that));
+    }
+    that.invoker_ = opaque_invoker_t();
+  }
+#endif
+
+  // Releases this callback's binder, leaving it without one.
+  void release_binder() {
+    if (has_inline_binder()) {
+      refcount_shared()->~abstract_binder_t();
+      set_refcount_shared(NULL);
+    } else {
+      refcount_reference_t::operator=(refcount_reference_t());
+    }
+  }
+
+  // Packed callbacks need to get at the invoker.
+  template <typename S> friend class packed_callback_t;
+
+  // Storage for inline binders. The extra members are there to make the
+  // memory suitably aligned for binders that hold the common types; binders
+  // that need more than that are allocated out of line.
+  union inline_binder_memory_t {
+    uint8_t memory[kInlineBinderSize];
+    void *align_pointer;
+    int64_t align_int64;
+    double align_double;
+  } inline_binder_;
+};
+
+template <typename B>
+void abstract_callback_t::bind(opaque_invoker_t invoker, B &binder) {
+  invoker_ = invoker;
+  abstract_binder_t *result = NULL;
+  if (B::kIsInlinable && (sizeof(B) <= kInlineBinderSize)
+      && (ALIGN_OF(B) <= ALIGN_OF(inline_binder_memory_t))) {
+    result = new (inline_binder_.memory) B(MOVE(binder));
+    result->mode_ = abstract_binder_t::amInline;
+  } else {
+    result = new (kDefaultAlloc) B(MOVE(binder));
+    if (result == NULL)
+      return;
+  }
+  set_refcount_shared(result);
+  result->ref();
+}
+
+// A callback stripped down to its binder and invoker, for keeping a callback
+// somewhere space is tight. There's no room for an inline binder so packing a
+// callback that has one moves it to the heap, which costs the allocation that
+// storing it inline saved. Packed callbacks can't be called directly, they
+// have to be unpacked first.
+template <typename S>
+class packed_callback_t : public refcount_reference_t<abstract_binder_t> {
+public:
+  packed_callback_t() : refcount_reference_t() { }
+
+  // Makes this packed callback, which must be empty, hold the given callback.
+  // Returns false if the callback's binder couldn't be moved to the heap.
+  bool pack(callback_t<S> &callback) {
+    if (callback.has_inline_binder()) {
+      abstract_binder_t *binder = callback.binder()->copy_alloced();
+      if (binder == NULL)
+        return false;
+      set_refcount_shared(binder);
+    } else {
+      refcount_reference_t::operator=(callback);
+    }
+    invoker_ = callback.invoker_;
+    return true;
+  }
+
+  // Returns a callback that calls what the packed callback was packed from.
+  callback_t<S> unpack() const {
+    return callback_t<S>(invoker_,
+        static_cast<typename callback_t<S>::my_binder_t*>(refcount_shared()));
+  }
+
+private:
+  opaque_invoker_t invoker_;
 };
 
 // Marker type that indicates a null/empty callback.
@@ -515,6 +799,14 @@ public:
 
   callback_t() : abstract_callback_t() { }
   callback_t(opaque_invoker_t invoker, my_binder_t *binder) : abstract_callback_t(invoker, binder) { }
+  // Returns a callback that calls the given invoker through a copy of the
+  // given binder, which must be a my_binder_t.
+  template <typename B>
+  static callback_t bound(opaque_invoker_t invoker, B binder) {
+    callback_t result;
+    result.bind(invoker, binder);
+    return result;
+  }
   callback_t(null_callback_t) : abstract_callback_t() { }
   callback_t(R (*invoker)(void))
     : abstract_callback_t(invoker, function_binder_0_t<R>::shared_instance()) { }
@@ -531,32 +823,37 @@ callback_t<R(void)> new_callback(R (*invoker)(void)) {
 
 template <typename R, typename B0>
 callback_t<R(void)> new_callback(R (*invoker)(B0), B0 b0) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) function_binder_1_t<R, B0>(b0));
+  return callback_t<R(void)>::bound(invoker,
+      function_binder_1_t<R, B0>(MOVE(b0)));
 }
 
 template <typename R, typename B0>
 callback_t<R(void)> new_callback(R (B0::*invoker)(void), B0 *b0) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) method_binder_1_t<R, B0>(b0));
+  return callback_t<R(void)>::bound(invoker, method_binder_1_t<R, B0>(b0));
 }
 
 template <typename R, typename B0, typename B1>
 callback_t<R(void)> new_callback(R (*invoker)(B0, B1), B0 b0, B1 b1) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) function_binder_2_t<R, B0, B1>(b0, b1));
+  return callback_t<R(void)>::bound(invoker,
+      function_binder_2_t<R, B0, B1>(MOVE(b0), MOVE(b1)));
 }
 
 template <typename R, typename B0, typename B1>
 callback_t<R(void)> new_callback(R (B0::*invoker)(B1), B0 *b0, B1 b1) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) method_binder_2_t<R, B0, B1>(b0, b1));
+  return callback_t<R(void)>::bound(invoker,
+      method_binder_2_t<R, B0, B1>(b0, MOVE(b1)));
 }
 
 template <typename R, typename B0, typename B1, typename B2>
 callback_t<R(void)> new_callback(R (*invoker)(B0, B1, B2), B0 b0, B1 b1, B2 b2) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) function_binder_3_t<R, B0, B1, B2>(b0, b1, b2));
+  return callback_t<R(void)>::bound(invoker,
+      function_binder_3_t<R, B0, B1, B2>(MOVE(b0), MOVE(b1), MOVE(b2)));
 }
 
 template <typename R, typename B0, typename B1, typename B2>
 callback_t<R(void)> new_callback(R (B0::*invoker)(B1, B2), B0 *b0, B1 b1, B2 b2) {
-  return callback_t<R(void)>(invoker, new (kDefaultAlloc) method_binder_3_t<R, B0, B1, B2>(b0, b1, b2));
+  return callback_t<R(void)>::bound(invoker,
+      method_binder_3_t<R, B0, B1, B2>(b0, MOVE(b1), MOVE(b2)));
 }
 
 template <typename T>
@@ -577,7 +874,7 @@ callback_t<void(T*)> new_destructor_callback() {
 // destructor.
 template <typename T>
 callback_t<void(void)> new_destructor_callback(T *t) {
-  return callback_t<void(void)>(destructor_trampoline<T>, new (kDefaultAlloc) function_binder_1_t<void, T*>(t));
+  return callback_t<void(void)>::bound(destructor_trampoline<T>, function_binder_1_t<void, T*>(t));
 }
 
 template <typename R, typename A0>
@@ -590,12 +887,19 @@ public:
   callback_t() : abstract_callback_t() { }
   callback_t(opaque_invoker_t invoker, my_binder_t *binder)
     : abstract_callback_t(invoker, binder) { }
+  template <typename B>
+  static callback_t bound(opaque_invoker_t invoker, B binder) {
+    callback_t result;
+    result.bind(invoker, binder);
+    return result;
+  }
   callback_t(null_callback_t) : abstract_callback_t() { }
   callback_t(R (*invoker)(A0))
     : abstract_callback_t(invoker, function_binder_0_t<R, A0>::shared_instance()) { }
 
   R operator()(A0 a0) {
-    return (static_cast<my_binder_t*>(binder()))->call(invoker_, a0);
+    return (static_cast<my_binder_t*>(binder()))->call(invoker_,
+        FORWARD(A0, a0));
   }
 };
 
@@ -610,17 +914,20 @@ unary_callback_t *unary_callback_from(callback_t<opaque_t(opaque_t)> *callback);
 
 template <typename R, typename A0, typename B0>
 callback_t<R(A0)> new_callback(R (*invoker)(B0, A0), B0 b0) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) function_binder_1_t<R, B0, A0>(b0));
+  return callback_t<R(A0)>::bound(invoker,
+      function_binder_1_t<R, B0, A0>(MOVE(b0)));
 }
 
 template <typename R, typename A0, typename B0, typename B1>
 callback_t<R(A0)> new_callback(R (*invoker)(B0, B1, A0), B0 b0, B1 b1) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) function_binder_2_t<R, B0, B1, A0>(b0, b1));
+  return callback_t<R(A0)>::bound(invoker,
+      function_binder_2_t<R, B0, B1, A0>(MOVE(b0), MOVE(b1)));
 }
 
 template <typename R, typename A0, typename B0, typename B1, typename B2>
 callback_t<R(A0)> new_callback(R (*invoker)(B0, B1, B2, A0), B0 b0, B1 b1, B2 b2) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) function_binder_3_t<R, B0, B1, B2, A0>(b0, b1, b2));
+  return callback_t<R(A0)>::bound(invoker,
+      function_binder_3_t<R, B0, B1, B2, A0>(MOVE(b0), MOVE(b1), MOVE(b2)));
 }
 
 template <typename R, typename A0>
@@ -630,17 +937,19 @@ callback_t<R(A0*)> new_callback(R (A0::*invoker)(void)) {
 
 template <typename R, typename A0, typename B0>
 callback_t<R(A0)> new_callback(R (B0::*invoker)(A0), B0 *b0) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) method_binder_1_t<R, B0, A0>(b0));
+  return callback_t<R(A0)>::bound(invoker, method_binder_1_t<R, B0, A0>(b0));
 }
 
 template <typename R, typename A0, typename B0, typename B1>
 callback_t<R(A0)> new_callback(R (B0::*invoker)(B1, A0), B0 *b0, B1 b1) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) method_binder_2_t<R, B0, B1, A0>(b0, b1));
+  return callback_t<R(A0)>::bound(invoker,
+      method_binder_2_t<R, B0, B1, A0>(b0, MOVE(b1)));
 }
 
 template <typename R, typename A0, typename B0, typename B1, typename B2>
 callback_t<R(A0)> new_callback(R (B0::*invoker)(B1, B2, A0), B0 *b0, B1 b1, B2 b2) {
-  return callback_t<R(A0)>(invoker, new (kDefaultAlloc) method_binder_3_t<R, B0, B1, B2, A0>(b0, b1, b2));
+  return callback_t<R(A0)>::bound(invoker,
+      method_binder_3_t<R, B0, B1, B2, A0>(b0, MOVE(b1), MOVE(b2)));
 }
 
 template <typename R, typename A0, typename A1>
@@ -652,12 +961,19 @@ public:
 
   callback_t() : abstract_callback_t() { }
   callback_t(opaque_invoker_t invoker, my_binder_t *binder) : abstract_callback_t(invoker, binder) { }
+  template <typename B>
+  static callback_t bound(opaque_invoker_t invoker, B binder) {
+    callback_t result;
+    result.bind(invoker, binder);
+    return result;
+  }
   callback_t(null_callback_t) : abstract_callback_t() { }
   callback_t(R (*invoker)(A0, A1))
     : abstract_callback_t(invoker, function_binder_0_t<R, A0, A1>::shared_instance()) { }
 
   R operator()(A0 a0, A1 a1) {
-    return (static_cast<my_binder_t*>(binder()))->call(invoker_, a0, a1);
+    return (static_cast<my_binder_t*>(binder()))->call(invoker_,
+        FORWARD(A0, a0), FORWARD(A1, a1));
   }
 };
 
@@ -668,17 +984,20 @@ callback_t<R(A0, A1)> new_callback(R (*invoker)(A0, A1)) {
 
 template <typename R, typename A0, typename A1, typename B0>
 callback_t<R(A0, A1)> new_callback(R (*invoker)(B0, A0, A1), B0 b0) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) function_binder_1_t<R, B0, A0, A1>(b0));
+  return callback_t<R(A0, A1)>::bound(invoker,
+      function_binder_1_t<R, B0, A0, A1>(MOVE(b0)));
 }
 
 template <typename R, typename A0, typename A1, typename B0, typename B1>
 callback_t<R(A0, A1)> new_callback(R (*invoker)(B0, B1, A0, A1), B0 b0, B1 b1) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) function_binder_2_t<R, B0, B1, A0, A1>(b0, b1));
+  return callback_t<R(A0, A1)>::bound(invoker,
+      function_binder_2_t<R, B0, B1, A0, A1>(MOVE(b0), MOVE(b1)));
 }
 
 template <typename R, typename A0, typename A1, typename B0, typename B1, typename B2>
 callback_t<R(A0, A1)> new_callback(R (*invoker)(B0, B1, B2, A0, A1), B0 b0, B1 b1, B2 b2) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) function_binder_3_t<R, B0, B1, B2, A0, A1>(b0, b1, b2));
+  return callback_t<R(A0, A1)>::bound(invoker,
+      function_binder_3_t<R, B0, B1, B2, A0, A1>(MOVE(b0), MOVE(b1), MOVE(b2)));
 }
 
 template <typename R, typename A0, typename A1>
@@ -688,17 +1007,19 @@ callback_t<R(A0*, A1)> new_callback(R (A0::*invoker)(A1)) {
 
 template <typename R, typename A0, typename A1, typename B0>
 callback_t<R(A0, A1)> new_callback(R (B0::*invoker)(A0, A1), B0* b0) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) method_binder_1_t<R, B0, A0, A1>(b0));
+  return callback_t<R(A0, A1)>::bound(invoker, method_binder_1_t<R, B0, A0, A1>(b0));
 }
 
 template <typename R, typename A0, typename A1, typename B0, typename B1>
 callback_t<R(A0, A1)> new_callback(R (B0::*invoker)(B1, A0, A1), B0* b0, B1 b1) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) method_binder_2_t<R, B0, B1, A0, A1>(b0, b1));
+  return callback_t<R(A0, A1)>::bound(invoker,
+      method_binder_2_t<R, B0, B1, A0, A1>(b0, MOVE(b1)));
 }
 
 template <typename R, typename A0, typename A1, typename B0, typename B1, typename B2>
 callback_t<R(A0, A1)> new_callback(R (B0::*invoker)(B1, B2, A0, A1), B0* b0, B1 b1, B2 b2) {
-  return callback_t<R(A0, A1)>(invoker, new (kDefaultAlloc) method_binder_3_t<R, B0, B1, B2, A0, A1>(b0, b1, b2));
+  return callback_t<R(A0, A1)>::bound(invoker,
+      method_binder_3_t<R, B0, B1, B2, A0, A1>(b0, MOVE(b1), MOVE(b2)));
 }
 
 template <typename R, typename A0, typename A1, typename A2>
@@ -710,12 +1031,19 @@ public:
 
   callback_t() : abstract_callback_t() { }
   callback_t(opaque_invoker_t invoker, my_binder_t *binder) : abstract_callback_t(invoker, binder) { }
+  template <typename B>
+  static callback_t bound(opaque_invoker_t invoker, B binder) {
+    callback_t result;
+    result.bind(invoker, binder);
+    return result;
+  }
   callback_t(null_callback_t) : abstract_callback_t() { }
   callback_t(R (*invoker)(A0, A1, A2))
     : abstract_callback_t(invoker, function_binder_0_t<R, A0, A1, A2>::shared_instance()) { }
 
   R operator()(A0 a0, A1 a1, A2 a2) {
-    return (static_cast<my_binder_t*>(binder()))->call(invoker_, a0, a1, a2);
+    return (static_cast<my_binder_t*>(binder()))->call(invoker_,
+        FORWARD(A0, a0), FORWARD(A1, a1), FORWARD(A2, a2));
   }
 };
 
@@ -726,17 +1054,21 @@ callback_t<R(A0, A1, A2)> new_callback(R (*invoker)(A0, A1, A2)) {
 
 template <typename R, typename A0, typename A1, typename A2, typename B0>
 callback_t<R(A0, A1, A2)> new_callback(R (*invoker)(B0, A0, A1, A2), B0 b0) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) function_binder_1_t<R, B0, A0, A1, A2>(b0));
+  return callback_t<R(A0, A1, A2)>::bound(invoker,
+      function_binder_1_t<R, B0, A0, A1, A2>(MOVE(b0)));
 }
 
 template <typename R, typename A0, typename A1, typename A2, typename B0, typename B1>
 callback_t<R(A0, A1, A2)> new_callback(R (*invoker)(B0, B1, A0, A1, A2), B0 b0, B1 b1) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) function_binder_2_t<R, B0, B1, A0, A1, A2>(b0, b1));
+  return callback_t<R(A0, A1, A2)>::bound(invoker,
+      function_binder_2_t<R, B0, B1, A0, A1, A2>(MOVE(b0), MOVE(b1)));
 }
 
 template <typename R, typename A0, typename A1, typename A2, typename B0, typename B1, typename B2>
 callback_t<R(A0, A1, A2)> new_callback(R (*invoker)(B0, B1, B2, A0, A1, A2), B0 b0, B1 b1, B2 b2) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) function_binder_3_t<R, B0, B1, B2, A0, A1, A2>(b0, b1, b2));
+  return callback_t<R(A0, A1, A2)>::bound(invoker,
+      function_binder_3_t<R, B0, B1, B2, A0, A1, A2>(MOVE(b0), MOVE(b1),
+      MOVE(b2)));
 }
 
 template <typename R, typename A0, typename A1, typename A2>
@@ -746,17 +1078,19 @@ callback_t<R(A0*, A1, A2)> new_callback(R (A0::*invoker)(A1, A2)) {
 
 template <typename R, typename A0, typename A1, typename A2, typename B0>
 callback_t<R(A0, A1, A2)> new_callback(R (B0::*invoker)(A0, A1, A2), B0 *b0) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) method_binder_1_t<R, B0, A0, A1, A2>(b0));
+  return callback_t<R(A0, A1, A2)>::bound(invoker, method_binder_1_t<R, B0, A0, A1, A2>(b0));
 }
 
 template <typename R, typename A0, typename A1, typename A2, typename B0, typename B1>
 callback_t<R(A0, A1, A2)> new_callback(R (B0::*invoker)(B1, A0, A1, A2), B0 *b0, B1 b1) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) method_binder_2_t<R, B0, B1, A0, A1, A2>(b0, b1));
+  return callback_t<R(A0, A1, A2)>::bound(invoker,
+      method_binder_2_t<R, B0, B1, A0, A1, A2>(b0, MOVE(b1)));
 }
 
 template <typename R, typename A0, typename A1, typename A2, typename B0, typename B1, typename B2>
 callback_t<R(A0, A1, A2)> new_callback(R (B0::*invoker)(B1, B2, A0, A1, A2), B0 *b0, B1 b1, B2 b2) {
-  return callback_t<R(A0, A1, A2)>(invoker, new (kDefaultAlloc) method_binder_3_t<R, B0, B1, B2, A0, A1, A2>(b0, b1, b2));
+  return callback_t<R(A0, A1, A2)>::bound(invoker,
+      method_binder_3_t<R, B0, B1, B2, A0, A1, A2>(b0, MOVE(b1), MOVE(b2)));
 }
 
 } // namespace tclib
@@ -3,6 +3,9 @@
 
 #include <mach/clock.h>
 #include <mach/mach.h>
+#include <mach/mach_time.h>
+
+#include "sync/seqlock.hh"
 
 NativeTime SystemRealTimeClock::time_since_epoch_utc() {
   clock_serv_t clock_serv;
@@ -13,6 +16,22 @@ NativeTime SystemRealTimeClock::time_since_epoch_utc() {
   return spec;
 }
 
+// The calibration used to convert absolute time to nanoseconds. It's fetched
+// lazily and read on every call so it's kept behind a seqlock; that way no
+// thread can see a half-written timebase and reading it never contends.
+static SeqLocked<mach_timebase_info_data_t> monotonic_timebase;
+
+uint64_t monotonic_clock_nanos() {
+  // The absolute time is in some unspecified unit; the timebase says how to
+  // convert it to nanoseconds.
+  mach_timebase_info_data_t timebase = monotonic_timebase.get();
+  if (timebase.denom == 0) {
+    mach_timebase_info(&timebase);
+    monotonic_timebase.set(timebase);
+  }
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 uint64_t NativeTime::to_millis() {
   return static_cast<uint64_t>((static_cast<double>(time.tv_sec) * 1000.0) + (static_cast<double>(time.tv_nsec) / 1000000.0));
 }
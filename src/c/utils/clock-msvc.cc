@@ -5,6 +5,18 @@
 
 #include "utils/duration.hh"
 
+uint64_t monotonic_clock_nanos() {
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  // Split the conversion to avoid overflowing for large counter values.
+  uint64_t ticks = counter.QuadPart;
+  uint64_t freq = frequency.QuadPart;
+  return ((ticks / freq) * 1000000000ULL)
+      + (((ticks % freq) * 1000000000ULL) / freq);
+}
+
 uint64_t NativeTime::to_millis() {
   return time;
 }
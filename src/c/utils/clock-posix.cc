@@ -9,6 +9,13 @@ NativeTime SystemRealTimeClock::time_since_epoch_utc() {
   return spec;
 }
 
+uint64_t monotonic_clock_nanos() {
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return (static_cast<uint64_t>(spec.tv_sec) * 1000000000ULL)
+      + static_cast<uint64_t>(spec.tv_nsec);
+}
+
 uint64_t NativeTime::to_millis() {
   return static_cast<uint64_t>((static_cast<double>(time.tv_sec) * 1000.0) + (static_cast<double>(time.tv_nsec) / 1000000.0));
 }
@@ -25,4 +25,9 @@ native_time_t real_time_clock_time_since_epoch_utc(real_time_clock_t *clock);
 // object.
 uint64_t native_time_to_millis(native_time_t time);
 
+// Returns the current reading of a monotonic clock, in nanoseconds. The
+// readings have no meaning in themselves, only the difference between two of
+// them does, but unlike the real time clock they never go backwards.
+uint64_t monotonic_clock_nanos();
+
 #endif // _TCLIB_UTILS_CLOCK_H
@@ -0,0 +1,46 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Heap profiler stack capture that uses execinfo.
+
+#include <execinfo.h>
+#include <stdio.h>
+
+static size_t heap_profiler_capture_stack(void **frames, size_t max_frames,
+    size_t skip) {
+  void *raw_frames[kHeapProfilerMaxFrames + kHeapProfilerSkipFrames];
+  size_t limit = max_frames + skip;
+  if (limit > kHeapProfilerMaxFrames + kHeapProfilerSkipFrames)
+    limit = kHeapProfilerMaxFrames + kHeapProfilerSkipFrames;
+  int size = backtrace(raw_frames, (int) limit);
+  if (size <= (int) skip)
+    return 0;
+  size_t count = ((size_t) size) - skip;
+  memcpy(frames, raw_frames + skip, count * sizeof(void*));
+  return count;
+}
+
+static void heap_profiler_print_frames(out_stream_t *out, void **frames,
+    size_t frame_count, const char *indent) {
+  char **symbols = backtrace_symbols(frames, (int) frame_count);
+  for (size_t i = 0; i < frame_count; i++) {
+    if (symbols == NULL) {
+      out_stream_printf(out, "%s%p\n", indent, frames[i]);
+    } else {
+      out_stream_printf(out, "%s%s\n", indent, symbols[i]);
+    }
+  }
+  free(symbols);
+}
+
+static void heap_profiler_print_mappings(out_stream_t *out) {
+  // Only linux has this file but that's also where pprof is most likely to be
+  // used on the output.
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps == NULL)
+    return;
+  char line[512];
+  while (fgets(line, sizeof(line), maps) != NULL)
+    out_stream_printf(out, "%s", line);
+  fclose(maps);
+}
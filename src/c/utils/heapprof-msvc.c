@@ -0,0 +1,26 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// Heap profiler stack capture for windows.
+
+#include "c/winhdr.h"
+
+static size_t heap_profiler_capture_stack(void **frames, size_t max_frames,
+    size_t skip) {
+  return CaptureStackBackTrace(static_cast<DWORD>(skip),
+      static_cast<DWORD>(max_frames), frames, NULL);
+}
+
+static void heap_profiler_print_frames(out_stream_t *out, void **frames,
+    size_t frame_count, const char *indent) {
+  // The crash handler has the machinery for resolving symbols but it's too
+  // slow to use for every frame of a heap profile so this just prints the
+  // addresses.
+  for (size_t i = 0; i < frame_count; i++)
+    out_stream_printf(out, "%s0x%p\n", indent, frames[i]);
+}
+
+static void heap_profiler_print_mappings(out_stream_t *out) {
+  // There's no windows equivalent of /proc/self/maps in a form pprof
+  // understands.
+}
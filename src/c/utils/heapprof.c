@@ -0,0 +1,503 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "utils/heapprof.h"
+#include "sync/atomic-inl.h"
+#include "utils/log.h"
+
+// How many of the profiler's own frames to leave out of captured stacks.
+#define kHeapProfilerSkipFrames 3
+
+// Captures the calling thread's stack, skipping the given number of frames,
+// into the given array. Returns the number of frames captured.
+static size_t heap_profiler_capture_stack(void **frames, size_t max_frames,
+    size_t skip);
+
+// Prints the given frames to the given stream, symbolized if the platform
+// supports it, each line prefixed with the given indentation.
+static void heap_profiler_print_frames(out_stream_t *out, void **frames,
+    size_t frame_count, const char *indent);
+
+// Prints the memory mappings of the process in the format pprof expects if
+// the platform supports it.
+static void heap_profiler_print_mappings(out_stream_t *out);
+
+#ifdef IS_MSVC
+#  include "heapprof-msvc.c"
+#else
+#  include "heapprof-execinfo.c"
+#endif
+
+// A call stack that sampled allocations were made from.
+typedef struct heap_stack_t {
+  // The next stack in the same bucket.
+  struct heap_stack_t *next;
+  uint32_t hash;
+  size_t frame_count;
+  void *frames[kHeapProfilerMaxFrames];
+  // Estimated live blocks and bytes allocated from this stack.
+  int64_t live_blocks;
+  int64_t live_bytes;
+  // Estimated blocks and bytes ever allocated from this stack.
+  int64_t total_blocks;
+  int64_t total_bytes;
+} heap_stack_t;
+
+// A sampled allocation that hasn't been freed yet.
+typedef struct heap_sample_t {
+  // The next sample in the same bucket.
+  struct heap_sample_t *next;
+  void *address;
+  // The estimated blocks and bytes this sample stands for.
+  int64_t blocks;
+  int64_t bytes;
+  heap_stack_t *stack;
+} heap_sample_t;
+
+// Sizes of the profiler's hash tables. Must be powers of 2.
+#define kHeapProfilerStackBuckets 4096
+#define kHeapProfilerSampleBuckets 4096
+#define kHeapProfilerFilterSize 65536
+
+// The number of bytes the current thread has left to allocate before the
+// next sample. This is 0 until the thread has been set up and is redrawn as
+// soon as it reaches 0 after that.
+static IF_MSVC(__declspec(thread), __thread) int64_t bytes_until_sample;
+
+// Returns the number of bytes to allocate before the next sample. The
+// intervals are uniformly distributed with the period as their mean, which
+// keeps allocation patterns from lining up with the sampling.
+static int64_t heap_profiler_next_interval(heap_profiler_t *prof) {
+  uint64_t span = 2 * (uint64_t) prof->period;
+  return (int64_t) (1 + (allocator_sampling_random() % span));
+}
+
+// Counts the given allocation against this thread's countdown and returns
+// true iff it should be sampled. The countdown is shared by all profilers so
+// one left over from a profiler with a longer period is drawn again rather
+// than making this one skip samples.
+static bool heap_profiler_should_sample(heap_profiler_t *prof, size_t size) {
+  if (bytes_until_sample <= 0
+      || bytes_until_sample > 2 * (int64_t) prof->period)
+    bytes_until_sample = heap_profiler_next_interval(prof);
+  bytes_until_sample -= (int64_t) size;
+  if (bytes_until_sample > 0)
+    return false;
+  bytes_until_sample = heap_profiler_next_interval(prof);
+  return true;
+}
+
+static void heap_profiler_lock(heap_profiler_t *prof) {
+  int32_t unlocked = 0;
+  while (!atomic_int32_compare_exchange(&prof->lock, &unlocked, 1,
+      moAcquire)) {
+    atomic_spin_pause();
+    unlocked = 0;
+  }
+}
+
+static void heap_profiler_unlock(heap_profiler_t *prof) {
+  atomic_int32_store(&prof->lock, 0, moRelease);
+}
+
+static uint32_t heap_profiler_hash_address(void *address) {
+  uint64_t value = ((uint64_t) (address_arith_t) address) >> 4;
+  return (uint32_t) (((value ^ (value >> 32)) * 2654435761U) & 0xFFFFFFFF);
+}
+
+static uint32_t heap_profiler_hash_frames(void **frames, size_t frame_count) {
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < frame_count; i++) {
+    hash ^= heap_profiler_hash_address(frames[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static atomic_int32_t *heap_profiler_filter_cell(heap_profiler_t *prof,
+    void *address) {
+  uint32_t hash = heap_profiler_hash_address(address);
+  return &prof->filter[hash & (kHeapProfilerFilterSize - 1)];
+}
+
+static heap_stack_t **heap_profiler_stack_bucket(heap_profiler_t *prof,
+    uint32_t hash) {
+  return &prof->stacks[hash & (kHeapProfilerStackBuckets - 1)];
+}
+
+// Returns the stack record for the given frames, which have the given hash,
+// or NULL if there is none. The profiler must be locked.
+static heap_stack_t *heap_profiler_find_stack(heap_profiler_t *prof,
+    uint32_t hash, void **frames, size_t frame_count) {
+  heap_stack_t *stack = *heap_profiler_stack_bucket(prof, hash);
+  for (; stack != NULL; stack = stack->next) {
+    if (stack->hash == hash && stack->frame_count == frame_count
+        && memcmp(stack->frames, frames, frame_count * sizeof(void*)) == 0)
+      return stack;
+  }
+  return NULL;
+}
+
+// Allocates a new, empty, stack record for the given frames. Returns NULL if
+// allocation fails.
+static heap_stack_t *heap_profiler_new_stack(heap_profiler_t *prof,
+    uint32_t hash, void **frames, size_t frame_count) {
+  blob_t memory = allocator_malloc(prof->outer, sizeof(heap_stack_t));
+  if (blob_is_empty(memory))
+    return NULL;
+  heap_stack_t *stack = (heap_stack_t*) memory.start;
+  struct_zero_fill(*stack);
+  stack->hash = hash;
+  stack->frame_count = frame_count;
+  memcpy(stack->frames, frames, frame_count * sizeof(void*));
+  return stack;
+}
+
+// Adds the given new stack record to the profiler. The profiler must be
+// locked.
+static void heap_profiler_add_stack(heap_profiler_t *prof,
+    heap_stack_t *stack) {
+  heap_stack_t **bucket = heap_profiler_stack_bucket(prof, stack->hash);
+  stack->next = *bucket;
+  *bucket = stack;
+  prof->stack_count++;
+}
+
+// Warns that a sample was dropped, the first time it happens.
+static void heap_profiler_warn_dropped(heap_profiler_t *prof) {
+  if (prof->has_warned)
+    return;
+  prof->has_warned = true;
+  WARN("Heap profiler failed to record a sample; profile will be incomplete");
+}
+
+// Records a sample for the given block which has just been allocated.
+static void heap_profiler_record(heap_profiler_t *prof, blob_t block) {
+  void *frames[kHeapProfilerMaxFrames];
+  size_t frame_count = heap_profiler_capture_stack(frames,
+      kHeapProfilerMaxFrames, kHeapProfilerSkipFrames);
+  blob_t memory = allocator_malloc(prof->outer, sizeof(heap_sample_t));
+  if (blob_is_empty(memory)) {
+    heap_profiler_warn_dropped(prof);
+    return;
+  }
+  heap_sample_t *sample = (heap_sample_t*) memory.start;
+  sample->address = block.start;
+  // A block smaller than the period stands for period/size blocks, one at
+  // least as large only for itself.
+  int64_t size = (int64_t) block.size;
+  int64_t period = (int64_t) prof->period;
+  sample->blocks = (size < period) ? (period + size / 2) / size : 1;
+  sample->bytes = (size < period) ? period : size;
+  uint32_t stack_hash = heap_profiler_hash_frames(frames, frame_count);
+  heap_stack_t *fresh = NULL;
+  heap_profiler_lock(prof);
+  heap_stack_t *stack = heap_profiler_find_stack(prof, stack_hash, frames,
+      frame_count);
+  if (stack == NULL) {
+    // The record for a new stack is allocated with the lock released so other
+    // threads don't spin while the outer allocator runs. Someone may add the
+    // same stack meanwhile in which case theirs is used.
+    heap_profiler_unlock(prof);
+    fresh = heap_profiler_new_stack(prof, stack_hash, frames, frame_count);
+    if (fresh == NULL) {
+      heap_profiler_warn_dropped(prof);
+      allocator_free(prof->outer, memory);
+      return;
+    }
+    heap_profiler_lock(prof);
+    stack = heap_profiler_find_stack(prof, stack_hash, frames, frame_count);
+    if (stack == NULL) {
+      heap_profiler_add_stack(prof, fresh);
+      stack = fresh;
+      fresh = NULL;
+    }
+  }
+  sample->stack = stack;
+  stack->live_blocks += sample->blocks;
+  stack->live_bytes += sample->bytes;
+  stack->total_blocks += sample->blocks;
+  stack->total_bytes += sample->bytes;
+  uint32_t hash = heap_profiler_hash_address(block.start);
+  heap_sample_t **bucket = &prof->samples[hash
+      & (kHeapProfilerSampleBuckets - 1)];
+  sample->next = *bucket;
+  *bucket = sample;
+  atomic_int32_fetch_add(heap_profiler_filter_cell(prof, block.start), 1,
+      moRelaxed);
+  heap_profiler_unlock(prof);
+  if (fresh != NULL)
+    allocator_free(prof->outer, blob_new(fresh, sizeof(heap_stack_t)));
+}
+
+// If the given address is a sampled block, forgets the sample.
+static void heap_profiler_forget(heap_profiler_t *prof, void *address) {
+  heap_sample_t *found = NULL;
+  uint32_t hash = heap_profiler_hash_address(address);
+  heap_profiler_lock(prof);
+  heap_sample_t **cursor = &prof->samples[hash
+      & (kHeapProfilerSampleBuckets - 1)];
+  while (*cursor != NULL) {
+    if ((*cursor)->address == address) {
+      found = *cursor;
+      *cursor = found->next;
+      found->stack->live_blocks -= found->blocks;
+      found->stack->live_bytes -= found->bytes;
+      atomic_int32_fetch_add(heap_profiler_filter_cell(prof, address), -1,
+          moRelaxed);
+      break;
+    }
+    cursor = &(*cursor)->next;
+  }
+  heap_profiler_unlock(prof);
+  if (found != NULL)
+    allocator_free(prof->outer, blob_new(found, sizeof(heap_sample_t)));
+}
+
+static blob_t heap_profiler_malloc(allocator_t *raw_self, size_t size) {
+  heap_profiler_t *prof = (heap_profiler_t*) raw_self;
+  blob_t result = allocator_malloc(prof->outer, size);
+  if (!blob_is_empty(result) && heap_profiler_should_sample(prof, size))
+    heap_profiler_record(prof, result);
+  return result;
+}
+
+static void heap_profiler_free(allocator_t *raw_self, blob_t memory) {
+  heap_profiler_t *prof = (heap_profiler_t*) raw_self;
+  if (!blob_is_empty(memory)) {
+    atomic_int32_t *cell = heap_profiler_filter_cell(prof, memory.start);
+    if (atomic_int32_load(cell, moRelaxed) != 0)
+      heap_profiler_forget(prof, memory.start);
+  }
+  allocator_free(prof->outer, memory);
+}
+
+static blob_t heap_profiler_malloc_aligned(allocator_t *raw_self, size_t size,
+    size_t alignment) {
+  heap_profiler_t *prof = (heap_profiler_t*) raw_self;
+  blob_t result = allocator_malloc_aligned(prof->outer, size, alignment);
+  if (!blob_is_empty(result) && heap_profiler_should_sample(prof, result.size))
+    heap_profiler_record(prof, result);
+  return result;
+}
+
+// A resized block is profiled as if the old block had been freed and a new one
+// allocated. The old sample is forgotten up front, before the outer allocator
+// can hand the address to someone else, so it is lost if resizing fails.
+static blob_t heap_profiler_realloc(allocator_t *raw_self, blob_t memory,
+    size_t new_size) {
+  heap_profiler_t *prof = (heap_profiler_t*) raw_self;
+  atomic_int32_t *cell = heap_profiler_filter_cell(prof, memory.start);
+  if (atomic_int32_load(cell, moRelaxed) != 0)
+    heap_profiler_forget(prof, memory.start);
+  blob_t result = allocator_realloc(prof->outer, memory, new_size);
+  if (!blob_is_empty(result) && heap_profiler_should_sample(prof, new_size))
+    heap_profiler_record(prof, result);
+  return result;
+}
+
+bool heap_profiler_init(heap_profiler_t *prof, allocator_t *outer,
+    size_t period) {
+  struct_zero_fill(*prof);
+  prof->header.malloc = heap_profiler_malloc;
+  prof->header.free = heap_profiler_free;
+  prof->header.malloc_aligned = heap_profiler_malloc_aligned;
+  prof->header.realloc = heap_profiler_realloc;
+  prof->outer = outer;
+  prof->period = (period == 0) ? 1 : period;
+  prof->lock = atomic_int32_new(0);
+  blob_t stacks = allocator_malloc(outer,
+      kHeapProfilerStackBuckets * sizeof(heap_stack_t*));
+  blob_t samples = allocator_malloc(outer,
+      kHeapProfilerSampleBuckets * sizeof(heap_sample_t*));
+  blob_t filter = allocator_malloc(outer,
+      kHeapProfilerFilterSize * sizeof(atomic_int32_t));
+  if (blob_is_empty(stacks) || blob_is_empty(samples)
+      || blob_is_empty(filter)) {
+    allocator_free(outer, stacks);
+    allocator_free(outer, samples);
+    allocator_free(outer, filter);
+    WARN("Failed to allocate heap profiler tables");
+    return false;
+  }
+  blob_fill(stacks, 0);
+  blob_fill(samples, 0);
+  blob_fill(filter, 0);
+  prof->stacks = (heap_stack_t**) stacks.start;
+  prof->samples = (heap_sample_t**) samples.start;
+  prof->filter = (atomic_int32_t*) filter.start;
+  return true;
+}
+
+void heap_profiler_dispose(heap_profiler_t *prof) {
+  for (size_t i = 0; i < kHeapProfilerSampleBuckets; i++) {
+    heap_sample_t *sample = prof->samples[i];
+    while (sample != NULL) {
+      heap_sample_t *next = sample->next;
+      allocator_free(prof->outer, blob_new(sample, sizeof(heap_sample_t)));
+      sample = next;
+    }
+  }
+  for (size_t i = 0; i < kHeapProfilerStackBuckets; i++) {
+    heap_stack_t *stack = prof->stacks[i];
+    while (stack != NULL) {
+      heap_stack_t *next = stack->next;
+      allocator_free(prof->outer, blob_new(stack, sizeof(heap_stack_t)));
+      stack = next;
+    }
+  }
+  allocator_free(prof->outer, blob_new(prof->stacks,
+      kHeapProfilerStackBuckets * sizeof(heap_stack_t*)));
+  allocator_free(prof->outer, blob_new(prof->samples,
+      kHeapProfilerSampleBuckets * sizeof(heap_sample_t*)));
+  allocator_free(prof->outer, blob_new(prof->filter,
+      kHeapProfilerFilterSize * sizeof(atomic_int32_t)));
+  prof->stacks = NULL;
+  prof->samples = NULL;
+  prof->filter = NULL;
+}
+
+bool heap_profiler_install(heap_profiler_t *prof, size_t period) {
+  if (!heap_profiler_init(prof, allocator_get_default(), period))
+    return false;
+  allocator_set_default(&prof->header);
+  return true;
+}
+
+void heap_profiler_uninstall(heap_profiler_t *prof) {
+  CHECK_PTREQ("not current allocator", &prof->header, allocator_get_default());
+  allocator_set_default(prof->outer);
+  heap_profiler_dispose(prof);
+}
+
+void heap_profiler_get_live(heap_profiler_t *prof, int64_t *blocks_out,
+    int64_t *bytes_out) {
+  int64_t blocks = 0;
+  int64_t bytes = 0;
+  heap_profiler_lock(prof);
+  for (size_t i = 0; i < kHeapProfilerStackBuckets; i++) {
+    for (heap_stack_t *stack = prof->stacks[i]; stack != NULL;
+        stack = stack->next) {
+      blocks += stack->live_blocks;
+      bytes += stack->live_bytes;
+    }
+  }
+  heap_profiler_unlock(prof);
+  *blocks_out = blocks;
+  *bytes_out = bytes;
+}
+
+// Copies all the stack records into a freshly allocated array such that they
+// can be printed without holding the lock; printing may allocate. Returns the
+// snapshot, which must be released with heap_profiler_release_snapshot, and
+// stores the number of stacks in the out parameter.
+static blob_t heap_profiler_snapshot(heap_profiler_t *prof,
+    size_t *count_out) {
+  while (true) {
+    heap_profiler_lock(prof);
+    size_t count = prof->stack_count;
+    heap_profiler_unlock(prof);
+    blob_t memory = allocator_malloc(prof->outer,
+        (count == 0 ? 1 : count) * sizeof(heap_stack_t));
+    if (blob_is_empty(memory)) {
+      *count_out = 0;
+      return memory;
+    }
+    heap_stack_t *copies = (heap_stack_t*) memory.start;
+    heap_profiler_lock(prof);
+    if (prof->stack_count == count) {
+      size_t index = 0;
+      for (size_t i = 0; i < kHeapProfilerStackBuckets; i++) {
+        for (heap_stack_t *stack = prof->stacks[i]; stack != NULL;
+            stack = stack->next)
+          copies[index++] = *stack;
+      }
+      heap_profiler_unlock(prof);
+      *count_out = count;
+      return memory;
+    }
+    // New stacks were added while we weren't looking; try again.
+    heap_profiler_unlock(prof);
+    allocator_free(prof->outer, memory);
+  }
+}
+
+static void heap_profiler_release_snapshot(heap_profiler_t *prof,
+    blob_t snapshot) {
+  allocator_free(prof->outer, snapshot);
+}
+
+// Orders stacks by live bytes, most first.
+static int heap_stack_compare_live(const void *raw_a, const void *raw_b) {
+  const heap_stack_t *a = (const heap_stack_t*) raw_a;
+  const heap_stack_t *b = (const heap_stack_t*) raw_b;
+  if (a->live_bytes == b->live_bytes)
+    return 0;
+  return (a->live_bytes > b->live_bytes) ? -1 : 1;
+}
+
+void heap_profiler_dump_text(heap_profiler_t *prof, out_stream_t *out,
+    size_t max_stacks) {
+  size_t count = 0;
+  blob_t snapshot = heap_profiler_snapshot(prof, &count);
+  heap_stack_t *stacks = (heap_stack_t*) snapshot.start;
+  qsort(stacks, count, sizeof(heap_stack_t), heap_stack_compare_live);
+  int64_t total_blocks = 0;
+  int64_t total_bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    total_blocks += stacks[i].live_blocks;
+    total_bytes += stacks[i].live_bytes;
+  }
+  out_stream_printf(out, "Heap profile: %lli bytes in %lli blocks live "
+      "(estimated, sampling every %lli bytes)\n", (long long) total_bytes,
+      (long long) total_blocks, (long long) prof->period);
+  for (size_t i = 0; i < count && i < max_stacks; i++) {
+    heap_stack_t *stack = &stacks[i];
+    if (stack->live_bytes == 0)
+      break;
+    int64_t permille = (total_bytes == 0)
+        ? 0
+        : (stack->live_bytes * 1000) / total_bytes;
+    out_stream_printf(out, "%lli bytes (%lli.%lli%%) in %lli blocks\n",
+        (long long) stack->live_bytes, (long long) (permille / 10),
+        (long long) (permille % 10), (long long) stack->live_blocks);
+    heap_profiler_print_frames(out, stack->frames, stack->frame_count, "  ");
+  }
+  heap_profiler_release_snapshot(prof, snapshot);
+  out_stream_flush(out);
+}
+
+void heap_profiler_dump_pprof(heap_profiler_t *prof, out_stream_t *out) {
+  size_t count = 0;
+  blob_t snapshot = heap_profiler_snapshot(prof, &count);
+  heap_stack_t *stacks = (heap_stack_t*) snapshot.start;
+  int64_t live_blocks = 0;
+  int64_t live_bytes = 0;
+  int64_t total_blocks = 0;
+  int64_t total_bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    live_blocks += stacks[i].live_blocks;
+    live_bytes += stacks[i].live_bytes;
+    total_blocks += stacks[i].total_blocks;
+    total_bytes += stacks[i].total_bytes;
+  }
+  // The counts have already been scaled up from the samples so this uses the
+  // plain heap profile header that tells pprof to use them as they are.
+  out_stream_printf(out,
+      "heap profile: %lli: %lli [%lli: %lli] @ heapprofile\n",
+      (long long) live_blocks, (long long) live_bytes,
+      (long long) total_blocks, (long long) total_bytes);
+  for (size_t i = 0; i < count; i++) {
+    heap_stack_t *stack = &stacks[i];
+    out_stream_printf(out, "%lli: %lli [%lli: %lli] @",
+        (long long) stack->live_blocks, (long long) stack->live_bytes,
+        (long long) stack->total_blocks, (long long) stack->total_bytes);
+    for (size_t j = 0; j < stack->frame_count; j++)
+      out_stream_printf(out, " %p", stack->frames[j]);
+    out_stream_printf(out, "\n");
+  }
+  heap_profiler_release_snapshot(prof, snapshot);
+  out_stream_printf(out, "\nMAPPED_LIBRARIES:\n");
+  heap_profiler_print_mappings(out);
+  out_stream_flush(out);
+}
@@ -0,0 +1,90 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+// A sampling heap profiler that plugs into the allocator framework.
+
+#ifndef _TCLIB_HEAPPROF_H
+#define _TCLIB_HEAPPROF_H
+
+#include "c/stdc.h"
+
+#include "io/stream.h"
+#include "sync/atomic.h"
+#include "utils/alloc.h"
+
+// The most frames recorded for a sampled allocation.
+#define kHeapProfilerMaxFrames 32
+
+// The default number of bytes allocated between samples, on average.
+#define kHeapProfilerDefaultPeriod (512 * 1024)
+
+struct heap_stack_t;
+struct heap_sample_t;
+
+// A heap profiler samples allocations, on average one per sampling period
+// bytes, records the call stack of each sampled allocation, and keeps track of
+// how much memory allocated from each call stack is still live. Each sample
+// stands for all the allocations made between it and the previous one so the
+// totals reported are estimates that get more accurate the more samples there
+// are.
+//
+// Allocations that aren't sampled cost a thread-local countdown and frees
+// that don't free a sampled block cost one relaxed load from a filter, so
+// with a sampling period in the hundreds of kilobytes the profiler is cheap
+// enough to run in production.
+typedef struct {
+  allocator_t header;
+  // The allocator that does the actual allocation, also used for the
+  // profiler's own data.
+  allocator_t *outer;
+  // The average number of bytes between samples.
+  size_t period;
+  // Spinlock protecting the tables below.
+  atomic_int32_t lock;
+  // Hash table of the call stacks seen so far.
+  struct heap_stack_t **stacks;
+  // The number of call stacks seen so far.
+  size_t stack_count;
+  // Hash table of the sampled allocations that are still live.
+  struct heap_sample_t **samples;
+  // Counts of live samples by address hash. A free only has to look in the
+  // table of samples if the count for its address is nonzero.
+  atomic_int32_t *filter;
+  // Has this profiler issued any warnings?
+  bool has_warned;
+} heap_profiler_t;
+
+// Initializes a heap profiler that takes one sample per the given number of
+// bytes on average and allocates through the given outer allocator. A period
+// of 1 samples every allocation. Returns false if initialization fails.
+bool heap_profiler_init(heap_profiler_t *prof, allocator_t *outer,
+    size_t period);
+
+// Disposes the given profiler. Blocks allocated through the profiler remain
+// valid as long as the outer allocator is.
+void heap_profiler_dispose(heap_profiler_t *prof);
+
+// Initializes the given profiler on top of the current default allocator and
+// installs it as the default. Returns false if initialization fails.
+bool heap_profiler_install(heap_profiler_t *prof, size_t period);
+
+// Uninstalls the given profiler, which must be the current default, restores
+// the previous allocator, and disposes the profiler.
+void heap_profiler_uninstall(heap_profiler_t *prof);
+
+// Stores the estimated number of live blocks and bytes allocated through the
+// given profiler in the out parameters.
+void heap_profiler_get_live(heap_profiler_t *prof, int64_t *blocks_out,
+    int64_t *bytes_out);
+
+// Writes a report of where live memory was allocated, the call stacks holding
+// the most memory first, to the given stream. At most the given number of
+// call stacks are included.
+void heap_profiler_dump_text(heap_profiler_t *prof, out_stream_t *out,
+    size_t max_stacks);
+
+// Writes the state of the profiler to the given stream in the legacy heap
+// profile format understood by pprof.
+void heap_profiler_dump_pprof(heap_profiler_t *prof, out_stream_t *out);
+
+#endif // _TCLIB_HEAPPROF_H
@@ -14,6 +14,7 @@
 #include "utils/alloc.hh"
 
 BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
 #include "sync/atomic.h"
 END_C_INCLUDES
 
@@ -25,14 +26,17 @@ public:
   refcount_shared_t() : refcount_(atomic_int32_new(0)) { }
   virtual ~refcount_shared_t() { }
 
-  // Increment refcount.
+  // Increment refcount. Whoever is reffing already holds a reference so this
+  // doesn't need to be ordered with anything.
   void ref() {
-    atomic_int32_increment(&refcount_);
+    atomic_int32_fetch_add(&refcount_, 1, moRelaxed);
   }
 
-  // Decremet refcount, possibly disposing this object.
+  // Decremet refcount, possibly disposing this object. The release makes all
+  // this reference's writes to the shared state visible to whoever ends up
+  // disposing it and the acquire makes them visible to the disposer.
   void deref() {
-    if (atomic_int32_decrement(&refcount_) == 0)
+    if (atomic_int32_fetch_add(&refcount_, -1, moAcqRel) == 1)
       dispose();
   }
 
@@ -46,7 +50,7 @@ public:
   // The raw refcount. This is visible for testing, you typically don't want to
   // ever use this for production code.
   int32_t refcount() {
-    return atomic_int32_get(&refcount_);
+    return atomic_int32_load(&refcount_, moRelaxed);
   }
 
 protected:
@@ -85,6 +89,24 @@ public:
     return *this;
   }
 
+#ifdef IS_CPP11
+  // Moving a reference takes over the source's ref so unlike copying it
+  // doesn't touch the refcount.
+  refcount_reference_t(refcount_reference_t<T> &&that)
+    : shared_(that.shared_) {
+    that.shared_ = NULL;
+  }
+
+  refcount_reference_t<T> &operator=(refcount_reference_t<T> &&that) {
+    if (this != &that) {
+      deref_shared();
+      shared_ = that.shared_;
+      that.shared_ = NULL;
+    }
+    return *this;
+  }
+#endif
+
   // Deref the binder on disposal.
   ~refcount_reference_t() {
     deref_shared();
@@ -98,7 +120,7 @@ protected:
   }
 
   // Returns the shared reference.
-  T *refcount_shared() { return shared_; }
+  T *refcount_shared() const { return shared_; }
 
   // Sets the shared reference directly. Note that this will not ref the value,
   // if that's the right thing to do you need to do that manually before or
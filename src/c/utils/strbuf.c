@@ -21,11 +21,11 @@ static fat_bool_t string_buffer_ensure_capacity(string_buffer_t *buf,
   if (length < buf->memory.size)
     return F_TRUE;
   size_t new_capacity = (length * 2);
-  blob_t new_memory = allocator_default_malloc(new_capacity);
+  // Resizing leaves the old memory as it was if it fails so the buffer is
+  // still valid.
+  blob_t new_memory = allocator_default_realloc(buf->memory, new_capacity);
   if (blob_is_empty(new_memory))
     return F_FALSE;
-  memcpy(new_memory.start, buf->memory.start, buf->length);
-  allocator_default_free(buf->memory);
   buf->memory = new_memory;
   return F_TRUE;
 }
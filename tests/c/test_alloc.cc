@@ -1,8 +1,11 @@
 //- Copyright 2015 the Neutrino authors (see AUTHORS).
 //- Licensed under the Apache License, Version 2.0 (see LICENSE).
 
+#include "c/stdvector.hh"
+#include "sync/thread.hh"
 #include "test/unittest.hh"
 #include "utils/alloc.hh"
+#include "utils/log.hh"
 
 using namespace tclib;
 
@@ -60,7 +63,7 @@ TEST(alloc, malloc_struct) {
   ASSERT_EQ(434, p->y);
   allocator_default_free_struct(point_t, p);
 
-  allocator_t blocked = {no_alloc, NULL};
+  allocator_t blocked = {no_alloc, NULL, NULL, NULL};
   allocator_t *prev = allocator_set_default(&blocked);
   ASSERT_PTREQ(NULL, allocator_default_malloc_struct(point_t));
   allocator_set_default(prev);
@@ -78,3 +81,608 @@ TEST(alloc, ref_nulls) {
   def_ref_t<Testy> t4 = t3;
   def_ref_t<Testy> t5 = t3;
 }
+
+TEST(alloc, arena) {
+  arena_allocator_t arena;
+  arena_allocator_init(&arena, allocator_get_default(), 1024);
+  allocator_t *alloc = &arena.header;
+  ASSERT_EQ(0, arena_allocator_footprint(&arena));
+  // Small allocations are carved from the same chunk, suitably aligned and
+  // without overlapping.
+  point_t *last = NULL;
+  for (size_t i = 0; i < 16; i++) {
+    blob_t block = allocator_malloc(alloc, sizeof(point_t));
+    point_t *p = (point_t*) block.start;
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(sizeof(point_t), block.size);
+    ASSERT_EQ(0, ((address_arith_t) p) % 16);
+    if (last != NULL)
+      ASSERT_TRUE(last + 1 <= p);
+    p->x = i;
+    p->y = i;
+    last = p;
+  }
+  ASSERT_EQ(1024, arena_allocator_footprint(&arena));
+  // Large allocations get a chunk of their own.
+  blob_t large = allocator_malloc(alloc, 4096);
+  ASSERT_FALSE(blob_is_empty(large));
+  blob_fill(large, 0xFA);
+  ASSERT_REL(arena_allocator_footprint(&arena), >=, 1024 + 4096);
+  // Filling up the current chunk starts a new one.
+  for (size_t i = 0; i < 64; i++)
+    ASSERT_FALSE(blob_is_empty(allocator_malloc(alloc, 64)));
+  ASSERT_REL(arena_allocator_footprint(&arena), >=, 2 * 1024 + 4096);
+  // Freeing does nothing, resetting keeps just one chunk.
+  allocator_free(alloc, large);
+  arena_allocator_reset(&arena);
+  ASSERT_EQ(1024, arena_allocator_footprint(&arena));
+  ASSERT_FALSE(blob_is_empty(allocator_malloc(alloc, 16)));
+  ASSERT_EQ(1024, arena_allocator_footprint(&arena));
+  arena_allocator_dispose(&arena);
+  ASSERT_EQ(0, arena_allocator_footprint(&arena));
+}
+
+TEST(alloc, arena_nested) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  arena_allocator_t outer;
+  arena_allocator_install(&outer, 4096);
+  point_t *p = allocator_default_malloc_struct(point_t);
+  ASSERT_TRUE(p != NULL);
+  {
+    // The inner arena gets its chunks from the outer one so even if it isn't
+    // disposed properly nothing leaks beyond the outer arena.
+    arena_allocator_t inner;
+    arena_allocator_install(&inner, 1024);
+    ASSERT_PTREQ(&outer.header, inner.outer);
+    for (size_t i = 0; i < 100; i++)
+      ASSERT_TRUE(allocator_default_malloc_struct(point_t) != NULL);
+    arena_allocator_uninstall(&inner);
+  }
+  ASSERT_PTREQ(&outer.header, allocator_get_default());
+  allocator_default_free_struct(point_t, p);
+  arena_allocator_uninstall(&outer);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+#define kArenaThreadCount 4
+#define kArenaBlockCount 2000
+
+static opaque_t fill_arena_blocks(arena_allocator_t *arena, size_t index,
+    point_t **blocks) {
+  for (size_t i = 0; i < kArenaBlockCount; i++) {
+    point_t *p = (point_t*) allocator_malloc(&arena->header,
+        sizeof(point_t)).start;
+    p->x = index;
+    p->y = i;
+    blocks[i] = p;
+  }
+  return o0();
+}
+
+TEST(alloc, arena_concurrent) {
+  // Threads allocating from the same arena at once never get overlapping
+  // blocks.
+  arena_allocator_t arena;
+  arena_allocator_init(&arena, allocator_get_default(), 1024);
+  point_t *blocks[kArenaThreadCount][kArenaBlockCount];
+  NativeThread threads[kArenaThreadCount];
+  for (size_t i = 0; i < kArenaThreadCount; i++) {
+    threads[i].set_callback(new_callback(fill_arena_blocks, &arena, i,
+        blocks[i]));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kArenaThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  for (size_t i = 0; i < kArenaThreadCount; i++) {
+    for (size_t j = 0; j < kArenaBlockCount; j++) {
+      ASSERT_EQ(i, blocks[i][j]->x);
+      ASSERT_EQ(j, blocks[i][j]->y);
+    }
+  }
+  arena_allocator_dispose(&arena);
+}
+
+TEST(alloc, slab) {
+  slab_allocator_t slab;
+  slab_allocator_init(&slab, allocator_get_default());
+  allocator_t *alloc = &slab.header;
+  // Freed blocks are reused for the next allocation of the same class.
+  blob_t first = allocator_malloc(alloc, 40);
+  ASSERT_EQ(40, first.size);
+  ASSERT_EQ(0, ((address_arith_t) first.start) % 16);
+  ASSERT_EQ(kSlabSize, slab_allocator_footprint(&slab));
+  allocator_free(alloc, first);
+  blob_t second = allocator_malloc(alloc, 48);
+  ASSERT_PTREQ(first.start, second.start);
+  // Different classes come from different slabs.
+  blob_t other = allocator_malloc(alloc, 200);
+  ASSERT_EQ(2 * kSlabSize, slab_allocator_footprint(&slab));
+  allocator_free(alloc, other);
+  allocator_free(alloc, second);
+  // Allocating many blocks of every size never hands out the same block
+  // twice.
+  std::vector<blob_t> blocks;
+  for (size_t size = 1; size <= kSlabMaxBlockSize + 64; size += 7) {
+    for (size_t i = 0; i < 4; i++) {
+      blob_t block = allocator_malloc(alloc, size);
+      ASSERT_FALSE(blob_is_empty(block));
+      blob_fill(block, (uint8_t) size);
+      blocks.push_back(block);
+    }
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    blob_t block = blocks[i];
+    for (size_t j = 0; j < block.size; j++)
+      ASSERT_EQ((uint8_t) block.size, ((uint8_t*) block.start)[j]);
+    allocator_free(alloc, block);
+  }
+  slab_allocator_dispose(&slab);
+  ASSERT_EQ(0, slab_allocator_footprint(&slab));
+}
+
+TEST(alloc, slab_installed) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  slab_allocator_t slab;
+  slab_allocator_install(&slab);
+  for (size_t i = 0; i < 100; i++) {
+    point_t *p = allocator_default_malloc_struct(point_t);
+    ASSERT_TRUE(p != NULL);
+    allocator_default_free_struct(point_t, p);
+  }
+  // All those points fit in one slab.
+  ASSERT_EQ(kSlabSize, slab_allocator_footprint(&slab));
+  slab_allocator_uninstall(&slab);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, slab_foreign) {
+  // Blocks allocated before the slab allocator was installed go back to
+  // where they came from when they're freed rather than into the slabs.
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  point_t *before = allocator_default_malloc_struct(point_t);
+  ASSERT_TRUE(before != NULL);
+  slab_allocator_t slab;
+  slab_allocator_install(&slab);
+  allocator_default_free_struct(point_t, before);
+  point_t *after = allocator_default_malloc_struct(point_t);
+  ASSERT_TRUE(after != NULL);
+  ASSERT_TRUE(after != before);
+  allocator_default_free_struct(point_t, after);
+  slab_allocator_uninstall(&slab);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+// How many threads the slab and thread cache tests churn blocks on, and how
+// many rounds each of them does.
+#define kChurnThreadCount 4
+#define kChurnRoundCount 2000
+
+static opaque_t churn_slab_blocks(slab_allocator_t *slab, size_t index) {
+  point_t *live[16];
+  for (size_t round = 0; round < kChurnRoundCount; round++) {
+    for (size_t i = 0; i < 16; i++) {
+      live[i] = (point_t*) allocator_malloc(&slab->header,
+          sizeof(point_t)).start;
+      live[i]->x = index;
+      live[i]->y = i;
+    }
+    for (size_t i = 0; i < 16; i++) {
+      ASSERT_EQ(index, live[i]->x);
+      ASSERT_EQ(i, live[i]->y);
+      allocator_free(&slab->header, blob_new(live[i], sizeof(point_t)));
+    }
+  }
+  return o0();
+}
+
+TEST(alloc, slab_concurrent) {
+  slab_allocator_t slab;
+  slab_allocator_init(&slab, allocator_get_default());
+  NativeThread threads[kChurnThreadCount];
+  for (size_t i = 0; i < kChurnThreadCount; i++) {
+    threads[i].set_callback(new_callback(churn_slab_blocks, &slab, i));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kChurnThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  slab_allocator_dispose(&slab);
+}
+
+TEST(alloc, thread_cache) {
+  thread_cache_allocator_t alloc;
+  ASSERT_TRUE(thread_cache_allocator_init(&alloc, allocator_get_default()));
+  // The first allocation fills this thread's cache with a batch from the back
+  // end, after which a freed block is handed out again right away.
+  blob_t first = allocator_malloc(&alloc.header, 24);
+  ASSERT_FALSE(blob_is_empty(first));
+  ASSERT_EQ(kSlabSize, slab_allocator_footprint(&alloc.back_end));
+  allocator_free(&alloc.header, first);
+  blob_t second = allocator_malloc(&alloc.header, 32);
+  ASSERT_PTREQ(first.start, second.start);
+  allocator_free(&alloc.header, second);
+  // Freeing more than fits in the cache hands blocks back, all but what fits
+  // in a magazine, and flushing hands back the rest.
+  size_t block_count = 3 * kThreadCacheMagazineSize;
+  std::vector<blob_t> blocks;
+  for (size_t i = 0; i < block_count; i++)
+    blocks.push_back(allocator_malloc(&alloc.header, 100));
+  size_t free_before = slab_allocator_free_block_count(&alloc.back_end);
+  for (size_t i = 0; i < blocks.size(); i++)
+    allocator_free(&alloc.header, blocks[i]);
+  size_t handed_back = slab_allocator_free_block_count(&alloc.back_end)
+      - free_before;
+  ASSERT_REL(handed_back, >=, block_count - kThreadCacheMagazineSize);
+  ASSERT_REL(handed_back, <, block_count);
+  thread_cache_allocator_flush(&alloc);
+  ASSERT_REL(slab_allocator_free_block_count(&alloc.back_end), >=,
+      free_before + block_count);
+  // Large blocks bypass the caches.
+  blob_t large = allocator_malloc(&alloc.header, 4 * kSlabMaxBlockSize);
+  ASSERT_FALSE(blob_is_empty(large));
+  allocator_free(&alloc.header, large);
+  thread_cache_allocator_dispose(&alloc);
+}
+
+TEST(alloc, thread_cache_foreign) {
+  // As with the slab allocator blocks from before the thread cache was
+  // installed are returned to where they came from.
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  point_t *before = allocator_default_malloc_struct(point_t);
+  ASSERT_TRUE(before != NULL);
+  thread_cache_allocator_t alloc;
+  ASSERT_TRUE(thread_cache_allocator_install(&alloc));
+  allocator_default_free_struct(point_t, before);
+  point_t *after = allocator_default_malloc_struct(point_t);
+  ASSERT_TRUE(after != NULL);
+  ASSERT_TRUE(after != before);
+  allocator_default_free_struct(point_t, after);
+  thread_cache_allocator_uninstall(&alloc);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+static opaque_t churn_thread_cache(size_t index) {
+  point_t *live[16];
+  for (size_t round = 0; round < kChurnRoundCount; round++) {
+    for (size_t i = 0; i < 16; i++) {
+      live[i] = allocator_default_malloc_struct(point_t);
+      live[i]->x = index;
+      live[i]->y = i;
+    }
+    for (size_t i = 0; i < 16; i++) {
+      ASSERT_EQ(index, live[i]->x);
+      ASSERT_EQ(i, live[i]->y);
+      allocator_default_free_struct(point_t, live[i]);
+    }
+  }
+  return o0();
+}
+
+TEST(alloc, thread_cache_installed) {
+  // Threads churning through the installed allocator and then exiting leave
+  // nothing behind once it is uninstalled.
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  thread_cache_allocator_t alloc;
+  ASSERT_TRUE(thread_cache_allocator_install(&alloc));
+  NativeThread threads[kChurnThreadCount];
+  for (size_t i = 0; i < kChurnThreadCount; i++) {
+    threads[i].set_callback(new_callback(churn_thread_cache, i));
+    ASSERT_TRUE(threads[i].start());
+  }
+  churn_thread_cache(kChurnThreadCount);
+  for (size_t i = 0; i < kChurnThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  thread_cache_allocator_uninstall(&alloc);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, system_unpoisoned) {
+  allocator_t system = allocator_system_unpoisoned();
+  blob_t block = allocator_malloc(&system, sizeof(point_t));
+  ASSERT_FALSE(blob_is_empty(block));
+  point_t *p = static_cast<point_t*>(block.start);
+  p->x = 1;
+  p->y = 2;
+  ASSERT_EQ(3, p->x + p->y);
+  allocator_free(&system, block);
+}
+
+// Returns the offset of the given address within its page.
+static size_t guarded_page_offset(guarded_allocator_t *alloc, void *address) {
+  return reinterpret_cast<address_arith_t>(address) % alloc->page_size;
+}
+
+TEST(alloc, guarded) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  guarded_allocator_t alloc;
+  ASSERT_TRUE(guarded_allocator_install(&alloc, 1, 4));
+  // With a sample rate of 1 every block goes on a guarded page, ending as
+  // close to the end of the page as alignment allows.
+  blob_t blocks[4];
+  for (size_t i = 0; i < 4; i++) {
+    blocks[i] = allocator_default_malloc(100);
+    ASSERT_FALSE(blob_is_empty(blocks[i]));
+    ASSERT_TRUE(guarded_allocator_owns(&alloc, blocks[i].start));
+    ASSERT_EQ(alloc.page_size - 112,
+        guarded_page_offset(&alloc, blocks[i].start));
+    blob_fill(blocks[i], static_cast<byte_t>(i));
+  }
+  // Once the slots are used up blocks come from the outer allocator, as do
+  // blocks too large for a page.
+  blob_t spill = allocator_default_malloc(100);
+  ASSERT_FALSE(guarded_allocator_owns(&alloc, spill.start));
+  blob_t large = allocator_default_malloc(alloc.page_size + 1);
+  ASSERT_FALSE(guarded_allocator_owns(&alloc, large.start));
+  allocator_default_free(spill);
+  allocator_default_free(large);
+  // Freed slots are reused least recently freed first.
+  allocator_default_free(blocks[2]);
+  allocator_default_free(blocks[0]);
+  blob_t again = allocator_default_malloc(16);
+  ASSERT_PTREQ(static_cast<byte_t*>(blocks[2].start) + 96, again.start);
+  allocator_default_free(again);
+  allocator_default_free(blocks[1]);
+  allocator_default_free(blocks[3]);
+  ASSERT_EQ(0, guarded_allocator_error_count(&alloc));
+  guarded_allocator_uninstall(&alloc);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, guarded_sampling) {
+  guarded_allocator_t alloc;
+  ASSERT_TRUE(guarded_allocator_init(&alloc, allocator_get_default(), 10,
+      1000));
+  std::vector<blob_t> blocks;
+  size_t guarded = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    blob_t block = allocator_malloc(&alloc.header, sizeof(point_t));
+    if (guarded_allocator_owns(&alloc, block.start))
+      guarded++;
+    blocks.push_back(block);
+  }
+  ASSERT_REL(guarded, >, 30);
+  ASSERT_REL(guarded, <, 300);
+  for (size_t i = 0; i < blocks.size(); i++)
+    allocator_free(&alloc.header, blocks[i]);
+  guarded_allocator_dispose(&alloc);
+}
+
+// Log that swallows errors and counts them.
+class ErrorCounter : public Log {
+public:
+  ErrorCounter() : count_(0) { }
+  virtual fat_bool_t record(log_entry_t *entry);
+  size_t count() { return count_; }
+private:
+  size_t count_;
+};
+
+fat_bool_t ErrorCounter::record(log_entry_t *entry) {
+  if (entry->level != llError)
+    return propagate(entry);
+  count_++;
+  return F_TRUE;
+}
+
+TEST(alloc, guarded_errors) {
+  guarded_allocator_t alloc;
+  ASSERT_TRUE(guarded_allocator_init(&alloc, allocator_get_default(), 1, 4));
+  ErrorCounter errors;
+  errors.ensure_installed();
+  // Writing past the end of a block but within the alignment padding is
+  // caught when the block is freed.
+  blob_t block = allocator_malloc(&alloc.header, 13);
+  static_cast<byte_t*>(block.start)[13] = 0;
+  allocator_free(&alloc.header, block);
+  ASSERT_EQ(1, errors.count());
+  ASSERT_EQ(1, guarded_allocator_error_count(&alloc));
+  // Freeing the same block again is caught right away.
+  allocator_free(&alloc.header, block);
+  ASSERT_EQ(2, errors.count());
+  // So is freeing something that isn't the start of a block.
+  blob_t other = allocator_malloc(&alloc.header, 32);
+  allocator_free(&alloc.header, blob_new(
+      static_cast<byte_t*>(other.start) + 8, 24));
+  ASSERT_EQ(3, guarded_allocator_error_count(&alloc));
+  allocator_free(&alloc.header, other);
+  ASSERT_EQ(3, guarded_allocator_error_count(&alloc));
+  errors.ensure_uninstalled();
+  guarded_allocator_dispose(&alloc);
+}
+
+static void check_large_allocator(huge_page_mode_t huge_pages) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  large_allocator_t alloc;
+  large_allocator_install(&alloc, 64 * 1024, huge_pages);
+  ASSERT_REL(alloc.huge_page_size, >=, alloc.page_size);
+  ASSERT_EQ(0, alloc.huge_page_size % alloc.page_size);
+  // Small blocks come from the outer allocator.
+  blob_t small = allocator_default_malloc(1024);
+  ASSERT_FALSE(blob_is_empty(small));
+  ASSERT_EQ(0, large_allocator_footprint(&alloc));
+  // Large ones are mapped directly, so they don't count against the limit.
+  size_t size = 4 * 1024 * 1024 + 1;
+  blob_t large = allocator_default_malloc(size);
+  ASSERT_FALSE(blob_is_empty(large));
+  ASSERT_EQ(size, large.size);
+  ASSERT_EQ(0, reinterpret_cast<address_arith_t>(large.start)
+      % alloc.page_size);
+  ASSERT_REL(large_allocator_footprint(&alloc), >, size);
+  blob_fill(large, 0xAB);
+  ASSERT_EQ(0xAB, static_cast<byte_t*>(large.start)[size - 1]);
+  allocator_default_free(large);
+  ASSERT_EQ(0, large_allocator_footprint(&alloc));
+  allocator_default_free(small);
+  large_allocator_uninstall(&alloc);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, large_foreign) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  // A large block allocated before the large allocator was installed goes
+  // back to where it came from rather than getting unmapped.
+  blob_t before = allocator_default_malloc(128 * 1024);
+  ASSERT_FALSE(blob_is_empty(before));
+  large_allocator_t alloc;
+  large_allocator_install(&alloc, 64 * 1024, hpNone);
+  allocator_default_free(before);
+  // Uninstalling unmaps the blocks that are still live.
+  blob_t leaked = allocator_default_malloc(128 * 1024);
+  ASSERT_FALSE(blob_is_empty(leaked));
+  ASSERT_REL(large_allocator_footprint(&alloc), >=, leaked.size);
+  large_allocator_uninstall(&alloc);
+  ASSERT_EQ(0, large_allocator_footprint(&alloc));
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, large) {
+  check_large_allocator(hpNone);
+  check_large_allocator(hpTransparent);
+  // There may not be any huge pages reserved on the machine running the test
+  // in which case this falls back to normal pages, but either way it works.
+  check_large_allocator(hpExplicit);
+}
+
+// Allocates a range of aligned blocks from the given allocator and checks that
+// they're aligned and usable.
+static void check_malloc_aligned(allocator_t *alloc) {
+  static const size_t kSizes[4] = {1, 24, 100, 700};
+  static const size_t kAlignments[4] = {16, 64, 256, 4096};
+  for (size_t si = 0; si < 4; si++) {
+    for (size_t ai = 0; ai < 4; ai++) {
+      size_t size = kSizes[si];
+      size_t alignment = kAlignments[ai];
+      blob_t block = allocator_malloc_aligned(alloc, size, alignment);
+      ASSERT_FALSE(blob_is_empty(block));
+      ASSERT_REL(block.size, >=, size);
+      ASSERT_EQ(0, reinterpret_cast<address_arith_t>(block.start)
+          % alignment);
+      blob_fill(block, 0xAB);
+      allocator_free(alloc, block);
+    }
+  }
+}
+
+// Grows and shrinks a block allocated from the given allocator, checking that
+// the contents survive.
+static void check_realloc(allocator_t *alloc) {
+  blob_t block = allocator_realloc(alloc, blob_empty(), 10);
+  ASSERT_FALSE(blob_is_empty(block));
+  byte_t *bytes = static_cast<byte_t*>(block.start);
+  for (size_t i = 0; i < 10; i++)
+    bytes[i] = static_cast<byte_t>(i);
+  static const size_t kSizes[5] = {12, 100, 1000, 70000, 5};
+  for (size_t si = 0; si < 5; si++) {
+    block = allocator_realloc(alloc, block, kSizes[si]);
+    ASSERT_FALSE(blob_is_empty(block));
+    ASSERT_EQ(kSizes[si], block.size);
+    bytes = static_cast<byte_t*>(block.start);
+    for (size_t i = 0; i < 5; i++)
+      ASSERT_EQ(i, bytes[i]);
+  }
+  ASSERT_TRUE(blob_is_empty(allocator_realloc(alloc, block, 0)));
+}
+
+TEST(alloc, aligned_and_realloc) {
+  allocator_t system = allocator_system();
+  check_malloc_aligned(&system);
+  check_realloc(&system);
+  allocator_t unpoisoned = allocator_system_unpoisoned();
+  check_malloc_aligned(&unpoisoned);
+  check_realloc(&unpoisoned);
+
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 1024 * 1024);
+  check_malloc_aligned(&limited.header);
+  check_realloc(&limited.header);
+
+  arena_allocator_t arena;
+  arena_allocator_init(&arena, &limited.header, 4096);
+  check_malloc_aligned(&arena.header);
+  check_realloc(&arena.header);
+  arena_allocator_dispose(&arena);
+
+  slab_allocator_t slab;
+  slab_allocator_init(&slab, &limited.header);
+  check_malloc_aligned(&slab.header);
+  check_realloc(&slab.header);
+  slab_allocator_dispose(&slab);
+
+  thread_cache_allocator_t cache;
+  ASSERT_TRUE(thread_cache_allocator_init(&cache, &limited.header));
+  check_malloc_aligned(&cache.header);
+  check_realloc(&cache.header);
+  thread_cache_allocator_dispose(&cache);
+
+  guarded_allocator_t guarded;
+  ASSERT_TRUE(guarded_allocator_init(&guarded, &limited.header, 2, 4));
+  check_malloc_aligned(&guarded.header);
+  check_realloc(&guarded.header);
+  ASSERT_EQ(0, guarded_allocator_error_count(&guarded));
+  guarded_allocator_dispose(&guarded);
+
+  large_allocator_t large;
+  large_allocator_init(&large, &limited.header, 512, hpNone);
+  check_malloc_aligned(&large.header);
+  check_realloc(&large.header);
+  ASSERT_EQ(0, large_allocator_footprint(&large));
+
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(alloc, realloc_in_place) {
+  // The most recent block in an arena grows into the space after it.
+  arena_allocator_t arena;
+  arena_allocator_init(&arena, allocator_get_default(), 4096);
+  allocator_malloc(&arena.header, 16);
+  blob_t last = allocator_malloc(&arena.header, 16);
+  blob_t grown = allocator_realloc(&arena.header, last, 200);
+  ASSERT_PTREQ(last.start, grown.start);
+  // Once something else has been allocated it has to move.
+  allocator_malloc(&arena.header, 16);
+  blob_t moved = allocator_realloc(&arena.header, grown, 400);
+  ASSERT_FALSE(moved.start == grown.start);
+  arena_allocator_dispose(&arena);
+
+  // Slab blocks stay put as long as they stay in the same size class.
+  slab_allocator_t slab;
+  slab_allocator_init(&slab, allocator_get_default());
+  blob_t block = allocator_malloc(&slab.header, 17);
+  blob_t same = allocator_realloc(&slab.header, block, 32);
+  ASSERT_PTREQ(block.start, same.start);
+  allocator_free(&slab.header, allocator_realloc(&slab.header, same, 33));
+  slab_allocator_dispose(&slab);
+
+  // Large blocks are remapped, which keeps their contents.
+  large_allocator_t large;
+  large_allocator_init(&large, allocator_get_default(), 4096, hpNone);
+  blob_t mapped = allocator_malloc(&large.header, 8192);
+  blob_fill(mapped, 0x5A);
+  blob_t remapped = allocator_realloc(&large.header, mapped, 1024 * 1024);
+  ASSERT_EQ(0x5A, static_cast<byte_t*>(remapped.start)[8191]);
+  ASSERT_EQ(1024 * 1024, large_allocator_footprint(&large));
+  allocator_free(&large.header, remapped);
+  ASSERT_EQ(0, large_allocator_footprint(&large));
+}
+
+TEST(alloc, large_over_aligned) {
+  // Mappings can't be aligned beyond the page size so blocks that need more
+  // come from the outer allocator.
+  large_allocator_t large;
+  large_allocator_init(&large, allocator_get_default(), 4096, hpNone);
+  size_t alignment = 1024 * 1024;
+  blob_t block = allocator_malloc_aligned(&large.header, 8192, alignment);
+  ASSERT_FALSE(blob_is_empty(block));
+  ASSERT_EQ(0, reinterpret_cast<address_arith_t>(block.start) % alignment);
+  ASSERT_EQ(0, large_allocator_footprint(&large));
+  blob_fill(block, 0xAB);
+  allocator_free(&large.header, block);
+  large_allocator_dispose(&large);
+}
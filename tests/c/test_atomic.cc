@@ -7,6 +7,7 @@
 #include "sync/thread.hh"
 
 BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
 #include "sync/atomic.h"
 END_C_INCLUDES
 
@@ -17,23 +18,41 @@ using namespace tclib;
 class A32 {
 public:
   typedef atomic_int32_t atomic_t;
+  typedef int32_t value_t;
   static atomic_t init(int32_t v) { return atomic_int32_new(v); }
   static int32_t get(atomic_t *v) { return atomic_int32_get(v); }
   static int32_t inc(atomic_t *v) { return atomic_int32_increment(v); }
   static int32_t dec(atomic_t *v) { return atomic_int32_decrement(v); }
   static int32_t add(atomic_t *v, int32_t d) { return atomic_int32_add(v, d); }
   static int32_t sub(atomic_t *v, int32_t d) { return atomic_int32_subtract(v, d); }
+  static bool cas(atomic_t *v, int32_t o, int32_t n) { return atomic_int32_compare_and_set(v, o, n); }
+  static int32_t load(atomic_t *v, memory_order_t o) { return atomic_int32_load(v, o); }
+  static void store(atomic_t *v, int32_t x, memory_order_t o) { atomic_int32_store(v, x, o); }
+  static int32_t exchange(atomic_t *v, int32_t x, memory_order_t o) { return atomic_int32_exchange(v, x, o); }
+  static int32_t fetch_add(atomic_t *v, int32_t d, memory_order_t o) { return atomic_int32_fetch_add(v, d, o); }
+  static int32_t fetch_or(atomic_t *v, int32_t b, memory_order_t o) { return atomic_int32_fetch_or(v, b, o); }
+  static int32_t fetch_and(atomic_t *v, int32_t b, memory_order_t o) { return atomic_int32_fetch_and(v, b, o); }
+  static bool compare_exchange(atomic_t *v, int32_t *e, int32_t d, memory_order_t o) { return atomic_int32_compare_exchange(v, e, d, o); }
 };
 
 class A64 {
 public:
   typedef atomic_int64_t atomic_t;
+  typedef int64_t value_t;
   static atomic_t init(int64_t v) { return atomic_int64_new(v); }
   static int64_t get(atomic_t *v) { return atomic_int64_get(v); }
   static int64_t inc(atomic_t *v) { return atomic_int64_increment(v); }
   static int64_t dec(atomic_t *v) { return atomic_int64_decrement(v); }
   static int64_t add(atomic_t *v, int64_t d) { return atomic_int64_add(v, d); }
   static int64_t sub(atomic_t *v, int64_t d) { return atomic_int64_subtract(v, d); }
+  static bool cas(atomic_t *v, int64_t o, int64_t n) { return atomic_int64_compare_and_set(v, o, n); }
+  static int64_t load(atomic_t *v, memory_order_t o) { return atomic_int64_load(v, o); }
+  static void store(atomic_t *v, int64_t x, memory_order_t o) { atomic_int64_store(v, x, o); }
+  static int64_t exchange(atomic_t *v, int64_t x, memory_order_t o) { return atomic_int64_exchange(v, x, o); }
+  static int64_t fetch_add(atomic_t *v, int64_t d, memory_order_t o) { return atomic_int64_fetch_add(v, d, o); }
+  static int64_t fetch_or(atomic_t *v, int64_t b, memory_order_t o) { return atomic_int64_fetch_or(v, b, o); }
+  static int64_t fetch_and(atomic_t *v, int64_t b, memory_order_t o) { return atomic_int64_fetch_and(v, b, o); }
+  static bool compare_exchange(atomic_t *v, int64_t *e, int64_t d, memory_order_t o) { return atomic_int64_compare_exchange(v, e, d, o); }
 };
 
 MULTITEST(atomic, simple, typename, A, ("32", A32), ("64", A64)) {
@@ -49,6 +68,72 @@ MULTITEST(atomic, simple, typename, A, ("32", A32), ("64", A64)) {
   ASSERT_EQ(101, A::get(&atomic));
   ASSERT_EQ(51, A::sub(&atomic, 50));
   ASSERT_EQ(51, A::get(&atomic));
+  ASSERT_FALSE(A::cas(&atomic, 50, 60));
+  ASSERT_EQ(51, A::get(&atomic));
+  ASSERT_TRUE(A::cas(&atomic, 51, 60));
+  ASSERT_EQ(60, A::get(&atomic));
+}
+
+MULTITEST(atomic, ordered, typename, A, ("32", A32), ("64", A64)) {
+  typename A::atomic_t atomic = A::init(0);
+  A::store(&atomic, 10, moRelaxed);
+  ASSERT_EQ(10, A::load(&atomic, moRelaxed));
+  A::store(&atomic, 11, moRelease);
+  ASSERT_EQ(11, A::load(&atomic, moAcquire));
+  A::store(&atomic, 12, moSeqCst);
+  ASSERT_EQ(12, A::load(&atomic, moSeqCst));
+  ASSERT_EQ(12, A::exchange(&atomic, 13, moAcqRel));
+  ASSERT_EQ(13, A::fetch_add(&atomic, 5, moRelaxed));
+  ASSERT_EQ(18, A::fetch_add(&atomic, -8, moAcqRel));
+  ASSERT_EQ(10, A::fetch_or(&atomic, 0x5, moRelease));
+  ASSERT_EQ(0xF, A::fetch_and(&atomic, 0x6, moAcquire));
+  ASSERT_EQ(0x6, A::load(&atomic, moRelaxed));
+  // A failed exchange reports what the value actually was.
+  typename A::value_t expected = 7;
+  ASSERT_FALSE(A::compare_exchange(&atomic, &expected, 8, moSeqCst));
+  ASSERT_EQ(0x6, expected);
+  ASSERT_TRUE(A::compare_exchange(&atomic, &expected, 8, moAcqRel));
+  ASSERT_EQ(8, A::load(&atomic, moRelaxed));
+  ASSERT_FALSE(A::compare_exchange(&atomic, &expected, 9, moRelaxed));
+  ASSERT_EQ(8, expected);
+}
+
+TEST(atomic, pointer) {
+  int x = 0;
+  int y = 0;
+  atomic_ptr_t ptr = atomic_ptr_new(NULL);
+  ASSERT_PTREQ(NULL, atomic_ptr_load(&ptr, moAcquire));
+  atomic_ptr_store(&ptr, &x, moRelease);
+  ASSERT_PTREQ(&x, atomic_ptr_load(&ptr, moRelaxed));
+  ASSERT_PTREQ(&x, atomic_ptr_exchange(&ptr, &y, moAcqRel));
+  void *expected = &x;
+  ASSERT_FALSE(atomic_ptr_compare_exchange(&ptr, &expected, NULL, moSeqCst));
+  ASSERT_PTREQ(&y, expected);
+  ASSERT_TRUE(atomic_ptr_compare_exchange(&ptr, &expected, NULL, moSeqCst));
+  ASSERT_PTREQ(NULL, atomic_ptr_load(&ptr, moSeqCst));
+}
+
+TEST(atomic, pair) {
+  if (!kHasAtomicPair)
+    SKIP_TEST("no atomic pair");
+#ifdef HAS_ATOMIC_PAIR
+  int x = 0;
+  int y = 0;
+  atomic_pair_t pair = atomic_pair_new(&x, &y);
+  word_pair_t current = atomic_pair_load(&pair);
+  ASSERT_PTREQ(&x, current.first);
+  ASSERT_PTREQ(&y, current.second);
+  word_pair_t expected = word_pair_new(&x, &x);
+  ASSERT_FALSE(atomic_pair_compare_exchange(&pair, &expected,
+      word_pair_new(NULL, NULL)));
+  ASSERT_PTREQ(&x, expected.first);
+  ASSERT_PTREQ(&y, expected.second);
+  ASSERT_TRUE(atomic_pair_compare_exchange(&pair, &expected,
+      word_pair_new(&y, &x)));
+  current = atomic_pair_load(&pair);
+  ASSERT_PTREQ(&y, current.first);
+  ASSERT_PTREQ(&x, current.second);
+#endif
 }
 
 #define kThreadCount 16
@@ -115,3 +200,45 @@ TEST(atomic, compare_and_set) {
   for (size_t i = 0; i < kThreadCount; i++)
     ASSERT_TRUE(threads[i].join(NULL));
 }
+
+#ifdef HAS_ATOMIC_PAIR
+
+static opaque_t hammer_pair(Drawbridge *start, atomic_pair_t *pair) {
+  ASSERT_TRUE(start->pass());
+  // Each thread bumps both words of the pair together. If the words weren't
+  // swapped as a unit they would drift apart.
+  for (size_t i = 0; i < 4096; i++) {
+    word_pair_t current = atomic_pair_load(pair);
+    while (true) {
+      ASSERT_PTREQ(current.first, current.second);
+      byte_t *next = static_cast<byte_t*>(current.first) + 1;
+      if (atomic_pair_compare_exchange(pair, &current, word_pair_new(next, next)))
+        break;
+    }
+  }
+  return o0();
+}
+
+#endif
+
+TEST(atomic, contended_pair) {
+  if (!kHasAtomicPair)
+    SKIP_TEST("no atomic pair");
+#ifdef HAS_ATOMIC_PAIR
+  NativeThread threads[kThreadCount];
+  atomic_pair_t pair = atomic_pair_new(NULL, NULL);
+  Drawbridge start;
+  ASSERT_TRUE(start.initialize());
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(hammer_pair, &start, &pair));
+    ASSERT_TRUE(threads[i].start());
+  }
+  ASSERT_TRUE(start.lower());
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  word_pair_t result = atomic_pair_load(&pair);
+  byte_t *expected = static_cast<byte_t*>(NULL) + kThreadCount * 4096;
+  ASSERT_PTREQ(expected, result.first);
+  ASSERT_PTREQ(expected, result.second);
+#endif
+}
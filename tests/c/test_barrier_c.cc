@@ -0,0 +1,34 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/barrier.h"
+END_C_INCLUDES
+
+TEST(barrier_c, simple) {
+  native_barrier_t barrier;
+  native_barrier_construct(&barrier, 1);
+  ASSERT_TRUE(native_barrier_initialize(&barrier));
+  ASSERT_TRUE(native_barrier_pass(&barrier, duration_unlimited()));
+  ASSERT_TRUE(native_barrier_pass(&barrier, duration_instant()));
+  native_barrier_dispose(&barrier);
+
+  native_barrier_construct(&barrier, 2);
+  ASSERT_TRUE(native_barrier_initialize(&barrier));
+  ASSERT_FALSE(native_barrier_pass(&barrier, duration_instant()));
+  native_barrier_dispose(&barrier);
+}
+
+TEST(barrier_c, latch) {
+  count_down_latch_t latch;
+  count_down_latch_construct(&latch, 2);
+  ASSERT_TRUE(count_down_latch_initialize(&latch));
+  ASSERT_EQ(2, count_down_latch_count(&latch));
+  ASSERT_FALSE(count_down_latch_wait(&latch, duration_instant()));
+  ASSERT_TRUE(count_down_latch_count_down(&latch, 2));
+  ASSERT_EQ(0, count_down_latch_count(&latch));
+  ASSERT_TRUE(count_down_latch_wait(&latch, duration_unlimited()));
+  count_down_latch_dispose(&latch);
+}
@@ -0,0 +1,151 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "sync/barrier.hh"
+#include "sync/thread.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+TEST(barrier_cpp, single) {
+  NativeBarrier barrier(1);
+  ASSERT_TRUE(barrier.initialize());
+  ASSERT_EQ(1, barrier.parties());
+  // With one party every pass opens the barrier immediately.
+  for (size_t i = 0; i < 16; i++)
+    ASSERT_TRUE(barrier.pass());
+}
+
+TEST(barrier_cpp, no_parties) {
+  log_o *noisy_log = silence_global_log();
+  NativeBarrier barrier(0);
+  ASSERT_FALSE(barrier.initialize());
+  set_global_log(noisy_log);
+}
+
+static opaque_t run_pass(NativeBarrier *barrier) {
+  ASSERT_TRUE(barrier->pass());
+  return o0();
+}
+
+TEST(barrier_cpp, timeout) {
+  NativeBarrier barrier(2);
+  ASSERT_TRUE(barrier.initialize());
+  ASSERT_FALSE(barrier.pass(Duration::instant()));
+  ASSERT_FALSE(barrier.pass(Duration::millis(10)));
+  // The failed passes must not have counted so it still takes two parties to
+  // get through.
+  NativeThread other(new_callback(run_pass, &barrier));
+  ASSERT_TRUE(other.start());
+  ASSERT_TRUE(barrier.pass());
+  ASSERT_TRUE(other.join(NULL));
+}
+
+#define kThreadCount 8
+#define kPhaseCount 256
+
+class BarrierData {
+public:
+  BarrierData() : barrier(kThreadCount) { }
+  NativeBarrier barrier;
+  // How many threads have reached each phase.
+  atomic_int32_t arrived[kPhaseCount];
+};
+
+static opaque_t run_phases(BarrierData *data) {
+  for (size_t i = 0; i < kPhaseCount; i++) {
+    atomic_int32_increment(&data->arrived[i]);
+    ASSERT_TRUE(data->barrier.pass());
+    // Once we're past the barrier everyone must have arrived at this phase.
+    ASSERT_EQ(kThreadCount, atomic_int32_get(&data->arrived[i]));
+  }
+  return o0();
+}
+
+TEST(barrier_cpp, phases) {
+  BarrierData data;
+  ASSERT_TRUE(data.barrier.initialize());
+  for (size_t i = 0; i < kPhaseCount; i++)
+    data.arrived[i] = atomic_int32_new(0);
+  NativeThread threads[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(run_phases, &data));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+}
+
+static opaque_t pass_slowly(NativeBarrier *barrier) {
+  // Sleep long enough that the other thread gives up spinning and blocks.
+  ASSERT_TRUE(NativeThread::sleep(Duration::millis(20)));
+  ASSERT_TRUE(barrier->pass());
+  return o0();
+}
+
+TEST(barrier_cpp, blocking) {
+  NativeBarrier barrier(2);
+  ASSERT_TRUE(barrier.initialize());
+  NativeThread thread(new_callback(pass_slowly, &barrier));
+  ASSERT_TRUE(thread.start());
+  ASSERT_TRUE(barrier.pass());
+  ASSERT_TRUE(thread.join(NULL));
+}
+
+TEST(barrier_cpp, latch_simple) {
+  CountDownLatch latch(3);
+  ASSERT_TRUE(latch.initialize());
+  ASSERT_EQ(3, latch.count());
+  ASSERT_FALSE(latch.wait(Duration::instant()));
+  ASSERT_TRUE(latch.count_down());
+  ASSERT_EQ(2, latch.count());
+  ASSERT_FALSE(latch.wait(Duration::millis(1)));
+  // Counting down past zero stops at zero.
+  ASSERT_TRUE(latch.count_down(5));
+  ASSERT_EQ(0, latch.count());
+  ASSERT_TRUE(latch.wait(Duration::instant()));
+  ASSERT_TRUE(latch.count_down());
+  ASSERT_EQ(0, latch.count());
+  ASSERT_TRUE(latch.wait());
+}
+
+static opaque_t wait_for_latch(CountDownLatch *latch, atomic_int32_t *passed) {
+  ASSERT_TRUE(latch->wait());
+  atomic_int32_increment(passed);
+  return o0();
+}
+
+static opaque_t count_down_latch(CountDownLatch *latch) {
+  ASSERT_TRUE(latch->count_down());
+  return o0();
+}
+
+TEST(barrier_cpp, latch_threads) {
+  CountDownLatch latch(kThreadCount);
+  ASSERT_TRUE(latch.initialize());
+  atomic_int32_t passed = atomic_int32_new(0);
+  NativeThread waiters[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    waiters[i].set_callback(new_callback(wait_for_latch, &latch, &passed));
+    ASSERT_TRUE(waiters[i].start());
+  }
+  // Give the waiters time to block.
+  ASSERT_TRUE(NativeThread::sleep(Duration::millis(20)));
+  ASSERT_EQ(0, atomic_int32_get(&passed));
+  NativeThread counters[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    counters[i].set_callback(new_callback(count_down_latch, &latch));
+    ASSERT_TRUE(counters[i].start());
+  }
+  for (size_t i = 0; i < kThreadCount; i++) {
+    ASSERT_TRUE(counters[i].join(NULL));
+    ASSERT_TRUE(waiters[i].join(NULL));
+  }
+  ASSERT_EQ(kThreadCount, atomic_int32_get(&passed));
+  ASSERT_EQ(0, latch.count());
+}
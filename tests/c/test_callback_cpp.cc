@@ -317,3 +317,112 @@ TEST(callback_cpp, thread_safety) {
     ASSERT_TRUE(threads[i].join(NULL));
   ASSERT_EQ(1, state.callback.binder()->refcount());
 }
+
+static int sum_three(int *a, int *b, int *c) {
+  return *a + *b + *c;
+}
+
+// A value that counts how many times it has been copied.
+class Copied {
+public:
+  explicit Copied(int *copies) : copies_(copies) { }
+  Copied(const Copied &that) : copies_(that.copies_) { (*copies_)++; }
+  int copies() const { return *copies_; }
+private:
+  int *copies_;
+};
+
+static int count_copies(Copied value) {
+  return value.copies();
+}
+
+TEST(callback_cpp, inline_binders) {
+  // Binding a few pointers doesn't need a heap binder.
+  int a = 1;
+  int b = 2;
+  int c = 3;
+  callback_t<int(void)> sum = new_callback(sum_three, &a, &b, &c);
+  ASSERT_TRUE(sum.has_inline_binder());
+  ASSERT_EQ(1, sum.binder()->refcount());
+  // Copies get their own binder.
+  callback_t<int(void)> copy = sum;
+  ASSERT_TRUE(copy.has_inline_binder());
+  ASSERT_TRUE(copy.binder() != sum.binder());
+  ASSERT_EQ(1, copy.binder()->refcount());
+  callback_t<int(void)> assigned;
+  assigned = copy;
+  ASSERT_TRUE(assigned.has_inline_binder());
+  sum = empty_callback();
+  ASSERT_TRUE(sum.is_empty());
+  a = 4;
+  ASSERT_EQ(9, copy());
+  ASSERT_EQ(9, assigned());
+  // Values that may care about being copied stay on the heap and are shared
+  // between copies of the callback.
+  int copies = 0;
+  callback_t<int(void)> shared = new_callback(count_copies, Copied(&copies));
+  ASSERT_FALSE(shared.has_inline_binder());
+  int copies_before = copies;
+  callback_t<int(void)> shared_copy = shared;
+  ASSERT_EQ(copies_before, copies);
+  ASSERT_TRUE(shared.binder() == shared_copy.binder());
+  ASSERT_EQ(2, shared.binder()->refcount());
+  // Calling passes the bound value by value so that's exactly one copy.
+  ASSERT_EQ(copies_before + 1, shared_copy());
+}
+
+TEST(callback_cpp, packed) {
+  // Packing moves an inline binder to the heap.
+  int a = 1;
+  int b = 2;
+  int c = 3;
+  callback_t<int(void)> sum = new_callback(sum_three, &a, &b, &c);
+  packed_callback_t<int(void)> packed;
+  ASSERT_TRUE(packed.pack(sum));
+  sum = empty_callback();
+  callback_t<int(void)> unpacked = packed.unpack();
+  ASSERT_FALSE(unpacked.has_inline_binder());
+  ASSERT_EQ(2, unpacked.binder()->refcount());
+  ASSERT_EQ(6, unpacked());
+  // Heap binders are shared with the packed callback.
+  int copies = 0;
+  callback_t<int(void)> shared = new_callback(count_copies, Copied(&copies));
+  packed_callback_t<int(void)> packed_shared;
+  ASSERT_TRUE(packed_shared.pack(shared));
+  ASSERT_TRUE(packed_shared.unpack().binder() == shared.binder());
+  ASSERT_EQ(2, shared.binder()->refcount());
+}
+
+#ifdef IS_CPP11
+
+// A small value that needs more alignment than the inline binder storage has.
+struct alignas(16) OverAligned {
+  int64_t value;
+};
+
+static int64_t read_over_aligned(OverAligned over) {
+  return over.value;
+}
+
+TEST(callback_cpp, over_aligned_binders) {
+  OverAligned over;
+  over.value = 8;
+  callback_t<int64_t(void)> callback = new_callback(read_over_aligned, over);
+  ASSERT_FALSE(callback.has_inline_binder());
+  ASSERT_EQ(8, callback());
+}
+
+TEST(callback_cpp, move) {
+  callback_t<int(void)> a = new_callback(f1, 0);
+  ASSERT_EQ(1, a.binder()->refcount());
+  callback_t<int(void)> b = MOVE(a);
+  ASSERT_TRUE(a.is_empty());
+  ASSERT_EQ(1, b.binder()->refcount());
+  callback_t<int(void)> c;
+  c = MOVE(b);
+  ASSERT_TRUE(b.is_empty());
+  ASSERT_EQ(1, c.binder()->refcount());
+  ASSERT_EQ(f1(0), c());
+}
+
+#endif // IS_CPP11
@@ -0,0 +1,252 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "io/stream.hh"
+#include "sync/condition.hh"
+#include "sync/contention.hh"
+#include "sync/intex.hh"
+#include "sync/semaphore.hh"
+#include "sync/thread.hh"
+
+#include <new>
+#include <string>
+
+using namespace tclib;
+
+TEST(contention, not_installed) {
+  ASSERT_PTREQ(NULL, ContentionProfiler::current());
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  NativeMutex mutex;
+  mutex.set_profile_name("not_installed");
+  ASSERT_TRUE(mutex.initialize());
+  ASSERT_TRUE(mutex.lock());
+  ASSERT_TRUE(mutex.unlock());
+  ASSERT_EQ(0, profiler.get_stats(ckMutex, "not_installed").acquisitions);
+}
+
+TEST(contention, uncontended) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  ASSERT_PTREQ(&profiler, ContentionProfiler::current());
+  NativeMutex mutex;
+  mutex.set_profile_name("uncontended");
+  ASSERT_TRUE(mutex.initialize());
+  for (size_t i = 0; i < 16; i++) {
+    ASSERT_TRUE(mutex.lock());
+    // Recursive locking only counts as one hold.
+    ASSERT_TRUE(mutex.lock());
+    ASSERT_TRUE(mutex.unlock());
+    ASSERT_TRUE(mutex.unlock());
+  }
+  profiler.uninstall(previous);
+  contention_stats_t stats = profiler.get_stats(ckMutex, "uncontended");
+  ASSERT_EQ(32, stats.acquisitions);
+  ASSERT_EQ(0, stats.contended);
+  ASSERT_EQ(0, stats.total_wait_nanos);
+  ASSERT_REL(stats.max_hold_nanos, <=, stats.total_hold_nanos);
+}
+
+static opaque_t hold_mutex(NativeMutex *mutex, NativeSemaphore *locked) {
+  ASSERT_TRUE(mutex->lock());
+  ASSERT_TRUE(locked->release());
+  ASSERT_TRUE(NativeThread::sleep(Duration::millis(20)));
+  ASSERT_TRUE(mutex->unlock());
+  return o0();
+}
+
+TEST(contention, contended_mutex) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  NativeMutex mutex;
+  mutex.set_profile_name("contended_mutex");
+  ASSERT_TRUE(mutex.initialize());
+  NativeSemaphore locked(0);
+  ASSERT_TRUE(locked.initialize());
+  NativeThread holder(new_callback(hold_mutex, &mutex, &locked));
+  ASSERT_TRUE(holder.start());
+  ASSERT_TRUE(locked.acquire());
+  ASSERT_FALSE(mutex.try_lock());
+  ASSERT_TRUE(mutex.lock());
+  ASSERT_TRUE(mutex.unlock());
+  ASSERT_TRUE(holder.join(NULL));
+  profiler.uninstall(previous);
+  contention_stats_t stats = profiler.get_stats(ckMutex, "contended_mutex");
+  ASSERT_EQ(3, stats.acquisitions);
+  ASSERT_EQ(2, stats.contended);
+  // The holder slept 20ms while holding the mutex so both the wait and the
+  // hold should reflect at least some of that.
+  ASSERT_REL(stats.max_wait_nanos, >=, 5000000);
+  ASSERT_REL(stats.max_hold_nanos, >=, 5000000);
+}
+
+TEST(contention, semaphore) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  NativeSemaphore sema(1);
+  sema.set_profile_name("semaphore");
+  ASSERT_TRUE(sema.initialize());
+  ASSERT_TRUE(sema.acquire());
+  ASSERT_FALSE(sema.acquire(Duration::millis(5)));
+  ASSERT_TRUE(sema.release());
+  profiler.uninstall(previous);
+  contention_stats_t stats = profiler.get_stats(ckSemaphore, "semaphore");
+  ASSERT_EQ(2, stats.acquisitions);
+  ASSERT_EQ(1, stats.contended);
+  ASSERT_REL(stats.total_wait_nanos, >=, 1000000);
+}
+
+TEST(contention, condition) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  NativeMutex mutex;
+  mutex.set_profile_name("condition");
+  ASSERT_TRUE(mutex.initialize());
+  NativeCondition cond;
+  cond.set_profile_name("condition");
+  ASSERT_TRUE(cond.initialize());
+  ASSERT_TRUE(mutex.lock());
+  ASSERT_FALSE(cond.wait(&mutex, Duration::millis(20)));
+  ASSERT_TRUE(mutex.unlock());
+  profiler.uninstall(previous);
+  contention_stats_t cond_stats = profiler.get_stats(ckCondition, "condition");
+  ASSERT_EQ(1, cond_stats.contended);
+  ASSERT_REL(cond_stats.total_wait_nanos, >=, 5000000);
+  // The time spent waiting doesn't count as holding the mutex.
+  contention_stats_t mutex_stats = profiler.get_stats(ckMutex, "condition");
+  ASSERT_REL(mutex_stats.max_hold_nanos, <, 5000000);
+}
+
+static opaque_t bump_intex(Intex *intex) {
+  ASSERT_TRUE(NativeThread::sleep(Duration::millis(20)));
+  ASSERT_TRUE(intex->lock());
+  ASSERT_TRUE(intex->set(1));
+  ASSERT_TRUE(intex->unlock());
+  return o0();
+}
+
+TEST(contention, intex) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  Intex intex(0);
+  intex.set_profile_name("intex");
+  ASSERT_TRUE(intex.initialize());
+  ASSERT_TRUE(intex.lock_when() == 0);
+  ASSERT_TRUE(intex.unlock());
+  NativeThread bumper(new_callback(bump_intex, &intex));
+  ASSERT_TRUE(bumper.start());
+  ASSERT_TRUE(intex.lock_when() == 1);
+  ASSERT_TRUE(intex.unlock());
+  ASSERT_TRUE(bumper.join(NULL));
+  profiler.uninstall(previous);
+  contention_stats_t stats = profiler.get_stats(ckIntex, "intex");
+  ASSERT_EQ(2, stats.acquisitions);
+  ASSERT_EQ(1, stats.contended);
+  ASSERT_REL(stats.total_wait_nanos, >=, 5000000);
+  // The intex's mutex is reported under the same name.
+  ASSERT_REL(profiler.get_stats(ckMutex, "intex").acquisitions, >=, 3);
+}
+
+TEST(contention, report) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  NativeSemaphore quiet(1);
+  quiet.set_profile_name("quiet");
+  ASSERT_TRUE(quiet.initialize());
+  ASSERT_TRUE(quiet.acquire());
+  ASSERT_TRUE(quiet.release());
+  NativeSemaphore busy(0);
+  busy.set_profile_name("busy");
+  ASSERT_TRUE(busy.initialize());
+  ASSERT_FALSE(busy.acquire(Duration::millis(5)));
+  profiler.uninstall(previous);
+
+  ByteOutStream out;
+  profiler.write_report(&out);
+  std::string report(out.data().begin(), out.data().end());
+  size_t busy_pos = report.find("semaphore busy");
+  size_t quiet_pos = report.find("semaphore quiet");
+  ASSERT_TRUE(busy_pos != std::string::npos);
+  ASSERT_TRUE(quiet_pos != std::string::npos);
+  // The most contended entry comes first.
+  ASSERT_REL(busy_pos, <, quiet_pos);
+
+  ByteOutStream limited;
+  profiler.write_report(&limited, 1);
+  std::string short_report(limited.data().begin(), limited.data().end());
+  ASSERT_TRUE(short_report.find("busy") != std::string::npos);
+  ASSERT_TRUE(short_report.find("quiet") == std::string::npos);
+}
+
+TEST(contention, table_full) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  static const size_t kMutexCount = ContentionProfiler::kEntryCount + 8;
+  NativeMutex *mutexes = new NativeMutex[kMutexCount];
+  ContentionProfiler *previous = profiler.install();
+  // Unnamed mutexes each need their own entry so some of them won't fit.
+  for (size_t i = 0; i < kMutexCount; i++) {
+    ASSERT_TRUE(mutexes[i].initialize());
+    ASSERT_TRUE(mutexes[i].lock());
+    ASSERT_TRUE(mutexes[i].unlock());
+  }
+  profiler.uninstall(previous);
+  delete[] mutexes;
+  ASSERT_REL(profiler.dropped_count(), >=, 8);
+  ByteOutStream out;
+  profiler.write_report(&out);
+  std::string report(out.data().begin(), out.data().end());
+  ASSERT_TRUE(report.find("records dropped") != std::string::npos);
+}
+
+// Returns the number of acquisitions the report gives for the given unnamed
+// primitive, -1 if it isn't there.
+static int64_t get_reported_acquisitions(ContentionProfiler *profiler,
+    const void *instance) {
+  ByteOutStream out;
+  profiler->write_report(&out);
+  std::string report(out.data().begin(), out.data().end());
+  char address[32];
+  snprintf(address, sizeof(address), " %p\n", instance);
+  size_t end = report.find(address);
+  if (end == std::string::npos)
+    return -1;
+  size_t start = report.rfind('\n', end) + 1;
+  unsigned long long wait, max_wait, contended, acquired;
+  if (sscanf(report.c_str() + start, "%llu %llu %llu %llu", &wait, &max_wait,
+      &contended, &acquired) != 4)
+    return -1;
+  return static_cast<int64_t>(acquired);
+}
+
+// A primitive created where a destroyed one used to be starts from scratch.
+TEST(contention, reused_address) {
+  ContentionProfiler profiler;
+  ASSERT_TRUE(profiler.initialize());
+  ContentionProfiler *previous = profiler.install();
+  uint64_t memory[(sizeof(NativeMutex) + 7) / 8];
+  NativeMutex *first = new (memory) NativeMutex();
+  ASSERT_TRUE(first->initialize());
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(first->lock());
+    ASSERT_TRUE(first->unlock());
+  }
+  ASSERT_EQ(3, get_reported_acquisitions(&profiler, memory));
+  first->~NativeMutex();
+  ASSERT_EQ(-1, get_reported_acquisitions(&profiler, memory));
+  NativeMutex *second = new (memory) NativeMutex();
+  ASSERT_TRUE(second->initialize());
+  ASSERT_TRUE(second->lock());
+  ASSERT_TRUE(second->unlock());
+  ASSERT_EQ(1, get_reported_acquisitions(&profiler, memory));
+  second->~NativeMutex();
+  profiler.uninstall(previous);
+}
@@ -0,0 +1,120 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "async/coroutine.hh"
+#include "test/unittest.hh"
+
+// Coroutines need C++20 so when building as anything older there's nothing to
+// test.
+#ifdef HAS_COROUTINES
+
+#include "sync/pipe.hh"
+
+using namespace tclib;
+
+static task_t<int, int> add_one(promise_t<int, int> input) {
+  promise_t<int, int> settled = co_await input;
+  if (settled.is_rejected())
+    co_return settled.peek_error(0) * 2;
+  co_return settled.peek_value(0) + 1;
+}
+
+TEST(coroutine, await_promise) {
+  promise_t<int, int> a = promise_t<int, int>::pending();
+  task_t<int, int> task = add_one(a);
+  ASSERT_FALSE(task.promise().is_settled());
+  a.fulfill(10);
+  ASSERT_EQ(11, task.promise().peek_value(0));
+
+  // Awaiting a settled promise doesn't suspend.
+  task_t<int, int> ready = add_one(a);
+  ASSERT_EQ(11, ready.promise().peek_value(0));
+
+  promise_t<int, int> b = promise_t<int, int>::pending();
+  task_t<int, int> failed = add_one(b);
+  b.reject(7);
+  ASSERT_EQ(14, failed.promise().peek_value(0));
+}
+
+static task_t<int, int> add_two(promise_t<int, int> input) {
+  promise_t<int, int> once = co_await add_one(input);
+  co_return once.peek_value(0) + 1;
+}
+
+static task_t<int, int> forward(promise_t<int, int> input) {
+  co_return input;
+}
+
+TEST(coroutine, await_task) {
+  promise_t<int, int> a = promise_t<int, int>::pending();
+  task_t<int, int> task = add_two(a);
+  task_t<int, int> forwarded = forward(a);
+  ASSERT_FALSE(task.promise().is_settled());
+  ASSERT_FALSE(forwarded.promise().is_settled());
+  a.fulfill(3);
+  ASSERT_EQ(5, task.promise().peek_value(0));
+  ASSERT_EQ(3, forwarded.promise().peek_value(0));
+
+  promise_t<int, int> b = promise_t<int, int>::pending();
+  task_t<int, int> rejected = forward(b);
+  b.reject(4);
+  ASSERT_EQ(4, rejected.promise().peek_error(0));
+}
+
+static task_t<int> count_on_pool(Workpool *pool, int *counter) {
+  ASSERT_FALSE(pool->is_worker_thread());
+  co_await reschedule_on(pool);
+  ASSERT_TRUE(pool->is_worker_thread());
+  co_return ++(*counter);
+}
+
+TEST(coroutine, reschedule) {
+  Workpool pool;
+  ASSERT_TRUE(pool.initialize());
+  ASSERT_TRUE(pool.start());
+  int counter = 0;
+  task_t<int> first = count_on_pool(&pool, &counter);
+  task_t<int> second = count_on_pool(&pool, &counter);
+  ASSERT_TRUE(pool.join());
+  ASSERT_EQ(1, first.promise().peek_value(0));
+  ASSERT_EQ(2, second.promise().peek_value(0));
+}
+
+static task_t<size_t> read_all(IopAwaitGroup *group, InStream *in, char *buf) {
+  size_t total = 0;
+  ReadIop iop(in, buf, 256);
+  group->group()->schedule(&iop);
+  while (true) {
+    co_await group->complete(&iop);
+    if (iop.at_eof())
+      break;
+    total += iop.bytes_read();
+    iop.recycle(buf + total, 256 - total);
+  }
+  co_return total;
+}
+
+TEST(coroutine, iops) {
+  NativePipe pipe;
+  ASSERT_TRUE(pipe.open(NativePipe::pfDefault));
+  IopGroup group;
+  IopAwaitGroup awaiter(&group);
+  char buf[256];
+  memset(buf, 0, 256);
+  task_t<size_t> task = read_all(&awaiter, pipe.in(), buf);
+  ASSERT_TRUE(awaiter.has_pending());
+  ASSERT_EQ(3, pipe.out()->printf("foo"));
+  Iop *next = NULL;
+  ASSERT_TRUE(awaiter.resume_next(Duration::unlimited(), &next));
+  ASSERT_TRUE(next->is_read());
+  ASSERT_EQ(3, pipe.out()->printf("bar"));
+  ASSERT_TRUE(awaiter.resume_next());
+  ASSERT_FALSE(task.promise().is_settled());
+  ASSERT_TRUE(pipe.out()->close());
+  ASSERT_TRUE(awaiter.resume_next());
+  ASSERT_FALSE(awaiter.has_pending());
+  ASSERT_EQ(6, task.promise().peek_value(0));
+  ASSERT_EQ(0, strcmp("foobar", buf));
+}
+
+#endif // HAS_COROUTINES
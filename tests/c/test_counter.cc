@@ -0,0 +1,94 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "sync/intex.hh"
+#include "sync/thread.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/counter.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+TEST(counter, simple) {
+  striped_counter_t counter;
+  striped_counter_initialize(&counter, 1);
+  ASSERT_EQ(0, striped_counter_get(&counter));
+  ASSERT_EQ(0, striped_counter_slack(&counter));
+  striped_counter_add(&counter, 10);
+  ASSERT_EQ(10, striped_counter_get(&counter));
+  ASSERT_EQ(10, striped_counter_get_approx(&counter));
+  striped_counter_add(&counter, -3);
+  ASSERT_EQ(7, striped_counter_get(&counter));
+  ASSERT_EQ(7, striped_counter_get_approx(&counter));
+}
+
+TEST(counter, batching) {
+  striped_counter_t counter;
+  striped_counter_initialize(&counter, 100);
+  ASSERT_EQ(99 * kStripedCounterStripes, striped_counter_slack(&counter));
+  // Small changes stay in this thread's stripe.
+  striped_counter_add(&counter, 50);
+  ASSERT_EQ(50, striped_counter_get(&counter));
+  ASSERT_EQ(0, striped_counter_get_approx(&counter));
+  striped_counter_add(&counter, 49);
+  ASSERT_EQ(99, striped_counter_get(&counter));
+  ASSERT_EQ(0, striped_counter_get_approx(&counter));
+  // Once the stripe drifts far enough it gets folded.
+  striped_counter_add(&counter, 1);
+  ASSERT_EQ(100, striped_counter_get(&counter));
+  ASSERT_EQ(100, striped_counter_get_approx(&counter));
+  // Same going the other way.
+  striped_counter_add(&counter, -99);
+  ASSERT_EQ(1, striped_counter_get(&counter));
+  ASSERT_EQ(100, striped_counter_get_approx(&counter));
+  striped_counter_add(&counter, -101);
+  ASSERT_EQ(-100, striped_counter_get(&counter));
+  ASSERT_EQ(-100, striped_counter_get_approx(&counter));
+}
+
+TEST(counter, padding) {
+  ASSERT_EQ(kCacheLineSize, sizeof(striped_counter_cell_t));
+  striped_counter_t counter;
+  address_arith_t first = reinterpret_cast<address_arith_t>(&counter.cells[0]);
+  ASSERT_EQ(0, first % kCacheLineSize);
+}
+
+#define kThreadCount 16
+#define kIterations 65536
+
+static opaque_t hammer_counter(Drawbridge *start, striped_counter_t *counter,
+    int64_t sign) {
+  ASSERT_TRUE(start->pass());
+  for (int64_t i = 0; i < kIterations; i++)
+    striped_counter_add(counter, sign * (i & 7));
+  return o0();
+}
+
+TEST(counter, contended) {
+  striped_counter_t counter;
+  striped_counter_initialize(&counter, 1024);
+  Drawbridge start;
+  ASSERT_TRUE(start.initialize());
+  NativeThread threads[kThreadCount];
+  // A quarter of the threads subtract so the stripes have to cope with going
+  // both up and down.
+  for (size_t i = 0; i < kThreadCount; i++) {
+    int64_t sign = (i % 4 == 0) ? -1 : 1;
+    threads[i].set_callback(new_callback(hammer_counter, &start, &counter,
+        sign));
+    ASSERT_TRUE(threads[i].start());
+  }
+  ASSERT_TRUE(start.lower());
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  int64_t per_thread = (kIterations / 8) * (0 + 1 + 2 + 3 + 4 + 5 + 6 + 7);
+  int64_t expected = per_thread * (kThreadCount / 2);
+  int64_t exact = striped_counter_get(&counter);
+  ASSERT_EQ(expected, exact);
+  int64_t approx = striped_counter_get_approx(&counter);
+  ASSERT_REL(exact - approx, <=, striped_counter_slack(&counter));
+  ASSERT_REL(approx - exact, <=, striped_counter_slack(&counter));
+}
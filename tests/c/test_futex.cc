@@ -0,0 +1,74 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "sync/futex.hh"
+#include "sync/thread.hh"
+#include "test/unittest.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "utils/clock.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+TEST(futex, simple) {
+  atomic_int32_t word = atomic_int32_new(0);
+  // Waiting for a value the word doesn't have returns immediately.
+  ASSERT_TRUE(NativeFutex::wait(&word, 1));
+  ASSERT_TRUE(NativeFutex::wait(&word, 1, Duration::instant()));
+  // Waiting for the value it does have times out.
+  ASSERT_FALSE(NativeFutex::wait(&word, 0, Duration::instant()));
+  ASSERT_FALSE(NativeFutex::wait(&word, 0, Duration::seconds(0.01)));
+  // Waking without waiters is fine.
+  ASSERT_TRUE(NativeFutex::wake_all(&word));
+}
+
+static opaque_t run_waiter(atomic_int32_t *word) {
+  while (atomic_int32_load(word, moAcquire) == 0)
+    ASSERT_TRUE(NativeFutex::wait(word, 0));
+  return o0();
+}
+
+#define kWaiterCount 4
+
+TEST(futex, wake_all) {
+  atomic_int32_t word = atomic_int32_new(0);
+  NativeThread waiters[kWaiterCount];
+  for (size_t i = 0; i < kWaiterCount; i++) {
+    waiters[i].set_callback(new_callback(run_waiter, &word));
+    ASSERT_TRUE(waiters[i].start());
+  }
+  ASSERT_TRUE(NativeThread::sleep(Duration::seconds(0.01)));
+  atomic_int32_store(&word, 1, moRelease);
+  ASSERT_TRUE(NativeFutex::wake_all(&word));
+  for (size_t i = 0; i < kWaiterCount; i++)
+    ASSERT_TRUE(waiters[i].join(NULL));
+}
+
+static opaque_t run_churner(atomic_int32_t *word, atomic_int32_t *stop) {
+  while (atomic_int32_load(stop, moAcquire) == 0) {
+    ASSERT_TRUE(NativeFutex::wake(word, 1));
+    ASSERT_TRUE(NativeThread::sleep(Duration::millis(5)));
+  }
+  return o0();
+}
+
+TEST(futex, deadline) {
+  atomic_int32_t word = atomic_int32_new(0);
+  atomic_int32_t stop = atomic_int32_new(0);
+  ASSERT_FALSE(NativeFutex::wait_until(&word, 0,
+      NativeFutex::deadline_after(Duration::instant())));
+  // Wakeups that don't change the word mustn't push the deadline out.
+  NativeThread churner(new_callback(run_churner, &word, &stop));
+  ASSERT_TRUE(churner.start());
+  uint64_t start = monotonic_clock_nanos();
+  uint64_t deadline = NativeFutex::deadline_after(Duration::millis(50));
+  while (NativeFutex::wait_until(&word, 0, deadline))
+    ;
+  uint64_t elapsed = monotonic_clock_nanos() - start;
+  atomic_int32_store(&stop, 1, moRelease);
+  ASSERT_TRUE(churner.join(NULL));
+  ASSERT_REL(elapsed, >=, 45000000ULL);
+  ASSERT_REL(elapsed, <, 1000000000ULL);
+}
@@ -0,0 +1,116 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include <string>
+
+#include "io/stream.hh"
+#include "test/unittest.hh"
+
+BEGIN_C_INCLUDES
+#include "utils/heapprof.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+static void *allocate_for_profile(size_t size) {
+  return allocator_default_malloc(size).start;
+}
+
+TEST(heapprof, exact) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 4 * 1024 * 1024);
+  heap_profiler_t prof;
+  // With a period of 1 every allocation is sampled and stands for exactly
+  // itself.
+  ASSERT_TRUE(heap_profiler_install(&prof, 1));
+  void *blocks[10];
+  for (size_t i = 0; i < 10; i++)
+    blocks[i] = allocate_for_profile(100);
+  int64_t live_blocks = 0;
+  int64_t live_bytes = 0;
+  heap_profiler_get_live(&prof, &live_blocks, &live_bytes);
+  ASSERT_EQ(10, live_blocks);
+  ASSERT_EQ(1000, live_bytes);
+  for (size_t i = 0; i < 5; i++)
+    allocator_default_free(blob_new(blocks[i], 100));
+  heap_profiler_get_live(&prof, &live_blocks, &live_bytes);
+  ASSERT_EQ(5, live_blocks);
+  ASSERT_EQ(500, live_bytes);
+
+  ByteOutStream text;
+  heap_profiler_dump_text(&prof, &text, 10);
+  std::string report(text.data().begin(), text.data().end());
+  ASSERT_TRUE(report.find("Heap profile: 500 bytes in 5 blocks")
+      != std::string::npos);
+  ASSERT_TRUE(report.find("500 bytes (100.0%) in 5 blocks")
+      != std::string::npos);
+
+  ByteOutStream pprof;
+  heap_profiler_dump_pprof(&prof, &pprof);
+  std::string profile(pprof.data().begin(), pprof.data().end());
+  // Formatting the text report allocated through the profiler too so only the
+  // live counts are known exactly.
+  ASSERT_EQ(0, profile.find("heap profile: 5: 500 ["));
+  ASSERT_TRUE(profile.find("5: 500 [10: 1000] @ 0x") != std::string::npos);
+  ASSERT_TRUE(profile.find("MAPPED_LIBRARIES:") != std::string::npos);
+
+  for (size_t i = 5; i < 10; i++)
+    allocator_default_free(blob_new(blocks[i], 100));
+  heap_profiler_get_live(&prof, &live_blocks, &live_bytes);
+  ASSERT_EQ(0, live_blocks);
+  ASSERT_EQ(0, live_bytes);
+  heap_profiler_uninstall(&prof);
+  // The profiler must have returned all its own memory too.
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(heapprof, sampled) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 16 * 1024 * 1024);
+  heap_profiler_t prof;
+  ASSERT_TRUE(heap_profiler_install(&prof, 4096));
+  static const size_t kBlockCount = 4096;
+  static const size_t kBlockSize = 64;
+  void *blocks[kBlockCount];
+  for (size_t i = 0; i < kBlockCount; i++)
+    blocks[i] = allocate_for_profile(kBlockSize);
+  // Only some of the allocations are sampled but the estimate should be in
+  // the right ballpark.
+  int64_t live_blocks = 0;
+  int64_t live_bytes = 0;
+  heap_profiler_get_live(&prof, &live_blocks, &live_bytes);
+  int64_t actual = kBlockCount * kBlockSize;
+  ASSERT_REL(live_bytes, >, actual / 4);
+  ASSERT_REL(live_bytes, <, actual * 4);
+  for (size_t i = 0; i < kBlockCount; i++)
+    allocator_default_free(blob_new(blocks[i], kBlockSize));
+  heap_profiler_get_live(&prof, &live_blocks, &live_bytes);
+  ASSERT_EQ(0, live_blocks);
+  ASSERT_EQ(0, live_bytes);
+  heap_profiler_uninstall(&prof);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
+
+TEST(heapprof, period_change) {
+  limited_allocator_t limited;
+  limited_allocator_install(&limited, 4 * 1024 * 1024);
+  // A profiler with a very long period leaves this thread with a long way to
+  // go before its next sample...
+  heap_profiler_t sparse;
+  ASSERT_TRUE(heap_profiler_install(&sparse, 1024 * 1024 * 1024));
+  void *block = allocate_for_profile(100);
+  allocator_default_free(blob_new(block, 100));
+  heap_profiler_uninstall(&sparse);
+  // ...which a profiler with a short period doesn't wait for.
+  heap_profiler_t dense;
+  ASSERT_TRUE(heap_profiler_install(&dense, 1));
+  block = allocate_for_profile(100);
+  int64_t live_blocks = 0;
+  int64_t live_bytes = 0;
+  heap_profiler_get_live(&dense, &live_blocks, &live_bytes);
+  ASSERT_EQ(1, live_blocks);
+  ASSERT_EQ(100, live_bytes);
+  allocator_default_free(blob_new(block, 100));
+  heap_profiler_uninstall(&dense);
+  ASSERT_TRUE(limited_allocator_uninstall(&limited));
+}
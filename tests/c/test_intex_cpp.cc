@@ -102,3 +102,105 @@ TEST(intex_cpp, drawbridge_multi) {
   for (size_t i = 0; i < kThreadCount; i++)
     ASSERT_TRUE(threads[i].join(NULL));
 }
+
+#define kManyWaiterCount 64
+
+class ManyWaitersData {
+public:
+  ManyWaitersData() : done_count(0) { }
+  Intex intex;
+  NativeSemaphore done_count;
+};
+
+static opaque_t run_many_waiters_thread(ManyWaitersData *data, size_t threshold) {
+  ASSERT_TRUE(data->intex.lock_when() >= threshold);
+  ASSERT_TRUE(data->intex.unlock());
+  ASSERT_TRUE(data->done_count.release());
+  return o0();
+}
+
+// Returns the number of waiters blocked on the given intex.
+static size_t get_waiter_count(Intex *intex) {
+  ASSERT_TRUE(intex->lock());
+  size_t result = intex->waiter_count();
+  ASSERT_TRUE(intex->unlock());
+  return result;
+}
+
+// Many threads waiting for different thresholds while the value is stepped up
+// one at a time. Each step should only release the thread whose threshold was
+// reached, the others stay registered as waiters.
+TEST(intex_cpp, many_waiters) {
+  ManyWaitersData data;
+  ASSERT_TRUE(data.intex.initialize());
+  ASSERT_TRUE(data.done_count.initialize());
+
+  NativeThread threads[kManyWaiterCount];
+  for (size_t i = 0; i < kManyWaiterCount; i++) {
+    threads[i].set_callback(new_callback(run_many_waiters_thread, &data, i + 1));
+    ASSERT_TRUE(threads[i].start());
+  }
+
+  // Wait for all the threads to block.
+  while (get_waiter_count(&data.intex) < kManyWaiterCount)
+    ASSERT_TRUE(NativeThread::yield());
+
+  for (size_t i = 0; i < kManyWaiterCount; i++) {
+    ASSERT_TRUE(data.intex.lock());
+    ASSERT_EQ(kManyWaiterCount - i, data.intex.waiter_count());
+    ASSERT_TRUE(data.intex.set(i + 1));
+    ASSERT_TRUE(data.intex.unlock());
+    ASSERT_TRUE(data.done_count.acquire());
+    ASSERT_TRUE(threads[i].join(NULL));
+  }
+
+  ASSERT_EQ(0, get_waiter_count(&data.intex));
+  ASSERT_FALSE(data.done_count.try_acquire());
+}
+
+static opaque_t run_sweep_thread(ManyWaitersData *data, size_t threshold) {
+  for (size_t i = 0; i < 64; i++) {
+    ASSERT_TRUE(data->intex.lock_when() >= threshold);
+    ASSERT_TRUE(data->intex.unlock());
+    ASSERT_TRUE(data->intex.lock_when() < threshold);
+    ASSERT_TRUE(data->intex.unlock());
+  }
+  ASSERT_TRUE(data->done_count.release());
+  return o0();
+}
+
+// Many waiters on different thresholds with the value sweeping back and forth
+// across all of them. Each sweep must release every waiter whose threshold it
+// crosses, otherwise the threads never finish.
+TEST(intex_cpp, sweeping_thresholds) {
+  ManyWaitersData data;
+  ASSERT_TRUE(data.intex.initialize());
+  ASSERT_TRUE(data.done_count.initialize());
+
+  NativeThread threads[kManyWaiterCount];
+  for (size_t i = 0; i < kManyWaiterCount; i++) {
+    threads[i].set_callback(new_callback(run_sweep_thread, &data, i + 1));
+    ASSERT_TRUE(threads[i].start());
+  }
+
+  size_t done = 0;
+  while (done < kManyWaiterCount) {
+    for (size_t v = 0; v <= kManyWaiterCount; v++) {
+      ASSERT_TRUE(data.intex.lock());
+      ASSERT_TRUE(data.intex.set(v));
+      ASSERT_TRUE(data.intex.unlock());
+      ASSERT_TRUE(NativeThread::yield());
+    }
+    for (size_t v = kManyWaiterCount + 1; v > 0; v--) {
+      ASSERT_TRUE(data.intex.lock());
+      ASSERT_TRUE(data.intex.set(v - 1));
+      ASSERT_TRUE(data.intex.unlock());
+      ASSERT_TRUE(NativeThread::yield());
+    }
+    while (data.done_count.try_acquire())
+      done++;
+  }
+
+  for (size_t i = 0; i < kManyWaiterCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+}
@@ -0,0 +1,133 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "async/workpool.hh"
+#include "test/unittest.hh"
+#include "utils/log.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/numa.h"
+#include "utils/alloc.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+TEST(numa, parse_cpu_list) {
+  native_cpu_set_t set;
+  native_cpu_set_clear(&set);
+  ASSERT_TRUE(numa_parse_cpu_list("0-2,5,64-65\n", &set));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 0));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 2));
+  ASSERT_FALSE(native_cpu_set_contains(&set, 3));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 5));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 65));
+  native_cpu_set_clear(&set);
+  ASSERT_TRUE(numa_parse_cpu_list("", &set));
+  ASSERT_TRUE(native_cpu_set_is_empty(&set));
+  ASSERT_FALSE(numa_parse_cpu_list("3-1", &set));
+  ASSERT_FALSE(numa_parse_cpu_list("1;2", &set));
+  ASSERT_FALSE(numa_parse_cpu_list("x", &set));
+}
+
+TEST(numa, topology) {
+  numa_topology_t topology;
+  numa_topology_discover(&topology);
+  ASSERT_REL(topology.node_count, >=, 1);
+  for (size_t i = 0; i < topology.node_count; i++) {
+    // A node may have memory but no cpus but the ids are always distinct.
+    for (size_t j = 0; j < i; j++)
+      ASSERT_FALSE(topology.nodes[i].id == topology.nodes[j].id);
+  }
+  ASSERT_EQ(kNoNumaNode, numa_topology_node_of_cpu(&topology, kMaxCpuCount));
+#ifdef IS_LINUX
+  // The current cpu must be on one of the nodes.
+  ASSERT_FALSE(numa_topology_current_node(&topology) == kNoNumaNode);
+#endif
+}
+
+TEST(numa, allocator) {
+  numa_topology_t topology;
+  numa_topology_discover(&topology);
+  numa_allocator_t numa;
+  numa_allocator_init(&numa, topology.nodes[0].id);
+  // Used as the outer allocator of an arena the node's memory is handed out
+  // in small pieces.
+  arena_allocator_t arena;
+  arena_allocator_init(&arena, &numa.header, 16384);
+  for (size_t i = 0; i < 1000; i++) {
+    blob_t block = allocator_malloc(&arena.header, 64);
+    ASSERT_FALSE(blob_is_empty(block));
+    blob_fill(block, 0xAB);
+  }
+  ASSERT_REL(numa_allocator_footprint(&numa), >=, 64000);
+  arena_allocator_dispose(&arena);
+  ASSERT_EQ(0, numa_allocator_footprint(&numa));
+  blob_t block = allocator_malloc(&numa.header, 100);
+  blob_fill(block, 0xCD);
+  block = allocator_realloc(&numa.header, block, 100000);
+  ASSERT_EQ(0xCD, static_cast<byte_t*>(block.start)[99]);
+  allocator_free(&numa.header, block);
+  ASSERT_EQ(0, numa_allocator_footprint(&numa));
+}
+
+#ifdef IS_LINUX
+
+// Log that swallows warnings and counts them.
+class WarningCounter : public Log {
+public:
+  WarningCounter() : count_(0) { }
+  virtual fat_bool_t record(log_entry_t *entry);
+  size_t count() { return count_; }
+private:
+  size_t count_;
+};
+
+fat_bool_t WarningCounter::record(log_entry_t *entry) {
+  if (entry->level != llWarning)
+    return propagate(entry);
+  count_++;
+  return F_TRUE;
+}
+
+TEST(numa, allocator_unknown_node) {
+  // Pages can only be bound to nodes the mask has room for; memory for other
+  // nodes isn't handed out unbound.
+  WarningCounter warnings;
+  warnings.ensure_installed();
+  numa_allocator_t numa;
+  numa_allocator_init(&numa, 64);
+  ASSERT_TRUE(blob_is_empty(allocator_malloc(&numa.header, 100)));
+  ASSERT_EQ(1, warnings.count());
+  ASSERT_EQ(0, numa_allocator_footprint(&numa));
+  warnings.ensure_uninstalled();
+}
+
+#endif // IS_LINUX
+
+static opaque_t record_node(const numa_topology_t *topology, size_t *node) {
+  *node = numa_topology_current_node(topology);
+  return o0();
+}
+
+TEST(numa, workpool) {
+  numa_topology_t topology;
+  numa_topology_discover(&topology);
+  // Use the last node with cpus, which on a numa machine is not the one the
+  // test usually starts on.
+  size_t index = topology.node_count;
+  while (index > 0 && native_cpu_set_is_empty(&topology.nodes[index - 1].cpus))
+    index--;
+  ASSERT_REL(index, >, 0);
+  index--;
+  Workpool pool;
+  ASSERT_TRUE(pool.initialize());
+  pool.set_worker_numa_node(&topology, index);
+  ASSERT_TRUE(pool.start());
+  size_t node = kNoNumaNode;
+  ASSERT_TRUE(pool.add_task(new_callback(record_node,
+      static_cast<const numa_topology_t*>(&topology), &node), tfRequired));
+  ASSERT_TRUE(pool.join());
+#ifdef IS_LINUX
+  ASSERT_EQ(index, node);
+#endif
+}
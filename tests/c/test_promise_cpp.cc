@@ -2,6 +2,7 @@
 //- Licensed under the Apache License, Version 2.0 (see LICENSE).
 
 #include "async/promise-inl.hh"
+#include "sync/barrier.hh"
 #include "sync/thread.hh"
 #include "test/unittest.hh"
 
@@ -171,6 +172,70 @@ TEST(promise_cpp, then_failure) {
   ASSERT_EQ(100, b.peek_error(0));
 }
 
+static int shift_on_worker(Workpool *pool, int n, int value) {
+  ASSERT_TRUE(pool->is_worker_thread());
+  return (10 * value) + n;
+}
+
+TEST(promise_cpp, then_on) {
+  Workpool pool;
+  ASSERT_TRUE(pool.initialize());
+  ASSERT_TRUE(pool.start());
+  promise_t<int> a = promise_t<int>::pending();
+  promise_t<int> b = a.then_on<int>(&pool,
+      new_callback(shift_on_worker, &pool, 4));
+  promise_t<int> c = b.then_on<int>(&pool,
+      new_callback(shift_on_worker, &pool, 5));
+  a.fulfill(8);
+  ASSERT_TRUE(pool.join());
+  ASSERT_EQ(84, b.peek_value(0));
+  ASSERT_EQ(845, c.peek_value(0));
+  ASSERT_FALSE(pool.is_worker_thread());
+
+  // Rejections are passed through without going through the pool.
+  promise_t<int, int> d = promise_t<int, int>::pending();
+  promise_t<int, int> e = d.then_on<int>(&pool,
+      new_callback(shift_plus_n, 6));
+  d.reject(100);
+  ASSERT_EQ(100, e.peek_error(0));
+}
+
+static void record_value(int *dest, int value) {
+  *dest = value;
+}
+
+static opaque_t fulfill_and_check(promise_t<int> p, int *dest) {
+  // Settling on the executor's own worker runs the action immediately.
+  p.fulfill(9);
+  ASSERT_EQ(9, *dest);
+  return o0();
+}
+
+TEST(promise_cpp, on_fulfill_on) {
+  // Without an executor the action runs inline.
+  int value = 0;
+  promise_t<int> a = promise_t<int>::pending();
+  a.on_fulfill_on(NULL, new_callback(record_value, &value));
+  a.fulfill(7);
+  ASSERT_EQ(7, value);
+
+  Workpool pool;
+  ASSERT_TRUE(pool.initialize());
+  ASSERT_TRUE(pool.start());
+  // Trivial actions run inline even when settled outside the executor.
+  promise_t<int> c = promise_t<int>::pending();
+  c.on_fulfill_on(&pool, new_callback(record_value, &value), cfTrivial);
+  c.fulfill(8);
+  ASSERT_EQ(8, value);
+
+  promise_t<int> b = promise_t<int>::pending();
+  b.on_fulfill_on(&pool, new_callback(record_value, &value));
+  ASSERT_TRUE(pool.add_task(new_callback(fulfill_and_check, b, &value),
+      tfRequired));
+  ASSERT_TRUE(pool.join());
+  ASSERT_EQ(9, value);
+}
+
 static opaque_t run_sync_fulfiller(promise_t<int> p) {
   ASSERT_TRUE(p.fulfill(10));
   return o0();
@@ -202,3 +267,308 @@ TEST(promise_cpp, sync_wait) {
   ASSERT_TRUE(fulfiller.join(NULL));
   ASSERT_TRUE(waiter.join(NULL));
 }
+
+TEST(promise_cpp, sync_wait_timeout) {
+  sync_promise_t<int, int> p = sync_promise_t<int, int>::pending();
+  ASSERT_FALSE(p.wait(Duration::instant()));
+  ASSERT_FALSE(p.wait(Duration::seconds(0.01)));
+  ASSERT_TRUE(p.reject(5));
+  ASSERT_TRUE(p.wait(Duration::instant()));
+  ASSERT_TRUE(p.wait());
+  ASSERT_EQ(5, p.peek_error(0));
+}
+
+#define kWaiterCount 4
+
+static opaque_t run_many_waiter(NativeBarrier *ready, sync_promise_t<int> p) {
+  ASSERT_TRUE(ready->pass());
+  ASSERT_TRUE(p.wait());
+  ASSERT_EQ(12, p.peek_value(0));
+  return o0();
+}
+
+TEST(promise_cpp, sync_wait_many) {
+  sync_promise_t<int> p = sync_promise_t<int>::pending();
+  NativeBarrier ready(kWaiterCount + 1);
+  ASSERT_TRUE(ready.initialize());
+  NativeThread waiters[kWaiterCount];
+  for (size_t i = 0; i < kWaiterCount; i++) {
+    waiters[i].set_callback(new_callback(run_many_waiter, &ready, p));
+    ASSERT_TRUE(waiters[i].start());
+  }
+  ASSERT_TRUE(ready.pass());
+  ASSERT_TRUE(NativeThread::sleep(Duration::seconds(0.01)));
+  ASSERT_TRUE(p.fulfill(12));
+  for (size_t i = 0; i < kWaiterCount; i++)
+    ASSERT_TRUE(waiters[i].join(NULL));
+}
+
+static void append_digit(int *dest, int digit, int value) {
+  *dest = (*dest * 10) + digit;
+}
+
+TEST(promise_cpp, continuation_order) {
+  // Continuations run in the order they were registered, both the inline one
+  // and the ones that have to be allocated.
+  int order = 0;
+  promise_t<int> p = promise_t<int>::pending();
+  for (int i = 1; i <= 5; i++)
+    p.on_fulfill(new_callback(append_digit, &order, i));
+  ASSERT_EQ(0, order);
+  p.fulfill(0);
+  ASSERT_EQ(12345, order);
+  // Once settled new ones run immediately.
+  p.on_fulfill(new_callback(append_digit, &order, 6));
+  ASSERT_EQ(123456, order);
+  // Fulfilling again does nothing.
+  ASSERT_FALSE(p.fulfill(1));
+  ASSERT_EQ(123456, order);
+}
+
+TEST(promise_cpp, unsettled_continuations) {
+  // Continuations on a promise that never settles are released along with it.
+  promise_t<int> p = promise_t<int>::pending();
+  int value = 0;
+  for (int i = 0; i < 4; i++)
+    p.on_fulfill(new_callback(set_value, &value));
+  promise_t<int> q = p.then<int>(new_callback(shift_plus_n, 1));
+  ASSERT_FALSE(q.is_settled());
+}
+
+TEST(promise_cpp, compact) {
+  // A pending promise with no continuations should fit in a few cache lines.
+  ASSERT_REL(sizeof(promise_state_t<int>), <=, 2 * kCacheLineSize);
+  // Sync promises don't need anything to wait on beyond the state.
+  ASSERT_REL(sizeof(sync_promise_state_t<int>), <=,
+      sizeof(promise_state_t<int>) + sizeof(void*));
+}
+
+#define kRacerCount 4
+#define kRaceRounds 500
+
+struct RaceState {
+  promise_t<int> *promises;
+  atomic_int32_t calls;
+  NativeBarrier *start;
+};
+
+static void count_call(atomic_int32_t *calls, int value) {
+  atomic_int32_increment(calls);
+}
+
+static opaque_t run_registrar(RaceState *state) {
+  for (size_t i = 0; i < kRaceRounds; i++) {
+    ASSERT_TRUE(state->start->pass());
+    for (size_t j = 0; j < 3; j++)
+      state->promises[i].on_fulfill(new_callback(count_call, &state->calls));
+  }
+  return o0();
+}
+
+static opaque_t run_settler(RaceState *state) {
+  for (size_t i = 0; i < kRaceRounds; i++) {
+    ASSERT_TRUE(state->start->pass());
+    state->promises[i].fulfill(static_cast<int>(i));
+  }
+  return o0();
+}
+
+TEST(promise_cpp, concurrent_continuations) {
+  // Registering continuations while another thread settles the promise runs
+  // every continuation exactly once.
+  NativeBarrier start(kRacerCount + 1);
+  ASSERT_TRUE(start.initialize());
+  std::vector< promise_t<int> > promises;
+  for (size_t i = 0; i < kRaceRounds; i++)
+    promises.push_back(sync_promise_t<int>::pending());
+  RaceState state;
+  state.promises = &promises[0];
+  state.calls = atomic_int32_new(0);
+  state.start = &start;
+  NativeThread settler(new_callback(run_settler, &state));
+  NativeThread registrars[kRacerCount];
+  for (size_t i = 0; i < kRacerCount; i++) {
+    registrars[i].set_callback(new_callback(run_registrar, &state));
+    ASSERT_TRUE(registrars[i].start());
+  }
+  ASSERT_TRUE(settler.start());
+  ASSERT_TRUE(settler.join(NULL));
+  for (size_t i = 0; i < kRacerCount; i++)
+    ASSERT_TRUE(registrars[i].join(NULL));
+  ASSERT_EQ(kRacerCount * kRaceRounds * 3, atomic_int32_get(&state.calls));
+}
+
+TEST(promise_cpp, all) {
+  std::vector< promise_t<int, int> > inputs;
+  for (int i = 0; i < 4; i++)
+    inputs.push_back(promise_t<int, int>::pending());
+  promise_t<std::vector<int>, int> all = promise_all(inputs);
+  // Settle out of order; the result keeps the input order.
+  inputs[2].fulfill(12);
+  inputs[0].fulfill(10);
+  inputs[3].fulfill(13);
+  ASSERT_FALSE(all.is_settled());
+  inputs[1].fulfill(11);
+  ASSERT_TRUE(all.is_fulfilled());
+  std::vector<int> values = all.peek_value(std::vector<int>());
+  ASSERT_EQ(4, values.size());
+  for (int i = 0; i < 4; i++)
+    ASSERT_EQ(10 + i, values[i]);
+
+  // The first rejection rejects the result.
+  std::vector< promise_t<int, int> > failing;
+  failing.push_back(promise_t<int, int>::pending());
+  failing.push_back(promise_t<int, int>::pending());
+  promise_t<std::vector<int>, int> failed = promise_all(failing);
+  failing[1].reject(7);
+  ASSERT_TRUE(failed.is_rejected());
+  ASSERT_EQ(7, failed.peek_error(0));
+  failing[0].reject(8);
+  ASSERT_EQ(7, failed.peek_error(0));
+
+  // No inputs means fulfilled right away.
+  promise_t<std::vector<int>, int> empty = promise_all(
+      std::vector< promise_t<int, int> >());
+  ASSERT_TRUE(empty.is_fulfilled());
+}
+
+TEST(promise_cpp, all_destruct) {
+  // Values are copied into the result and released along with it, including
+  // when the result never settles.
+  int count = 0;
+  {
+    A a(&count);
+    std::vector< promise_t<A> > inputs;
+    inputs.push_back(promise_t<A>::pending());
+    inputs.push_back(promise_t<A>::pending());
+    promise_t<std::vector<A> > all = promise_all(inputs);
+    inputs[0].fulfill(a);
+    promise_t<std::vector<A> > never = promise_all(inputs);
+  }
+  ASSERT_EQ(0, count);
+}
+
+TEST(promise_cpp, any) {
+  std::vector< promise_t<int, int> > inputs;
+  for (int i = 0; i < 3; i++)
+    inputs.push_back(promise_t<int, int>::pending());
+  promise_t<int, std::vector<int> > any = promise_any(inputs);
+  inputs[0].reject(1);
+  ASSERT_FALSE(any.is_settled());
+  inputs[2].fulfill(20);
+  ASSERT_TRUE(any.is_fulfilled());
+  ASSERT_EQ(20, any.peek_value(0));
+  inputs[1].fulfill(21);
+  ASSERT_EQ(20, any.peek_value(0));
+
+  // If everything is rejected the result gets all the errors.
+  std::vector< promise_t<int, int> > failing;
+  for (int i = 0; i < 3; i++)
+    failing.push_back(promise_t<int, int>::pending());
+  promise_t<int, std::vector<int> > failed = promise_any(failing);
+  failing[2].reject(32);
+  failing[0].reject(30);
+  failing[1].reject(31);
+  ASSERT_TRUE(failed.is_rejected());
+  std::vector<int> errors = failed.peek_error(std::vector<int>());
+  ASSERT_EQ(3, errors.size());
+  for (int i = 0; i < 3; i++)
+    ASSERT_EQ(30 + i, errors[i]);
+}
+
+TEST(promise_cpp, race) {
+  std::vector< promise_t<int, int> > inputs;
+  for (int i = 0; i < 3; i++)
+    inputs.push_back(promise_t<int, int>::pending());
+  promise_t<int, int> race = promise_race(inputs);
+  ASSERT_FALSE(race.is_settled());
+  inputs[1].reject(5);
+  ASSERT_TRUE(race.is_rejected());
+  ASSERT_EQ(5, race.peek_error(0));
+  inputs[0].fulfill(6);
+  ASSERT_TRUE(race.is_rejected());
+}
+
+TEST(promise_cpp, all_settled) {
+  std::vector< promise_t<int, int> > inputs;
+  for (int i = 0; i < 3; i++)
+    inputs.push_back(promise_t<int, int>::pending());
+  promise_t<std::vector< promise_t<int, int> >, int> settled =
+      promise_all_settled(inputs);
+  inputs[0].fulfill(1);
+  inputs[1].reject(2);
+  ASSERT_FALSE(settled.is_settled());
+  inputs[2].fulfill(3);
+  ASSERT_TRUE(settled.is_fulfilled());
+  std::vector< promise_t<int, int> > outcomes = settled.peek_value(inputs);
+  ASSERT_EQ(3, outcomes.size());
+  ASSERT_EQ(1, outcomes[0].peek_value(0));
+  ASSERT_TRUE(outcomes[1].is_rejected());
+  ASSERT_EQ(2, outcomes[1].peek_error(0));
+  ASSERT_EQ(3, outcomes[2].peek_value(0));
+}
+
+static opaque_t run_fulfill_range(std::vector< promise_t<int, int> > *inputs,
+    size_t start, size_t step) {
+  for (size_t i = start; i < inputs->size(); i += step)
+    (*inputs)[i].fulfill(static_cast<int>(i));
+  return o0();
+}
+
+TEST(promise_cpp, all_concurrent) {
+  // Inputs settled from many threads at once are all counted exactly once.
+  static const size_t kInputCount = 1000;
+  std::vector< promise_t<int, int> > inputs;
+  for (size_t i = 0; i < kInputCount; i++)
+    inputs.push_back(sync_promise_t<int, int>::pending());
+  promise_t<std::vector<int>, int> all = promise_all(inputs);
+  NativeThread threads[kRacerCount];
+  for (size_t i = 0; i < kRacerCount; i++) {
+    threads[i].set_callback(new_callback(run_fulfill_range, &inputs, i,
+        static_cast<size_t>(kRacerCount)));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kRacerCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_TRUE(all.is_fulfilled());
+  std::vector<int> values = all.peek_value(std::vector<int>());
+  ASSERT_EQ(kInputCount, values.size());
+  for (size_t i = 0; i < kInputCount; i++)
+    ASSERT_EQ(i, values[i]);
+}
+
+#ifdef IS_CPP11
+
+// A value that can only be moved.
+class Unique {
+public:
+  explicit Unique(int value) : value_(value) { }
+  Unique(Unique &&that) : value_(that.value_) { that.value_ = 0; }
+  int value() const { return value_; }
+private:
+  Unique(const Unique &that);
+  int value_;
+};
+
+TEST(promise_cpp, fulfill_move) {
+  promise_t<Unique> p = promise_t<Unique>::pending();
+  ASSERT_TRUE(p.fulfill(Unique(3)));
+  ASSERT_FALSE(p.fulfill(Unique(4)));
+  Unique otherwise(0);
+  ASSERT_EQ(3, p.peek_value(otherwise).value());
+  // Moving the promise takes the reference along with it.
+  promise_t<Unique> q = MOVE(p);
+  ASSERT_EQ(3, q.peek_value(otherwise).value());
+}
+
+TEST(promise_cpp, sync_fulfill_move) {
+  sync_promise_t<Unique> p = sync_promise_t<Unique>::pending();
+  Unique value(5);
+  ASSERT_TRUE(p.fulfill(MOVE(value)));
+  ASSERT_EQ(0, value.value());
+  ASSERT_TRUE(p.wait());
+  Unique otherwise(0);
+  ASSERT_EQ(5, p.peek_value(otherwise).value());
+}
+
+#endif // IS_CPP11
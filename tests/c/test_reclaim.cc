@@ -0,0 +1,266 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "sync/barrier.hh"
+#include "sync/thread.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic-inl.h"
+#include "sync/reclaim.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+// An allocator that counts how many blocks it has freed.
+struct counting_allocator_t {
+  allocator_t header;
+  allocator_t *outer;
+  atomic_int32_t frees;
+};
+
+static blob_t counting_malloc(allocator_t *self, size_t size) {
+  counting_allocator_t *counting = reinterpret_cast<counting_allocator_t*>(self);
+  return allocator_malloc(counting->outer, size);
+}
+
+static void counting_free(allocator_t *self, blob_t memory) {
+  counting_allocator_t *counting = reinterpret_cast<counting_allocator_t*>(self);
+  atomic_int32_increment(&counting->frees);
+  allocator_free(counting->outer, memory);
+}
+
+static void counting_allocator_init(counting_allocator_t *alloc) {
+  struct_zero_fill(*alloc);
+  alloc->header.malloc = counting_malloc;
+  alloc->header.free = counting_free;
+  alloc->outer = allocator_get_default();
+  alloc->frees = atomic_int32_new(0);
+}
+
+// A node in a lock-free stack. The link comes first so a pointer to the node
+// is also a pointer to the start of its memory.
+struct Node {
+  Node *next;
+  int64_t value;
+  reclaim_node_t reclaim;
+};
+
+static Node *new_node(allocator_t *alloc, int64_t value) {
+  Node *node = static_cast<Node*>(allocator_malloc(alloc, sizeof(Node)).start);
+  node->next = NULL;
+  node->value = value;
+  return node;
+}
+
+TEST(reclaim, epoch_simple) {
+  counting_allocator_t alloc;
+  counting_allocator_init(&alloc);
+  epoch_domain_t domain;
+  ASSERT_TRUE(epoch_domain_init(&domain, &alloc.header));
+  epoch_participant_t reader;
+  epoch_participant_t writer;
+  epoch_participant_register(&domain, &reader);
+  epoch_participant_register(&domain, &writer);
+
+  // While the reader is inside a critical region nothing it could have seen
+  // can be freed, however many times the writer collects.
+  epoch_enter(&reader);
+  Node *node = new_node(&alloc.header, 0);
+  epoch_retire(&writer, &node->reclaim, blob_new(node, sizeof(Node)));
+  for (size_t i = 0; i < 8; i++)
+    ASSERT_EQ(0, epoch_collect(&writer));
+  ASSERT_EQ(0, atomic_int32_get(&alloc.frees));
+
+  // Nesting doesn't end the region.
+  epoch_enter(&reader);
+  epoch_leave(&reader);
+  ASSERT_EQ(0, epoch_collect(&writer));
+
+  // Once it leaves the epoch can move on and the node gets freed.
+  epoch_leave(&reader);
+  size_t freed = 0;
+  for (size_t i = 0; i < 4; i++)
+    freed += epoch_collect(&writer);
+  ASSERT_EQ(1, freed);
+  ASSERT_EQ(1, atomic_int32_get(&alloc.frees));
+
+  epoch_participant_unregister(&reader);
+  epoch_participant_unregister(&writer);
+  epoch_domain_dispose(&domain);
+}
+
+TEST(reclaim, epoch_orphans) {
+  counting_allocator_t alloc;
+  counting_allocator_init(&alloc);
+  epoch_domain_t domain;
+  ASSERT_TRUE(epoch_domain_init(&domain, &alloc.header));
+  epoch_participant_t reader;
+  epoch_participant_t writer;
+  epoch_participant_register(&domain, &reader);
+  epoch_participant_register(&domain, &writer);
+  epoch_enter(&reader);
+  for (size_t i = 0; i < 4; i++) {
+    Node *node = new_node(&alloc.header, 0);
+    epoch_retire(&writer, &node->reclaim, blob_new(node, sizeof(Node)));
+  }
+  // The writer goes away before its nodes can be freed; they're handed to the
+  // domain which frees them on dispose.
+  epoch_participant_unregister(&writer);
+  ASSERT_EQ(0, atomic_int32_get(&alloc.frees));
+  epoch_leave(&reader);
+  epoch_participant_unregister(&reader);
+  epoch_domain_dispose(&domain);
+  ASSERT_EQ(4, atomic_int32_get(&alloc.frees));
+}
+
+TEST(reclaim, hazard_simple) {
+  counting_allocator_t alloc;
+  counting_allocator_init(&alloc);
+  hazard_domain_t domain;
+  hazard_domain_init(&domain, &alloc.header);
+  hazard_record_t *reader = hazard_record_acquire(&domain);
+  hazard_record_t *writer = hazard_record_acquire(&domain);
+  ASSERT_TRUE(reader != writer);
+
+  Node *node = new_node(&alloc.header, 0);
+  atomic_ptr_t shared = atomic_ptr_new(node);
+  ASSERT_PTREQ(node, hazard_protect(reader, 0, &shared));
+  atomic_ptr_store(&shared, NULL, moSeqCst);
+  hazard_retire(writer, &node->reclaim, blob_new(node, sizeof(Node)));
+  ASSERT_EQ(0, hazard_collect(writer));
+  ASSERT_EQ(0, atomic_int32_get(&alloc.frees));
+  hazard_clear(reader, 0);
+  ASSERT_EQ(1, hazard_collect(writer));
+  ASSERT_EQ(1, atomic_int32_get(&alloc.frees));
+
+  // Released records get reused.
+  hazard_record_release(reader);
+  ASSERT_PTREQ(reader, hazard_record_acquire(&domain));
+  hazard_record_release(reader);
+  hazard_record_release(writer);
+  hazard_domain_dispose(&domain);
+}
+
+#define kThreadCount 8
+#define kOpCount 4096
+
+// A lock-free stack shared between threads.
+struct Stack {
+  atomic_ptr_t top;
+  allocator_t *alloc;
+  NativeBarrier *start;
+  epoch_domain_t epochs;
+  hazard_domain_t hazards;
+};
+
+static void push(Stack *stack, Node *node) {
+  void *top = atomic_ptr_load(&stack->top, moRelaxed);
+  do {
+    node->next = static_cast<Node*>(top);
+  } while (!atomic_ptr_compare_exchange(&stack->top, &top, node, moRelease));
+}
+
+// Pops a node, protecting the read of the next pointer with an epoch.
+static Node *epoch_pop(Stack *stack, epoch_participant_t *self) {
+  epoch_enter(self);
+  void *top = atomic_ptr_load(&stack->top, moAcquire);
+  while (top != NULL) {
+    Node *next = static_cast<Node*>(top)->next;
+    if (atomic_ptr_compare_exchange(&stack->top, &top, next, moAcquire))
+      break;
+  }
+  epoch_leave(self);
+  return static_cast<Node*>(top);
+}
+
+static opaque_t run_epoch_worker(Stack *stack, int64_t id) {
+  epoch_participant_t self;
+  epoch_participant_register(&stack->epochs, &self);
+  ASSERT_TRUE(stack->start->pass());
+  for (int64_t i = 0; i < kOpCount; i++) {
+    push(stack, new_node(stack->alloc, id));
+    Node *node = epoch_pop(stack, &self);
+    ASSERT_TRUE(node != NULL);
+    epoch_retire(&self, &node->reclaim, blob_new(node, sizeof(Node)));
+  }
+  epoch_participant_unregister(&self);
+  return o0();
+}
+
+TEST(reclaim, epoch_stack) {
+  counting_allocator_t alloc;
+  counting_allocator_init(&alloc);
+  NativeBarrier start(kThreadCount);
+  ASSERT_TRUE(start.initialize());
+  Stack stack;
+  stack.top = atomic_ptr_new(NULL);
+  stack.alloc = &alloc.header;
+  stack.start = &start;
+  ASSERT_TRUE(epoch_domain_init(&stack.epochs, &alloc.header));
+  NativeThread threads[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(run_epoch_worker, &stack,
+        static_cast<int64_t>(i)));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_PTREQ(NULL, atomic_ptr_load(&stack.top, moRelaxed));
+  epoch_domain_dispose(&stack.epochs);
+  ASSERT_EQ(kThreadCount * kOpCount, atomic_int32_get(&alloc.frees));
+}
+
+// Pops a node, protecting the read of the next pointer with a hazard pointer.
+static Node *hazard_pop(Stack *stack, hazard_record_t *self) {
+  while (true) {
+    void *top = hazard_protect(self, 0, &stack->top);
+    if (top == NULL)
+      return NULL;
+    Node *next = static_cast<Node*>(top)->next;
+    if (atomic_ptr_compare_exchange(&stack->top, &top, next, moAcquire)) {
+      hazard_clear(self, 0);
+      return static_cast<Node*>(top);
+    }
+  }
+}
+
+static opaque_t run_hazard_worker(Stack *stack, int64_t id) {
+  hazard_record_t *self = hazard_record_acquire(&stack->hazards);
+  ASSERT_TRUE(self != NULL);
+  ASSERT_TRUE(stack->start->pass());
+  for (int64_t i = 0; i < kOpCount; i++) {
+    push(stack, new_node(stack->alloc, id));
+    Node *node = hazard_pop(stack, self);
+    ASSERT_TRUE(node != NULL);
+    hazard_retire(self, &node->reclaim, blob_new(node, sizeof(Node)));
+  }
+  hazard_record_release(self);
+  return o0();
+}
+
+TEST(reclaim, hazard_stack) {
+  counting_allocator_t alloc;
+  counting_allocator_init(&alloc);
+  NativeBarrier start(kThreadCount);
+  ASSERT_TRUE(start.initialize());
+  Stack stack;
+  stack.top = atomic_ptr_new(NULL);
+  stack.alloc = &alloc.header;
+  stack.start = &start;
+  hazard_domain_init(&stack.hazards, &alloc.header);
+  NativeThread threads[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(run_hazard_worker, &stack,
+        static_cast<int64_t>(i)));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_PTREQ(NULL, atomic_ptr_load(&stack.top, moRelaxed));
+  hazard_domain_dispose(&stack.hazards);
+  // The records themselves are freed through the allocator too.
+  int32_t records = atomic_int32_get(&stack.hazards.record_count);
+  ASSERT_EQ(kThreadCount * kOpCount + records, atomic_int32_get(&alloc.frees));
+}
@@ -41,3 +41,14 @@ TEST(semaphore_c, timed_wait) {
   ASSERT_FALSE(native_semaphore_acquire(&sema, duration_millis(100)));
   native_semaphore_dispose(&sema);
 }
+
+TEST(semaphore_c, many_permits) {
+  native_semaphore_t sema;
+  native_semaphore_construct_with_count(&sema, 0);
+  ASSERT_TRUE(native_semaphore_initialize(&sema));
+  ASSERT_TRUE(native_semaphore_release_many(&sema, 4));
+  ASSERT_FALSE(native_semaphore_acquire_many(&sema, 5, duration_instant()));
+  ASSERT_TRUE(native_semaphore_acquire_many(&sema, 4, duration_instant()));
+  ASSERT_FALSE(native_semaphore_try_acquire(&sema));
+  native_semaphore_dispose(&sema);
+}
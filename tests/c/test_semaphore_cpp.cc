@@ -104,3 +104,134 @@ TEST(semaphore_cpp, timed_wait) {
   ASSERT_TRUE(sema.initialize());
   ASSERT_FALSE(sema.acquire(Duration::millis(100)));
 }
+
+TEST(semaphore_cpp, many_permits) {
+  NativeSemaphore sema(0);
+  ASSERT_TRUE(sema.initialize());
+  ASSERT_TRUE(sema.release(5));
+  ASSERT_FALSE(sema.acquire(6, Duration::instant()));
+  ASSERT_TRUE(sema.acquire(3, Duration::instant()));
+  // Failing to get all the permits mustn't take any of them.
+  ASSERT_FALSE(sema.acquire(3, Duration::millis(10)));
+  ASSERT_TRUE(sema.acquire(2));
+  ASSERT_FALSE(sema.try_acquire());
+  ASSERT_TRUE(sema.acquire(0, Duration::instant()));
+  ASSERT_TRUE(sema.release(0));
+  ASSERT_FALSE(sema.try_acquire());
+}
+
+// Waits for the given number of permits, then signals that it's done.
+static opaque_t run_many_permits_waiter(NativeSemaphore *sema,
+    NativeSemaphore *done_count, uint32_t permits) {
+  ASSERT_TRUE(sema->acquire(permits));
+  ASSERT_TRUE(done_count->release());
+  return o0();
+}
+
+// Batch releasing permits should release as many waiters as there are permits.
+TEST(semaphore_cpp, batch_release) {
+  NativeSemaphore sema(0);
+  NativeSemaphore done_count(0);
+  ASSERT_TRUE(sema.initialize());
+  ASSERT_TRUE(done_count.initialize());
+  NativeThread threads[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(run_many_permits_waiter, &sema,
+        &done_count, 1U));
+    ASSERT_TRUE(threads[i].start());
+  }
+  ASSERT_TRUE(sema.release(kThreadCount / 2));
+  ASSERT_TRUE(done_count.acquire(kThreadCount / 2));
+  ASSERT_FALSE(done_count.acquire(1, Duration::millis(10)));
+  ASSERT_TRUE(sema.release(kThreadCount / 2));
+  ASSERT_TRUE(done_count.acquire(kThreadCount / 2));
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_FALSE(sema.try_acquire());
+}
+
+// Waiters that want different numbers of permits are all released once there
+// are enough permits to go around.
+TEST(semaphore_cpp, wide_waiters) {
+  static const uint32_t kWaiterCount = 8;
+  NativeSemaphore sema(0);
+  NativeSemaphore done_count(0);
+  ASSERT_TRUE(sema.initialize());
+  ASSERT_TRUE(done_count.initialize());
+  NativeThread threads[kWaiterCount];
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < kWaiterCount; i++) {
+    threads[i].set_callback(new_callback(run_many_permits_waiter, &sema,
+        &done_count, i + 1));
+    ASSERT_TRUE(threads[i].start());
+    total += i + 1;
+  }
+  for (uint32_t i = 0; i < total; i++)
+    ASSERT_TRUE(sema.release());
+  ASSERT_TRUE(done_count.acquire(kWaiterCount));
+  for (size_t i = 0; i < kWaiterCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_FALSE(sema.try_acquire());
+}
+
+// A wide waiter that can't be satisfied mustn't keep the permits released one
+// at a time from reaching the single permit waiters.
+TEST(semaphore_cpp, mixed_waiters) {
+  for (size_t round = 0; round < 4; round++) {
+    NativeSemaphore sema(0);
+    NativeSemaphore done_count(0);
+    ASSERT_TRUE(sema.initialize());
+    ASSERT_TRUE(done_count.initialize());
+    NativeThread wide(new_callback(run_many_permits_waiter, &sema, &done_count,
+        static_cast<uint32_t>(kThreadCount + 1)));
+    NativeThread threads[kThreadCount];
+    for (size_t i = 0; i < kThreadCount; i++)
+      threads[i].set_callback(new_callback(run_many_permits_waiter, &sema,
+          &done_count, 1U));
+    ASSERT_TRUE(wide.start());
+    for (size_t i = 0; i < kThreadCount; i++)
+      ASSERT_TRUE(threads[i].start());
+    for (size_t i = 0; i < kThreadCount; i++)
+      ASSERT_TRUE(sema.release());
+    ASSERT_TRUE(done_count.acquire(kThreadCount, Duration::seconds(10)));
+    ASSERT_TRUE(sema.release(static_cast<uint32_t>(kThreadCount + 1)));
+    ASSERT_TRUE(done_count.acquire(1, Duration::seconds(10)));
+    ASSERT_TRUE(wide.join(NULL));
+    for (size_t i = 0; i < kThreadCount; i++)
+      ASSERT_TRUE(threads[i].join(NULL));
+  }
+}
+
+static opaque_t run_many_permits_cycler(NativeSemaphore *sema,
+    NativeSemaphore *done_count, uint32_t permits) {
+  for (size_t i = 0; i < 64; i++) {
+    ASSERT_TRUE(sema->acquire(permits));
+    ASSERT_TRUE(sema->release(permits));
+  }
+  ASSERT_TRUE(done_count->release());
+  return o0();
+}
+
+// Waiters that want many permits each mustn't split the permits between them
+// while waiting, that way none of them ever gets enough.
+TEST(semaphore_cpp, competing_wide_waiters) {
+  static const uint32_t kWaiterCount = 4;
+  static const uint32_t kPermits = 16;
+  NativeSemaphore sema(0);
+  NativeSemaphore done_count(0);
+  ASSERT_TRUE(sema.initialize());
+  ASSERT_TRUE(done_count.initialize());
+  NativeThread threads[kWaiterCount];
+  for (uint32_t i = 0; i < kWaiterCount; i++) {
+    threads[i].set_callback(new_callback(run_many_permits_cycler, &sema,
+        &done_count, kPermits));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (uint32_t i = 0; i < kPermits; i++)
+    ASSERT_TRUE(sema.release());
+  ASSERT_TRUE(done_count.acquire(kWaiterCount, Duration::seconds(10)));
+  for (size_t i = 0; i < kWaiterCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  ASSERT_TRUE(sema.acquire(kPermits, Duration::instant()));
+  ASSERT_FALSE(sema.try_acquire());
+}
@@ -0,0 +1,134 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "sync/barrier.hh"
+#include "sync/seqlock.hh"
+#include "sync/thread.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/seqlock.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+TEST(seqlock, simple_c) {
+  seqlock_t lock;
+  seqlock_init(&lock);
+  int64_t start = seqlock_read_begin(&lock);
+  ASSERT_FALSE(seqlock_read_retry(&lock, start));
+  seqlock_write_begin(&lock);
+  seqlock_write_end(&lock);
+  ASSERT_TRUE(seqlock_read_retry(&lock, start));
+  int64_t next = seqlock_read_begin(&lock);
+  ASSERT_FALSE(seqlock_read_retry(&lock, next));
+
+  address_arith_t data[3] = {1, 2, 3};
+  address_arith_t update[3] = {4, 5, 6};
+  address_arith_t copy[3] = {0, 0, 0};
+  seqlock_write_words(&lock, data, update, sizeof(data));
+  seqlock_read_words(&lock, copy, data, sizeof(data));
+  ASSERT_EQ(4, copy[0]);
+  ASSERT_EQ(5, copy[1]);
+  ASSERT_EQ(6, copy[2]);
+}
+
+// Some calibration data, a typical thing to protect with a seqlock.
+struct Calibration {
+  int64_t offset;
+  double scale;
+  int32_t generation;
+};
+
+TEST(seqlock, simple_cpp) {
+  SeqLocked<Calibration> locked;
+  ASSERT_EQ(0, locked.get().offset);
+  ASSERT_EQ(0, locked.get().generation);
+  Calibration cal;
+  cal.offset = 100;
+  cal.scale = 0.5;
+  cal.generation = 3;
+  locked.set(cal);
+  Calibration copy = locked.get();
+  ASSERT_EQ(100, copy.offset);
+  ASSERT_TRUE(copy.scale == 0.5);
+  ASSERT_EQ(3, copy.generation);
+
+  SeqLocked<int32_t> small(9);
+  ASSERT_EQ(9, small.get());
+  small.set(10);
+  ASSERT_EQ(10, small.get());
+}
+
+// A value where every field is derived from the first so a torn read is easy
+// to spot.
+struct Snapshot {
+  int64_t a;
+  int64_t b;
+  int64_t c;
+  int64_t d;
+};
+
+static Snapshot make_snapshot(int64_t value) {
+  Snapshot result;
+  result.a = value;
+  result.b = value * 3;
+  result.c = ~value;
+  result.d = value + 7;
+  return result;
+}
+
+#define kReaderCount 6
+#define kWriteCount 20000
+
+struct Shared {
+  SeqLocked<Snapshot> value;
+  atomic_int32_t done;
+  NativeBarrier *start;
+};
+
+static opaque_t run_writer(Shared *shared) {
+  ASSERT_TRUE(shared->start->pass());
+  for (int64_t i = 1; i <= kWriteCount; i++)
+    shared->value.set(make_snapshot(i));
+  atomic_int32_store(&shared->done, 1, moRelease);
+  return o0();
+}
+
+static opaque_t run_reader(Shared *shared) {
+  ASSERT_TRUE(shared->start->pass());
+  int64_t last = 0;
+  while (atomic_int32_load(&shared->done, moAcquire) == 0) {
+    Snapshot snapshot = shared->value.get();
+    ASSERT_EQ(snapshot.a * 3, snapshot.b);
+    ASSERT_EQ(~snapshot.a, snapshot.c);
+    ASSERT_EQ(snapshot.a + 7, snapshot.d);
+    // There is only one writer so values only ever increase.
+    ASSERT_REL(last, <=, snapshot.a);
+    last = snapshot.a;
+  }
+  ASSERT_EQ(kWriteCount, shared->value.get().a);
+  return o0();
+}
+
+TEST(seqlock, contended) {
+  NativeBarrier start(kReaderCount + 1);
+  ASSERT_TRUE(start.initialize());
+  Shared shared;
+  shared.done = atomic_int32_new(0);
+  shared.start = &start;
+  // Readers may get in before the first write so the initial value must be
+  // consistent too.
+  shared.value.set(make_snapshot(0));
+  NativeThread writer(new_callback(run_writer, &shared));
+  NativeThread readers[kReaderCount];
+  for (size_t i = 0; i < kReaderCount; i++) {
+    readers[i].set_callback(new_callback(run_reader, &shared));
+    ASSERT_TRUE(readers[i].start());
+  }
+  ASSERT_TRUE(writer.start());
+  ASSERT_TRUE(writer.join(NULL));
+  for (size_t i = 0; i < kReaderCount; i++)
+    ASSERT_TRUE(readers[i].join(NULL));
+}
@@ -7,6 +7,7 @@
 
 BEGIN_C_INCLUDES
 #include "sync/thread.h"
+#include "utils/string-inl.h"
 END_C_INCLUDES
 
 using namespace tclib;
@@ -80,3 +81,127 @@ TEST(thread, sleep) {
   // real time clock on windows so allow the duration to be smaller there.
   ASSERT_REL(end - start, >=, IF_MSVC(100, 150));
 }
+
+TEST(thread, cpu_set) {
+  native_cpu_set_t set;
+  native_cpu_set_clear(&set);
+  ASSERT_TRUE(native_cpu_set_is_empty(&set));
+  native_cpu_set_add(&set, 0);
+  native_cpu_set_add(&set, 65);
+  native_cpu_set_add(&set, kMaxCpuCount);
+  ASSERT_FALSE(native_cpu_set_is_empty(&set));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 0));
+  ASSERT_FALSE(native_cpu_set_contains(&set, 1));
+  ASSERT_TRUE(native_cpu_set_contains(&set, 65));
+  ASSERT_FALSE(native_cpu_set_contains(&set, kMaxCpuCount));
+}
+
+struct OptionsProbe {
+  char name[kMaxThreadNameSize];
+  int cpu;
+};
+
+static opaque_t run_probe(OptionsProbe *probe) {
+  ASSERT_TRUE(NativeThread::get_current_name(probe->name, kMaxThreadNameSize));
+#ifdef IS_LINUX
+  probe->cpu = sched_getcpu();
+#else
+  probe->cpu = 0;
+#endif
+  return o0();
+}
+
+TEST(thread, options) {
+  native_thread_options_t options;
+  native_thread_options_init(&options);
+  options.stack_size = 64 * 1024;
+  options.guard_size = 4096;
+  options.name = "tclib test thread with a long name";
+  native_cpu_set_add(&options.affinity, 0);
+  OptionsProbe probe;
+  NativeThread thread(new_callback(run_probe, &probe));
+  thread.set_options(options);
+  ASSERT_EQ(64 * 1024, thread.options().stack_size);
+  ASSERT_TRUE(thread.start());
+  ASSERT_TRUE(thread.join(NULL));
+  ASSERT_EQ(0, probe.cpu);
+#if defined(IS_MSVC)
+  ASSERT_C_STREQ("", probe.name);
+#else
+  // Names are truncated to what linux allows.
+  ASSERT_C_STREQ("tclib test thre", probe.name);
+#endif
+}
+
+TEST(thread, options_c) {
+  CallCounter counter;
+  nullary_callback_t *callback = nullary_callback_new_1(run_call_counter_bridge,
+      p2o(&counter));
+  native_thread_t *thread = native_thread_new(callback);
+  native_thread_options_t options;
+  native_thread_options_init(&options);
+  options.stack_size = 1;
+  options.policy = spDefault;
+  native_thread_set_options(thread, &options);
+  ASSERT_TRUE(native_thread_start(thread));
+  ASSERT_TRUE(native_thread_join(thread, NULL));
+  ASSERT_EQ(1, counter.value);
+  native_thread_destroy(thread);
+  callback_destroy(callback);
+}
+
+#ifdef IS_LINUX
+
+static opaque_t run_policy_probe(int *policy) {
+  *policy = sched_getscheduler(0);
+  return o0();
+}
+
+// Runs a thread with the given policy and returns the policy the thread saw
+// itself running under.
+static int get_running_policy(scheduling_policy_t policy) {
+  native_thread_options_t options;
+  native_thread_options_init(&options);
+  options.policy = policy;
+  int result = -1;
+  NativeThread thread(new_callback(run_policy_probe, &result));
+  thread.set_options(options);
+  ASSERT_TRUE(thread.start());
+  ASSERT_TRUE(thread.join(NULL));
+  return result;
+}
+
+TEST(thread, policies) {
+  // The linux specific policies can't be set through the thread attributes so
+  // make sure they actually take effect.
+  ASSERT_EQ(SCHED_BATCH, get_running_policy(spBatch));
+  ASSERT_EQ(SCHED_IDLE, get_running_policy(spIdle));
+  ASSERT_EQ(SCHED_OTHER, get_running_policy(spDefault));
+}
+
+#endif // IS_LINUX
+
+static opaque_t run_many_small(int *count) {
+  // Just use a bit of stack.
+  char buf[1024];
+  memset(buf, *count, sizeof(buf));
+  return o0();
+}
+
+TEST(thread, small_stacks) {
+  // Starting a lot of threads with small stacks at the same time works.
+  static const size_t kCount = 64;
+  native_thread_options_t options;
+  native_thread_options_init(&options);
+  options.stack_size = 32 * 1024;
+  options.name = "small";
+  int value = 7;
+  NativeThread threads[kCount];
+  for (size_t i = 0; i < kCount; i++) {
+    threads[i].set_callback(new_callback(run_many_small, &value));
+    threads[i].set_options(options);
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+}
@@ -0,0 +1,107 @@
+//- Copyright 2016 the Neutrino authors (see AUTHORS).
+//- Licensed under the Apache License, Version 2.0 (see LICENSE).
+
+#include "test/unittest.hh"
+
+#include "sync/thread.hh"
+#include "sync/threadlocal.hh"
+
+BEGIN_C_INCLUDES
+#include "sync/atomic.h"
+#include "sync/threadlocal.h"
+END_C_INCLUDES
+
+using namespace tclib;
+
+static atomic_int32_t destroyed_count = atomic_int32_new(0);
+
+static void count_destroyed(void *value) {
+  atomic_int32_increment(&destroyed_count);
+  *static_cast<int*>(value) = -1;
+}
+
+static opaque_t run_set_value(thread_local_t *local, int *value) {
+  ASSERT_PTREQ(NULL, thread_local_get(local));
+  ASSERT_TRUE(thread_local_set(local, value));
+  ASSERT_PTREQ(value, thread_local_get(local));
+  return o0();
+}
+
+TEST(threadlocal, simple_c) {
+  destroyed_count = atomic_int32_new(0);
+  thread_local_t local;
+  thread_local_construct(&local, count_destroyed);
+  ASSERT_TRUE(thread_local_initialize(&local));
+  int own = 0;
+  ASSERT_PTREQ(NULL, thread_local_get(&local));
+  ASSERT_TRUE(thread_local_set(&local, &own));
+  ASSERT_PTREQ(&own, thread_local_get(&local));
+
+  // Another thread has its own value which is destroyed when it exits.
+  int other = 0;
+  NativeThread thread(new_callback(run_set_value, &local, &other));
+  ASSERT_TRUE(thread.start());
+  ASSERT_TRUE(thread.join(NULL));
+  ASSERT_EQ(1, atomic_int32_get(&destroyed_count));
+  ASSERT_EQ(-1, other);
+  ASSERT_EQ(0, own);
+  ASSERT_PTREQ(&own, thread_local_get(&local));
+
+  // Disposing destroys the current thread's value.
+  thread_local_dispose(&local);
+  ASSERT_EQ(2, atomic_int32_get(&destroyed_count));
+  ASSERT_EQ(-1, own);
+}
+
+TEST(threadlocal, no_destructor) {
+  NativeThreadLocal local;
+  ASSERT_TRUE(local.initialize());
+  int value = 4;
+  ASSERT_TRUE(local.set(&value));
+  ASSERT_PTREQ(&value, local.get());
+  ASSERT_TRUE(local.set(NULL));
+  ASSERT_PTREQ(NULL, local.get());
+}
+
+// A per-thread cache of the kind thread locals are for.
+class Cache {
+public:
+  Cache() : hits(0) { atomic_int32_increment(&live); }
+  ~Cache() { atomic_int32_decrement(&live); }
+  int64_t hits;
+  static atomic_int32_t live;
+};
+
+atomic_int32_t Cache::live = atomic_int32_new(0);
+
+#define kThreadCount 8
+
+static opaque_t run_cache_user(ThreadLocal<Cache> *caches, int64_t id) {
+  ASSERT_PTREQ(NULL, caches->peek());
+  Cache *cache = caches->get();
+  ASSERT_TRUE(cache != NULL);
+  for (int64_t i = 0; i < 100 + id; i++) {
+    // The same instance is returned every time.
+    ASSERT_PTREQ(cache, caches->get());
+    caches->get()->hits++;
+  }
+  ASSERT_EQ(100 + id, cache->hits);
+  return o0();
+}
+
+TEST(threadlocal, simple_cpp) {
+  ThreadLocal<Cache> caches;
+  ASSERT_TRUE(caches.initialize());
+  NativeThread threads[kThreadCount];
+  for (size_t i = 0; i < kThreadCount; i++) {
+    threads[i].set_callback(new_callback(run_cache_user, &caches,
+        static_cast<int64_t>(i)));
+    ASSERT_TRUE(threads[i].start());
+  }
+  for (size_t i = 0; i < kThreadCount; i++)
+    ASSERT_TRUE(threads[i].join(NULL));
+  // All the threads have exited so their instances have been destroyed.
+  ASSERT_EQ(0, atomic_int32_get(&Cache::live));
+  ASSERT_TRUE(caches.get() != NULL);
+  ASSERT_EQ(1, atomic_int32_get(&Cache::live));
+}